@@ -0,0 +1,2559 @@
+/*
+ * midibench.c
+ * ===========
+ * 
+ * Measures the throughput of the libsmfparse library on a synthetic
+ * MIDI file, and checks that all the ways of parsing a file agree.
+ * 
+ * This is a benchmark program for the libsmfparse library.  It
+ * generates a Standard MIDI File in memory according to the shape
+ * options.  Before anything is timed, it checks that every parse path
+ * reads the same entity stream from the file as a reference path,
+ * which parses through a smfsource_custom() source that delivers one
+ * byte per callback.  The paths that are checked are smfparse_read()
+ * over a memory source and over a block source with tiny blocks,
+ * smfparse_read_batch(), smfparse_feed() in small pieces, the binary
+ * cache, the lenient and trusted validation levels, and a round trip
+ * through a writer.  Once the file is written out, smfparse_batch() is
+ * also checked against a path source with max_file limits around every
+ * chunk boundary, and the writer is checked to reject MIDI messages
+ * with values out of range.  The program aborts if any path disagrees
+ * or a bad message is written.
+ * 
+ * It then parses the file repeatedly from a memory source, a file
+ * handle source, and a file path source, timing the smfparse_read()
+ * loop end to end for each source type.  It then times the same parse
+ * from memory with smfparse_run() dispatching to handlers, and the
+ * same parse with every entity re-encoded into a buffer with
+ * smfwrite_put().  Finally, it builds a binary cache of the file with
+ * smfcache_build() and times the same iteration with smfcache_read().
+ * Throughput is reported in entities per second and megabytes of MIDI
+ * file per second.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   midibench [options]
+ * 
+ * Options
+ * -------
+ * 
+ *   -t count   number of note tracks (default 16)
+ *   -n count   number of notes per track (default 10000)
+ *   -d ticks   average delta time between events (default 60)
+ *   -r pct     percentage of channel messages that use running status
+ *              when possible (default 100)
+ *   -x bytes   payload length of SysEx messages, or 0 for none
+ *              (default 0)
+ *   -e count   number of notes between SysEx messages (default 100)
+ *   -i count   number of timed parses per source type (default 10)
+ *   -s seed    seed for the pseudo-random generator (default 1)
+ *   -o path    path of the file to generate for the file sources
+ *              (default midibench.mid, which is removed afterwards)
+ *   -f count   number of mutated copies of the file to check before
+ *              timing (default 0)
+ *   -m kents   minimum throughput of the memory source in thousands
+ *              of entities per second, or 0 for none (default 0)
+ *   -a path    only check the given file and then exit, without
+ *              generating or timing anything
+ * 
+ * When -o is given, the generated file is kept so that it can be
+ * examined with midiwalk or reused by other tools.
+ * 
+ * With -f, each mutated copy has a few random edits, so most of them
+ * fail to parse somewhere.  All the parse paths must still agree on
+ * the entities before the error and on the error itself.  For invalid
+ * copies, the lenient and trusted levels are also run but not
+ * compared, so that a memory checker such as AddressSanitizer can
+ * catch unsafe accesses.  Small shape options keep each check fast,
+ * for example "-t 2 -n 100 -x 20 -e 10 -f 100000".
+ * 
+ * With -m, the program fails after reporting if the memory source does
+ * not reach the minimum, so that it can be used as a performance
+ * regression gate.  Pick the minimum with some margin for the machine
+ * that runs it, because timings vary between runs.
+ * 
+ * Timings are measured in wall-clock time with the monotonic clock on
+ * POSIX platforms, so that the file sources include the time spent
+ * waiting for I/O.  Elsewhere, they fall back to the processor time
+ * measured by clock().
+ * 
+ * With -a, the given file is checked instead of a generated one, and
+ * with -f as well, mutated copies of it are checked.  The program only
+ * fails on disagreement between parse paths, not on errors in the
+ * file, so this can also be used as the target of a file-driven fuzzer
+ * such as afl-fuzz, which then treats any disagreement as a crash.
+ * 
+ * The note tracks are preceded by a conductor track with a tempo and a
+ * time signature.  Each note is a Note-On followed by a Note-On with
+ * zero velocity, so running status can apply to every channel message
+ * when -r is 100.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * Only requires libsmfparse.
+ */
+
+/*
+ * Request the POSIX declarations on platforms that have them, so that
+ * the monotonic clock can be used even in strict ISO C compilation
+ * modes.  This must come before any system header.
+ */
+#if !defined(SMF_NO_POSIX) && \
+    (defined(__unix__) || defined(__unix) || \
+      (defined(__APPLE__) && defined(__MACH__)))
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "smfparse.h"
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of delta time units per beat in the generated file.
+ */
+#define BENCH_SUBDIV (480)
+
+/*
+ * The default path of the generated file for the file sources.
+ */
+#define BENCH_PATH "midibench.mid"
+
+/*
+ * The number of entity structures in the arrays that the batch and
+ * feed paths decode into.
+ */
+#define BENCH_BATCH (64)
+
+/*
+ * The maximum number of bytes that the block read callback of the check
+ * source delivers at a time.  This is deliberately small and odd so
+ * that entities straddle refill boundaries.
+ */
+#define BENCH_BLOCK (7)
+
+/*
+ * The number of bytes per call that the feed path pushes into the
+ * parser.
+ */
+#define BENCH_PIECE (13)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * The shape options of the generated MIDI file.
+ */
+typedef struct {
+  
+  /*
+   * The number of note tracks, excluding the conductor track.
+   */
+  int32_t tracks;
+  
+  /*
+   * The number of notes in each note track.
+   */
+  int32_t notes;
+  
+  /*
+   * The average delta time between events.
+   */
+  int32_t density;
+  
+  /*
+   * The percentage of channel messages that use running status if the
+   * previous event allows it.
+   */
+  int32_t running;
+  
+  /*
+   * The payload length of SysEx messages, or zero for no SysEx.
+   */
+  int32_t sysex;
+  
+  /*
+   * The number of notes between SysEx messages.
+   */
+  int32_t every;
+  
+  /*
+   * The seed of the pseudo-random generator.
+   */
+  int32_t seed;
+  
+} BENCH_SHAPE;
+
+/*
+ * The instance of the custom input sources that the differential check
+ * reads a MIDI file through.
+ */
+typedef struct {
+  
+  /*
+   * The bytes of the MIDI file.
+   */
+  const uint8_t *pData;
+  int32_t len;
+  
+  /*
+   * The offset of the next byte to read.
+   */
+  int32_t pos;
+  
+} BENCH_READER;
+
+/*
+ * A digest of the entity stream that one parse path produced.
+ */
+typedef struct {
+  
+  /*
+   * The FNV-1a hash of all the fields of the entities before the last
+   * one, including their payloads.
+   */
+  uint64_t hash;
+  
+  /*
+   * The number of entities before the last one.
+   */
+  int32_t count;
+  
+  /*
+   * The status of the last entity, which is either SMF_TYPE_EOF or an
+   * error code.
+   */
+  int status;
+  
+  /*
+   * If located is non-zero, offset and track are where smfparse_error()
+   * says that the error in status was detected.  This is only recorded
+   * for parse paths that end with an error through a parser object.
+   */
+  int located;
+  int64_t offset;
+  int32_t track;
+  
+} BENCH_DIGEST;
+
+/*
+ * The calls to the error callback of the feed path.
+ */
+typedef struct {
+  
+  /*
+   * The number of calls.
+   */
+  int32_t calls;
+  
+  /*
+   * The description of the error in the last call.
+   */
+  SMF_ERRINFO info;
+  
+} BENCH_ERRORS;
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+/*
+ * The executable module name for diagnostic messages, or NULL if not
+ * known.
+ */
+static const char *pModule = NULL;
+
+/*
+ * Report an error to standard error and exit the program with failure
+ * code.
+ * 
+ * The message is a printf-style message, and it is followed by a
+ * variable-length argument list of parameters.
+ * 
+ * Parameters:
+ * 
+ *   lnum - the source file line number (__LINE__)
+ * 
+ *   pMsg - the error message, or NULL for a generic message
+ * 
+ *   ... - extra parameters for the error message
+ */
+static void raiseErr(long lnum, const char *pMsg, ...) {
+  
+  va_list ap;
+  va_start(ap, pMsg);
+  
+  /* Report module name */
+  if (pModule != NULL) {
+    fprintf(stderr, "%s: ", pModule);
+  } else {
+    fprintf(stderr, "midibench: ");
+  }
+  
+  /* Report error and line number */
+  if (lnum > 0) {
+    fprintf(stderr, "[Error on source line %ld] ", lnum);
+  } else {
+    fprintf(stderr, "[Error]");
+  }
+  
+  /* Report message */
+  if (pMsg != NULL) {
+    vfprintf(stderr, pMsg, ap);
+  } else {
+    fprintf(stderr, "Unexpected");
+  }
+  
+  /* Finish report */
+  fprintf(stderr, "\n");
+  
+  va_end(ap);
+  exit(EXIT_FAILURE);
+}
+
+/*
+ * Report that a parse path disagrees with the reference path and abort
+ * the program.
+ * 
+ * This indicates a bug in the library rather than a problem with the
+ * input, so the program is aborted instead of exiting, which lets
+ * fuzzers and debuggers catch it.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name of the parse path
+ * 
+ *   pRef - the digest of the reference path
+ * 
+ *   pDig - the digest of the parse path that disagrees
+ */
+static void raiseMismatch(const char *pName,
+                          const BENCH_DIGEST *pRef,
+                          const BENCH_DIGEST *pDig) {
+  
+  if (pModule != NULL) {
+    fprintf(stderr, "%s: ", pModule);
+  } else {
+    fprintf(stderr, "midibench: ");
+  }
+  
+  fprintf(stderr, "[Mismatch] %s path read %ld entities "
+                  "ending with status %d, reference read %ld entities "
+                  "ending with status %d\n",
+          pName,
+          (long) pDig->count,
+          pDig->status,
+          (long) pRef->count,
+          pRef->status);
+  
+  if (pDig->located && pRef->located) {
+    fprintf(stderr, "[Mismatch] %s path error at offset %ld in track "
+                    "%ld, reference error at offset %ld in track %ld\n",
+            pName,
+            (long) pDig->offset,
+            (long) pDig->track,
+            (long) pRef->offset,
+            (long) pRef->track);
+  }
+  
+  abort();
+}
+
+/*
+ * Generated file buffer
+ * =====================
+ */
+
+/*
+ * The bytes of the generated MIDI file.
+ */
+static uint8_t *m_buf = NULL;
+static int32_t m_len = 0;
+static int32_t m_cap = 0;
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static uint32_t m_rand = 0;
+
+/*
+ * The bytes of the mutated copy of the generated file for fuzzing.
+ */
+static uint8_t *m_mut = NULL;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t parseCount(const char *pStr, int32_t lo, int32_t hi);
+static int32_t randomInt(int32_t n);
+static void putByte(int c);
+static void putUint16(int32_t v);
+static void putUint32(int32_t v, int32_t offs);
+static void putVar(int32_t v);
+static void putChannel(int st, int a, int b, int pct, int *pRun);
+static void putTrack(const BENCH_SHAPE *pShape, int32_t tnum);
+static void generate(const BENCH_SHAPE *pShape);
+static int32_t parseAll(SMFPARSE *ps, SMFSOURCE *pSrc);
+static int onHeader(void *pCustom, const SMF_HEADER *pHead);
+static int onChunk(void *pCustom, uint32_t chunk_type);
+static int onTrack(void *pCustom, int32_t trk, int64_t tick);
+static int onMessage(void *pCustom, int64_t tick, int ch, int a, int b);
+static int onChannel(void *pCustom, int64_t tick, int ch, int val);
+static int onNumber(void *pCustom, int64_t tick, int32_t val);
+static int onData(void *pCustom, int64_t tick, int kind,
+                  const uint8_t *pData, int32_t len);
+static int onSmpte(void *pCustom, int64_t tick, const SMF_TIMECODE *pTC);
+static int onTimeSig(void *pCustom, int64_t tick, const SMF_TIMESIG *pTS);
+static int onKeySig(void *pCustom, int64_t tick, const SMF_KEYSIG *pKS);
+static int32_t runAll(SMFPARSE *ps, SMFSOURCE *pSrc);
+static int32_t writeAll(SMFPARSE *ps, SMFSOURCE *pSrc);
+static int32_t cacheAll(SMFCACHE *pc);
+static void hashBytes(uint64_t *pHash, const uint8_t *pData, int32_t len);
+static void hashInt(uint64_t *pHash, int64_t v);
+static void digestEntity(BENCH_DIGEST *pDig, const SMF_ENTITY *pEnt);
+static void digestError(BENCH_DIGEST *pDig, const SMFPARSE *ps);
+static void onError(void *pCustom, const SMF_ERRINFO *pInfo);
+static int readerByte(void *pInstance);
+static int32_t readerBlock(void *pInstance, uint8_t *pBuf, int32_t len);
+static int readerRewind(void *pInstance);
+static void digestRead(SMFPARSE *ps, SMFSOURCE *pSrc, BENCH_DIGEST *pDig);
+static void digestBatch(SMFPARSE *ps, SMFSOURCE *pSrc, BENCH_DIGEST *pDig);
+static void pairNotes(SMFPARSE *ps, SMFSOURCE *pSrc);
+static void digestFeed(const uint8_t *pData, int32_t len,
+                        BENCH_DIGEST *pDig);
+static int digestCache(const uint8_t *pData, int32_t len,
+                        BENCH_DIGEST *pDig);
+static int digestWrite(SMFPARSE *ps, const uint8_t *pData, int32_t len,
+                        BENCH_DIGEST *pPut, BENCH_DIGEST *pDig);
+static void checkWriter(void);
+static void compare(const char *pName,
+                    const BENCH_DIGEST *pRef,
+                    const BENCH_DIGEST *pDig);
+static void check(const uint8_t *pData, int32_t len, BENCH_DIGEST *pRef);
+static int32_t mutate(void);
+static void fuzzAll(int32_t count);
+static int limitPath(const char *pPath, const SMF_OPTIONS *pOpt);
+static void checkLimits(const char *pPath);
+static double wallClock(void);
+static double report(const char *pName, int32_t ents, int32_t iter,
+                      double elapsed);
+
+/*
+ * Parse a program argument as a decimal integer in a given range.
+ * 
+ * An error is raised if the argument is not a valid integer or if it is
+ * out of range.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the program argument
+ * 
+ *   lo - the minimum value
+ * 
+ *   hi - the maximum value
+ * 
+ * Return:
+ * 
+ *   the integer value
+ */
+static int32_t parseCount(const char *pStr, int32_t lo, int32_t hi) {
+  
+  long v = 0;
+  char *pEnd = NULL;
+  
+  if (pStr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  v = strtol(pStr, &pEnd, 10);
+  if ((pEnd == pStr) || (*pEnd != 0) || (v < lo) || (v > hi)) {
+    raiseErr(__LINE__, "Invalid numeric argument: %s", pStr);
+  }
+  
+  return (int32_t) v;
+}
+
+/*
+ * Generate a pseudo-random integer in range zero to n - 1, inclusive.
+ * 
+ * A simple linear congruential generator is used so that the generated
+ * file only depends on the seed.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of possible values, greater than zero
+ * 
+ * Return:
+ * 
+ *   the pseudo-random integer
+ */
+static int32_t randomInt(int32_t n) {
+  
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  m_rand = (m_rand * UINT32_C(1103515245)) + UINT32_C(12345);
+  return (int32_t) ((m_rand >> 8) % ((uint32_t) n));
+}
+
+/*
+ * Append a byte to the generated file.
+ * 
+ * Parameters:
+ * 
+ *   c - the unsigned byte value
+ */
+static void putByte(int c) {
+  
+  int32_t new_cap = 0;
+  
+  if ((c < 0) || (c > 255)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (m_len >= m_cap) {
+    if (m_cap > INT32_MAX / 2) {
+      raiseErr(__LINE__, "Generated file too large");
+    }
+    if (m_cap < 1) {
+      new_cap = 65536;
+    } else {
+      new_cap = m_cap * 2;
+    }
+    
+    m_buf = (uint8_t *) realloc(m_buf, (size_t) new_cap);
+    if (m_buf == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_cap = new_cap;
+  }
+  
+  m_buf[m_len] = (uint8_t) c;
+  m_len++;
+}
+
+/*
+ * Append an unsigned 16-bit integer in big endian order to the
+ * generated file.
+ * 
+ * Parameters:
+ * 
+ *   v - the value
+ */
+static void putUint16(int32_t v) {
+  
+  if ((v < 0) || (v > 0xffff)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  putByte((int) (v >> 8));
+  putByte((int) (v & 0xff));
+}
+
+/*
+ * Store an unsigned 32-bit integer in big endian order in the
+ * generated file.
+ * 
+ * If offs is -1, the integer is appended.  Otherwise, it overwrites the
+ * four bytes at offset offs, which must already have been generated.
+ * 
+ * Parameters:
+ * 
+ *   v - the value, zero or greater
+ * 
+ *   offs - the offset to write to, or -1 to append
+ */
+static void putUint32(int32_t v, int32_t offs) {
+  
+  int i = 0;
+  
+  if ((v < 0) || (offs < -1) || ((offs >= 0) && (offs > m_len - 4))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 0; i < 4; i++) {
+    if (offs < 0) {
+      putByte((int) ((v >> (24 - (8 * i))) & 0xff));
+    } else {
+      m_buf[offs + i] = (uint8_t) ((v >> (24 - (8 * i))) & 0xff);
+    }
+  }
+}
+
+/*
+ * Append a variable-length quantity to the generated file.
+ * 
+ * Parameters:
+ * 
+ *   v - the value, in range zero to SMF_MAX_VARINT
+ */
+static void putVar(int32_t v) {
+  
+  int i = 0;
+  int started = 0;
+  int c = 0;
+  
+  if ((v < 0) || (v > SMF_MAX_VARINT)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 3; i >= 0; i--) {
+    c = (int) ((v >> (7 * i)) & 0x7f);
+    if ((c != 0) || (i == 0)) {
+      started = 1;
+    }
+    if (started) {
+      if (i > 0) {
+        putByte(c | 0x80);
+      } else {
+        putByte(c);
+      }
+    }
+  }
+}
+
+/*
+ * Append a channel message to the generated file, using running status
+ * with the given percentage of probability if the previous event
+ * allows it.
+ * 
+ * pRun holds the current running status, or -1 if there is none, and
+ * it is updated by this function.
+ * 
+ * Parameters:
+ * 
+ *   st - the status byte
+ * 
+ *   a - the first data byte
+ * 
+ *   b - the second data byte, or -1 if there is none
+ * 
+ *   pct - the running status percentage
+ * 
+ *   pRun - the current running status
+ */
+static void putChannel(int st, int a, int b, int pct, int *pRun) {
+  
+  if ((st < 0x80) || (st > 0xef) || (pRun == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if ((st != *pRun) || (randomInt(100) >= pct)) {
+    putByte(st);
+  }
+  *pRun = st;
+  
+  putByte(a);
+  if (b >= 0) {
+    putByte(b);
+  }
+}
+
+/*
+ * Append a note track to the generated file.
+ * 
+ * Parameters:
+ * 
+ *   pShape - the shape options
+ * 
+ *   tnum - the zero-based index of the note track
+ */
+static void putTrack(const BENCH_SHAPE *pShape, int32_t tnum) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t offs = 0;
+  int ch = 0;
+  int key = 0;
+  int run = -1;
+  char name[32];
+  
+  memset(name, 0, sizeof(name));
+  
+  if ((pShape == NULL) || (tnum < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  ch = (int) (tnum % 16);
+  
+  /* Chunk header with the length filled in at the end */
+  putUint32(INT32_C(0x4d54726b), -1);
+  offs = m_len;
+  putUint32(0, -1);
+  
+  /* Track name and program */
+  sprintf(name, "Track %ld", (long) (tnum + 1));
+  putVar(0);
+  putByte(0xff);
+  putByte(0x03);
+  putVar((int32_t) strlen(name));
+  for(i = 0; name[i] != 0; i++) {
+    putByte((int) name[i]);
+  }
+  
+  putVar(0);
+  putChannel(0xc0 + ch, (int) randomInt(128), -1, pShape->running, &run);
+  
+  /* Notes, with a SysEx message every so often */
+  for(i = 0; i < pShape->notes; i++) {
+    if ((pShape->sysex > 0) && (i > 0) && ((i % pShape->every) == 0)) {
+      putVar(0);
+      putByte(0xf0);
+      putVar(pShape->sysex);
+      for(j = 0; j < pShape->sysex - 1; j++) {
+        putByte((int) randomInt(128));
+      }
+      putByte(0xf7);
+      run = -1;
+    }
+    
+    key = (int) (36 + randomInt(48));
+    putVar(randomInt((2 * pShape->density) + 1));
+    putChannel(0x90 + ch, key, (int) (1 + randomInt(127)),
+                pShape->running, &run);
+    putVar(randomInt((2 * pShape->density) + 1));
+    putChannel(0x90 + ch, key, 0, pShape->running, &run);
+  }
+  
+  /* End of track */
+  putVar(0);
+  putByte(0xff);
+  putByte(0x2f);
+  putVar(0);
+  
+  putUint32(m_len - offs - 4, offs);
+}
+
+/*
+ * Generate the MIDI file in memory.
+ * 
+ * Parameters:
+ * 
+ *   pShape - the shape options
+ */
+static void generate(const BENCH_SHAPE *pShape) {
+  
+  int32_t i = 0;
+  int32_t offs = 0;
+  
+  if (pShape == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  m_len = 0;
+  m_rand = (uint32_t) pShape->seed;
+  
+  /* Header chunk */
+  putUint32(INT32_C(0x4d546864), -1);
+  putUint32(6, -1);
+  putUint16(1);
+  putUint16(pShape->tracks + 1);
+  putUint16(BENCH_SUBDIV);
+  
+  /* Conductor track with tempo and time signature */
+  putUint32(INT32_C(0x4d54726b), -1);
+  offs = m_len;
+  putUint32(0, -1);
+  
+  putVar(0);
+  putByte(0xff);
+  putByte(0x51);
+  putVar(3);
+  putByte(0x07);
+  putByte(0xa1);
+  putByte(0x20);
+  
+  putVar(0);
+  putByte(0xff);
+  putByte(0x58);
+  putVar(4);
+  putByte(4);
+  putByte(2);
+  putByte(24);
+  putByte(8);
+  
+  putVar(0);
+  putByte(0xff);
+  putByte(0x2f);
+  putVar(0);
+  
+  putUint32(m_len - offs - 4, offs);
+  
+  /* Note tracks */
+  for(i = 0; i < pShape->tracks; i++) {
+    putTrack(pShape, i);
+  }
+}
+
+/*
+ * Parse a whole MIDI file and count the entities.
+ * 
+ * The parser is reset first.  An error is raised if parsing fails.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pSrc - the input source, positioned at the start of the file
+ * 
+ * Return:
+ * 
+ *   the number of entities read, excluding the final EOF
+ */
+static int32_t parseAll(SMFPARSE *ps, SMFSOURCE *pSrc) {
+  
+  int32_t count = 0;
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if ((ps == NULL) || (pSrc == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  smfparse_reset(ps);
+  for(smfparse_read(ps, &ent, pSrc);
+      ent.status > 0;
+      smfparse_read(ps, &ent, pSrc)) {
+    count++;
+  }
+  
+  if (ent.status != SMF_TYPE_EOF) {
+    raiseErr(__LINE__, "MIDI parsing error: %s",
+              smf_errorString(ent.status));
+  }
+  
+  return count;
+}
+
+/*
+ * Handlers for smfparse_run() that count the entities they receive.
+ * 
+ * pCustom points to the int32_t counter.  The handlers always continue
+ * the run.
+ */
+static int onHeader(void *pCustom, const SMF_HEADER *pHead) {
+  (void) pHead;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onChunk(void *pCustom, uint32_t chunk_type) {
+  (void) chunk_type;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onTrack(void *pCustom, int32_t trk, int64_t tick) {
+  (void) trk;
+  (void) tick;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onMessage(void *pCustom, int64_t tick, int ch, int a, int b) {
+  (void) tick;
+  (void) ch;
+  (void) a;
+  (void) b;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onChannel(void *pCustom, int64_t tick, int ch, int val) {
+  (void) tick;
+  (void) ch;
+  (void) val;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onNumber(void *pCustom, int64_t tick, int32_t val) {
+  (void) tick;
+  (void) val;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onData(void *pCustom, int64_t tick, int kind,
+                  const uint8_t *pData, int32_t len) {
+  (void) tick;
+  (void) kind;
+  (void) pData;
+  (void) len;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onSmpte(void *pCustom, int64_t tick, const SMF_TIMECODE *pTC) {
+  (void) tick;
+  (void) pTC;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onTimeSig(void *pCustom, int64_t tick, const SMF_TIMESIG *pTS) {
+  (void) tick;
+  (void) pTS;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+static int onKeySig(void *pCustom, int64_t tick, const SMF_KEYSIG *pKS) {
+  (void) tick;
+  (void) pKS;
+  (*((int32_t *) pCustom))++;
+  return 1;
+}
+
+/*
+ * Dispatch all the entities of a MIDI file to counting handlers with
+ * smfparse_run().
+ * 
+ * Every entity type has a handler, so nothing is filtered out and the
+ * count matches parseAll().
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pSrc - the input source, positioned at the start of the file
+ * 
+ * Return:
+ * 
+ *   the number of entities dispatched, excluding the final EOF
+ */
+static int32_t runAll(SMFPARSE *ps, SMFSOURCE *pSrc) {
+  
+  int result = 0;
+  int32_t count = 0;
+  SMF_HANDLERS h;
+  
+  memset(&h, 0, sizeof(SMF_HANDLERS));
+  
+  if ((ps == NULL) || (pSrc == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  h.fHeader        = &onHeader;
+  h.fChunk         = &onChunk;
+  h.fBeginTrack    = &onTrack;
+  h.fEndTrack      = &onTrack;
+  h.fNoteOff       = &onMessage;
+  h.fNoteOn        = &onMessage;
+  h.fKeyAftertouch = &onMessage;
+  h.fControl       = &onMessage;
+  h.fProgram       = &onChannel;
+  h.fChAftertouch  = &onChannel;
+  h.fPitchBend     = &onChannel;
+  h.fSysex         = &onData;
+  h.fSysesc        = &onData;
+  h.fSeqNum        = &onNumber;
+  h.fText          = &onData;
+  h.fChPrefix      = &onNumber;
+  h.fTempo         = &onNumber;
+  h.fSmpte         = &onSmpte;
+  h.fTimeSig       = &onTimeSig;
+  h.fKeySig        = &onKeySig;
+  h.fMeta          = &onData;
+  
+  smfparse_reset(ps);
+  result = smfparse_run(ps, pSrc, &h, &count);
+  
+  if (result != SMF_TYPE_EOF) {
+    raiseErr(__LINE__, "MIDI parsing error: %s",
+              smf_errorString(result));
+  }
+  
+  return count;
+}
+
+/*
+ * Parse all the entities of a MIDI file and re-encode them into a
+ * buffer with a writer.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pSrc - the input source, positioned at the start of the file
+ * 
+ * Return:
+ * 
+ *   the number of entities re-encoded, excluding the final EOF
+ */
+static int32_t writeAll(SMFPARSE *ps, SMFSOURCE *pSrc) {
+  
+  int err_num = 0;
+  int32_t count = 0;
+  SMFWRITE *pw = NULL;
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if ((ps == NULL) || (pSrc == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pw = smfwrite_new_buffer();
+  
+  smfparse_reset(ps);
+  for(smfparse_read(ps, &ent, pSrc);
+      ent.status > 0;
+      smfparse_read(ps, &ent, pSrc)) {
+    if (!smfwrite_put(pw, &ent, &err_num)) {
+      raiseErr(__LINE__, "MIDI writing error: %s",
+                smf_errorString(err_num));
+    }
+    count++;
+  }
+  
+  if (ent.status != SMF_TYPE_EOF) {
+    raiseErr(__LINE__, "MIDI parsing error: %s",
+              smf_errorString(ent.status));
+  }
+  
+  if (!smfwrite_finish(pw, &err_num)) {
+    raiseErr(__LINE__, "MIDI writing error: %s",
+              smf_errorString(err_num));
+  }
+  
+  smfwrite_free(pw);
+  pw = NULL;
+  
+  return count;
+}
+
+/*
+ * Read all the entities of a binary cache from the start.
+ * 
+ * Parameters:
+ * 
+ *   pc - the cache object
+ * 
+ * Return:
+ * 
+ *   the number of entities read, excluding the final EOF
+ */
+static int32_t cacheAll(SMFCACHE *pc) {
+  
+  int32_t count = 0;
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if (pc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  smfcache_rewind(pc);
+  for(smfcache_read(pc, &ent);
+      ent.status > 0;
+      smfcache_read(pc, &ent)) {
+    count++;
+  }
+  
+  if (ent.status != SMF_TYPE_EOF) {
+    raiseErr(__LINE__, "Cache reading error: %s",
+              smf_errorString(ent.status));
+  }
+  
+  return count;
+}
+
+/*
+ * Mix bytes into an FNV-1a hash.
+ * 
+ * Parameters:
+ * 
+ *   pHash - the hash to update
+ * 
+ *   pData - the bytes to mix in, or NULL if len is zero
+ * 
+ *   len - the number of bytes
+ */
+static void hashBytes(uint64_t *pHash, const uint8_t *pData, int32_t len) {
+  
+  int32_t i = 0;
+  
+  if ((pHash == NULL) || (len < 0) || ((pData == NULL) && (len > 0))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 0; i < len; i++) {
+    *pHash = (*pHash ^ ((uint64_t) pData[i])) * UINT64_C(0x100000001b3);
+  }
+}
+
+/*
+ * Mix an integer into an FNV-1a hash.
+ * 
+ * The integer is mixed in as eight bytes in little endian order, so
+ * the hash does not depend on the platform.
+ * 
+ * Parameters:
+ * 
+ *   pHash - the hash to update
+ * 
+ *   v - the integer to mix in
+ */
+static void hashInt(uint64_t *pHash, int64_t v) {
+  
+  int i = 0;
+  uint8_t b[8];
+  
+  memset(b, 0, sizeof(b));
+  
+  for(i = 0; i < 8; i++) {
+    b[i] = (uint8_t) ((((uint64_t) v) >> (8 * i)) & 0xff);
+  }
+  hashBytes(pHash, b, 8);
+}
+
+/*
+ * Add an entity to the digest of an entity stream.
+ * 
+ * Entities with a positive status are counted and every field is mixed
+ * into the hash, including the payload and the structures that the
+ * entity points to.  An entity with the status SMF_TYPE_EOF or an error
+ * status ends the stream and is only recorded as the final status.
+ * 
+ * Parameters:
+ * 
+ *   pDig - the digest to update
+ * 
+ *   pEnt - the entity
+ */
+static void digestEntity(BENCH_DIGEST *pDig, const SMF_ENTITY *pEnt) {
+  
+  uint64_t *pHash = NULL;
+  
+  if ((pDig == NULL) || (pEnt == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (pEnt->status <= 0) {
+    pDig->status = pEnt->status;
+    return;
+  }
+  
+  pDig->count++;
+  pHash = &(pDig->hash);
+  
+  hashInt(pHash, pEnt->status);
+  hashInt(pHash, (int64_t) pEnt->chunk_type);
+  hashInt(pHash, pEnt->delta);
+  hashInt(pHash, pEnt->tick);
+  hashInt(pHash, pEnt->ch);
+  hashInt(pHash, pEnt->key);
+  hashInt(pHash, pEnt->ctl);
+  hashInt(pHash, pEnt->val);
+  hashInt(pHash, pEnt->bend);
+  hashInt(pHash, pEnt->buf_len);
+  if (pEnt->buf_len > 0) {
+    hashBytes(pHash, pEnt->buf_ptr, pEnt->buf_len);
+  }
+  hashInt(pHash, pEnt->seq_num);
+  hashInt(pHash, pEnt->txtype);
+  hashInt(pHash, pEnt->beat_dur);
+  hashInt(pHash, pEnt->meta_type);
+  
+  if (pEnt->pHead != NULL) {
+    hashInt(pHash, (pEnt->pHead)->fmt);
+    hashInt(pHash, (pEnt->pHead)->nTracks);
+    hashInt(pHash, (pEnt->pHead)->ts.subdiv);
+    hashInt(pHash, (pEnt->pHead)->ts.frame_rate);
+  }
+  if (pEnt->tcode != NULL) {
+    hashInt(pHash, (pEnt->tcode)->hour);
+    hashInt(pHash, (pEnt->tcode)->minute);
+    hashInt(pHash, (pEnt->tcode)->second);
+    hashInt(pHash, (pEnt->tcode)->frame);
+    hashInt(pHash, (pEnt->tcode)->ff);
+  }
+  if (pEnt->tsig != NULL) {
+    hashInt(pHash, (pEnt->tsig)->numerator);
+    hashInt(pHash, (pEnt->tsig)->denominator);
+    hashInt(pHash, (pEnt->tsig)->click);
+    hashInt(pHash, (pEnt->tsig)->beat_unit);
+  }
+  if (pEnt->ksig != NULL) {
+    hashInt(pHash, (pEnt->ksig)->key);
+    hashInt(pHash, (pEnt->ksig)->is_minor);
+  }
+}
+
+/*
+ * Callbacks for the custom input sources of the differential check.
+ * 
+ * pInstance points to a BENCH_READER.  readerByte() is the reference
+ * path, which delivers one byte per callback.  readerBlock() delivers
+ * at most BENCH_BLOCK bytes per callback.  Both sources share the
+ * rewind callback.
+ */
+static int readerByte(void *pInstance) {
+  
+  BENCH_READER *pr = (BENCH_READER *) pInstance;
+  
+  if (pr->pos >= pr->len) {
+    return SMFSOURCE_EOF;
+  }
+  
+  pr->pos++;
+  return (int) pr->pData[pr->pos - 1];
+}
+
+static int32_t readerBlock(void *pInstance, uint8_t *pBuf, int32_t len) {
+  
+  BENCH_READER *pr = (BENCH_READER *) pInstance;
+  
+  if (len > BENCH_BLOCK) {
+    len = BENCH_BLOCK;
+  }
+  if (len > pr->len - pr->pos) {
+    len = pr->len - pr->pos;
+  }
+  
+  if (len > 0) {
+    memcpy(pBuf, pr->pData + pr->pos, (size_t) len);
+    pr->pos += len;
+  }
+  return len;
+}
+
+static int readerRewind(void *pInstance) {
+  ((BENCH_READER *) pInstance)->pos = 0;
+  return 1;
+}
+
+/*
+ * Record where a parse path ended with an error in its digest.
+ * 
+ * Nothing is recorded if the digest does not end with an error.
+ * 
+ * Parameters:
+ * 
+ *   pDig - the digest of the finished parse path
+ * 
+ *   ps - the parser that the parse path used
+ */
+static void digestError(BENCH_DIGEST *pDig, const SMFPARSE *ps) {
+  
+  SMF_ERRINFO info;
+  
+  memset(&info, 0, sizeof(SMF_ERRINFO));
+  
+  if ((pDig == NULL) || (ps == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (pDig->status < 0) {
+    if (!smfparse_error(ps, &info)) {
+      raiseErr(__LINE__, "Parser is not in an error state");
+    }
+    if (info.code != pDig->status) {
+      raiseErr(__LINE__, "Parser error state does not match");
+    }
+    pDig->located = 1;
+    pDig->offset  = info.offset;
+    pDig->track   = info.track;
+  }
+}
+
+/*
+ * Error callback that records the calls in a BENCH_ERRORS structure.
+ */
+static void onError(void *pCustom, const SMF_ERRINFO *pInfo) {
+  BENCH_ERRORS *pErrs = (BENCH_ERRORS *) pCustom;
+  
+  pErrs->calls++;
+  memcpy(&(pErrs->info), pInfo, sizeof(SMF_ERRINFO));
+}
+
+/*
+ * Digest the entity stream of a MIDI file with smfparse_read().
+ * 
+ * The parser is reset first.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pSrc - the input source, positioned at the start of the file
+ * 
+ *   pDig - receives the digest
+ */
+static void digestRead(SMFPARSE *ps, SMFSOURCE *pSrc, BENCH_DIGEST *pDig) {
+  
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if ((ps == NULL) || (pSrc == NULL) || (pDig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(pDig, 0, sizeof(BENCH_DIGEST));
+  
+  smfparse_reset(ps);
+  for(smfparse_read(ps, &ent, pSrc);
+      ent.status > 0;
+      smfparse_read(ps, &ent, pSrc)) {
+    digestEntity(pDig, &ent);
+  }
+  digestEntity(pDig, &ent);
+  digestError(pDig, ps);
+}
+
+/*
+ * Digest the entity stream of a MIDI file with smfparse_read_batch().
+ * 
+ * The parser is reset first.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pSrc - the input source, positioned at the start of the file
+ * 
+ *   pDig - receives the digest
+ */
+static void digestBatch(SMFPARSE *ps, SMFSOURCE *pSrc, BENCH_DIGEST *pDig) {
+  
+  int32_t i = 0;
+  int32_t count = 0;
+  SMF_ENTITY ents[BENCH_BATCH];
+  
+  memset(ents, 0, sizeof(ents));
+  
+  if ((ps == NULL) || (pSrc == NULL) || (pDig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(pDig, 0, sizeof(BENCH_DIGEST));
+  
+  smfparse_reset(ps);
+  do {
+    count = smfparse_read_batch(ps, ents, BENCH_BATCH, pSrc);
+    for(i = 0; i < count; i++) {
+      digestEntity(pDig, &(ents[i]));
+    }
+  } while (ents[count - 1].status > 0);
+  digestError(pDig, ps);
+}
+
+/*
+ * Pass the entity stream of a MIDI file through a note pairing engine.
+ * 
+ * This only checks that whatever the parser returns can be consumed
+ * without a fault, so the notes themselves are discarded.  The parser
+ * is reset first.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pSrc - the input source, positioned at the start of the file
+ */
+static void pairNotes(SMFPARSE *ps, SMFSOURCE *pSrc) {
+  
+  SMFNOTES *pn = NULL;
+  SMF_ENTITY ent;
+  SMF_NOTE note;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  memset(&note, 0, sizeof(SMF_NOTE));
+  
+  if ((ps == NULL) || (pSrc == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pn = smfnotes_alloc(SMF_NOTES_NEST);
+  
+  smfparse_reset(ps);
+  for(smfparse_read(ps, &ent, pSrc);
+      ent.status > 0;
+      smfparse_read(ps, &ent, pSrc)) {
+    smfnotes_put(pn, &ent);
+    while (smfnotes_get(pn, &note)) { }
+  }
+  
+  smfnotes_free(pn);
+  pn = NULL;
+}
+
+/*
+ * Digest the entity stream of a MIDI file with smfparse_feed().
+ * 
+ * The file is pushed into a new parser BENCH_PIECE bytes at a time, and
+ * then the end of input is signaled.
+ * 
+ * Parameters:
+ * 
+ *   pData - the bytes of the file, or NULL if len is zero
+ * 
+ *   len - the number of bytes in the file
+ * 
+ *   pDig - receives the digest
+ */
+static void digestFeed(const uint8_t *pData, int32_t len,
+                        BENCH_DIGEST *pDig) {
+  
+  int32_t offs = 0;
+  int32_t piece = 0;
+  int32_t count = 0;
+  int32_t i = 0;
+  int ended = 0;
+  int done = 0;
+  SMFPARSE *ps = NULL;
+  SMF_ENTITY ents[BENCH_BATCH];
+  BENCH_ERRORS errs;
+  
+  memset(ents, 0, sizeof(ents));
+  memset(&errs, 0, sizeof(BENCH_ERRORS));
+  
+  if ((len < 0) || ((pData == NULL) && (len > 0)) || (pDig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(pDig, 0, sizeof(BENCH_DIGEST));
+  ps = smfparse_alloc();
+  smfparse_set_error(ps, &onError, &errs);
+  
+  while (!done) {
+    /* Push the next piece, or signal the end once everything is in */
+    if (offs < len) {
+      piece = len - offs;
+      if (piece > BENCH_PIECE) {
+        piece = BENCH_PIECE;
+      }
+      count = smfparse_feed(ps, pData + offs, piece, ents, BENCH_BATCH);
+      offs += piece;
+    } else {
+      count = smfparse_feed(ps, NULL, SMF_FEED_END, ents, BENCH_BATCH);
+      ended = 1;
+    }
+    
+    /* Take all the entities that are complete */
+    for( ; ; ) {
+      for(i = 0; i < count; i++) {
+        if (ents[i].status != SMF_TYPE_NEED_MORE) {
+          digestEntity(pDig, &(ents[i]));
+        }
+      }
+      if (ents[count - 1].status <= 0) {
+        done = 1;
+        break;
+      }
+      if (count < BENCH_BATCH) {
+        break;
+      }
+      count = smfparse_feed(ps, NULL, 0, ents, BENCH_BATCH);
+    }
+    
+    if ((!done) && ended) {
+      raiseErr(__LINE__, "Feed path needs more input after the end");
+    }
+  }
+  
+  /* The error callback must have been called exactly once for an
+   * error, and never for entities that only needed more input */
+  digestError(pDig, ps);
+  if (pDig->status < 0) {
+    if ((errs.calls != 1) ||
+        (errs.info.code != pDig->status) ||
+        (errs.info.offset != pDig->offset) ||
+        (errs.info.track != pDig->track)) {
+      raiseErr(__LINE__, "Feed path error callback does not match");
+    }
+  } else if (errs.calls != 0) {
+    raiseErr(__LINE__, "Feed path error callback called without error");
+  }
+  
+  smfparse_free(ps);
+  ps = NULL;
+}
+
+/*
+ * Digest the entity stream of a MIDI file through a binary cache.
+ * 
+ * If the cache cannot be built, the digest is empty with the error code
+ * that smfcache_build() reported as its final status.
+ * 
+ * Parameters:
+ * 
+ *   pData - the bytes of the file, or NULL if len is zero
+ * 
+ *   len - the number of bytes in the file
+ * 
+ *   pDig - receives the digest
+ * 
+ * Return:
+ * 
+ *   non-zero if the cache was built, zero if not
+ */
+static int digestCache(const uint8_t *pData, int32_t len,
+                        BENCH_DIGEST *pDig) {
+  
+  int status = 1;
+  int err_num = 0;
+  int64_t blob_len = 0;
+  void *pBlob = NULL;
+  SMFSOURCE *pSrc = NULL;
+  SMFCACHE *pc = NULL;
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if ((len < 0) || ((pData == NULL) && (len > 0)) || (pDig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(pDig, 0, sizeof(BENCH_DIGEST));
+  
+  pSrc = smfsource_new_memory(pData, len);
+  if (!smfcache_build(pSrc, NULL, &pBlob, &blob_len, &err_num)) {
+    pDig->status = err_num;
+    status = 0;
+  }
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  if (status) {
+    pc = smfcache_open(pBlob, blob_len, &err_num);
+    if (pc == NULL) {
+      raiseErr(__LINE__, "Failed to open cache: %s",
+                smf_errorString(err_num));
+    }
+    
+    for(smfcache_read(pc, &ent);
+        ent.status > 0;
+        smfcache_read(pc, &ent)) {
+      digestEntity(pDig, &ent);
+    }
+    digestEntity(pDig, &ent);
+    
+    smfcache_close(pc);
+    pc = NULL;
+  }
+  
+  free(pBlob);
+  pBlob = NULL;
+  
+  return status;
+}
+
+/*
+ * Digest the entity stream of a MIDI file after re-encoding it with a
+ * writer.
+ * 
+ * The file is parsed from memory and every entity is passed to
+ * smfwrite_put(), and then the buffer that the writer produced is
+ * parsed and digested.  If writing fails, the digest is empty with the
+ * error code that the writer reported as its final status.  The file
+ * must parse without errors.
+ * 
+ * The writer drops SMF_TYPE_CHUNK entities, so the entities that were
+ * passed to the writer are digested separately without them, for
+ * comparison with what is read back.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser
+ * 
+ *   pData - the bytes of the file, or NULL if len is zero
+ * 
+ *   len - the number of bytes in the file
+ * 
+ *   pPut - receives the digest of the entities passed to the writer
+ * 
+ *   pDig - receives the digest of the entities read back
+ * 
+ * Return:
+ * 
+ *   non-zero if the file was re-encoded, zero if not
+ */
+static int digestWrite(SMFPARSE *ps, const uint8_t *pData, int32_t len,
+                        BENCH_DIGEST *pPut, BENCH_DIGEST *pDig) {
+  
+  int status = 1;
+  int err_num = 0;
+  int64_t out_len = 0;
+  const uint8_t *pOut = NULL;
+  SMFSOURCE *pSrc = NULL;
+  SMFWRITE *pw = NULL;
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if ((ps == NULL) || (len < 0) || ((pData == NULL) && (len > 0)) ||
+      (pPut == NULL) || (pDig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(pPut, 0, sizeof(BENCH_DIGEST));
+  memset(pDig, 0, sizeof(BENCH_DIGEST));
+  pw = smfwrite_new_buffer();
+  
+  /* Re-encode the file */
+  pSrc = smfsource_new_memory(pData, len);
+  smfparse_reset(ps);
+  for(smfparse_read(ps, &ent, pSrc);
+      ent.status > 0;
+      smfparse_read(ps, &ent, pSrc)) {
+    if (!smfwrite_put(pw, &ent, &err_num)) {
+      status = 0;
+      break;
+    }
+    if (ent.status != SMF_TYPE_CHUNK) {
+      digestEntity(pPut, &ent);
+    }
+  }
+  digestEntity(pPut, &ent);
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  if (status && (ent.status != SMF_TYPE_EOF)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (status) {
+    if (!smfwrite_finish(pw, &err_num)) {
+      status = 0;
+    }
+  }
+  
+  /* Parse what was written */
+  if (status) {
+    pOut = smfwrite_buffer(pw, &out_len);
+    pSrc = smfsource_new_memory(pOut, out_len);
+    digestRead(ps, pSrc, pDig);
+    smfsource_close(pSrc);
+    pSrc = NULL;
+  } else {
+    pDig->status = err_num;
+  }
+  
+  smfwrite_free(pw);
+  pw = NULL;
+  
+  return status;
+}
+
+/*
+ * Check that the writer rejects MIDI messages with out-of-range values
+ * with SMF_ERR_MIDI_DATA, rather than writing them.
+ * 
+ * Each bad message is written to a fresh writer at the start of its
+ * first track.  Channels are tried that would turn the status byte
+ * into a System Exclusive or beyond, along with negative data bytes,
+ * including the second data byte that Program Change doesn't have.
+ */
+static void checkWriter(void) {
+  
+  static const int bad[][4] = {
+    /* type, ch, key or ctl, val */
+    { SMF_TYPE_NOTE_ON,          0x60,  60,  64 },
+    { SMF_TYPE_NOTE_ON,          0x70,  60,  64 },
+    { SMF_TYPE_NOTE_OFF,        0x100,  60,  64 },
+    { SMF_TYPE_CONTROL,            -1,   7, 100 },
+    { SMF_TYPE_PROGRAM,            16,   0,   5 },
+    { SMF_TYPE_NOTE_ON,             0,  60,  -5 },
+    { SMF_TYPE_KEY_AFTERTOUCH,      0, 128,  10 },
+    { SMF_TYPE_CONTROL,             0,   7,  -1 },
+    { SMF_TYPE_CH_AFTERTOUCH,       0,   0,  -1 }
+  };
+  
+  int32_t i = 0;
+  int err_num = 0;
+  SMF_HEADER head;
+  SMF_ENTITY ent;
+  SMFWRITE *pw = NULL;
+  
+  memset(&head, 0, sizeof(SMF_HEADER));
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  head.fmt = 0;
+  head.nTracks = 1;
+  head.ts.subdiv = 96;
+  
+  for(i = 0; i < (int32_t) (sizeof(bad) / sizeof(bad[0])); i++) {
+    pw = smfwrite_new_buffer();
+    
+    memset(&ent, 0, sizeof(SMF_ENTITY));
+    ent.status = SMF_TYPE_HEADER;
+    ent.pHead = &head;
+    if (!smfwrite_put(pw, &ent, &err_num)) {
+      raiseErr(__LINE__, "Writer failed: %s", smf_errorString(err_num));
+    }
+    
+    memset(&ent, 0, sizeof(SMF_ENTITY));
+    ent.status = SMF_TYPE_BEGIN_TRACK;
+    if (!smfwrite_put(pw, &ent, &err_num)) {
+      raiseErr(__LINE__, "Writer failed: %s", smf_errorString(err_num));
+    }
+    
+    memset(&ent, 0, sizeof(SMF_ENTITY));
+    ent.status = bad[i][0];
+    ent.ch = bad[i][1];
+    if (ent.status == SMF_TYPE_CONTROL) {
+      ent.ctl = bad[i][2];
+    } else {
+      ent.key = bad[i][2];
+    }
+    ent.val = bad[i][3];
+    
+    if (smfwrite_put(pw, &ent, &err_num) ||
+        (err_num != SMF_ERR_MIDI_DATA)) {
+      raiseErr(__LINE__, "Writer accepted bad message %ld",
+                (long) i);
+    }
+    
+    smfwrite_free(pw);
+    pw = NULL;
+  }
+}
+
+/*
+ * Compare the digest of a parse path with the digest of the reference
+ * path, and abort with raiseMismatch() if they differ.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name of the parse path
+ * 
+ *   pRef - the digest of the reference path
+ * 
+ *   pDig - the digest of the parse path
+ */
+static void compare(const char *pName,
+                    const BENCH_DIGEST *pRef,
+                    const BENCH_DIGEST *pDig) {
+  
+  if ((pName == NULL) || (pRef == NULL) || (pDig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if ((pDig->hash != pRef->hash) ||
+      (pDig->count != pRef->count) ||
+      (pDig->status != pRef->status)) {
+    raiseMismatch(pName, pRef, pDig);
+  }
+  
+  if (pDig->located && pRef->located) {
+    if ((pDig->offset != pRef->offset) ||
+        (pDig->track != pRef->track)) {
+      raiseMismatch(pName, pRef, pDig);
+    }
+  }
+}
+
+/*
+ * Check that every parse path reads the same entity stream from a MIDI
+ * file as the reference path.
+ * 
+ * The reference path is smfparse_read() over a smfsource_custom()
+ * source that delivers one byte per callback and has no skip callback,
+ * which is the simplest way through the parser.  It is compared with
+ * smfparse_read() over a memory source and over a block source with
+ * tiny blocks, smfparse_read_batch() over a memory source, and
+ * smfparse_feed() in small pieces, all of which must agree exactly,
+ * including on where and how parsing fails.  The binary cache must be
+ * built exactly when the reference parse succeeds, and then it must
+ * agree too.
+ * 
+ * If the reference parse succeeds, parsing at the lenient and trusted
+ * validation levels must also agree, and so must parsing the file
+ * again after re-encoding it with a writer, apart from the
+ * unrecognized chunks that the writer drops.  Otherwise, the file is
+ * still parsed at the lenient and trusted validation levels so that
+ * any unsafe memory access on invalid input can be caught by a memory
+ * checker, but the results are not compared, because those levels are
+ * allowed to accept invalid files.  Either way, the trusted parse also
+ * builds a tempo map and has its notes paired, which must not fault.
+ * 
+ * The program is aborted if any path disagrees.  Errors in the file
+ * itself are not a problem as long as all paths find them.
+ * 
+ * Parameters:
+ * 
+ *   pData - the bytes of the file, or NULL if len is zero
+ * 
+ *   len - the number of bytes in the file
+ * 
+ *   pRef - receives the digest of the reference path
+ */
+static void check(const uint8_t *pData, int32_t len, BENCH_DIGEST *pRef) {
+  
+  int ok = 0;
+  SMF_OPTIONS opt;
+  SMFPARSE *ps = NULL;
+  SMFPARSE *psLenient = NULL;
+  SMFPARSE *psTrusted = NULL;
+  SMFTEMPO *pm = NULL;
+  SMFSOURCE *pSrc = NULL;
+  BENCH_READER rd;
+  BENCH_DIGEST put;
+  BENCH_DIGEST dig;
+  
+  memset(&opt, 0, sizeof(SMF_OPTIONS));
+  memset(&rd, 0, sizeof(BENCH_READER));
+  memset(&put, 0, sizeof(BENCH_DIGEST));
+  memset(&dig, 0, sizeof(BENCH_DIGEST));
+  
+  if ((len < 0) || ((pData == NULL) && (len > 0)) || (pRef == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  ps = smfparse_alloc();
+  
+  smfparse_defaults(&opt);
+  opt.validate = SMF_VALIDATE_LENIENT;
+  psLenient = smfparse_alloc_ex(&opt);
+  
+  smfparse_defaults(&opt);
+  opt.validate = SMF_VALIDATE_TRUSTED;
+  psTrusted = smfparse_alloc_ex(&opt);
+  
+  pm = smftempo_alloc();
+  smfparse_set_tempo(psTrusted, pm);
+  
+  rd.pData = pData;
+  rd.len = len;
+  
+  /* Reference path, one byte per callback */
+  pSrc = smfsource_custom(&rd, &readerByte, &readerRewind, NULL, NULL);
+  digestRead(ps, pSrc, pRef);
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  /* Block source with tiny blocks */
+  rd.pos = 0;
+  pSrc = smfsource_custom_block(&rd, &readerBlock, &readerRewind,
+                                NULL, NULL);
+  digestRead(ps, pSrc, &dig);
+  compare("block", pRef, &dig);
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  /* Memory source, single and batched, and in other validation
+   * levels */
+  pSrc = smfsource_new_memory(pData, len);
+  
+  digestRead(ps, pSrc, &dig);
+  compare("memory", pRef, &dig);
+  
+  if (!smfsource_rewind(pSrc)) {
+    raiseErr(__LINE__, "Failed to rewind memory source");
+  }
+  digestBatch(ps, pSrc, &dig);
+  compare("batch", pRef, &dig);
+  
+  if (!smfsource_rewind(pSrc)) {
+    raiseErr(__LINE__, "Failed to rewind memory source");
+  }
+  digestRead(psLenient, pSrc, &dig);
+  if (pRef->status == SMF_TYPE_EOF) {
+    compare("lenient", pRef, &dig);
+  }
+  
+  if (!smfsource_rewind(pSrc)) {
+    raiseErr(__LINE__, "Failed to rewind memory source");
+  }
+  digestRead(psTrusted, pSrc, &dig);
+  if (pRef->status == SMF_TYPE_EOF) {
+    compare("trusted", pRef, &dig);
+  }
+  
+  if (!smfsource_rewind(pSrc)) {
+    raiseErr(__LINE__, "Failed to rewind memory source");
+  }
+  pairNotes(psTrusted, pSrc);
+  
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  /* Feed path */
+  digestFeed(pData, len, &dig);
+  compare("feed", pRef, &dig);
+  
+  /* Binary cache */
+  ok = digestCache(pData, len, &dig);
+  if ((!ok) != (pRef->status != SMF_TYPE_EOF)) {
+    raiseMismatch("cache", pRef, &dig);
+  }
+  if (ok) {
+    compare("cache", pRef, &dig);
+  }
+  
+  /* Writer round trip */
+  if (pRef->status == SMF_TYPE_EOF) {
+    if (!digestWrite(ps, pData, len, &put, &dig)) {
+      raiseMismatch("write", pRef, &dig);
+    }
+    compare("write", &put, &dig);
+  }
+  
+  smfparse_free(ps);
+  smfparse_free(psLenient);
+  smfparse_free(psTrusted);
+  smftempo_free(pm);
+  ps = NULL;
+  psLenient = NULL;
+  psTrusted = NULL;
+  pm = NULL;
+}
+
+/*
+ * Make a mutated copy of the generated file for fuzzing.
+ * 
+ * The copy is written to m_mut, which must have room for m_len bytes.
+ * Between one and eight random edits are made to it: bytes are
+ * overwritten with random values or with values that are significant
+ * in MIDI files, runs of bytes are copied over other parts of the file,
+ * and occasionally the file is truncated.
+ * 
+ * Return:
+ * 
+ *   the length of the mutated copy
+ */
+static int32_t mutate(void) {
+  
+  static const uint8_t special[8] = {
+    0x00, 0x7f, 0x80, 0xff, 0xf0, 0xf7, 0x2f, 0x51
+  };
+  
+  int32_t len = 0;
+  int32_t edits = 0;
+  int32_t i = 0;
+  int32_t a = 0;
+  int32_t b = 0;
+  int32_t n = 0;
+  int32_t kind = 0;
+  
+  if ((m_mut == NULL) || (m_len < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memcpy(m_mut, m_buf, (size_t) m_len);
+  len = m_len;
+  
+  edits = 1 + randomInt(8);
+  for(i = 0; (i < edits) && (len > 0); i++) {
+    kind = randomInt(16);
+    if (kind < 1) {
+      /* Truncate */
+      len = randomInt(len);
+      
+    } else if (kind < 4) {
+      /* Copy a run of bytes */
+      a = randomInt(len);
+      b = randomInt(len);
+      n = 1 + randomInt(16);
+      if (n > len - a) {
+        n = len - a;
+      }
+      if (n > len - b) {
+        n = len - b;
+      }
+      memmove(m_mut + b, m_mut + a, (size_t) n);
+      
+    } else if (kind < 8) {
+      /* Significant value */
+      m_mut[randomInt(len)] = special[randomInt(8)];
+      
+    } else {
+      /* Random value */
+      m_mut[randomInt(len)] = (uint8_t) randomInt(256);
+    }
+  }
+  
+  return len;
+}
+
+/*
+ * Check mutated copies of the MIDI file in m_buf with check() and
+ * report how many of them parsed without errors.
+ * 
+ * Parameters:
+ * 
+ *   count - the number of mutated copies to check
+ */
+static void fuzzAll(int32_t count) {
+  
+  int32_t i = 0;
+  int32_t ok = 0;
+  BENCH_DIGEST dig;
+  
+  memset(&dig, 0, sizeof(BENCH_DIGEST));
+  
+  if ((count < 0) || (m_len < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  m_mut = (uint8_t *) malloc((size_t) m_len);
+  if (m_mut == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  for(i = 0; i < count; i++) {
+    check(m_mut, mutate(), &dig);
+    if (dig.status == SMF_TYPE_EOF) {
+      ok++;
+    }
+  }
+  
+  printf("Fuzz: %ld mutated files, %ld without errors, "
+          "all paths agree\n",
+          (long) count, (long) ok);
+  
+  free(m_mut);
+  m_mut = NULL;
+}
+
+/*
+ * Parse a MIDI file from a path source and return its result in the
+ * same form as smfparse_batch() reports it.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ *   pOpt - the parser options
+ * 
+ * Return:
+ * 
+ *   zero if the file parsed successfully, or else the error code
+ */
+static int limitPath(const char *pPath, const SMF_OPTIONS *pOpt) {
+  
+  int err_num = 0;
+  SMFPARSE *ps = NULL;
+  SMFSOURCE *pSrc = NULL;
+  SMF_ENTITY ent;
+  
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  if ((pPath == NULL) || (pOpt == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pSrc = smfsource_new_path(pPath, &err_num);
+  if (pSrc == NULL) {
+    raiseErr(__LINE__, "Failed to open input: %s",
+              smf_errorString(err_num));
+  }
+  
+  ps = smfparse_alloc_ex(pOpt);
+  do {
+    smfparse_read(ps, &ent, pSrc);
+  } while (ent.status > 0);
+  
+  smfparse_free(ps);
+  ps = NULL;
+  if (!smfsource_close(pSrc)) {
+    raiseErr(__LINE__, "Failed to close input");
+  }
+  pSrc = NULL;
+  
+  if (ent.status == SMF_TYPE_EOF) {
+    return 0;
+  }
+  return ent.status;
+}
+
+/*
+ * Check that smfparse_batch() reports the same result as a path source
+ * when the file is cut off by the max_file option.
+ * 
+ * The generated file must already be written to pPath.  The max_file
+ * limits that are checked are all those within nine bytes of the end
+ * of a chunk, which covers every way a chunk header or chunk body can
+ * cross the limit.  The batch parses the file both from the path and
+ * from memory.  The program is aborted if any result differs.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the generated file
+ */
+static void checkLimits(const char *pPath) {
+  
+  int32_t offs = 0;
+  int32_t ck_len = 0;
+  int32_t d = 0;
+  int32_t count = 0;
+  int ref = 0;
+  int results[2];
+  SMF_OPTIONS opt;
+  SMF_BATCH_FILE files[2];
+  
+  memset(results, 0, sizeof(results));
+  memset(&opt, 0, sizeof(SMF_OPTIONS));
+  memset(files, 0, sizeof(files));
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  files[0].pPath = pPath;
+  files[1].pData = m_buf;
+  files[1].len   = m_len;
+  
+  /* Walk the chunks of the generated file, which are all well formed */
+  for(offs = 0; m_len - offs >= 8; offs += ck_len + 8) {
+    ck_len = (int32_t)
+      ((((uint32_t) m_buf[offs + 4]) << 24) |
+        (((uint32_t) m_buf[offs + 5]) << 16) |
+        (((uint32_t) m_buf[offs + 6]) <<  8) |
+         ((uint32_t) m_buf[offs + 7]));
+    
+    for(d = -9; d <= 9; d++) {
+      if (offs + ck_len + 8 + d < 1) {
+        continue;
+      }
+      
+      smfparse_defaults(&opt);
+      opt.max_file = (int64_t) (offs + ck_len + 8 + d);
+      
+      ref = limitPath(pPath, &opt);
+      smfparse_batch(files, 2, &opt, SMF_FILTER_ALL, 1,
+                      NULL, NULL, NULL, results);
+      if ((results[0] != ref) || (results[1] != ref)) {
+        raiseErr(__LINE__,
+          "Batch results %d and %d differ from path result %d "
+          "with max_file %ld",
+          results[0], results[1], ref, (long) opt.max_file);
+      }
+      count++;
+    }
+  }
+  
+  printf("Limits: %ld max_file values, batch and path agree\n",
+          (long) count);
+}
+
+/*
+ * Read the clock used for timing.
+ * 
+ * On POSIX platforms, this is the monotonic wall clock.  Elsewhere, it
+ * is the processor time from clock().
+ * 
+ * Return:
+ * 
+ *   the current time in seconds from an arbitrary starting point
+ */
+static double wallClock(void) {
+#ifdef SMF_POSIX
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read the monotonic clock");
+  }
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0);
+#else
+  return ((double) clock()) / ((double) CLOCKS_PER_SEC);
+#endif
+}
+
+/*
+ * Report the throughput of one source type.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name of the source type
+ * 
+ *   ents - the number of entities in one parse
+ * 
+ *   iter - the number of timed parses
+ * 
+ *   elapsed - the time in seconds of all timed parses, measured with
+ *   wallClock()
+ * 
+ * Return:
+ * 
+ *   the throughput in thousands of entities per second, or -1.0 if the
+ *   parses were too fast to measure
+ */
+static double report(const char *pName, int32_t ents, int32_t iter,
+                      double elapsed) {
+  
+  double sec = 0.0;
+  double rate = -1.0;
+  
+  if ((pName == NULL) || (ents < 0) || (iter < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  sec = elapsed;
+  
+  if (sec > 0.0) {
+    rate = (((double) ents) * ((double) iter)) / sec / 1000.0;
+    printf("%-7s %9.3f s  %10.3f Mentities/s  %9.2f MB/s\n",
+            pName,
+            sec,
+            rate / 1000.0,
+            (((double) m_len) * ((double) iter)) / sec / 1000000.0);
+  } else {
+    printf("%-7s %9.3f s  (too fast to measure, raise -i)\n",
+            pName, sec);
+  }
+  
+  return rate;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  int i = 0;
+  int c = 0;
+  int keep = 0;
+  int err_num = 0;
+  int32_t iter = 10;
+  int32_t ents = 0;
+  int32_t j = 0;
+  int32_t fuzz = 0;
+  int32_t min_rate = 0;
+  int64_t blob_len = 0;
+  double rate = 0.0;
+  const char *pPath = BENCH_PATH;
+  const char *pCheck = NULL;
+  
+  BENCH_SHAPE shape;
+  BENCH_DIGEST ref;
+  SMFPARSE *ps = NULL;
+  SMFSOURCE *pSrc = NULL;
+  SMFCACHE *pCache = NULL;
+  void *pBlob = NULL;
+  FILE *fh = NULL;
+  double t0 = 0.0;
+  
+  /* Initialize structures */
+  memset(&shape, 0, sizeof(BENCH_SHAPE));
+  memset(&ref, 0, sizeof(BENCH_DIGEST));
+  
+  shape.tracks  = 16;
+  shape.notes   = 10000;
+  shape.density = 60;
+  shape.running = 100;
+  shape.sysex   = 0;
+  shape.every   = 100;
+  shape.seed    = 1;
+  
+  /* Get module name */
+  if ((argc > 0) && (argv != NULL)) {
+    pModule = argv[0];
+  }
+  
+  /* Check parameters */
+  if (argc > 0) {
+    if (argv == NULL) {
+      raiseErr(__LINE__, NULL);
+    }
+    for(i = 0; i < argc; i++) {
+      if (argv[i] == NULL) {
+        raiseErr(__LINE__, NULL);
+      }
+    }
+  }
+  
+  /* Parse program arguments */
+  for(i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      raiseErr(__LINE__, "Missing value for option %s", argv[i]);
+    }
+    
+    if (strcmp(argv[i], "-t") == 0) {
+      shape.tracks = parseCount(argv[i + 1], 0, 65534);
+      
+    } else if (strcmp(argv[i], "-n") == 0) {
+      shape.notes = parseCount(argv[i + 1], 0, INT32_C(100000000));
+      
+    } else if (strcmp(argv[i], "-d") == 0) {
+      shape.density = parseCount(argv[i + 1], 0, INT32_C(1000000));
+      
+    } else if (strcmp(argv[i], "-r") == 0) {
+      shape.running = parseCount(argv[i + 1], 0, 100);
+      
+    } else if (strcmp(argv[i], "-x") == 0) {
+      shape.sysex = parseCount(argv[i + 1], 0, INT32_C(1000000));
+      
+    } else if (strcmp(argv[i], "-e") == 0) {
+      shape.every = parseCount(argv[i + 1], 1, INT32_MAX);
+      
+    } else if (strcmp(argv[i], "-i") == 0) {
+      iter = parseCount(argv[i + 1], 1, INT32_C(1000000));
+      
+    } else if (strcmp(argv[i], "-s") == 0) {
+      shape.seed = parseCount(argv[i + 1], 0, INT32_MAX);
+      
+    } else if (strcmp(argv[i], "-o") == 0) {
+      pPath = argv[i + 1];
+      keep = 1;
+      
+    } else if (strcmp(argv[i], "-f") == 0) {
+      fuzz = parseCount(argv[i + 1], 0, INT32_MAX);
+      
+    } else if (strcmp(argv[i], "-m") == 0) {
+      min_rate = parseCount(argv[i + 1], 0, INT32_MAX);
+      
+    } else if (strcmp(argv[i], "-a") == 0) {
+      pCheck = argv[i + 1];
+      
+    } else {
+      raiseErr(__LINE__, "Unrecognized option %s", argv[i]);
+    }
+  }
+  
+  /* If a file to check is given, only run the differential check on
+   * it */
+  if (pCheck != NULL) {
+    fh = fopen(pCheck, "rb");
+    if (fh == NULL) {
+      raiseErr(__LINE__, "Failed to open %s", pCheck);
+    }
+    for(c = fgetc(fh); c != EOF; c = fgetc(fh)) {
+      putByte(c);
+    }
+    if (ferror(fh)) {
+      raiseErr(__LINE__, "Failed to read %s", pCheck);
+    }
+    fclose(fh);
+    fh = NULL;
+    
+    check(m_buf, m_len, &ref);
+    if (ref.status == SMF_TYPE_EOF) {
+      printf("Check: %ld bytes, %ld entities, all paths agree\n",
+              (long) m_len, (long) ref.count);
+    } else {
+      printf("Check: %ld bytes, %ld entities before error: %s, "
+              "all paths agree\n",
+              (long) m_len, (long) ref.count,
+              smf_errorString(ref.status));
+    }
+    
+    if ((fuzz > 0) && (m_len > 0)) {
+      m_rand = (uint32_t) shape.seed;
+      fuzzAll(fuzz);
+    }
+    
+    free(m_buf);
+    m_buf = NULL;
+    return EXIT_SUCCESS;
+  }
+  
+  /* Check that the writer rejects bad messages */
+  checkWriter();
+  
+  /* Generate the file in memory and check that all the parse paths
+   * agree on it */
+  generate(&shape);
+  
+  check(m_buf, m_len, &ref);
+  if (ref.status != SMF_TYPE_EOF) {
+    raiseErr(__LINE__, "Generated file failed to parse: %s",
+              smf_errorString(ref.status));
+  }
+  
+  /* Write the file out for the file sources */
+  
+  fh = fopen(pPath, "wb");
+  if (fh == NULL) {
+    raiseErr(__LINE__, "Failed to create %s", pPath);
+  }
+  if (fwrite(m_buf, 1, (size_t) m_len, fh) != (size_t) m_len) {
+    raiseErr(__LINE__, "Failed to write %s", pPath);
+  }
+  if (fclose(fh)) {
+    raiseErr(__LINE__, "Failed to write %s", pPath);
+  }
+  fh = NULL;
+  
+  /* Check the file size limit on the batch driver */
+  checkLimits(pPath);
+  
+  /* Allocate a parser and count the entities with an untimed parse,
+   * which also warms up the parser buffers */
+  ps = smfparse_alloc();
+  
+  pSrc = smfsource_new_memory(m_buf, m_len);
+  ents = parseAll(ps, pSrc);
+  
+  printf("File: %ld bytes, %ld tracks, %ld entities, %ld parses\n",
+          (long) m_len,
+          (long) (shape.tracks + 1),
+          (long) ents,
+          (long) iter);
+  
+  /* Check mutated copies of the file */
+  if (fuzz > 0) {
+    fuzzAll(fuzz);
+  }
+  
+  /* Memory source */
+  t0 = wallClock();
+  for(j = 0; j < iter; j++) {
+    if (!smfsource_rewind(pSrc)) {
+      raiseErr(__LINE__, "Failed to rewind memory source");
+    }
+    if (parseAll(ps, pSrc) != ents) {
+      raiseErr(__LINE__, "Entity count changed");
+    }
+  }
+  rate = report("memory", ents, iter, wallClock() - t0);
+  
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  /* File handle source */
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    raiseErr(__LINE__, "Failed to open %s", pPath);
+  }
+  pSrc = smfsource_new_handle(fh, 1, 1, &err_num);
+  if (pSrc == NULL) {
+    raiseErr(__LINE__, "Failed to open input: %s",
+              smf_errorString(err_num));
+  }
+  fh = NULL;
+  
+  t0 = wallClock();
+  for(j = 0; j < iter; j++) {
+    if (!smfsource_rewind(pSrc)) {
+      raiseErr(__LINE__, "Failed to rewind handle source");
+    }
+    if (parseAll(ps, pSrc) != ents) {
+      raiseErr(__LINE__, "Entity count changed");
+    }
+  }
+  report("handle", ents, iter, wallClock() - t0);
+  
+  if (!smfsource_close(pSrc)) {
+    raiseErr(__LINE__, "Failed to close input");
+  }
+  pSrc = NULL;
+  
+  /* File path source, opened anew for each parse */
+  t0 = wallClock();
+  for(j = 0; j < iter; j++) {
+    pSrc = smfsource_new_path(pPath, &err_num);
+    if (pSrc == NULL) {
+      raiseErr(__LINE__, "Failed to open input: %s",
+                smf_errorString(err_num));
+    }
+    if (parseAll(ps, pSrc) != ents) {
+      raiseErr(__LINE__, "Entity count changed");
+    }
+    if (!smfsource_close(pSrc)) {
+      raiseErr(__LINE__, "Failed to close input");
+    }
+    pSrc = NULL;
+  }
+  report("path", ents, iter, wallClock() - t0);
+  
+  /* Memory source with handler dispatch */
+  pSrc = smfsource_new_memory(m_buf, m_len);
+  
+  t0 = wallClock();
+  for(j = 0; j < iter; j++) {
+    if (!smfsource_rewind(pSrc)) {
+      raiseErr(__LINE__, "Failed to rewind memory source");
+    }
+    if (runAll(ps, pSrc) != ents) {
+      raiseErr(__LINE__, "Entity count changed");
+    }
+  }
+  report("run", ents, iter, wallClock() - t0);
+  
+  /* Memory source re-encoded with a writer */
+  t0 = wallClock();
+  for(j = 0; j < iter; j++) {
+    if (!smfsource_rewind(pSrc)) {
+      raiseErr(__LINE__, "Failed to rewind memory source");
+    }
+    if (writeAll(ps, pSrc) != ents) {
+      raiseErr(__LINE__, "Entity count changed");
+    }
+  }
+  report("write", ents, iter, wallClock() - t0);
+  
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  /* Binary cache in memory, built once */
+  pSrc = smfsource_new_memory(m_buf, m_len);
+  if (!smfcache_build(pSrc, NULL, &pBlob, &blob_len, &err_num)) {
+    raiseErr(__LINE__, "Failed to build cache: %s",
+              smf_errorString(err_num));
+  }
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  
+  pCache = smfcache_open(pBlob, blob_len, &err_num);
+  if (pCache == NULL) {
+    raiseErr(__LINE__, "Failed to open cache: %s",
+              smf_errorString(err_num));
+  }
+  
+  t0 = wallClock();
+  for(j = 0; j < iter; j++) {
+    if (cacheAll(pCache) != ents) {
+      raiseErr(__LINE__, "Entity count changed");
+    }
+  }
+  report("cache", ents, iter, wallClock() - t0);
+  
+  smfcache_close(pCache);
+  pCache = NULL;
+  free(pBlob);
+  pBlob = NULL;
+  
+  /* Release everything */
+  smfparse_free(ps);
+  ps = NULL;
+  
+  free(m_buf);
+  m_buf = NULL;
+  
+  if (!keep) {
+    if (remove(pPath)) {
+      raiseErr(__LINE__, "Failed to remove %s", pPath);
+    }
+  }
+  
+  /* Fail if the memory source did not reach the minimum throughput */
+  if ((min_rate > 0) && (rate >= 0.0) && (rate < (double) min_rate)) {
+    raiseErr(__LINE__,
+              "Memory source throughput %.0f kentities/s is below "
+              "the minimum of %ld",
+              rate, (long) min_rate);
+  }
+  
+  /* If we got here, return successfully */
+  return EXIT_SUCCESS;
+}
@@ -162,6 +162,7 @@ int main(int argc, char *argv[]) {
   SMFSOURCE *pSrc = NULL;
   SMFPARSE *ps = NULL;
   SMF_ENTITY ent;
+  SMF_ERRINFO einf;
   int err_num = 0;
   
   int32_t offs = 0;
@@ -169,6 +170,7 @@ int main(int argc, char *argv[]) {
   
   /* Initialize structures */
   memset(&ent, 0, sizeof(SMF_ENTITY));
+  memset(&einf, 0, sizeof(SMF_ERRINFO));
   
   /* Get module name */
   if ((argc > 0) && (argv != NULL)) {
@@ -403,7 +405,10 @@ int main(int argc, char *argv[]) {
   if (ent.status == SMF_TYPE_EOF) {
     printf("EOF\n");
   } else {
-    raiseErr(__LINE__, "MIDI parsing error: %s",
+    smfparse_error(ps, &einf);
+    raiseErr(__LINE__,
+              "MIDI parsing error at offset %ld (track %ld, status %d): %s",
+              (long) einf.offset, (long) einf.track, einf.status_byte,
               smf_errorString(ent.status));
   }
   
@@ -7,12 +7,38 @@
  * See the header for further information.
  */
 
+/*
+ * Request the POSIX declarations on platforms that have them, so that
+ * the memory-mapped input source and 64-bit file offsets can be used
+ * even in strict ISO C compilation modes.  This must come before any
+ * system header.
+ */
+#if !defined(SMF_NO_POSIX) && \
+    (defined(__unix__) || defined(__unix) || \
+      (defined(__APPLE__) && defined(__MACH__)))
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+#endif
+
 #include "smfparse.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef SMF_POSIX
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /*
  * Constants
  * =========
@@ -35,20 +61,98 @@
 #define SOURCE_STATE_EOF    (3)
 
 /*
- * The maximum length of files that can be read with the built-in
- * HANDLE_SOURCE reader.
- * 
- * This is 1 GiB.
+ * The size in bytes of the refill buffer that source objects with a
+ * block read callback use.
+ */
+#define SOURCE_BLOCK INT32_C(4096)
+
+/*
+ * The size in bytes of the scratch buffer that the skip callback of
+ * handle sources reads into when the handle does not support random
+ * access.
  */
-#define HANDLE_FILE_MAXLEN INT32_C(1073741824)
+#define HANDLE_SKIP INT32_C(16384)
 
 /*
- * The initial and maximum capacities of the data buffer used for
- * storing system exclusive message payloads, text data payloads, and
- * custom meta-event data.
+ * The initial capacity of the data buffer used for storing system
+ * exclusive message payloads, text data payloads, and custom meta-event
+ * data, if the buffer was not allocated when the parser was
+ * constructed.
+ * 
+ * The maximum capacity is set by the parser options.
  */
 #define BCAP_INIT INT32_C(256)
-#define BCAP_MAX  INT32_C(32768)
+
+/*
+ * The initial capacity of dynamically grown arrays, such as the columns
+ * of SMF_TRACK structures and the chunk index of parser objects.
+ */
+#define ARRAY_INIT INT32_C(256)
+
+/*
+ * The default beat duration in microseconds that applies before the
+ * first Set Tempo meta-event, which is 120 beats per minute.
+ */
+#define DEFAULT_BEAT_DUR INT32_C(500000)
+
+/*
+ * The number of bytes that must be available both in the input window
+ * and in the current chunk for fastEvent() to decode an event.
+ * 
+ * This is the length of the longest channel message, which is a delta
+ * time of the maximum four bytes, a status byte, and two data bytes.
+ */
+#define FAST_EVENT INT32_C(7)
+
+/*
+ * The magic value at the start of a binary cache, which is "SMFC" read
+ * as a big-endian integer, and the number of 32-bit words in the cache
+ * header.
+ * 
+ * Since the magic value is stored in the byte order of the machine that
+ * built the cache, it also serves as a byte order mark.
+ */
+#define CACHE_MAGIC UINT32_C(0x534d4643)
+#define CACHE_HEAD  INT32_C(16)
+
+/*
+ * The size in bytes at which a writer around a file handle writes out
+ * its buffered output.
+ * 
+ * This is also the size of the blocks in which smfwrite_copy() copies
+ * chunk data.
+ */
+#define WRITE_BLOCK INT32_C(65536)
+
+/*
+ * Writer stages.
+ * 
+ * HEAD is before the header has been written.  CHUNK is between chunks,
+ * after the header.  TRACK is within a track chunk.  DONE is after
+ * smfwrite_finish() has succeeded.
+ */
+#define WRITE_STAGE_HEAD  (0)
+#define WRITE_STAGE_CHUNK (1)
+#define WRITE_STAGE_TRACK (2)
+#define WRITE_STAGE_DONE  (3)
+
+/*
+ * Instrumentation counter macros.
+ * 
+ * STAT_ADD() adds n to a field of the SMF_STATS structure of a parser
+ * object.  SOURCE_STAT() increments a field of the SMF_STATS structure
+ * that is attached to a source object while a parser is decoding from
+ * it, if there is one.  Both compile to nothing unless SMF_ENABLE_STATS
+ * is defined.
+ */
+#ifdef SMF_ENABLE_STATS
+#define STAT_ADD(ps, field, n) (((ps)->stats).field += (int64_t) (n))
+#define SOURCE_STAT(pSrc, field) \
+  (((pSrc)->pStats != NULL) ? (void) (((pSrc)->pStats)->field++) : (void) 0)
+#else
+#define STAT_ADD(ps, field, n) ((void) 0)
+#define SOURCE_STAT(pSrc, field) ((void) 0)
+#endif
 
 /*
  * Type declarations
@@ -75,13 +179,32 @@ struct SMFSOURCE_TAG {
    */
   void *pInstance;
   
+  /*
+   * Non-zero if this is a memory-resident source.
+   * 
+   * Memory-resident sources have their whole input available in memory
+   * in the input window (see below).  They have neither of the read
+   * callbacks nor the rewind and skip callbacks, because reading,
+   * rewinding, and skipping are all done directly on the window.
+   */
+  int is_mem;
+  
   /*
    * Read function pointer.
    * 
-   * Required, never NULL.
+   * For sources that are not memory-resident, this is NULL if and only
+   * if fReadBlock is defined.  Always NULL for memory-resident sources.
    */
   smfsource_fp_read fRead;
   
+  /*
+   * Block read function pointer.
+   * 
+   * For sources that are not memory-resident, this is NULL if and only
+   * if fRead is defined.  Always NULL for memory-resident sources.
+   */
+  smfsource_fp_readBlock fReadBlock;
+  
   /*
    * Rewind function pointer.
    * 
@@ -102,6 +225,48 @@ struct SMFSOURCE_TAG {
    * Optional, NULL if no special skip function supported.
    */
   smfsource_fp_skip fSkip;
+  
+  /*
+   * Input window state.
+   * 
+   * pWin points to the bytes that can currently be read directly from
+   * memory.  For sources with a block read callback, this is the refill
+   * buffer pBlock.  For memory-resident sources, this is the whole input
+   * and it may only be NULL if the input is empty.  For sources with a
+   * byte read callback, it is NULL.
+   * 
+   * pBlock is the dynamically allocated refill buffer of SOURCE_BLOCK
+   * bytes if fReadBlock is defined, or else NULL.
+   * 
+   * blen is the number of valid bytes currently in the window and bpos
+   * is the offset of the next byte to read from the window, such that
+   * bpos is in range zero to blen, inclusive.  Both are always zero if
+   * there is no window.
+   * 
+   * Unread bytes in the window are only ever present in normal state,
+   * so a bpos that is less than blen means the next byte can be taken
+   * directly from the window.
+   */
+  const uint8_t * pWin;
+  uint8_t       * pBlock;
+  int64_t         blen;
+  int64_t         bpos;
+  
+  /*
+   * The allocator that the source object and its refill buffer were
+   * allocated with.
+   * 
+   * All fields are NULL if the C heap was used.
+   */
+  SMF_ALLOCATOR alloc;
+
+#ifdef SMF_ENABLE_STATS
+  /*
+   * The counters of the parser object that is currently decoding from
+   * this source, or NULL if there is none.
+   */
+  SMF_STATS *pStats;
+#endif
 };
 
 /*
@@ -118,18 +283,16 @@ typedef struct {
    * The byte offset of the next byte that will be read from the input
    * file.
    * 
-   * If flen is not -1, this must not exceed flen.  Otherwise, this must
-   * not exceed HANDLE_FILE_MAXLEN.
+   * If flen is not -1, this must not exceed flen.
    */
-  int32_t fptr;
+  int64_t fptr;
   
   /*
    * The cached total length of the file.
    * 
-   * Only available if can_seek is non-zero.  Else, set to -1.  May not
-   * exceed HANDLE_FILE_MAXLEN.
+   * Only available if can_seek is non-zero.  Else, set to -1.
    */
-  int32_t flen;
+  int64_t flen;
   
   /*
    * Non-zero if the source object owns the handle and should close it
@@ -142,8 +305,269 @@ typedef struct {
    */
   int can_seek;
   
+  /*
+   * The allocator that this instance data was allocated with.
+   */
+  SMF_ALLOCATOR alloc;
+  
 } HANDLE_SOURCE;
 
+#ifdef SMF_POSIX
+
+/*
+ * Instance data for built-in source type that reads a file on a
+ * background thread.
+ * 
+ * The ring holds depth slots of SMF_PREFETCH_BLOCK bytes each.  The
+ * count slots starting at slot head, wrapping around, are filled with
+ * the input that follows the reading position, in order.
+ * 
+ * Everything after the lock may only be accessed while holding it.  The
+ * only exception is that the reader thread fills the slot just after
+ * the filled slots without holding the lock, which is safe because no
+ * one else touches that slot until it is counted as filled.
+ */
+typedef struct {
+  
+  /*
+   * The file descriptor and the length of the file in bytes.
+   */
+  int     fd;
+  int64_t flen;
+  
+  /*
+   * The ring buffer of read-ahead blocks.
+   * 
+   * pRing has depth slots of SMF_PREFETCH_BLOCK bytes each.  pFill
+   * gives for each slot the number of bytes it holds, or
+   * SMFSOURCE_IOERR if the read for that slot failed.
+   */
+  int32_t   depth;
+  uint8_t * pRing;
+  int32_t * pFill;
+  
+  /*
+   * The reader thread, and the lock and conditions that the reader
+   * thread and the source use to coordinate.
+   * 
+   * cv_data is signaled when a slot is filled and cv_space when a slot
+   * is emptied, the ring is dropped, or the reader should stop.
+   */
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cv_data;
+  pthread_cond_t  cv_space;
+  
+  /*
+   * The filled slots of the ring.
+   * 
+   * head is the first filled slot and count is the number of them.
+   * spos is the number of bytes of the head slot that have already been
+   * consumed.
+   */
+  int32_t head;
+  int32_t count;
+  int32_t spos;
+  
+  /*
+   * The reading position, which is the file offset of the next byte
+   * the source delivers, and the file offset where the reader thread
+   * reads next.
+   */
+  int64_t coff;
+  int64_t roff;
+  
+  /*
+   * Incremented every time the ring is dropped, so that the reader
+   * thread can tell if the ring was dropped while it was reading.
+   */
+  int32_t gen;
+  
+  /*
+   * Non-zero if the reader thread has reached the end of the file or an
+   * error, and it should stop.
+   */
+  int done;
+  int stop;
+  
+} PREFETCH_SOURCE;
+
+#endif
+
+/*
+ * Instance data for built-in source type that wraps a memory-mapped
+ * file.
+ */
+typedef struct {
+  
+  /*
+   * The base address of the mapping, or NULL if the file was empty and
+   * nothing was mapped.
+   */
+  void *pMap;
+  
+  /*
+   * The length of the mapping in bytes.
+   */
+  size_t mlen;
+  
+} MMAP_SOURCE;
+
+/*
+ * Shared state of a parallel decoding job run by smfparse_parallel().
+ * 
+ * Everything except next and err is read-only while the worker threads
+ * are running.  next and err may only be accessed while holding lock,
+ * if the job is running on multiple threads.
+ */
+typedef struct {
+  
+  /*
+   * The MIDI file in memory.
+   */
+  const uint8_t * pData;
+  int64_t         len;
+  
+  /*
+   * The parser options for the parser object of each worker.
+   */
+  SMF_OPTIONS opt;
+  
+  /*
+   * The parsed header.
+   */
+  SMF_HEADER head;
+  
+  /*
+   * The dynamically allocated array of track chunks, which has one
+   * element for each declared track.
+   */
+  SMF_CHUNK *pTracks;
+  
+  /*
+   * The callback that receives the decoded tracks and its custom
+   * parameter.
+   */
+  smfparse_fp_track   fTrack;
+  void              * pCustom;
+  
+  /*
+   * The number of the next track that a worker should decode.
+   */
+  int32_t next;
+  
+  /*
+   * The error code of the lowest-numbered track that failed and the
+   * number of that track, or zero and -1 if no track has failed yet.
+   */
+  int     err;
+  int32_t err_trk;
+  
+  /*
+   * Non-zero if the job is running on multiple threads, which means the
+   * lock must be used.
+   */
+  int threaded;
+
+#ifdef SMF_POSIX
+  pthread_mutex_t lock;
+#endif
+
+} PARALLEL_JOB;
+
+/*
+ * Shared state of a batch parsing job run by smfparse_batch().
+ * 
+ * Everything except next and failed is read-only while the worker
+ * threads are running.  next and failed may only be accessed while
+ * holding lock, if the job is running on multiple threads.  Each
+ * element of pResults is only written by the worker that parses the
+ * corresponding file.
+ */
+typedef struct {
+  
+  /*
+   * The files to parse.
+   */
+  const SMF_BATCH_FILE * pFiles;
+  int32_t                count;
+  
+  /*
+   * The parser options and the event filter for the parser object of
+   * each worker.
+   */
+  SMF_OPTIONS opt;
+  uint32_t    mask;
+  
+  /*
+   * The callbacks, either of which may be NULL, and their custom
+   * parameter.
+   */
+  smfparse_fp_entity   fEntity;
+  smfparse_fp_file     fFile;
+  void               * pCustom;
+  
+  /*
+   * The array that receives the result of each file, or NULL.
+   */
+  int *pResults;
+  
+  /*
+   * The index of the next file that a worker should parse.
+   */
+  int32_t next;
+  
+  /*
+   * The number of files that have failed so far.
+   */
+  int32_t failed;
+  
+  /*
+   * Non-zero if the job is running on multiple threads, which means the
+   * lock must be used.
+   */
+  int threaded;
+
+#ifdef SMF_POSIX
+  pthread_mutex_t lock;
+#endif
+
+} BATCH_JOB;
+
+/*
+ * A checkpoint of the parsing state within a track, recorded by
+ * smfparse_index() for smfparse_seek_tick().
+ */
+typedef struct {
+  
+  /*
+   * The zero-based number of the track.
+   */
+  int32_t trk;
+  
+  /*
+   * The file offset of the next event of the track.
+   */
+  int64_t pos;
+  
+  /*
+   * The absolute tick offset of the last event before the checkpoint,
+   * or zero at the start of the track.
+   */
+  int64_t tick;
+  
+  /*
+   * The number of bytes remaining in the track chunk at pos.
+   */
+  int32_t ckrem;
+  
+  /*
+   * The running status byte at pos, or -1 if none.
+   */
+  int run;
+  
+} CHECKPOINT;
+
 /*
  * SMFPARSE structure declaration.
  * 
@@ -171,6 +595,19 @@ struct SMFPARSE_TAG {
    */
   int32_t trkcount;
   
+  /*
+   * The file offset just past the end of the last chunk whose header has
+   * been read, or zero if no chunk header has been read yet.
+   * 
+   * This never exceeds the max_file limit in the options.
+   */
+  int64_t foff;
+  
+  /*
+   * The parser options given to the constructor.
+   */
+  SMF_OPTIONS opt;
+  
   /*
    * The header information, if status is greater than zero.
    * 
@@ -191,11 +628,14 @@ struct SMFPARSE_TAG {
    * Data buffer state.
    * 
    * blen is the actual number of bytes currently in the buffer.  It
-   * must be in range zero to bcap, inclusive.
+   * must be in range zero to bcap, inclusive.  The buffer is emptied at
+   * the start of each read call.  For a batch read, it holds the
+   * payloads of all the entities in the batch, one after the other.
    * 
    * bcap is the total size of the buffer in bytes.  The initial
-   * capacity is BCAP_INIT and the maximum capacity is BCAP_MAX.
-   * Capacity grows by doubling, maxing out at BCAP_MAX.
+   * capacity is the init_payload option, or BCAP_INIT if the buffer was
+   * not allocated when the parser was constructed.  Capacity grows by
+   * doubling, maxing out at the max_payload option.
    * 
    * bptr is a pointer to the dynamically-allocated buffer block.  If
    * bcap is zero, this will be NULL.  Otherwise, it will be non-NULL
@@ -205,6 +645,21 @@ struct SMFPARSE_TAG {
   int32_t   bcap;
   uint8_t * bptr;
   
+  /*
+   * The data payload of the event currently being read.
+   * 
+   * plen is the length of the payload in bytes, which is zero or
+   * greater.  pPay points to the payload bytes, or it is NULL if plen is
+   * zero.
+   * 
+   * The payload bytes are usually in the data buffer.  However, when
+   * reading from a memory-resident source, pPay may instead point
+   * directly into the memory of the source, in which case the payload
+   * is not copied at all.
+   */
+  const uint8_t * pPay;
+  int32_t         plen;
+  
   /*
    * Running status state.
    * 
@@ -212,642 +667,819 @@ struct SMFPARSE_TAG {
    * if there is no buffered running status byte.
    */
   int run;
-};
-
-/*
- * Static data
- * ===========
- */
+  
+  /*
+   * The chunk index built by smfparse_index().
+   * 
+   * has_index is non-zero if there is an index, in which case ihead is
+   * the header that was parsed while indexing.
+   * 
+   * pIdx is the dynamically allocated array of icount indexed chunks,
+   * which has room for icap chunks.  It is NULL if icap is zero.
+   */
+  int         has_index;
+  SMF_HEADER  ihead;
+  SMF_CHUNK * pIdx;
+  int32_t     icount;
+  int32_t     icap;
+  
+  /*
+   * The checkpoints recorded by smfparse_index().
+   * 
+   * pCkpt is the dynamically allocated array of ccount checkpoints,
+   * which has room for ccap checkpoints.  It is NULL if ccap is zero.
+   * Checkpoints are in order of track, and then in file order within
+   * each track.  They are only valid while has_index is set.
+   */
+  CHECKPOINT * pCkpt;
+  int32_t      ccount;
+  int32_t      ccap;
+  
+  /*
+   * The absolute tick offset of the last event that was read within the
+   * current track, or zero at the start of a track.
+   */
+  int64_t tick;
+  
+  /*
+   * The number of defects recovered from in lenient validation mode
+   * since the parser was last reset.
+   */
+  int64_t repairs;
+  
+  /*
+   * The attached tempo map, or NULL if there is none.
+   * 
+   * The tempo map is not owned by the parser.
+   */
+  SMFTEMPO *pTempo;
+  
+  /*
+   * The event filter mask set with smfparse_set_filter().
+   */
+  uint32_t filter;
+  
+  /*
+   * The input queue of smfparse_feed().
+   * 
+   * pQueue is the dynamically allocated queue buffer with room for qcap
+   * bytes, holding qlen bytes of input that has been fed.  The first
+   * qpos of them have already been parsed.  pQueue is NULL if qcap is
+   * zero.
+   * 
+   * pFeed is the memory-resident source that is pointed at the unparsed
+   * part of the queue for each parsing attempt, or NULL if the parser
+   * has not been fed yet.
+   * 
+   * fin is non-zero once the end of the input has been signaled.
+   * 
+   * wait is the queue length required before the next parsing attempt,
+   * which is used to avoid parsing a partial entity again before any of
+   * its missing bytes have arrived.
+   */
+  uint8_t   * pQueue;
+  int32_t     qcap;
+  int32_t     qlen;
+  int32_t     qpos;
+  SMFSOURCE * pFeed;
+  int         fin;
+  int64_t     wait;
+  
+  /*
+   * If a payload could not be read or skipped because a memory-resident
+   * input source ended first, this is the source position just past the
+   * end of that payload; otherwise, zero.
+   * 
+   * smfparse_feed() uses this to know how much more input to wait for.
+   */
+  int64_t need;
+  
+  /*
+   * Error reporting state.
+   * 
+   * err describes the error that the parser went into its error state
+   * with, and it is only valid while status is less than zero.
+   * 
+   * fError is the error callback registered with smfparse_set_error(),
+   * or NULL if there is none, and pError is the custom data pointer
+   * that is passed through to it.
+   * 
+   * ebyte is the status byte of the event that failed to be read, or -1
+   * if the last failure did not happen within an event.
+   * 
+   * hold is non-zero while smfparse_feed() is making an attempt that it
+   * might roll back, in which case the error callback is held back
+   * until the attempt is known to be final.
+   */
+  SMF_ERRINFO         err;
+  smfparse_fp_error   fError;
+  void              * pError;
+  int                 ebyte;
+  int                 hold;
 
-/*
- * The fault handler, or NULL if nothing is registered.
- */
-static smf_fp_fault m_fault = NULL;
+#ifdef SMF_ENABLE_STATS
+  /*
+   * The instrumentation counters.
+   * 
+   * fClock is the registered clock or NULL, and pClock is the custom
+   * data pointer that is passed through to it.
+   */
+  SMF_STATS      stats;
+  smf_fp_clock   fClock;
+  void         * pClock;
+#endif
+};
 
 /*
- * Local functions
- * ===============
+ * A tempo change within a tempo map.
  */
-
-/* Prototypes */
-static void fault(long lnum);
-
-static int pushBuffer(SMFPARSE *ps, int c);
-
-static int32_t readUint16BE(SMFSOURCE *pSrc, int *pErr);
-static int readUint32BE(uint32_t *pv, SMFSOURCE *pSrc, int *pErr);
-static int readChunkByte(SMFSOURCE *pSrc, int32_t *pRem, int *pErr);
-static int32_t readChunkVar(SMFSOURCE *pSrc, int32_t *pRem, int *pErr);
-
-static int readChunkHead(
-    uint32_t  * pType,
-    int32_t   * pLen,
-    SMFSOURCE * pSrc,
-    int       * pErr);
-static int readHeaderChunk(SMF_HEADER *ph, SMFSOURCE *pSrc, int *pErr);
-static int parseEvent(
-    SMFPARSE   * ps,
-    SMF_ENTITY * pEnt,
-    int          ev,
-    int          a,
-    int          b,
-    int32_t      delta,
-    int        * pErr);
-static int readEvent(
-    SMFPARSE   * ps,
-    SMF_ENTITY * pEnt,
-    SMFSOURCE  * pSrc,
-    int        * pErr);
-
-static int handle_source_read(void *pInstance);
-static int handle_source_rewind(void *pInstance);
-static int handle_source_close(void *pInstance);
-static int handle_source_skip(void *pInstance, int32_t skip);
+typedef struct {
+  
+  /*
+   * The absolute tick offset where the tempo change takes effect.
+   */
+  int64_t tick;
+  
+  /*
+   * The time of the tempo change from the start of the track.
+   * 
+   * This is us microseconds plus rem subdivisions of a microsecond,
+   * where there are subdiv subdivisions in a microsecond (see
+   * SMF_TIMESYS).  Keeping the remainder means that times are exact
+   * regardless of the number of tempo changes.
+   */
+  int64_t us;
+  int32_t rem;
+  
+  /*
+   * The beat duration in microseconds from this tempo change onwards.
+   */
+  int32_t beat_dur;
+  
+} TEMPO_POINT;
 
 /*
- * Raise a fault.
- * 
- * This function does not return.
- * 
- * Parameters:
+ * SMFTEMPO structure.
  * 
- *   lnum - the line number (__LINE__)
+ * Prototype given in header.
  */
-static void fault(long lnum) {
-  if (m_fault != NULL) {
-    m_fault(lnum);
-  } else {
-    fprintf(stderr, "Fault within libsmfparse at line %ld\n", lnum);
-  }
-  exit(EXIT_FAILURE);
-}
+struct SMFTEMPO_TAG {
+  
+  /*
+   * The time system of the MIDI file.
+   * 
+   * subdiv is zero if the time system has not been set yet.
+   */
+  SMF_TIMESYS ts;
+  
+  /*
+   * The dynamically allocated array of count tempo changes, sorted by
+   * tick, which has room for cap tempo changes.
+   * 
+   * There is always at least one tempo change, and the first one is
+   * always at tick zero.  If no tempo change was added at tick zero,
+   * the first one has the default beat duration.
+   */
+  TEMPO_POINT * pPt;
+  int32_t       count;
+  int32_t       cap;
+  
+  /*
+   * The index of the tempo change used by the last lookup.
+   */
+  int32_t cur;
+};
 
 /*
- * Push a data byte into the data buffer of the given parser object.
- * 
- * The buffer will be expanded if necessary.  The function fails if the
- * buffer is full and has reached the maximum allowed capacity.
- * 
- * Parameters:
- * 
- *   ps - the parser object
- * 
- *   c - the unsigned byte value to append to the buffer, range 0-255
- * 
- * Return:
- * 
- *   non-zero if successful, zero if no more room nor capacity
+ * The state of a single track within a merger.
  */
-static int pushBuffer(SMFPARSE *ps, int c) {
-  
-  int status = 1;
-  int32_t new_cap = 0;
+typedef struct {
   
-  /* Check parameters */
-  if ((ps == NULL) || (c < 0) || (c > 255)) {
-    fault(__LINE__);
-  }
+  /*
+   * The parser object that is positioned within the track.
+   */
+  SMFPARSE *ps;
   
-  /* If data buffer not allocated, allocate it with initial capacity */
-  if (ps->bcap < 1) {
-    ps->bptr = (uint8_t *) calloc((size_t) BCAP_INIT, 1);
-    if (ps->bptr == NULL) {
-      fault(__LINE__);
-    }
-    ps->bcap = BCAP_INIT;
-    ps->blen = 0;
-  }
+  /*
+   * The memory source over the track data if the input source of the
+   * merger is memory-resident, or NULL if the track is read from the
+   * shared input source.
+   */
+  SMFSOURCE *pSub;
   
-  /* Expand capacity if necessary */
-  if (ps->blen >= ps->bcap) {
-    /* Check that we have not reached maximum capacity */
-    if (ps->bcap >= BCAP_MAX) {
-      status = 0;
-    }
-    
-    /* Proceed if we can expand capacity */
-    if (status) {
-      /* New capacity is minimum of double current capacity and the
-       * maximum allowed capacity */
-      new_cap = ps->bcap * 2;
-      if (new_cap > BCAP_MAX) {
-        new_cap = BCAP_MAX;
-      }
-      
-      /* Expand buffer */
-      ps->bptr = (uint8_t *) realloc(ps->bptr, (size_t) new_cap);
-      memset(
-        &((ps->bptr)[ps->bcap]),
-        0,
-        (size_t) (new_cap - ps->bcap));
-      ps->bcap = new_cap;
-    }
-  }
+  /*
+   * The track chunk.
+   */
+  SMF_CHUNK ck;
   
-  /* Add byte to buffer */
-  if (status) {
-    (ps->bptr)[ps->blen] = (uint8_t) c;
-    (ps->blen)++;
-  }
+  /*
+   * The next event of the track that has been read but not returned
+   * yet, and its absolute tick offset.
+   */
+  SMF_ENTITY ent;
+  int64_t    tick;
   
-  /* Return status */
-  return status;
-}
+} MERGE_CURSOR;
 
 /*
- * Read an unsigned 16-bit integer in big endian order from the input
- * source.
- * 
- * Parameters:
- * 
- *   pSrc - the input source to read from
- * 
- *   pErr - receives an error code if failure
- * 
- * Return:
+ * SMFMERGE structure.
  * 
- *   the unsigned 16-bit value, or -1 if failure
+ * Prototype given in header.
  */
-static int32_t readUint16BE(SMFSOURCE *pSrc, int *pErr) {
+struct SMFMERGE_TAG {
   
-  int c = 0;
-  int i = 0;
-  int32_t result = 0;
+  /*
+   * The merger status.
+   * 
+   * Zero is the normal state, one means that all tracks have ended, and
+   * a negative value is an error state with that error code.
+   */
+  int status;
   
-  /* Check parameters */
-  if ((pSrc == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
+  /*
+   * The input source, which is not owned by the merger.
+   */
+  SMFSOURCE *pSrc;
   
-  /* Read the two bytes and add to result */
-  for(i = 0; i < 2; i++) {
-    c = smfsource_read(pSrc);
-    
-    if (c == SMFSOURCE_IOERR) {
-      *pErr = SMF_ERR_IO;
-      result = -1;
-      break;
-      
-    } else if (c == SMFSOURCE_EOF) {
-      *pErr = SMF_ERR_EOF;
-      result = -1;
-      break;
-    }
-    
-    result <<= 8;
-    result |= ((int32_t) c);
-  }
+  /*
+   * The index of the cursor that the input source is currently
+   * positioned for, or -1 if none.
+   * 
+   * This is only used when the tracks are read from the shared input
+   * source.
+   */
+  int32_t owner;
   
-  /* Return result or -1 */
-  return result;
-}
+  /*
+   * The dynamically allocated array of ntrk track cursors.
+   */
+  MERGE_CURSOR * pCur;
+  int32_t        ntrk;
+  
+  /*
+   * The binary min-heap of hcount cursor indices, ordered by the tick
+   * offset of the next event and then by track number.
+   * 
+   * The heap only contains cursors that have an event waiting.  The
+   * array has room for ntrk indices.
+   */
+  int32_t * pHeap;
+  int32_t   hcount;
+  
+  /*
+   * The index of the cursor whose event was returned last and that must
+   * be advanced before the next event is returned, or -1 if none.
+   * 
+   * Advancing is deferred so that the pointers in the returned entity
+   * remain valid until the next read.
+   */
+  int32_t last;
+  
+  /*
+   * The absolute tick offset of the event that was returned last.
+   */
+  int64_t tick;
+};
 
 /*
- * Read an unsigned 32-bit integer in big-endian order from the input
- * source.
- * 
- * Parameters:
- * 
- *   pv - the variable to receive the result
- * 
- *   pSrc - the input source to read from
- * 
- *   pErr - receives an error code if failure
- * 
- * Return:
- * 
- *   non-zero if successful, zero if error
+ * The state of a single channel and key within a note pairing engine.
  */
-static int readUint32BE(uint32_t *pv, SMFSOURCE *pSrc, int *pErr) {
-  
-  int status = 1;
-  int c = 0;
-  int i = 0;
+typedef struct {
   
-  /* Check parameters */
-  if ((pv == NULL) || (pSrc == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
+  /*
+   * The tick offset within the track of the Note-On that started the
+   * sounding note.
+   */
+  int64_t start;
   
-  /* Clear result */
-  *pv = 0;
+  /*
+   * The velocity of the Note-On that started the sounding note.
+   */
+  int vel;
   
-  /* Read the four bytes and add to result */
-  for(i = 0; i < 4; i++) {
-    c = smfsource_read(pSrc);
-    
-    if (c == SMFSOURCE_IOERR) {
-      *pErr = SMF_ERR_IO;
-      status = 0;
-      break;
-      
-    } else if (c == SMFSOURCE_EOF) {
-      *pErr = SMF_ERR_EOF;
-      status = 0;
-      break;
-    }
-    
-    *pv <<= 8;
-    *pv |= ((uint32_t) c);
-  }
+  /*
+   * The number of Note-Ons that the sounding note is waiting to be
+   * released for, or zero if no note is sounding.
+   * 
+   * This is only greater than one for the NEST policy.
+   */
+  int32_t depth;
   
-  /* Return status */
-  return status;
-}
+} NOTE_SLOT;
 
 /*
- * Read a byte from within a chunk.
- * 
- * pRem points to a variable that tracks the number of remaining bytes
- * in the chunk.  If less than one, the function fails.  If this
- * function is successful, the remainder count will be decremented.
- * 
- * Parameters:
- * 
- *   pSrc - the input source to read from
- * 
- *   pRem - the remaining bytes counter
+ * SMFNOTES structure.
  * 
- *   pErr - receives an error code in case of failure
- * 
- * Return:
- * 
- *   the unsigned byte value that was read, in range 0 to 255 inclusive,
- *   or -1 if failure
+ * Prototype given in header.
  */
-static int readChunkByte(SMFSOURCE *pSrc, int32_t *pRem, int *pErr) {
+struct SMFNOTES_TAG {
   
-  int c = 0;
-  
-  /* Check parameters */
-  if ((pSrc == NULL) || (pRem == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
+  /*
+   * The overlapping note policy, one of the SMF_NOTES constants.
+   */
+  int policy;
   
-  /* If no remaining bytes, fail */
-  if (*pRem < 1) {
-    c = -1;
-    *pErr = SMF_ERR_OPEN_TRACK;
-  }
+  /*
+   * The index of the current track, or -1 before the first track.
+   */
+  int32_t trk;
   
-  /* Read from the track */
-  if (c >= 0) {
-    c = smfsource_read(pSrc);
-    
-    if (c == SMFSOURCE_EOF) {
-      c = -1;
-      *pErr = SMF_ERR_EOF;
-      
-    } else if (c == SMFSOURCE_IOERR) {
-      c = -1;
-      *pErr = SMF_ERR_IO;
-    }
-  }
+  /*
+   * The current tick offset within the track.
+   */
+  int64_t tick;
   
-  /* Decrement byte counter */
-  if (c >= 0) {
-    (*pRem)--;
-  }
+  /*
+   * The number of slots that currently have a sounding note.
+   */
+  int32_t sounding;
   
-  /* Return byte read or -1 */
-  return c;
-}
+  /*
+   * The sounding note table, indexed by channel and then key.
+   */
+  NOTE_SLOT slot[16][128];
+  
+  /*
+   * The dynamically allocated queue of completed note spans.
+   * 
+   * qcap is the capacity, qlen is the number of spans stored, and qpos
+   * is the index of the next span to return.  The queue is emptied
+   * whenever the last span is returned.
+   */
+  SMF_NOTE * pQ;
+  int32_t    qcap;
+  int32_t    qlen;
+  int32_t    qpos;
+};
 
 /*
- * Read a variable-length integer from within a chunk.
- * 
- * pRem points to a variable that tracks the number of remaining bytes
- * in the chunk.  If less than one, the function fails.  If this
- * function is successful, the remainder count will be decremented by
- * the number of bytes read in the variable-length integer.
- * 
- * Parameters:
- * 
- *   pSrc - the input source to read
- * 
- *   pRem - the remaining bytes counter
- * 
- *   pErr - receives an error code in case of failure
- * 
- * Return:
- * 
- *   the variable-length integer quantity, which is always zero or
- *   greater, or -1 if failure
+ * The SMF_FILTER() mask of the entity types that affect the chase
+ * state.
  */
-static int32_t readChunkVar(SMFSOURCE *pSrc, int32_t *pRem, int *pErr) {
+#define CHASE_FILTER ( \
+    SMF_FILTER(SMF_TYPE_CONTROL) | \
+    SMF_FILTER(SMF_TYPE_PROGRAM) | \
+    SMF_FILTER(SMF_TYPE_CH_AFTERTOUCH) | \
+    SMF_FILTER(SMF_TYPE_PITCH_BEND) | \
+    SMF_FILTER(SMF_TYPE_TEMPO) | \
+    SMF_FILTER(SMF_TYPE_TIME_SIG) | \
+    SMF_FILTER(SMF_TYPE_KEY_SIG))
+
+/*
+ * A single change of the chase state, recorded by smfchase_alloc().
+ */
+typedef struct {
   
-  int bc = 0;
-  int c = 0;
-  int32_t result = 0;
+  /*
+   * The absolute tick offset of the change.
+   */
+  int64_t tick;
   
-  /* Check parameters */
-  if ((pSrc == NULL) || (pRem == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
+  /*
+   * The new value.
+   * 
+   * This is the controller value, program, pressure, pitch bend, or beat
+   * duration.  Time signatures are packed with the numerator, click,
+   * and beat unit in the low three bytes and the base-2 logarithm of the
+   * denominator in the high byte.  Key signatures are packed with the
+   * key as a two's complement byte in the low byte and the minor flag
+   * in the next byte.
+   */
+  int32_t val;
   
-  /* Processing loop */
-  while (1) {
-    /* Read a byte from the chunk */
-    c = readChunkByte(pSrc, pRem, pErr);
-    if (c < 0) {
-      result = -1;
-      break;
-    }
-    
-    /* Incorporate the seven least significant bits of this byte into
-     * the result */
-    result = (result << 7) | ((int32_t) (c & 0x7f));
-    
-    /* If most significant bit of this byte is clear, then leave loop */
-    if (c < 0x80) {
-      break;
-    }
-    
-    /* If we got here, increment the byte count before looping back; if
-     * byte count has reached 4 then error because variable-length
-     * quantities with more than 4 encoded bytes are not allowed */
-    bc++;
-    if (bc >= 4) {
-      result = -1;
-      *pErr = SMF_ERR_LONG_VARINT;
-      break;
-    }
-  }
+  /*
+   * The SMF_TYPE_ constant of the event that made the change.
+   */
+  uint8_t type;
   
-  /* Return result or -1 */
-  return result;
-}
+  /*
+   * The channel and the controller number, or zero if not used.
+   */
+  uint8_t ch;
+  uint8_t ctl;
+  
+} CHASE_CHANGE;
 
 /*
- * Read the header of a chunk within a MIDI file.
- * 
- * pType and pLen point to the variables to receive the type of chunk
- * and the length of the chunk in bytes.  The length of the chunk does
- * not include the chunk header.
- * 
- * pSrc is the input source to read the header from.  Reading starts
- * sequentially at current position.  Upon successful return, the input
- * source will be positioned to read the first byte of data within the
- * chunk.
- * 
- * pErr points to a variable to receive an error code if the function
- * fails.
- * 
- * Parameters:
- * 
- *   pType - pointer to the output chunk type variable
- * 
- *   pLen - pointer to the output chunk length variable
- * 
- *   pSrc - the input source
- * 
- *   pErr - pointer to the error code variable
- * 
- * Return:
+ * The chase state in the compact form that is stored in snapshots.
  * 
- *   non-zero if successful, zero if error
+ * The fields have the same meaning as in SMF_CHASE.
  */
-static int readChunkHead(
-    uint32_t  * pType,
-    int32_t   * pLen,
-    SMFSOURCE * pSrc,
-    int       * pErr) {
-  
-  int status = 1;
-  uint32_t lv = 0;
+typedef struct {
   
-  /* Check parameters */
-  if ((pType == NULL) || (pLen == NULL) ||
-      (pSrc == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
+  int16_t ctl[16][128];
+  int16_t program[16];
+  int16_t pressure[16];
+  int16_t bend[16];
   
-  /* Read the type */
-  if (!readUint32BE(pType, pSrc, pErr)) {
-    status = 0;
-  }
+  int32_t beat_dur;
   
-  /* Read the length as unsigned */
-  if (status) {
-    if (!readUint32BE(&lv, pSrc, pErr)) {
-      status = 0;
-    }
-  }
+  int         has_time_sig;
+  SMF_TIMESIG tsig;
   
-  /* Make sure length in signed range */
-  if (status) {
-    if (lv > INT32_MAX) {
-      status = 0;
-      *pErr = SMF_ERR_HUGE_CHUNK;
-    }
-  }
+  int        has_key_sig;
+  SMF_KEYSIG ksig;
   
-  /* Write the signed length and return status */
-  if (status) {
-    *pLen = (int32_t) lv;
-  }
+} CHASE_STATE;
 
-  return status;
-}
+/*
+ * A snapshot of the chase state.
+ */
+typedef struct {
+  
+  /*
+   * The tick offset of the snapshot, which is a multiple of the snapshot
+   * interval.
+   */
+  int64_t tick;
+  
+  /*
+   * The index of the first state change that is not included in the
+   * snapshot.  All the changes before it are at earlier ticks.
+   */
+  int32_t pos;
+  
+  /*
+   * The state before any events at the tick of the snapshot.
+   */
+  CHASE_STATE st;
+  
+} CHASE_SNAPSHOT;
 
 /*
- * Read the MIDI header chunk.
- * 
- * Parameters:
- * 
- *   ph - the structure to store the parsed results
- * 
- *   pSrc - the source to read from
- * 
- *   pErr - stores the error code on failure
- * 
- * Return:
+ * SMFCHASE structure.
  * 
- *   non-zero if successful, zero if error
+ * Prototype given in header.
  */
-static int readHeaderChunk(SMF_HEADER *ph, SMFSOURCE *pSrc, int *pErr) {
+struct SMFCHASE_TAG {
   
-  int status = 1;
+  /*
+   * The snapshot interval in ticks.
+   */
+  int32_t interval;
   
-  uint32_t ck_type = 0;
-  int32_t ck_len = 0;
+  /*
+   * The dynamically allocated array of ccount state changes in time
+   * order, which has room for ccap changes.
+   */
+  CHASE_CHANGE * pChg;
+  int32_t        ccount;
+  int32_t        ccap;
   
-  int32_t fmt = 0;
-  int32_t ntrks = 0;
-  int32_t division = 0;
+  /*
+   * The dynamically allocated array of scount snapshots in time order,
+   * which has room for scap snapshots.
+   * 
+   * The first snapshot is always at tick zero with the initial state.
+   */
+  CHASE_SNAPSHOT * pSnap;
+  int32_t          scount;
+  int32_t          scap;
+};
+
+/*
+ * SMFWRITE structure.
+ * 
+ * Prototype given in header.
+ */
+struct SMFWRITE_TAG {
   
-  int32_t subdiv = 0;
-  int frame_rate = 0;
+  /*
+   * The writer status, which is zero normally or a negative error code
+   * once the writer has failed.
+   */
+  int status;
   
-  /* Check parameters */
-  if ((ph == NULL) || (pSrc == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
+  /*
+   * The writer stage, one of the WRITE_STAGE_ constants.
+   */
+  int stage;
   
-  /* Read the header chunk header */
-  if (!readChunkHead(&ck_type, &ck_len, pSrc, pErr)) {
-    status = 0;
-  }
+  /*
+   * The output file handle, or NULL if the writer encodes into its
+   * buffer only.
+   * 
+   * is_owner is non-zero if the handle is closed when the writer is
+   * released.  can_seek is non-zero if the handle supports random
+   * access.
+   */
+  FILE * fh;
+  int    is_owner;
+  int    can_seek;
   
-  /* Make sure header chunk is correct type */
-  if (status) {
-    if (ck_type != UINT32_C(0x4d546864)) {
-      status = 0;
-      *pErr = SMF_ERR_SIGNATURE;
-    }
-  }
+  /*
+   * The dynamically allocated output buffer, which holds blen bytes and
+   * has room for bcap bytes.  It is NULL if bcap is zero.
+   */
+  uint8_t * pBuf;
+  int32_t   blen;
+  int32_t   bcap;
   
-  /* Make sure header chunk is at least six bytes */
-  if (status) {
-    if (ck_len < 6) {
-      status = 0;
-      *pErr = SMF_ERR_HEADER;
-    }
-  }
+  /*
+   * The number of bytes that have already been written out to the file
+   * handle, which come before the bytes in the buffer.
+   */
+  int64_t flushed;
   
-  /* Read the three header fields */
-  if (status) {
-    fmt = readUint16BE(pSrc, pErr);
-    if (fmt < 0) {
-      status = 0;
-    }
-  }
+  /*
+   * The header that was written.
+   * 
+   * declared is the track count written in the header chunk, and ntrk
+   * is the number of tracks written so far.
+   */
+  int         fmt;
+  SMF_TIMESYS ts;
+  int32_t     declared;
+  int32_t     ntrk;
   
-  if (status) {
-    ntrks = readUint16BE(pSrc, pErr);
-    if (ntrks < 0) {
-      status = 0;
-    }
-  }
+  /*
+   * The byte offset of the header of the current track chunk, from the
+   * start of the output.
+   */
+  int64_t trk_pos;
   
-  if (status) {
-    division = readUint16BE(pSrc, pErr);
-    if (division < 0) {
-      status = 0;
-    }
-  }
+  /*
+   * The running status byte of the current track, or -1 if none.
+   */
+  int run;
+};
+
+/*
+ * The layout of a binary cache.
+ * 
+ * The cache header is CACHE_HEAD 32-bit words, which are the magic
+ * value, the version, the header fields (format, track count,
+ * subdivision, and frame rate), the five counts below in order, and
+ * five reserved words that are zero.  The sections follow, each at the
+ * byte offset given here, in an order that keeps every section aligned
+ * to its element size.
+ */
+typedef struct {
   
-  /* Skip any remaining bytes in the header */
-  if (status) {
-    if (!smfsource_skip(pSrc, ck_len - 6)) {
-      status = 0;
-      *pErr = SMF_ERR_IO;
-    }
-  }
+  /*
+   * The number of chunks, tempo changes, events, payloads, and payload
+   * arena bytes.
+   */
+  int32_t nck;
+  int32_t ntm;
+  int32_t nev;
+  int32_t npay;
+  int32_t narena;
   
-  /* Check fmt range */
-  if (status) {
-    if (fmt > 2) {
-      status = 0;
-      *pErr = SMF_ERR_MIDI_FMT;
-    }
-  }
+  /*
+   * The byte offsets of the chunk index columns.
+   */
+  int64_t ck_off;
+  int64_t ck_type;
+  int64_t ck_len;
+  int64_t ck_first;
+  int64_t ck_count;
   
-  /* Check at least one track */
-  if (status) {
-    if (ntrks < 1) {
-      status = 0;
-      *pErr = SMF_ERR_NO_TRACKS;
-    }
-  }
+  /*
+   * The byte offsets of the tempo map columns.
+   */
+  int64_t tm_tick;
+  int64_t tm_beat;
   
-  /* Check that if format 0, there is at most one track */
-  if (status) {
-    if ((fmt == 0) && (ntrks > 1)) {
-      status = 0;
-      *pErr = SMF_ERR_MULTI_TRACK;
-    }
-  }
+  /*
+   * The byte offsets of the event columns.
+   */
+  int64_t ev_tick;
+  int64_t ev_aux;
+  int64_t ev_type;
+  int64_t ev_ch;
+  int64_t ev_d1;
+  int64_t ev_d2;
   
-  /* Decypher the division field */
-  if (status) {
-    if ((division & INT32_C(0x8000)) == 0) {
-      /* High bit clear, so the division gives the number of delta units
-       * per beat ("MIDI quarter note") */
-      if (division > 0) {
-        subdiv = division;
-        frame_rate = 0;
-        
-      } else {
-        status = 0;
-        *pErr = SMF_ERR_HEADER;
-      }
-      
-    } else {
-      /* High bit set, so this is an SMPTE time; parse the subfields */
-      frame_rate = (int) (division >> 8);
-      frame_rate = (frame_rate ^ 0xff) + 1;
-      subdiv = division & 0xff;
-      
-      /* Check frame rate and subdivision in range */
-      if (((frame_rate != 24) && (frame_rate != 25) &&
-            (frame_rate != 29) && (frame_rate != 30)) ||
-          (subdiv < 1)) {
-        status = 0;
-        *pErr = SMF_ERR_HEADER;
-      }
-    }
-  }
+  /*
+   * The byte offsets of the payload table and the payload arena.
+   */
+  int64_t pay_off;
+  int64_t pay_len;
+  int64_t arena;
   
-  /* Fill in the header structure */
-  if (status) {
-    ph->fmt = (int) fmt;
-    ph->nTracks = ntrks;
-    (ph->ts).subdiv = subdiv;
-    (ph->ts).frame_rate = frame_rate;
-  }
+  /*
+   * The total length of the cache in bytes.
+   */
+  int64_t total;
   
-  /* Return status */
-  return status;
-}
+} CACHE_LAYOUT;
 
 /*
- * Parse an event that we have fully read from input and fill in the
- * entity structure appropriately.
- * 
- * The parser state must have a status code of 1 and a ckrem value that
- * is zero or greater.  The entity structure is assumed to be in a reset
- * state.
- * 
- * The ev parameter is the lead byte of the message to parse.  If
- * running status is used, this must be the cached running status byte.
- * 
- * The "A" parameter is the first parameter, or -1 if there is no such
- * parameter.
- * 
- * The "B" parameter is the second parameter, or -1 if there is no such
- * parameter.
- * 
- * For System Exclusive and meta-events, the data payload should already
- * be read into the parser data buffer.  For End Of Track, all remaining
- * data in the track should have already been skipped.
- * 
- * For meta-events, the event type should be the "A" parameter.
- * 
- * If the parse operation fails, the entity is not modified and the
- * parser status is not changed.  Instead, the error code is written to
- * pErr and zero is returned.
- * 
- * Parameters:
- * 
- *   ps - the parser object
- * 
- *   pEnt - the entity structure to fill in
- * 
- *   ev - the lead/status byte
- * 
- *   a - the first parameter, or -1
+ * SMFCACHE structure.
  * 
- *   b - the second parameter, or -1
+ * Prototype given in header.
+ */
+struct SMFCACHE_TAG {
+  
+  /*
+   * The cache bytes and their length.
+   * 
+   * If the cache object owns the bytes, pCopy is the dynamically
+   * allocated copy they are in, or pMap is the memory-mapped source
+   * they are in.  Otherwise, both are NULL.
+   */
+  const uint8_t * pData;
+  int64_t         len;
+  uint8_t       * pCopy;
+  SMFSOURCE     * pMap;
+  
+  /*
+   * The header of the MIDI file and the layout of the cache.
+   */
+  SMF_HEADER   head;
+  CACHE_LAYOUT lay;
+  
+  /*
+   * Pointers to the columns within the cache bytes.
+   * 
+   * ck_first is the index of the first event of each track chunk, or -1
+   * for other chunks, and ck_count is the number of events of each
+   * track chunk, or zero for other chunks.
+   */
+  const int64_t  * ck_off;
+  const uint32_t * ck_type;
+  const int32_t  * ck_len;
+  const int32_t  * ck_first;
+  const int32_t  * ck_count;
+  
+  const int64_t * tm_tick;
+  const int32_t * tm_beat;
+  
+  const uint32_t * ev_tick;
+  const int32_t  * ev_aux;
+  const uint8_t  * ev_type;
+  const uint8_t  * ev_ch;
+  const uint8_t  * ev_d1;
+  const uint8_t  * ev_d2;
+  
+  const int32_t * pay_off;
+  const int32_t * pay_len;
+  const uint8_t * arena;
+  
+  /*
+   * The parser object that decodes the stored payloads of
+   * System-Exclusive events and meta-events, and that holds the
+   * structures returned with the entities.
+   */
+  SMFPARSE *ps;
+  
+  /*
+   * The iteration state.
+   * 
+   * status is zero before the header, one while returning chunks and
+   * events, two at EOF, or a negative error code.
+   * 
+   * ck is the index of the next chunk to return.  ev is the index of
+   * the next event to return and evend is one past the last event of
+   * the current track, so they are equal when not inside a track.
+   */
+  int     status;
+  int32_t ck;
+  int32_t ev;
+  int32_t evend;
+};
+
+#ifdef SMF_POSIX
+
+/*
+ * The fault handler of a single thread, which is stored as the value
+ * of the m_fault_key thread-specific data key.
+ */
+typedef struct {
+  smf_fp_thread_fault   fFault;
+  void                * pCustom;
+} FAULT_SLOT;
+
+#endif
+
+/*
+ * Static data
+ * ===========
+ */
+
+/*
+ * The fault handler, or NULL if nothing is registered.
+ */
+static smf_fp_fault m_fault = NULL;
+
+#ifdef SMF_POSIX
+
+/*
+ * The thread-specific data key for the fault handlers of single
+ * threads.
  * 
- *   delta - the delta time prior to the event
+ * The key is created the first time that it is needed, with
+ * m_fault_once.  m_fault_ok is non-zero if that succeeded.  It is only
+ * read after pthread_once() has returned, which makes it safe to read
+ * from any thread.
+ */
+static pthread_once_t m_fault_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  m_fault_key;
+static int            m_fault_ok = 0;
+
+#endif
+
+/*
+ * A blank entity with every field set to its "not used" value.
  * 
- *   pErr - receives the error code if failure
+ * Entity structures are reset by copying this over them.
+ */
+static const SMF_ENTITY m_blank = {
+  0,      /* status */
+  NULL,   /* pHead */
+  0,      /* chunk_type */
+  -1,     /* delta */
+  -1,     /* tick */
+  -1,     /* ch */
+  -1,     /* key */
+  -1,     /* ctl */
+  -1,     /* val */
+  0,      /* bend */
+  0,      /* buf_len */
+  NULL,   /* buf_ptr */
+  -1,     /* seq_num */
+  -1,     /* txtype */
+  -1,     /* beat_dur */
+  NULL,   /* tcode */
+  NULL,   /* tsig */
+  NULL,   /* ksig */
+  -1      /* meta_type */
+};
+
+/*
+ * The event code of each SMF_TYPE_ constant up to SMF_TYPE_META.
  * 
- * Return:
+ * For MIDI messages, this is the status byte on channel zero.  For
+ * System Exclusive events, it is the lead byte.  For meta-events that
+ * the parser interprets, it is the meta-event type.  For all other
+ * entity types, it is -1.
  * 
- *   non-zero if successful, zero if error
+ * This is shared by the track decoder and the writer, so that both
+ * agree on the encoding.
+ */
+static const int m_code[SMF_TYPE_META + 1] = {
+  -1,     /* SMF_TYPE_EOF */
+  -1,     /* SMF_TYPE_HEADER */
+  -1,     /* SMF_TYPE_CHUNK */
+  -1,     /* SMF_TYPE_BEGIN_TRACK */
+  0x2f,   /* SMF_TYPE_END_TRACK */
+  0x80,   /* SMF_TYPE_NOTE_OFF */
+  0x90,   /* SMF_TYPE_NOTE_ON */
+  0xa0,   /* SMF_TYPE_KEY_AFTERTOUCH */
+  0xb0,   /* SMF_TYPE_CONTROL */
+  0xc0,   /* SMF_TYPE_PROGRAM */
+  0xd0,   /* SMF_TYPE_CH_AFTERTOUCH */
+  0xe0,   /* SMF_TYPE_PITCH_BEND */
+  0xf0,   /* SMF_TYPE_SYSEX */
+  0xf7,   /* SMF_TYPE_SYSESC */
+  0x00,   /* SMF_TYPE_SEQ_NUM */
+  -1,     /* SMF_TYPE_TEXT */
+  0x20,   /* SMF_TYPE_CH_PREFIX */
+  0x51,   /* SMF_TYPE_TEMPO */
+  0x54,   /* SMF_TYPE_SMPTE */
+  0x58,   /* SMF_TYPE_TIME_SIG */
+  0x59,   /* SMF_TYPE_KEY_SIG */
+  -1      /* SMF_TYPE_META */
+};
+
+/*
+ * Local functions
+ * ===============
  */
+
+/* Prototypes */
+static void fault(long lnum);
+#ifdef SMF_POSIX
+static void initFaultKey(void);
+static void freeFaultSlot(void *pSlot);
+#endif
+
+static void checkAllocator(const SMF_ALLOCATOR *pa);
+static void *memAlloc(const SMF_ALLOCATOR *pa, size_t size);
+static void *memRealloc(const SMF_ALLOCATOR *pa, void *p, size_t size);
+static void memFree(const SMF_ALLOCATOR *pa, void *p);
+
+static void reserveBuffer(SMFPARSE *ps, int32_t n);
+
+static int32_t readUint16BE(SMFSOURCE *pSrc, int *pErr);
+static int readUint32BE(uint32_t *pv, SMFSOURCE *pSrc, int *pErr);
+static int readChunkByte(SMFSOURCE *pSrc, int32_t *pRem, int *pErr);
+static int32_t readChunkVar(SMFSOURCE *pSrc, int32_t *pRem, int *pErr);
+
+static int readPayload(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t     len,
+    int       * pErr);
+
+static int readChunkHead(
+    uint32_t  * pType,
+    int32_t   * pLen,
+    SMFSOURCE * pSrc,
+    int       * pErr);
+static int addChunkLength(SMFPARSE *ps, int32_t ck_len, int *pErr);
+static int readHeaderChunk(SMFPARSE *ps, SMFSOURCE *pSrc, int *pErr);
 static int parseEvent(
     SMFPARSE   * ps,
     SMF_ENTITY * pEnt,
@@ -855,895 +1487,10298 @@ static int parseEvent(
     int          a,
     int          b,
     int32_t      delta,
-    int        * pErr) {
-  
-  int status = 1;
-  int msg = 0;
-  int ch = 0;
-  
-  /* Check parameters */
-  if ((ps == NULL) || (pEnt == NULL) || (pErr == NULL)) {
-    fault(__LINE__);
-  }
-  if ((ev < 0) || (ev > 255)) {
-    fault(__LINE__);
-  }
-  if ((a < -1) || (a > 255)) {
-    fault(__LINE__);
-  }
-  if ((b < -1) || (b > 255)) {
-    fault(__LINE__);
-  }
-  if ((b >= 0) && (a < 0)) {
-    fault(__LINE__);
-  }
-  if ((delta < 0) || (delta > SMF_MAX_VARINT)) {
-    fault(__LINE__);
-  }
-  
-  /* Handle the different event classes */
-  if ((ev == 0xf0) || (ev == 0xf7)) {
-    /* System exclusive event, so there shouldn't be any parameters */
-    if ((a != -1) || (b != -1)) {
-      fault(__LINE__);
-    }
-    
-    /* Set the entity type, delta, and data buffer */
-    if (ev == 0xf0) {
-      pEnt->status = SMF_TYPE_SYSEX;
-      
-    } else if (ev == 0xf7) {
+    int        * pErr);
+static int eventType(int ev, int a);
+static int skipEvent(const SMFPARSE *ps, int ev, int a);
+static int fastEvent(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t   * pDelta,
+    int       * pEv,
+    int       * pA,
+    int       * pB);
+static int readEvent(
+    SMFPARSE   * ps,
+    SMF_ENTITY * pEnt,
+    SMFSOURCE  * pSrc,
+    int        * pSkip,
+    int        * pErr);
+static void readEntity(SMFPARSE *ps, SMF_ENTITY *pEnt, SMFSOURCE *pSrc);
+static void describeState(const SMFPARSE *ps, SMF_ERRINFO *pInfo);
+static void setError(SMFPARSE *ps, int code);
+static void notifyError(SMFPARSE *ps);
+static void resetParser(SMFPARSE *ps);
+static int skipSource(SMFSOURCE *pSrc, int64_t skip);
+static void appendChunk(
+    SMFPARSE * ps,
+    uint32_t   type,
+    int64_t    offset,
+    int32_t    length);
+static void enterTrack(
+    SMFPARSE         * ps,
+    const SMF_HEADER * ph,
+    int32_t            trk,
+    const SMF_CHUNK  * pc);
+static void appendCheckpoint(SMFPARSE *ps, int32_t trk);
+static int buildCheckpoints(SMFPARSE *ps, SMFSOURCE *pSrc, int *pErr);
+static const SMF_CHUNK *indexedTrack(SMFPARSE *ps, int32_t trk);
+
+static SMF_CHUNK *trackChunks(SMFPARSE *ps, int32_t count);
+static void runWorker(PARALLEL_JOB *pj);
+#ifdef SMF_POSIX
+static void *parallel_thread(void *pArg);
+#endif
+
+static SMFSOURCE *openBatchFile(
+    const BATCH_JOB      * pj,
+    const SMF_BATCH_FILE * pf,
+    SMFSOURCE            * pMem,
+    uint8_t             ** ppBuf,
+    int32_t              * pCap,
+    int                  * pErr);
+static void runBatch(BATCH_JOB *pj);
+#ifdef SMF_POSIX
+static void *batch_thread(void *pArg);
+#endif
+
+static void trackTime(SMFPARSE *ps, SMF_ENTITY *pEnt);
+static void timeTempo(SMFTEMPO *pm, int32_t i);
+
+static int mergeBefore(const SMFMERGE *pm, int32_t a, int32_t b);
+static void mergePush(SMFMERGE *pm, int32_t c);
+static int32_t mergePop(SMFMERGE *pm);
+static int mergeAdvance(SMFMERGE *pm, int32_t c);
+
+static void closeNote(SMFNOTES *pn, int ch, int key, int off_vel);
+static void closeAllNotes(SMFNOTES *pn);
+
+static void clearChase(CHASE_STATE *pst);
+static void applyChase(CHASE_STATE *pst, const CHASE_CHANGE *pc);
+static int recordChase(
+    SMFCHASE         * pc,
+    const SMF_ENTITY * pEnt,
+    int64_t            tick);
+static void snapChase(SMFCHASE *pc, int64_t tick, const CHASE_STATE *pst);
+
+static int64_t cacheSection(int64_t *pPos, int32_t count, size_t esize);
+static void cacheLayout(CACHE_LAYOUT *pl);
+static SMFCACHE *openCache(
+    const uint8_t * pData,
+    int64_t         len,
+    uint8_t       * pCopy,
+    SMFSOURCE     * pMap,
+    int           * pErr);
+static int cacheEvent(SMFCACHE *pc, SMF_ENTITY *pEnt);
+
+static void storeText(
+    uint8_t       ** ppBuf,
+    int32_t        * pCap,
+    int32_t        * pLen,
+    const uint8_t  * pData,
+    int32_t          len);
+static void scanTrack(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t     scan,
+    SMF_PROBE * pProbe);
+
+static int reserveWrite(SMFWRITE *pw, int32_t n, int *pErr);
+static int putWrite(
+    SMFWRITE      * pw,
+    const uint8_t * pData,
+    int32_t         len,
+    int           * pErr);
+static int flushWrite(SMFWRITE *pw, int32_t min, int *pErr);
+static int seekHandle(FILE *fh, int64_t dist);
+static int patchWrite(
+    SMFWRITE      * pw,
+    int64_t         pos,
+    const uint8_t * pData,
+    int32_t         len,
+    int           * pErr);
+static int32_t encodeVar(uint8_t *pBuf, int32_t v);
+static int writeHeader(SMFWRITE *pw, const SMF_HEADER *ph, int *pErr);
+static int writeEvent(SMFWRITE *pw, const SMF_ENTITY *pEnt, int *pErr);
+
+static int32_t growCapacity(int32_t cap, int32_t n);
+static void *resizeBlock(void *p, int32_t count, size_t esize);
+static void *resizeBlockWith(
+    const SMF_ALLOCATOR * pa,
+    void                * p,
+    int32_t               count,
+    size_t                esize);
+static void appendTrackEvent(
+    SMF_TRACK        * pt,
+    const SMF_ENTITY * pEnt,
+    uint32_t           tick,
+    const uint8_t    * pPay,
+    int32_t            plen);
+
+static int refillSource(SMFSOURCE *pSrc);
+static SMFSOURCE *newMemorySource(
+    const uint8_t       * pData,
+    int64_t               len,
+    void                * pInstance,
+    smfsource_fp_close    fClose,
+    const SMF_ALLOCATOR * pa);
+static SMFSOURCE *newBlockSource(
+    void                   * pInstance,
+    smfsource_fp_readBlock   fReadBlock,
+    smfsource_fp_rewind      fRewind,
+    smfsource_fp_close       fClose,
+    smfsource_fp_skip        fSkip,
+    const SMF_ALLOCATOR    * pa);
+
+static int64_t handleLength(FILE *pIn);
+static int64_t startHandle(FILE *pIn);
+
+static int32_t handle_source_readBlock(
+    void    * pInstance,
+    uint8_t * pBuf,
+    int32_t   len);
+static int handle_source_rewind(void *pInstance);
+static int handle_source_close(void *pInstance);
+static int handle_source_skip(void *pInstance, int32_t skip);
+
+#ifdef SMF_POSIX
+static int mmap_source_close(void *pInstance);
+
+static void *prefetch_thread(void *pArg);
+static void dropPrefetch(PREFETCH_SOURCE *pp, int64_t offset);
+static int32_t prefetch_source_readBlock(
+    void    * pInstance,
+    uint8_t * pBuf,
+    int32_t   len);
+static int prefetch_source_rewind(void *pInstance);
+static int prefetch_source_close(void *pInstance);
+static int prefetch_source_skip(void *pInstance, int32_t skip);
+#endif
+
+/*
+ * Raise a fault.
+ * 
+ * This function does not return.
+ * 
+ * Parameters:
+ * 
+ *   lnum - the line number (__LINE__)
+ */
+static void fault(long lnum) {
+#ifdef SMF_POSIX
+  FAULT_SLOT *pSlot = NULL;
+  
+  /* A handler of the calling thread takes precedence */
+  if (pthread_once(&m_fault_once, &initFaultKey) == 0) {
+    if (m_fault_ok) {
+      pSlot = (FAULT_SLOT *) pthread_getspecific(m_fault_key);
+      if (pSlot != NULL) {
+        pSlot->fFault(pSlot->pCustom, lnum);
+      }
+    }
+  }
+#endif
+  
+  if (m_fault != NULL) {
+    m_fault(lnum);
+  } else {
+    fprintf(stderr, "Fault within libsmfparse at line %ld\n", lnum);
+  }
+  exit(EXIT_FAILURE);
+}
+
+#ifdef SMF_POSIX
+
+/*
+ * Create the thread-specific data key for the fault handlers of single
+ * threads.
+ * 
+ * This is only called through pthread_once() with m_fault_once.  It
+ * can't fault, because fault() itself depends on it, so m_fault_ok
+ * simply stays zero if the key can't be created.
+ */
+static void initFaultKey(void) {
+  if (pthread_key_create(&m_fault_key, &freeFaultSlot) == 0) {
+    m_fault_ok = 1;
+  }
+}
+
+/*
+ * Release the fault handler slot of a thread when the thread ends.
+ * 
+ * Parameters:
+ * 
+ *   pSlot - the FAULT_SLOT of the thread
+ */
+static void freeFaultSlot(void *pSlot) {
+  free(pSlot);
+}
+
+#endif
+
+/*
+ * Check that an allocator structure either has all of its callbacks
+ * set or none of them.
+ * 
+ * A fault occurs if only some of the callbacks are set.
+ * 
+ * Parameters:
+ * 
+ *   pa - the allocator
+ */
+static void checkAllocator(const SMF_ALLOCATOR *pa) {
+  
+  /* Check parameters */
+  if (pa == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Check that callbacks are all set or all clear */
+  if (pa->fAlloc != NULL) {
+    if ((pa->fRealloc == NULL) || (pa->fFree == NULL)) {
+      fault(__LINE__);
+    }
+  } else {
+    if ((pa->fRealloc != NULL) || (pa->fFree != NULL)) {
+      fault(__LINE__);
+    }
+  }
+}
+
+/*
+ * Allocate a zero-filled memory block with an allocator.
+ * 
+ * pa may be NULL or have its callbacks set to NULL to use the C heap.
+ * A fault occurs if the memory can't be allocated.
+ * 
+ * Parameters:
+ * 
+ *   pa - the allocator, or NULL
+ * 
+ *   size - the size of the block in bytes, greater than zero
+ * 
+ * Return:
+ * 
+ *   the new block
+ */
+static void *memAlloc(const SMF_ALLOCATOR *pa, size_t size) {
+  
+  void *p = NULL;
+  
+  /* Check parameters */
+  if (size < 1) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate and clear block */
+  if ((pa != NULL) && (pa->fAlloc != NULL)) {
+    p = pa->fAlloc(pa->pCustom, size);
+    if (p != NULL) {
+      memset(p, 0, size);
+    }
+  } else {
+    p = calloc(1, size);
+  }
+  if (p == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Return block */
+  return p;
+}
+
+/*
+ * Allocate or resize a memory block with an allocator.
+ * 
+ * If p is NULL, a new block is allocated, and its contents are
+ * undefined.  Otherwise, the existing block is resized, preserving its
+ * contents.  pa may be NULL or have its callbacks set to NULL to use
+ * the C heap.  A fault occurs if the memory can't be allocated.
+ * 
+ * Parameters:
+ * 
+ *   pa - the allocator, or NULL
+ * 
+ *   p - the existing block, or NULL
+ * 
+ *   size - the new size of the block in bytes, greater than zero
+ * 
+ * Return:
+ * 
+ *   the new block
+ */
+static void *memRealloc(const SMF_ALLOCATOR *pa, void *p, size_t size) {
+  
+  /* Check parameters */
+  if (size < 1) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate or expand block */
+  if ((pa != NULL) && (pa->fAlloc != NULL)) {
+    if (p == NULL) {
+      p = pa->fAlloc(pa->pCustom, size);
+    } else {
+      p = pa->fRealloc(pa->pCustom, p, size);
+    }
+  } else {
+    if (p == NULL) {
+      p = malloc(size);
+    } else {
+      p = realloc(p, size);
+    }
+  }
+  if (p == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Return block */
+  return p;
+}
+
+/*
+ * Release a memory block that was allocated with an allocator.
+ * 
+ * pa must be the same allocator that the block was allocated with.  If
+ * p is NULL, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pa - the allocator, or NULL
+ * 
+ *   p - the block to release, or NULL
+ */
+static void memFree(const SMF_ALLOCATOR *pa, void *p) {
+  if (p != NULL) {
+    if ((pa != NULL) && (pa->fFree != NULL)) {
+      pa->fFree(pa->pCustom, p);
+    } else {
+      free(p);
+    }
+  }
+}
+
+/*
+ * Make sure that the data buffer of the given parser object has a
+ * capacity of at least n bytes.
+ * 
+ * The buffer is allocated with the initial capacity if it has not been
+ * allocated yet, and the capacity is then doubled as often as
+ * necessary, but never beyond the max_payload option unless n itself
+ * is larger than that.  n must not exceed twice max_payload, which
+ * leaves room for a batch read to append a payload to a buffer that is
+ * almost full.  The contents of the buffer are preserved.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   n - the minimum required capacity in bytes
+ */
+static void reserveBuffer(SMFPARSE *ps, int32_t n) {
+  
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  if ((n < 0) || (n > 2 * (ps->opt).max_payload)) {
+    fault(__LINE__);
+  }
+  
+  /* Only proceed if current capacity is not sufficient */
+  if (n > ps->bcap) {
+    /* New capacity is the initial capacity or the current capacity,
+     * doubled until it is large enough, and at most the maximum allowed
+     * capacity */
+    if (ps->bcap < BCAP_INIT) {
+      new_cap = BCAP_INIT;
+    } else {
+      new_cap = ps->bcap;
+    }
+    while (new_cap < n) {
+      new_cap *= 2;
+    }
+    if (new_cap > (ps->opt).max_payload) {
+      new_cap = (ps->opt).max_payload;
+    }
+    if (new_cap < n) {
+      new_cap = n;
+    }
+    
+    /* Allocate or expand buffer */
+    ps->bptr = (uint8_t *) memRealloc(
+                  &((ps->opt).alloc), ps->bptr, (size_t) new_cap);
+    ps->bcap = new_cap;
+    STAT_ADD(ps, grows, 1);
+  }
+}
+
+/*
+ * Read an unsigned 16-bit integer in big endian order from the input
+ * source.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   pErr - receives an error code if failure
+ * 
+ * Return:
+ * 
+ *   the unsigned 16-bit value, or -1 if failure
+ */
+static int32_t readUint16BE(SMFSOURCE *pSrc, int *pErr) {
+  
+  int c = 0;
+  int i = 0;
+  int32_t result = 0;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Read the two bytes and add to result */
+  for(i = 0; i < 2; i++) {
+    c = smfsource_read(pSrc);
+    
+    if (c == SMFSOURCE_IOERR) {
+      *pErr = SMF_ERR_IO;
+      result = -1;
+      break;
+      
+    } else if (c == SMFSOURCE_EOF) {
+      *pErr = SMF_ERR_EOF;
+      result = -1;
+      break;
+    }
+    
+    result <<= 8;
+    result |= ((int32_t) c);
+  }
+  
+  /* Return result or -1 */
+  return result;
+}
+
+/*
+ * Read an unsigned 32-bit integer in big-endian order from the input
+ * source.
+ * 
+ * Parameters:
+ * 
+ *   pv - the variable to receive the result
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   pErr - receives an error code if failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int readUint32BE(uint32_t *pv, SMFSOURCE *pSrc, int *pErr) {
+  
+  int status = 1;
+  int c = 0;
+  int i = 0;
+  
+  /* Check parameters */
+  if ((pv == NULL) || (pSrc == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Clear result */
+  *pv = 0;
+  
+  /* Read the four bytes and add to result */
+  for(i = 0; i < 4; i++) {
+    c = smfsource_read(pSrc);
+    
+    if (c == SMFSOURCE_IOERR) {
+      *pErr = SMF_ERR_IO;
+      status = 0;
+      break;
+      
+    } else if (c == SMFSOURCE_EOF) {
+      *pErr = SMF_ERR_EOF;
+      status = 0;
+      break;
+    }
+    
+    *pv <<= 8;
+    *pv |= ((uint32_t) c);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Read a byte from within a chunk.
+ * 
+ * pRem points to a variable that tracks the number of remaining bytes
+ * in the chunk.  If less than one, the function fails.  If this
+ * function is successful, the remainder count will be decremented.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   pRem - the remaining bytes counter
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   the unsigned byte value that was read, in range 0 to 255 inclusive,
+ *   or -1 if failure
+ */
+static int readChunkByte(SMFSOURCE *pSrc, int32_t *pRem, int *pErr) {
+  
+  int c = 0;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (pRem == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* If no remaining bytes, fail */
+  if (*pRem < 1) {
+    c = -1;
+    *pErr = SMF_ERR_OPEN_TRACK;
+  }
+  
+  /* Read from the track, taking the byte straight from the refill
+   * buffer of the source if it is available there */
+  if (c >= 0) {
+    if (pSrc->bpos < pSrc->blen) {
+      c = (pSrc->pWin)[pSrc->bpos];
+      (pSrc->bpos)++;
+      
+    } else {
+      c = smfsource_read(pSrc);
+      
+      if (c == SMFSOURCE_EOF) {
+        c = -1;
+        *pErr = SMF_ERR_EOF;
+        
+      } else if (c == SMFSOURCE_IOERR) {
+        c = -1;
+        *pErr = SMF_ERR_IO;
+      }
+    }
+  }
+  
+  /* Decrement byte counter */
+  if (c >= 0) {
+    (*pRem)--;
+  }
+  
+  /* Return byte read or -1 */
+  return c;
+}
+
+/*
+ * Read a variable-length integer from within a chunk.
+ * 
+ * pRem points to a variable that tracks the number of remaining bytes
+ * in the chunk.  If less than one, the function fails.  If this
+ * function is successful, the remainder count will be decremented by
+ * the number of bytes read in the variable-length integer.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the input source to read
+ * 
+ *   pRem - the remaining bytes counter
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   the variable-length integer quantity, which is always zero or
+ *   greater, or -1 if failure
+ */
+static int32_t readChunkVar(SMFSOURCE *pSrc, int32_t *pRem, int *pErr) {
+  
+  int bc = 0;
+  int c = 0;
+  int32_t result = 0;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (pRem == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Processing loop */
+  while (1) {
+    /* Read a byte from the chunk */
+    c = readChunkByte(pSrc, pRem, pErr);
+    if (c < 0) {
+      result = -1;
+      break;
+    }
+    
+    /* Incorporate the seven least significant bits of this byte into
+     * the result */
+    result = (result << 7) | ((int32_t) (c & 0x7f));
+    
+    /* If most significant bit of this byte is clear, then leave loop */
+    if (c < 0x80) {
+      break;
+    }
+    
+    /* If we got here, increment the byte count before looping back; if
+     * byte count has reached 4 then error because variable-length
+     * quantities with more than 4 encoded bytes are not allowed */
+    bc++;
+    if (bc >= 4) {
+      result = -1;
+      *pErr = SMF_ERR_LONG_VARINT;
+      break;
+    }
+  }
+  
+  /* Return result or -1 */
+  return result;
+}
+
+/*
+ * Read the data payload of a System-Exclusive event or meta-event from
+ * within a chunk.
+ * 
+ * len is the length of the payload in bytes, which must be zero or
+ * greater.  The remaining bytes counter ckrem of the parser is
+ * decremented by the length of the payload.  If the payload extends
+ * beyond the end of the chunk, the function fails.
+ * 
+ * Upon successful return, the pPay and plen fields of the parser object
+ * describe the payload.  If the input source is memory-resident and the
+ * whole payload is available, pPay will point directly into the memory
+ * of the input source without copying anything.  Otherwise, the payload
+ * is appended to the data buffer of the parser and pPay points there.
+ * In the latter case, pPay only remains valid until the data buffer is
+ * next appended to, because the buffer may be reallocated.
+ * 
+ * The function fails with SMF_ERR_BIG_PAYLOAD if the payload exceeds
+ * the max_payload option of the parser, regardless of whether the
+ * payload would actually be copied.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   len - the length of the payload in bytes
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int readPayload(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t     len,
+    int       * pErr) {
+  
+  int status = 1;
+  int32_t n = 0;
+  int32_t got = 0;
+  int d = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (len < 0) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Reset payload */
+  ps->pPay = NULL;
+  ps->plen = 0;
+  
+  /* Note how far a memory-resident source is short of the payload */
+  if (pSrc->is_mem && (len > pSrc->blen - pSrc->bpos)) {
+    ps->need = pSrc->bpos + len;
+  }
+  
+  /* If the source is memory-resident and the whole payload is there,
+   * just point to it; otherwise, copy it into the data buffer, which
+   * also takes care of reporting the appropriate errors */
+  if (pSrc->is_mem &&
+      (len <= ps->ckrem) &&
+      (len <= pSrc->blen - pSrc->bpos) &&
+      (len <= (ps->opt).max_payload)) {
+    if (len > 0) {
+      ps->pPay = &((pSrc->pWin)[pSrc->bpos]);
+      ps->plen = len;
+      pSrc->bpos += len;
+      ps->ckrem -= len;
+      STAT_ADD(ps, pay_direct, len);
+    }
+    
+  } else {
+    /* Determine how many bytes to copy into the buffer, which is the
+     * whole payload, except it stops at the maximum buffer capacity and
+     * at the end of the chunk */
+    n = len;
+    if (n > (ps->opt).max_payload) {
+      n = (ps->opt).max_payload;
+    }
+    if (n > ps->ckrem) {
+      n = ps->ckrem;
+    }
+    
+    /* Reserve space for the whole copy after anything already in the
+     * buffer and read it in one go */
+    reserveBuffer(ps, ps->blen + n);
+    if (n > 0) {
+      got = smfsource_readBlock(pSrc, &((ps->bptr)[ps->blen]), n);
+      if (got == SMFSOURCE_IOERR) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+        
+      } else if (got < n) {
+        status = 0;
+        *pErr = SMF_ERR_EOF;
+      }
+    }
+    
+    if (status) {
+      ps->ckrem -= n;
+    }
+    
+    /* If we didn't get the whole payload, then report the error in the
+     * same way as reading the payload byte by byte would: if the chunk
+     * ends first, it is an open track; if the payload is too big, one
+     * more byte is read so that an end of file or end of chunk takes
+     * precedence over the payload size */
+    if (status && (n < len)) {
+      d = readChunkByte(pSrc, &(ps->ckrem), pErr);
+      if (d >= 0) {
+        *pErr = SMF_ERR_BIG_PAYLOAD;
+      }
+      status = 0;
+    }
+    
+    if (status && (n > 0)) {
+      ps->pPay = &((ps->bptr)[ps->blen]);
+      ps->plen = n;
+      ps->blen += n;
+      STAT_ADD(ps, pay_copied, n);
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Read the header of a chunk within a MIDI file.
+ * 
+ * pType and pLen point to the variables to receive the type of chunk
+ * and the length of the chunk in bytes.  The length of the chunk does
+ * not include the chunk header.
+ * 
+ * pSrc is the input source to read the header from.  Reading starts
+ * sequentially at current position.  Upon successful return, the input
+ * source will be positioned to read the first byte of data within the
+ * chunk.
+ * 
+ * pErr points to a variable to receive an error code if the function
+ * fails.
+ * 
+ * Parameters:
+ * 
+ *   pType - pointer to the output chunk type variable
+ * 
+ *   pLen - pointer to the output chunk length variable
+ * 
+ *   pSrc - the input source
+ * 
+ *   pErr - pointer to the error code variable
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int readChunkHead(
+    uint32_t  * pType,
+    int32_t   * pLen,
+    SMFSOURCE * pSrc,
+    int       * pErr) {
+  
+  int status = 1;
+  uint32_t lv = 0;
+  
+  /* Check parameters */
+  if ((pType == NULL) || (pLen == NULL) ||
+      (pSrc == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Read the type */
+  if (!readUint32BE(pType, pSrc, pErr)) {
+    status = 0;
+  }
+  
+  /* Read the length as unsigned */
+  if (status) {
+    if (!readUint32BE(&lv, pSrc, pErr)) {
+      status = 0;
+    }
+  }
+  
+  /* Make sure length in signed range */
+  if (status) {
+    if (lv > INT32_MAX) {
+      status = 0;
+      *pErr = SMF_ERR_HUGE_CHUNK;
+    }
+  }
+  
+  /* Write the signed length and return status */
+  if (status) {
+    *pLen = (int32_t) lv;
+  }
+
+  return status;
+}
+
+/*
+ * Account for a chunk whose header has just been read in the file
+ * offset of a parser object.
+ * 
+ * The file offset is advanced past the chunk header and the ck_len
+ * bytes of chunk data.  If this would go beyond the max_file option of
+ * the parser, the function fails with SMF_ERR_HUGE_FILE and the file
+ * offset is not changed.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   ck_len - the length of the chunk data, not including the header
+ * 
+ *   pErr - stores the error code on failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int addChunkLength(SMFPARSE *ps, int32_t ck_len, int *pErr) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (ck_len < 0) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Check that the end of the chunk is within the limit; foff never
+   * exceeds the limit, so the subtraction can't overflow */
+  if ((int64_t) ck_len + 8 > (ps->opt).max_file - ps->foff) {
+    status = 0;
+    *pErr = SMF_ERR_HUGE_FILE;
+  }
+  
+  /* Advance the file offset */
+  if (status) {
+    ps->foff += (int64_t) ck_len + 8;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Read the MIDI header chunk.
+ * 
+ * The parsed results are stored in the head field of the parser object.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the source to read from
+ * 
+ *   pErr - stores the error code on failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int readHeaderChunk(SMFPARSE *ps, SMFSOURCE *pSrc, int *pErr) {
+  
+  int status = 1;
+  SMF_HEADER *ph = NULL;
+  
+  uint32_t ck_type = 0;
+  int32_t ck_len = 0;
+  
+  int32_t fmt = 0;
+  int32_t ntrks = 0;
+  int32_t division = 0;
+  
+  int32_t subdiv = 0;
+  int frame_rate = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  ph = &(ps->head);
+  
+  /* Read the header chunk header */
+  if (!readChunkHead(&ck_type, &ck_len, pSrc, pErr)) {
+    status = 0;
+  }
+  
+  /* Make sure header chunk is correct type */
+  if (status) {
+    if (ck_type != UINT32_C(0x4d546864)) {
+      status = 0;
+      *pErr = SMF_ERR_SIGNATURE;
+    }
+  }
+  
+  /* Make sure header chunk is within the file size limit */
+  if (status) {
+    if (!addChunkLength(ps, ck_len, pErr)) {
+      status = 0;
+    }
+  }
+  
+  /* Make sure header chunk is at least six bytes */
+  if (status) {
+    if (ck_len < 6) {
+      status = 0;
+      *pErr = SMF_ERR_HEADER;
+    }
+  }
+  
+  /* Read the three header fields */
+  if (status) {
+    fmt = readUint16BE(pSrc, pErr);
+    if (fmt < 0) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    ntrks = readUint16BE(pSrc, pErr);
+    if (ntrks < 0) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    division = readUint16BE(pSrc, pErr);
+    if (division < 0) {
+      status = 0;
+    }
+  }
+  
+  /* Skip any remaining bytes in the header */
+  if (status) {
+    if (!smfsource_skip(pSrc, ck_len - 6)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  /* Check fmt range */
+  if (status) {
+    if (fmt > 2) {
+      status = 0;
+      *pErr = SMF_ERR_MIDI_FMT;
+    }
+  }
+  
+  /* Check at least one track */
+  if (status) {
+    if (ntrks < 1) {
+      status = 0;
+      *pErr = SMF_ERR_NO_TRACKS;
+    }
+  }
+  
+  /* Check that if format 0, there is at most one track */
+  if (status) {
+    if ((fmt == 0) && (ntrks > 1)) {
+      status = 0;
+      *pErr = SMF_ERR_MULTI_TRACK;
+    }
+  }
+  
+  /* Decypher the division field */
+  if (status) {
+    if ((division & INT32_C(0x8000)) == 0) {
+      /* High bit clear, so the division gives the number of delta units
+       * per beat ("MIDI quarter note") */
+      if (division > 0) {
+        subdiv = division;
+        frame_rate = 0;
+        
+      } else {
+        status = 0;
+        *pErr = SMF_ERR_HEADER;
+      }
+      
+    } else {
+      /* High bit set, so this is an SMPTE time; parse the subfields */
+      frame_rate = (int) (division >> 8);
+      frame_rate = (frame_rate ^ 0xff) + 1;
+      subdiv = division & 0xff;
+      
+      /* Check frame rate and subdivision in range */
+      if (((frame_rate != 24) && (frame_rate != 25) &&
+            (frame_rate != 29) && (frame_rate != 30)) ||
+          (subdiv < 1)) {
+        status = 0;
+        *pErr = SMF_ERR_HEADER;
+      }
+    }
+  }
+  
+  /* Fill in the header structure */
+  if (status) {
+    ph->fmt = (int) fmt;
+    ph->nTracks = ntrks;
+    (ph->ts).subdiv = subdiv;
+    (ph->ts).frame_rate = frame_rate;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Parse an event that we have fully read from input and fill in the
+ * entity structure appropriately.
+ * 
+ * The parser state must have a status code of 1 and a ckrem value that
+ * is zero or greater.  The entity structure is assumed to be in a reset
+ * state.
+ * 
+ * The ev parameter is the lead byte of the message to parse.  If
+ * running status is used, this must be the cached running status byte.
+ * 
+ * The "A" parameter is the first parameter, or -1 if there is no such
+ * parameter.
+ * 
+ * The "B" parameter is the second parameter, or -1 if there is no such
+ * parameter.
+ * 
+ * For System Exclusive and meta-events, the data payload should already
+ * be read with readPayload().  For End Of Track, all remaining data in
+ * the track should have already been skipped.
+ * 
+ * For meta-events, the event type should be the "A" parameter.
+ * 
+ * At the SMF_VALIDATE_TRUSTED level, the range checks on the decoded
+ * values are skipped, and payloads of meta-events only need to be long
+ * enough to decode rather than of exactly the right length.  The data
+ * bytes of MIDI messages are masked to seven bits instead of being
+ * checked, and a Set Tempo of zero is still rejected, so that the
+ * entities can always be passed on to the tempo map, the note pairing
+ * engine, and the other consumers of entities without faulting.
+ * 
+ * If the parse operation fails, the entity is not modified and the
+ * parser status is not changed.  Instead, the error code is written to
+ * pErr and zero is returned.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pEnt - the entity structure to fill in
+ * 
+ *   ev - the lead/status byte
+ * 
+ *   a - the first parameter, or -1
+ * 
+ *   b - the second parameter, or -1
+ * 
+ *   delta - the delta time prior to the event
+ * 
+ *   pErr - receives the error code if failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int parseEvent(
+    SMFPARSE   * ps,
+    SMF_ENTITY * pEnt,
+    int          ev,
+    int          a,
+    int          b,
+    int32_t      delta,
+    int        * pErr) {
+  
+  int status = 1;
+  int check = 0;
+  int msg = 0;
+  int ch = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnt == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  if ((ev < 0) || (ev > 255)) {
+    fault(__LINE__);
+  }
+  if ((a < -1) || (a > 255)) {
+    fault(__LINE__);
+  }
+  if ((b < -1) || (b > 255)) {
+    fault(__LINE__);
+  }
+  if ((b >= 0) && (a < 0)) {
+    fault(__LINE__);
+  }
+  if ((delta < 0) || (delta > SMF_MAX_VARINT)) {
+    fault(__LINE__);
+  }
+  
+  /* Determine whether values are range-checked */
+  check = ((ps->opt).validate != SMF_VALIDATE_TRUSTED);
+  
+  /* Handle the different event classes */
+  if ((ev == 0xf0) || (ev == 0xf7)) {
+    /* System exclusive event, so there shouldn't be any parameters */
+    if ((a != -1) || (b != -1)) {
+      fault(__LINE__);
+    }
+    
+    /* Set the entity type, delta, and data buffer */
+    if (ev == 0xf0) {
+      pEnt->status = SMF_TYPE_SYSEX;
+      
+    } else if (ev == 0xf7) {
       pEnt->status = SMF_TYPE_SYSESC;
       
-    } else {
-      fault(__LINE__);
+    } else {
+      fault(__LINE__);
+    }
+    
+    pEnt->delta = delta;
+    pEnt->buf_len = ps->plen;
+    if (pEnt->buf_len > 0) {
+      pEnt->buf_ptr = (uint8_t *) ps->pPay;
+    } else {
+      pEnt->buf_ptr = NULL;
+    }
+    
+  } else if (ev == 0xff) {
+    /* Meta-event, so there should be an "A" parameter with the event
+     * type and no "B" parameter */
+    if ((a == -1) || (b != -1)) {
+      fault(__LINE__);
+    }
+    
+    /* Handle the different meta-events */
+    if (a == 0x00) {
+      /* Sequence Number, so there should be exactly two buffered data
+       * bytes */
+      if ((ps->plen < 2) || (check && (ps->plen != 2))) {
+        status = 0;
+        *pErr = SMF_ERR_SEQ_NUM;
+      }
+      
+      /* Decode the payload as a big-endian 16-bit value containing the
+       * sequence number */
+      if (status) {
+        pEnt->seq_num =
+          (((int32_t) (ps->pPay)[0]) << 8) |
+           ((int32_t) (ps->pPay)[1]);
+      }
+      
+      /* Also set the status and delta */
+      if (status) {
+        pEnt->status = SMF_TYPE_SEQ_NUM;
+        pEnt->delta = delta;
+      }
+      
+    } else if ((a >= 0x01) && (a <= 0x07)) {
+      /* One of the text events, so use the "A" parameter as the text
+       * subclass, and also set the status, delta, and data buffer */
+      pEnt->status = SMF_TYPE_TEXT;
+      pEnt->delta = delta;
+      pEnt->buf_len = ps->plen;
+      if (pEnt->buf_len > 0) {
+        pEnt->buf_ptr = (uint8_t *) ps->pPay;
+      } else {
+        pEnt->buf_ptr = NULL;
+      }
+      pEnt->txtype = a;
+      
+    } else if (a == 0x20) {
+      /* MIDI channel prefix, so there should be exactly one buffered
+       * data byte */
+      if ((ps->plen < 1) || (check && (ps->plen != 1))) {
+        status = 0;
+        *pErr = SMF_ERR_CH_PREFIX;
+      }
+      
+      /* Get the buffered data byte into "B" */
+      if (status) {
+        b = (ps->pPay)[0];
+      }
+      
+      /* The buffered data byte must be in range 0-15 */
+      if (status && check) {
+        if ((b < 0) || (b > 15)) {
+          status = 0;
+          *pErr = SMF_ERR_CH_PREFIX;
+        }
+      }
+      
+      /* Set the status, delta, and channel */
+      if (status) {
+        pEnt->status = SMF_TYPE_CH_PREFIX;
+        pEnt->delta = delta;
+        pEnt->ch = b;
+      }
+      
+    } else if (a == 0x2f) {
+      /* End Of Track, so there should be no buffered data bytes */
+      if (check && (ps->plen != 0)) {
+        status = 0;
+        *pErr = SMF_ERR_BAD_EOT;
+      }
+      
+      /* Verify that chunk remaining bytes are zero and then set to -1
+       * to leave the chunk */
+      if (status) {
+        if (ps->ckrem != 0) {
+          fault(__LINE__);
+        }
+        ps->ckrem = -1;
+      }
+      
+      /* Set the status and delta */
+      if (status) {
+        pEnt->status = SMF_TYPE_END_TRACK;
+        pEnt->delta = delta;
+      }
+      
+    } else if (a == 0x51) {
+      /* Set Tempo, so there should be exactly 3 data bytes */
+      if ((ps->plen < 3) || (check && (ps->plen != 3))) {
+        status = 0;
+        *pErr = SMF_ERR_SET_TEMPO;
+      }
+      
+      /* Verify the bytes aren't all zero, which is checked at every
+       * validation level because a tempo map can't use a zero tempo */
+      if (status) {
+        if (((ps->pPay)[0] == 0) && ((ps->pPay)[1] == 0) &&
+            ((ps->pPay)[2] == 0)) {
+          status = 0;
+          *pErr = SMF_ERR_SET_TEMPO;
+        }
+      }
+      
+      /* Set the status, delta, and beat duration */
+      if (status) {
+        pEnt->status = SMF_TYPE_TEMPO;
+        pEnt->delta = delta;
+        pEnt->beat_dur =
+          (((int32_t) (ps->pPay)[0]) << 16) |
+          (((int32_t) (ps->pPay)[1]) <<  8) |
+          (((int32_t) (ps->pPay)[2]));
+      }
+      
+    } else if (a == 0x54) {
+      /* SMPTE Offset, so there should be exactly 5 data bytes */
+      if ((ps->plen < 5) || (check && (ps->plen != 5))) {
+        status = 0;
+        *pErr = SMF_ERR_SMPTE_OFF;
+      }
+      
+      /* Clear the timecode structure and read the data bytes into it */
+      if (status) {
+        memset(&(ps->rTC), 0, sizeof(SMF_TIMECODE));
+        (ps->rTC).hour   = (ps->pPay)[0];
+        (ps->rTC).minute = (ps->pPay)[1];
+        (ps->rTC).second = (ps->pPay)[2];
+        (ps->rTC).frame  = (ps->pPay)[3];
+        (ps->rTC).ff     = (ps->pPay)[4];
+      }
+      
+      /* Check the ranges of all the fields */
+      if (status && check) {
+        if (((ps->rTC).hour   > 23) ||
+            ((ps->rTC).minute > 59) ||
+            ((ps->rTC).second > 59) ||
+            ((ps->rTC).frame  > 29) ||
+            ((ps->rTC).ff     > 99)) {
+          status = 0;
+          *pErr = SMF_ERR_SMPTE_OFF;
+        }
+      }
+      
+      /* If the MIDI file is in an SMPTE timing mode and the frame rate
+       * is 24 or 25, then enforce restricted range (the 29 value uses
+       * the same range as 30 because of drop-frame) */
+      if (status && check) {
+        if (((ps->head).ts.frame_rate >  0) &&
+            ((ps->head).ts.frame_rate < 29)) {
+          if ((ps->rTC).frame >= (ps->head).ts.frame_rate) {
+            status = 0;
+            *pErr = SMF_ERR_SMPTE_OFF;
+          }
+        }
+      }
+      
+      /* If the MIDI file is in SMPTE drop-frame timing and the minutes
+       * are neither zero nor divisible by 10, then enforce that neither
+       * frame 0 nor 1 are used because those timecodes are dropped */
+      if (status && check) {
+        if ((ps->head).ts.frame_rate == 29) {
+          if (((ps->rTC).minute % 10) != 0) {
+            if ((ps->rTC).frame < 2) {
+              status = 0;
+              *pErr = SMF_ERR_SMPTE_OFF;
+            }
+          }
+        }
+      }
+      
+      /* Set the status, delta, and timecode fields */
+      if (status) {
+        pEnt->status = SMF_TYPE_SMPTE;
+        pEnt->delta = delta;
+        pEnt->tcode = &(ps->rTC);
+      }
+      
+    } else if (a == 0x58) {
+      /* Time Signature, so there should be exactly 4 data bytes */
+      if ((ps->plen < 4) || (check && (ps->plen != 4))) {
+        status = 0;
+        *pErr = SMF_ERR_TIME_SIG;
+      }
+      
+      /* Clear the time signature structure and read the data bytes
+       * into it */
+      if (status) {
+        memset(&(ps->rTS), 0, sizeof(SMF_TIMESIG));
+        (ps->rTS).numerator = (ps->pPay)[0];
+        (ps->rTS).denominator = (ps->pPay)[1];
+        (ps->rTS).click = (ps->pPay)[2];
+        (ps->rTS).beat_unit = (ps->pPay)[3];
+      }
+      
+      /* Numerator, click, and beat unit should be at least one */
+      if (status && check) {
+        if (((ps->rTS).numerator < 1) ||
+            ((ps->rTS).click     < 1) ||
+            ((ps->rTS).beat_unit < 1)) {
+          status = 0;
+          *pErr = SMF_ERR_TIME_SIG;
+        }
+      }
+      
+      /* Denominator should not exceed 15 so we can safely perform the
+       * shifting, which is checked at every validation level */
+      if (status) {
+        if ((ps->rTS).denominator > 15) {
+          status = 0;
+          *pErr = SMF_ERR_TIME_SIG;
+        }
+      }
+      
+      /* Decode the denominator as a power of two, such that a
+       * denominator of 0 decodes to 1, 1 to 2, 2 to 4, 3 to 8, and so
+       * forth; then, make sure it is in range */
+      if (status) {
+        (ps->rTS).denominator = 1 << ((ps->rTS).denominator);
+        if (check && ((ps->rTS).denominator > SMF_MAX_TIME_DENOM)) {
+          status = 0;
+          *pErr = SMF_ERR_TIME_SIG;
+        }
+      }
+      
+      /* Set the status, delta, and time signature */
+      if (status) {
+        pEnt->status = SMF_TYPE_TIME_SIG;
+        pEnt->delta = delta;
+        pEnt->tsig = &(ps->rTS);
+      }
+      
+    } else if (a == 0x59) {
+      /* Key signature, so there should be exactly 2 data bytes */
+      if ((ps->plen < 2) || (check && (ps->plen != 2))) {
+        status = 0;
+        *pErr = SMF_ERR_KEY_SIG;
+      }
+      
+      /* Clear the key signature structure and read in the data bytes */
+      if (status) {
+        memset(&(ps->rKS), 0, sizeof(SMF_KEYSIG));
+        (ps->rKS).key = (ps->pPay)[0];
+        (ps->rKS).is_minor = (ps->pPay)[1];
+      }
+      
+      /* Decode the key value in two's-complement */
+      if (status) {
+        if ((ps->rKS).key > 0x7f) {
+          (ps->rKS).key = (ps->rKS).key - 0x100;
+        }
+      }
+      
+      /* Check ranges */
+      if (status && check) {
+        if (((ps->rKS).key < SMF_MIN_KEYSIG) ||
+            ((ps->rKS).key > SMF_MAX_KEYSIG)) {
+          status = 0;
+          *pErr = SMF_ERR_KEY_SIG;
+        }
+      }
+      if (status && check) {
+        if (((ps->rKS).is_minor != 1) &&
+            ((ps->rKS).is_minor != 0)) {
+          status = 0;
+          *pErr = SMF_ERR_KEY_SIG;
+        }
+      }
+      
+      /* Set the status, delta, and key signature */
+      if (status) {
+        pEnt->status = SMF_TYPE_KEY_SIG;
+        pEnt->delta = delta;
+        pEnt->ksig = &(ps->rKS);
+      }
+      
+    } else {
+      /* Sequencer-specific meta-event or some undocumented meta-event,
+       * so use a META entity and set the status, delta, data buffer,
+       * and meta_type */
+      pEnt->status = SMF_TYPE_META;
+      pEnt->delta = delta;
+      pEnt->buf_len = ps->plen;
+      if (pEnt->buf_len > 0) {
+        pEnt->buf_ptr = (uint8_t *) ps->pPay;
+      } else {
+        pEnt->buf_ptr = NULL;
+      }
+      pEnt->meta_type = a;
+    }
+    
+  } else if ((ev >= 0x80) && (ev <= 0xef)) {
+    /* MIDI message, so first split into a message and a channel */
+    msg = ev & 0xf0;
+    ch  = ev & 0x0f;
+    
+    /* Make sure that all messages except 0xC0 and 0xD0 have both
+     * parameters, and 0xC0 and 0xD0 have only the "A" parameter */
+    if ((msg == 0xc0) || (msg == 0xd0)) {
+      if ((a == -1) || (b != -1)) {
+        fault(__LINE__);
+      }
+    } else {
+      if ((a == -1) || (b == -1)) {
+        fault(__LINE__);
+      }
+    }
+    
+    /* Make sure that the defined parameters have their most significant
+     * bits clear, or just clear them if validation is trusted */
+    if (!check) {
+      a &= 0x7f;
+      if (b >= 0) {
+        b &= 0x7f;
+      }
+    }
+    
+    if (check && (a >= 0) && (a > 0x7f)) {
+      status = 0;
+      *pErr = SMF_ERR_MIDI_DATA;
+    }
+    if (status && check) {
+      if ((b >= 0) && (b > 0x7f)) {
+        status = 0;
+        *pErr = SMF_ERR_MIDI_DATA;
+      }
+    }
+    
+    /* Set the delta and channel for all MIDI messages */
+    if (status) {
+      pEnt->delta = delta;
+      pEnt->ch = ch;
+    }
+    
+    /* Set the status and message-specific data */
+    if (status) {
+      if (msg == 0x80) {
+        pEnt->status = SMF_TYPE_NOTE_OFF;
+        pEnt->key = a;
+        pEnt->val = b;
+        
+      } else if (msg == 0x90) {
+        pEnt->status = SMF_TYPE_NOTE_ON;
+        pEnt->key = a;
+        pEnt->val = b;
+        
+      } else if (msg == 0xa0) {
+        pEnt->status = SMF_TYPE_KEY_AFTERTOUCH;
+        pEnt->key = a;
+        pEnt->val = b;
+        
+      } else if (msg == 0xb0) {
+        pEnt->status = SMF_TYPE_CONTROL;
+        pEnt->ctl = a;
+        pEnt->val = b;
+        
+      } else if (msg == 0xc0) {
+        pEnt->status = SMF_TYPE_PROGRAM;
+        pEnt->val = a;
+        
+      } else if (msg == 0xd0) {
+        pEnt->status = SMF_TYPE_CH_AFTERTOUCH;
+        pEnt->val = a;
+        
+      } else if (msg == 0xe0) {
+        pEnt->status = SMF_TYPE_PITCH_BEND;
+        pEnt->bend = ((b << 7) | a) - 8192;
+        
+      } else {
+        fault(__LINE__);
+      }
+    }
+    
+  } else {
+    status = 0;
+    *pErr = SMF_ERR_BAD_EVENT;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Determine the SMF_TYPE_ constant of the entity that an event within a
+ * track will be parsed into.
+ * 
+ * Parameters:
+ * 
+ *   ev - the lead/status byte, which must be a valid event type
+ * 
+ *   a - the meta-event type for meta-events, ignored otherwise
+ * 
+ * Return:
+ * 
+ *   the SMF_TYPE_ constant
+ */
+static int eventType(int ev, int a) {
+  
+  int result = 0;
+  
+  if ((ev >= 0x80) && (ev <= 0xef)) {
+    result = SMF_TYPE_NOTE_OFF + ((ev >> 4) - 0x8);
+    
+  } else if (ev == 0xf0) {
+    result = SMF_TYPE_SYSEX;
+    
+  } else if (ev == 0xf7) {
+    result = SMF_TYPE_SYSESC;
+    
+  } else if (ev == 0xff) {
+    if (a == 0x00) {
+      result = SMF_TYPE_SEQ_NUM;
+    } else if ((a >= 0x01) && (a <= 0x07)) {
+      result = SMF_TYPE_TEXT;
+    } else if (a == 0x20) {
+      result = SMF_TYPE_CH_PREFIX;
+    } else if (a == 0x2f) {
+      result = SMF_TYPE_END_TRACK;
+    } else if (a == 0x51) {
+      result = SMF_TYPE_TEMPO;
+    } else if (a == 0x54) {
+      result = SMF_TYPE_SMPTE;
+    } else if (a == 0x58) {
+      result = SMF_TYPE_TIME_SIG;
+    } else if (a == 0x59) {
+      result = SMF_TYPE_KEY_SIG;
+    } else {
+      result = SMF_TYPE_META;
+    }
+    
+  } else {
+    fault(__LINE__);
+  }
+  
+  return result;
+}
+
+/*
+ * Determine whether an event within a track is removed by the event
+ * filter of a parser object and can be skipped without parsing it.
+ * 
+ * End Of Track is never skipped.  Set Tempo meta-events in the first
+ * track are not skipped if a tempo map is attached, because the tempo
+ * map needs them.  These might still be removed by the filter after
+ * they are parsed.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   ev - the lead/status byte, which must be a valid event type
+ * 
+ *   a - the meta-event type for meta-events, ignored otherwise
+ * 
+ * Return:
+ * 
+ *   non-zero if the event can be skipped, zero otherwise
+ */
+static int skipEvent(const SMFPARSE *ps, int ev, int a) {
+  
+  int t = 0;
+  int result = 0;
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Check the event type against the filter */
+  if (ps->filter != SMF_FILTER_ALL) {
+    t = eventType(ev, a);
+    if ((ps->filter & SMF_FILTER(t)) == 0) {
+      result = 1;
+    }
+    if ((t == SMF_TYPE_END_TRACK) ||
+        ((t == SMF_TYPE_TEMPO) &&
+          (ps->pTempo != NULL) && (ps->trkcount == 1))) {
+      result = 0;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Decode a channel message event directly from the input window of a
+ * source.
+ * 
+ * This is the fast path of readEvent() for the common case of MIDI
+ * channel messages, with or without running status, that lie well
+ * within both the input window and the current chunk.  If at least
+ * FAST_EVENT bytes are available in both, the delta time, the status
+ * byte, and the data bytes are decoded straight from memory, without
+ * going through readChunkByte() for each byte.
+ * 
+ * If the next event is not a channel message, if running status is
+ * needed but not available, if the delta time is malformed, or if there
+ * are not enough bytes available, nothing is consumed and zero is
+ * returned.  The caller should then use the generic path, which also
+ * reports any errors.
+ * 
+ * On success, the source window position and the ckrem field of the
+ * parser are advanced past the event, and the delta time, the status
+ * byte, and the "A" and "B" data bytes are written to the return
+ * parameters.  "B" is -1 for messages with only one data byte.  The
+ * data bytes are not checked, and running status is not updated.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the input source
+ * 
+ *   pDelta - receives the delta time
+ * 
+ *   pEv - receives the status byte
+ * 
+ *   pA - receives the "A" data byte
+ * 
+ *   pB - receives the "B" data byte, or -1
+ * 
+ * Return:
+ * 
+ *   non-zero if an event was decoded, zero if not
+ */
+static int fastEvent(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t   * pDelta,
+    int       * pEv,
+    int       * pA,
+    int       * pB) {
+  
+  int result = 0;
+  int c = 0;
+  int a = -1;
+  int b = -1;
+  int32_t i = 0;
+  int32_t delta = 0;
+  const uint8_t *p = NULL;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) ||
+      (pDelta == NULL) || (pEv == NULL) || (pA == NULL) || (pB == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Only proceed if a whole channel message of maximum length is
+   * available in both the window and the chunk */
+  if ((ps->ckrem >= FAST_EVENT) &&
+      (pSrc->blen - pSrc->bpos >= FAST_EVENT)) {
+    p = &((pSrc->pWin)[pSrc->bpos]);
+    
+    /* Decode the delta time, which must end within four bytes */
+    for(i = 0; i < 4; i++) {
+      delta = (delta << 7) | ((int32_t) (p[i] & 0x7f));
+      if (p[i] < 0x80) {
+        break;
+      }
+    }
+    
+    /* Decode the status byte, using running status if there is a data
+     * byte instead */
+    if (i < 4) {
+      i++;
+      c = p[i];
+      if (c < 0x80) {
+        if (ps->run >= 0) {
+          a = c;
+          c = ps->run;
+          i++;
+          result = 1;
+          STAT_ADD(ps, running, 1);
+        }
+        
+      } else if (c <= 0xef) {
+        i++;
+        result = 1;
+      }
+    }
+    
+    /* Decode the data bytes */
+    if (result) {
+      if (a < 0) {
+        a = p[i];
+        i++;
+      }
+      if ((c <= 0xbf) || (c >= 0xe0)) {
+        b = p[i];
+        i++;
+      }
+    }
+    
+    /* Consume the event */
+    if (result) {
+      pSrc->bpos += i;
+      ps->ckrem -= i;
+      
+      *pDelta = delta;
+      *pEv = c;
+      *pA = a;
+      *pB = b;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Read an event from within a track.
+ * 
+ * The parser state must have a status code of 1 and a ckrem value that
+ * is zero or greater.  The entity structure is assumed to be in a reset
+ * state.
+ * 
+ * If the event type is removed by the event filter (see skipEvent()),
+ * the event is skipped instead of parsed.  Then, *pSkip is set to
+ * non-zero and only the delta field of the entity is filled in.
+ * Otherwise, *pSkip is set to zero.
+ * 
+ * If the read operation fails, the entity is not modified and the
+ * parser status is not changed.  Instead, the error code is written to
+ * pErr and zero is returned.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pEnt - the entity to fill in
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   pSkip - receives whether the event was skipped
+ * 
+ *   pErr - receives an error code if there is a failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int readEvent(
+    SMFPARSE   * ps,
+    SMF_ENTITY * pEnt,
+    SMFSOURCE  * pSrc,
+    int        * pSkip,
+    int        * pErr) {
+  
+  int status = 1;
+  int skip = 0;
+  int fast = 0;
+  int c = 0;
+  int a = -1;
+  int b = -1;
+  int32_t delta = 0;
+  int32_t vl = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnt == NULL) ||
+      (pSrc == NULL) || (pSkip == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Clear skip return */
+  *pSkip = 0;
+  
+  /* Check state */
+  if ((ps->status != 1) || (ps->ckrem < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Reset payload */
+  ps->pPay = NULL;
+  ps->plen = 0;
+  
+  /* Decode channel messages straight from the input window if possible,
+   * else use the generic path below */
+  fast = fastEvent(ps, pSrc, &delta, &c, &a, &b);
+  if (fast) {
+    STAT_ADD(ps, fast, 1);
+  }
+  
+  /* Read the delta value */
+  if (!fast) {
+    delta = readChunkVar(pSrc, &(ps->ckrem), pErr);
+    if (delta < 0) {
+      status = 0;
+    }
+  }
+  
+  /* Read a byte to determine how to proceed */
+  if (status && (!fast)) {
+    c = readChunkByte(pSrc, &(ps->ckrem), pErr);
+    if (c < 0) {
+      status = 0;
+    }
+  }
+  
+  /* In lenient mode, data bytes without running status are discarded
+   * up to the next status byte, which then follows the delta time that
+   * was read before them */
+  if (status && (!fast) && (c < 0x80) && (ps->run < 0) &&
+      ((ps->opt).validate == SMF_VALIDATE_LENIENT)) {
+    (ps->repairs)++;
+    while (status && (c < 0x80)) {
+      c = readChunkByte(pSrc, &(ps->ckrem), pErr);
+      if (c < 0) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* If we got a byte that doesn't have its most significant bit set,
+   * then we need to retrieve a running status byte and set this byte we
+   * just read as the "A" byte */
+  if (status && (!fast) && (c < 0x80)) {
+    if (ps->run < 0) {
+      status = 0;
+      *pErr = SMF_ERR_RUN_STATUS;
+    }
+    
+    if (status) {
+      a = c;
+      c = ps->run;
+      STAT_ADD(ps, running, 1);
+    }
+  }
+  
+  /* Handle the different cases of status byte to read the whole
+   * message; we might already have read the "A" parameter for MIDI
+   * messages if running status was used */
+  if (status && (!fast)) {
+    if (((c >= 0x80) && (c <= 0xbf)) || ((c >= 0xe0) && (c <= 0xef))) {
+      /* MIDI message that has two parameters "A" and "B" */
+      if (a < 0) {
+        a = readChunkByte(pSrc, &(ps->ckrem), pErr);
+        if (a < 0) {
+          status = 0;
+        }
+      }
+      
+      if (status) {
+        b = readChunkByte(pSrc, &(ps->ckrem), pErr);
+        if (b < 0) {
+          status = 0;
+        }
+      }
+      
+    } else if ((c >= 0xc0) && (c <= 0xdf)) {
+      /* MIDI message that has one parameter "A" */
+      if (a < 0) {
+        a = readChunkByte(pSrc, &(ps->ckrem), pErr);
+        if (a < 0) {
+          status = 0;
+        }
+      }
+      
+    } else if ((c == 0xf0) || (c == 0xf7)) {
+      /* System-Exclusive event that has a variable-length size and then
+       * a payload which we read into the data buffer */
+      vl = readChunkVar(pSrc, &(ps->ckrem), pErr);
+      if (vl < 0) {
+        status = 0;
+      }
+      
+      /* Read the data payload, or skip over it if the event is filtered
+       * out and the payload is within the chunk */
+      if (status) {
+        if (skipEvent(ps, c, a) && (vl <= ps->ckrem)) {
+          skip = 1;
+          if (pSrc->is_mem && (vl > pSrc->blen - pSrc->bpos)) {
+            ps->need = pSrc->bpos + vl;
+          }
+          if (!smfsource_skip(pSrc, vl)) {
+            status = 0;
+            *pErr = SMF_ERR_IO;
+          }
+          if (status) {
+            ps->ckrem -= vl;
+          }
+          
+        } else {
+          if (!readPayload(ps, pSrc, vl, pErr)) {
+            status = 0;
+          }
+        }
+      }
+      
+    } else if (c == 0xff) {
+      /* Meta-event that has a type we will store in "A" (no running
+       * status allowed here) and then a variable-length size and then a
+       * payload which we read into the data buffer */
+      a = readChunkByte(pSrc, &(ps->ckrem), pErr);
+      if (a < 0) {
+        status = 0;
+      }
+      
+      if (status) {
+        vl = readChunkVar(pSrc, &(ps->ckrem), pErr);
+        if (vl < 0) {
+          status = 0;
+        }
+      }
+      
+      if (status) {
+        if (skipEvent(ps, c, a) && (vl <= ps->ckrem)) {
+          skip = 1;
+          if (pSrc->is_mem && (vl > pSrc->blen - pSrc->bpos)) {
+            ps->need = pSrc->bpos + vl;
+          }
+          if (!smfsource_skip(pSrc, vl)) {
+            status = 0;
+            *pErr = SMF_ERR_IO;
+          }
+          if (status) {
+            ps->ckrem -= vl;
+          }
+          
+        } else {
+          if (!readPayload(ps, pSrc, vl, pErr)) {
+            status = 0;
+          }
+        }
+      }
+      
+    } else {
+      /* Something invalid */
+      status = 0;
+      *pErr = SMF_ERR_BAD_EVENT;
+    }
+  }
+  
+  /* If we have a MIDI message status byte, update running status; else,
+   * clear running status */
+  if (status) {
+    if ((c >= 0x80) && (c <= 0xef)) {
+      ps->run = c;
+      
+    } else {
+      ps->run = -1;
+    }
+  }
+  
+  /* For the End Of Track meta-event (type 2F), skip any remaining data
+   * in the track */
+  if (status && (c == 0xff) && (a == 0x2f)) {
+    if (!smfsource_skip(pSrc, ps->ckrem)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+    if (status) {
+      ps->ckrem = 0;
+    }
+  }
+  
+  /* MIDI messages that are filtered out are skipped after checking
+   * their data bytes, unless validation is trusted */
+  if (status && (c >= 0x80) && (c <= 0xef)) {
+    if (skipEvent(ps, c, a)) {
+      if (((ps->opt).validate != SMF_VALIDATE_TRUSTED) &&
+          ((a > 0x7f) || (b > 0x7f))) {
+        status = 0;
+        *pErr = SMF_ERR_MIDI_DATA;
+      }
+      if (status) {
+        skip = 1;
+      }
+    }
+  }
+  
+  /* Parse the event, or just report the delta of a skipped event */
+  if (status) {
+    if (skip) {
+      pEnt->delta = delta;
+      *pSkip = 1;
+      
+    } else {
+      if (!parseEvent(ps, pEnt, c, a, b, delta, pErr)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Note the status byte of a failed event for the error report */
+  if (!status) {
+    if (c >= 0x80) {
+      ps->ebyte = c;
+    } else {
+      ps->ebyte = ps->run;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Read the next entity from a MIDI file.
+ * 
+ * This is the shared implementation of smfparse_read() and
+ * smfparse_read_batch().  The entity structure must already have been
+ * reset.  Any payload that is copied is appended to the data buffer.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pEnt - the reset entity structure to fill with parsing results
+ * 
+ *   pSrc - the input source to read from
+ */
+static void readEntity(SMFPARSE *ps, SMF_ENTITY *pEnt, SMFSOURCE *pSrc) {
+  
+  int status = 1;
+  int err_code = 0;
+  int skip = 0;
+  int32_t acc = 0;
+  int32_t blen = 0;
+  
+  uint32_t ck_type = 0;
+  int32_t ck_len = 0;
+  
+#ifdef SMF_ENABLE_STATS
+  int64_t pos = 0;
+  int64_t t0 = 0;
+#endif
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnt == NULL) || (pSrc == NULL)) {
+    fault(__LINE__);
+  }
+  
+#ifdef SMF_ENABLE_STATS
+  /* Note the input position and time, and attach the counters to the
+   * source so that it counts its callbacks */
+  if (ps->ckrem >= 0) {
+    pos = ps->foff - ps->ckrem;
+  } else {
+    pos = ps->foff;
+  }
+  if (ps->fClock != NULL) {
+    t0 = ps->fClock(ps->pClock);
+  }
+  pSrc->pStats = &(ps->stats);
+#endif
+  
+  /* Determine what to do */
+  if (ps->status < 0) {
+    /* We are in an error state, so just use that */
+    status = 0;
+    err_code = ps->status;
+    
+  } else if (ps->status == 0) {
+    /* We are in initial state, so read the header chunk */
+    if (!readHeaderChunk(ps, pSrc, &err_code)) {
+      status = 0;
+    }
+    
+    /* Change to header-read state */
+    if (status) {
+      ps->status = 1;
+    }
+    
+    /* Copy parsed header into header return structure */
+    if (status) {
+      memcpy(&(ps->rHead), &(ps->head), sizeof(SMF_HEADER));
+    }
+    
+    /* Set up header entity */
+    if (status) {
+      pEnt->status = SMF_TYPE_HEADER;
+      pEnt->pHead  = &(ps->rHead);
+    }
+    
+  } else if (ps->status == 2) {
+    /* We are in EOF state, so just use that */
+    pEnt->status = SMF_TYPE_EOF;
+    
+  } else if ((ps->status == 1) && (ps->ckrem < 0)) {
+    /* We've read the header but are outside of any chunk -- check first
+     * whether there's another declared track to read */
+    if (ps->trkcount < (ps->head).nTracks) {
+      /* More declared tracks remain to be read, so read a chunk
+       * header */
+      if (!readChunkHead(&ck_type, &ck_len, pSrc, &err_code)) {
+        status = 0;
+      }
+      
+      /* Make sure chunk is within the file size limit */
+      if (status) {
+        if (!addChunkLength(ps, ck_len, &err_code)) {
+          status = 0;
+        }
+      }
+      
+      /* Check the chunk type */
+      if (status) {
+        if (ck_type == UINT32_C(0x4d54726b)) {
+          /* Track chunk, so increase track count and load the track
+           * length */
+          (ps->trkcount)++;
+          ps->ckrem = ck_len;
+          
+          /* Return BEGIN_TRACK entity and reset running status */
+          pEnt->status = SMF_TYPE_BEGIN_TRACK;
+          ps->run = -1;
+          
+        } else if (ck_type == UINT32_C(0x4d546864)) {
+          /* Another MIDI header chunk, which shouldn't happen */
+          status = 0;
+          err_code = SMF_ERR_MULTI_HEAD;
+          
+        } else {
+          /* Unrecognized chunk type, which is OK, so skip its data
+           * payload and report it */
+          if (!smfsource_skip(pSrc, ck_len)) {
+            status = 0;
+            err_code = SMF_ERR_IO;
+          }
+          
+          if (status) {
+            pEnt->status = SMF_TYPE_CHUNK;
+            pEnt->chunk_type = ck_type;
+          }
+        }
+      }
+      
+    } else {
+      /* We've read all the declared tracks, so go to EOF state and
+       * return EOF */
+      ps->status = 2;
+      pEnt->status = SMF_TYPE_EOF;
+    }
+    
+  } else if ((ps->status == 1) && (ps->ckrem >= 0)) {
+    /* We're inside a track, so read events until one gets through the
+     * event filter, adding up the delta times of the ones that don't */
+    acc = 0;
+    skip = 1;
+    ps->ebyte = -1;
+    while (status && skip) {
+      blen = ps->blen;
+      if (!readEvent(ps, pEnt, pSrc, &skip, &err_code)) {
+        status = 0;
+      }
+      
+      /* In lenient mode, a track chunk that runs out without an End Of
+       * Track is closed here instead, dropping any partial event */
+      if ((!status) && (err_code == SMF_ERR_OPEN_TRACK) &&
+          ((ps->opt).validate == SMF_VALIDATE_LENIENT)) {
+        if (ps->ckrem != 0) {
+          fault(__LINE__);
+        }
+        (ps->repairs)++;
+        
+        status = 1;
+        skip = 0;
+        ps->ckrem = -1;
+        ps->run = -1;
+        ps->blen = blen;
+        ps->pPay = NULL;
+        ps->plen = 0;
+        
+        memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+        pEnt->status = SMF_TYPE_END_TRACK;
+        pEnt->delta = 0;
+      }
+      
+      /* A Set Tempo that was only parsed for the tempo map is added to
+       * the map here and then dropped, along with its payload */
+      if (status && (!skip) &&
+          (pEnt->status != SMF_TYPE_END_TRACK) &&
+          ((ps->filter & SMF_FILTER(pEnt->status)) == 0)) {
+        if (pEnt->status != SMF_TYPE_TEMPO) {
+          fault(__LINE__);
+        }
+        smftempo_add(ps->pTempo,
+          ps->tick + acc + pEnt->delta, pEnt->beat_dur);
+        
+        skip = 1;
+        ps->blen = blen;
+        ps->pPay = NULL;
+        ps->plen = 0;
+      }
+      
+      /* Add up the delta times */
+      if (status) {
+        if (pEnt->delta > INT32_MAX - acc) {
+          status = 0;
+          err_code = SMF_ERR_TIME_RANGE;
+          
+        } else if (skip) {
+          acc += pEnt->delta;
+          memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+          STAT_ADD(ps, filtered, 1);
+          
+        } else {
+          pEnt->delta += acc;
+        }
+      }
+    }
+    
+  } else {
+    fault(__LINE__);
+  }
+  
+  /* If status indicates failure, copy error code into entity, make sure
+   * that entity status is negative, and put the parser into the error
+   * state */
+  if (!status) {
+    if (err_code >= 0) {
+      fault(__LINE__);
+    }
+    
+    pEnt->status = err_code;
+    setError(ps, err_code);
+  }
+  
+  /* Keep track of time if successful */
+  if (status) {
+    trackTime(ps, pEnt);
+  }
+
+#ifdef SMF_ENABLE_STATS
+  /* Detach the counters from the source and count the entity, the input
+   * bytes it consumed, and the time it took */
+  pSrc->pStats = NULL;
+  
+  if (ps->ckrem >= 0) {
+    pos = ps->foff - ps->ckrem - pos;
+  } else {
+    pos = ps->foff - pos;
+  }
+  if (pos > 0) {
+    STAT_ADD(ps, bytes, pos);
+  }
+  
+  if (pEnt->status < 0) {
+    STAT_ADD(ps, errors, 1);
+  } else if (pEnt->status < SMF_STATS_TYPES) {
+    STAT_ADD(ps, entities[pEnt->status], 1);
+  } else {
+    fault(__LINE__);
+  }
+  
+  if (ps->fClock != NULL) {
+    STAT_ADD(ps, time, ps->fClock(ps->pClock) - t0);
+  }
+#endif
+}
+
+/*
+ * Describe the current parsing position of a parser object.
+ * 
+ * The code field is set to zero.  The status byte is the one noted for
+ * the last failed event if the parser is within a track.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pInfo - the structure to fill in
+ */
+static void describeState(const SMFPARSE *ps, SMF_ERRINFO *pInfo) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pInfo == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Describe the position */
+  memset(pInfo, 0, sizeof(SMF_ERRINFO));
+  
+  if (ps->ckrem >= 0) {
+    pInfo->offset      = ps->foff - ps->ckrem;
+    pInfo->track       = ps->trkcount - 1;
+    pInfo->tick        = ps->tick;
+    pInfo->status_byte = ps->ebyte;
+    
+  } else {
+    pInfo->offset      = ps->foff;
+    pInfo->track       = -1;
+    pInfo->tick        = -1;
+    pInfo->status_byte = -1;
+  }
+}
+
+/*
+ * Put a parser object into an error state.
+ * 
+ * If the parser is not already in an error state, the error is recorded
+ * for smfparse_error() and the error callback is called, unless it is
+ * being held back by smfparse_feed().  If the parser is already in an
+ * error state, only the status is updated.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   code - the error code
+ */
+static void setError(SMFPARSE *ps, int code) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (code >= 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Record the error on entering the error state */
+  if (ps->status >= 0) {
+    describeState(ps, &(ps->err));
+    (ps->err).code = code;
+    ps->status = code;
+    
+    if (!(ps->hold)) {
+      notifyError(ps);
+    }
+    
+  } else {
+    ps->status = code;
+  }
+}
+
+/*
+ * Call the error callback of a parser object, if there is one, with the
+ * recorded error.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object, which must be in an error state
+ */
+static void notifyError(SMFPARSE *ps) {
+  
+  SMF_ERRINFO info;
+  
+  memset(&info, 0, sizeof(SMF_ERRINFO));
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  if (ps->status >= 0) {
+    fault(__LINE__);
+  }
+  
+  /* Call through with a copy, so the record stays intact */
+  if (ps->fError != NULL) {
+    memcpy(&info, &(ps->err), sizeof(SMF_ERRINFO));
+    ps->fError(ps->pError, &info);
+  }
+}
+
+/*
+ * Reset the parsing state of a parser object back to the initial state
+ * it has after construction.
+ * 
+ * The options, the data buffer allocation, and the chunk index are
+ * kept.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ */
+static void resetParser(SMFPARSE *ps) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Reset state */
+  ps->status   = 0;
+  ps->ckrem    = -1;
+  ps->trkcount = 0;
+  ps->foff     = 0;
+  ps->blen     = 0;
+  ps->pPay     = NULL;
+  ps->plen     = 0;
+  ps->run      = -1;
+  ps->tick     = 0;
+  ps->repairs  = 0;
+  ps->ebyte    = -1;
+}
+
+/*
+ * Skip a source ahead by a distance that may exceed the 32-bit range of
+ * smfsource_skip().
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object
+ * 
+ *   skip - the non-negative skip distance
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if skip failed
+ */
+static int skipSource(SMFSOURCE *pSrc, int64_t skip) {
+  
+  int status = 1;
+  int32_t n = 0;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (skip < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Skip in pieces that fit in 32 bits */
+  while (status && (skip > 0)) {
+    if (skip > INT32_MAX) {
+      n = INT32_MAX;
+    } else {
+      n = (int32_t) skip;
+    }
+    
+    if (!smfsource_skip(pSrc, n)) {
+      status = 0;
+    }
+    skip -= n;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append a chunk to the chunk index of a parser object.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   type - the chunk type
+ * 
+ *   offset - the byte offset of the chunk header
+ * 
+ *   length - the length of the chunk data
+ */
+static void appendChunk(
+    SMFPARSE * ps,
+    uint32_t   type,
+    int64_t    offset,
+    int32_t    length) {
+  
+  int32_t cap = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (offset < 0) || (length < 0)) {
+    fault(__LINE__);
+  }
+  if (ps->icount >= INT32_MAX) {
+    fault(__LINE__);
+  }
+  
+  /* Make room in the index */
+  if (ps->icount >= ps->icap) {
+    cap = growCapacity(ps->icap, ps->icount + 1);
+    ps->pIdx = (SMF_CHUNK *) resizeBlockWith(
+                  &((ps->opt).alloc), ps->pIdx, cap, sizeof(SMF_CHUNK));
+    ps->icap = cap;
+  }
+  
+  /* Store the chunk */
+  (ps->pIdx)[ps->icount].type   = type;
+  (ps->pIdx)[ps->icount].offset = offset;
+  (ps->pIdx)[ps->icount].length = length;
+  (ps->icount)++;
+}
+
+/*
+ * Set up a parser object as if all chunks before a given track chunk
+ * had been parsed and the track had just begun.
+ * 
+ * The input source that is used with the parser must be positioned at
+ * the first byte of the track data.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   ph - the header of the MIDI file
+ * 
+ *   trk - the zero-based number of the track
+ * 
+ *   pc - the track chunk
+ */
+static void enterTrack(
+    SMFPARSE         * ps,
+    const SMF_HEADER * ph,
+    int32_t            trk,
+    const SMF_CHUNK  * pc) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (ph == NULL) || (pc == NULL)) {
+    fault(__LINE__);
+  }
+  if ((trk < 0) || (trk >= ph->nTracks) ||
+      (pc->offset < 0) || (pc->length < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Set up state */
+  resetParser(ps);
+  memcpy(&(ps->head), ph, sizeof(SMF_HEADER));
+  ps->status   = 1;
+  ps->ckrem    = pc->length;
+  ps->trkcount = trk + 1;
+  ps->foff     = pc->offset + 8 + pc->length;
+  ps->run      = -1;
+}
+
+/*
+ * Record a checkpoint of the current parsing state within a track.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object, which must be within a track
+ * 
+ *   trk - the zero-based number of the track
+ */
+static void appendCheckpoint(SMFPARSE *ps, int32_t trk) {
+  
+  int32_t cap = 0;
+  CHECKPOINT *pc = NULL;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (trk < 0)) {
+    fault(__LINE__);
+  }
+  if ((ps->status != 1) || (ps->ckrem < 0)) {
+    fault(__LINE__);
+  }
+  if (ps->ccount >= INT32_MAX) {
+    fault(__LINE__);
+  }
+  
+  /* Make room for the checkpoint */
+  if (ps->ccount >= ps->ccap) {
+    cap = growCapacity(ps->ccap, ps->ccount + 1);
+    ps->pCkpt = (CHECKPOINT *) resizeBlockWith(
+                  &((ps->opt).alloc), ps->pCkpt, cap, sizeof(CHECKPOINT));
+    ps->ccap = cap;
+  }
+  
+  /* Store the checkpoint */
+  pc = &((ps->pCkpt)[ps->ccount]);
+  (ps->ccount)++;
+  
+  pc->trk   = trk;
+  pc->pos   = ps->foff - ps->ckrem;
+  pc->tick  = ps->tick;
+  pc->ckrem = ps->ckrem;
+  pc->run   = ps->run;
+}
+
+/*
+ * Decode every track in the chunk index of a parser object and record
+ * checkpoints at the interval given by the checkpoint option.
+ * 
+ * The header of the parser object must hold the parsed header, which is
+ * copied into the index header.  The event filter and the tempo map are
+ * ignored while decoding.  Afterwards, the parser state is undefined
+ * and the position of the source is arbitrary.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the rewindable input source
+ * 
+ *   pErr - receives an error code if the function fails
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int buildCheckpoints(SMFPARSE *ps, SMFSOURCE *pSrc, int *pErr) {
+  
+  int status = 1;
+  int32_t trk = 0;
+  int32_t n = 0;
+  uint32_t filter = 0;
+  SMFTEMPO *pTempo = NULL;
+  const SMF_CHUNK *pc = NULL;
+  SMF_ENTITY ent;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  if ((ps->opt).checkpoint < 1) {
+    fault(__LINE__);
+  }
+  
+  /* Decode every event of every track */
+  memcpy(&(ps->ihead), &(ps->head), sizeof(SMF_HEADER));
+  filter = ps->filter;
+  pTempo = ps->pTempo;
+  ps->filter = SMF_FILTER_ALL;
+  ps->pTempo = NULL;
+  
+  for(trk = 0; status && (trk < (ps->ihead).nTracks); trk++) {
+    pc = indexedTrack(ps, trk);
+    
+    if (!smfsource_rewind(pSrc)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+    if (status) {
+      if (!skipSource(pSrc, pc->offset + 8)) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+      }
+    }
+    
+    if (status) {
+      enterTrack(ps, &(ps->ihead), trk, pc);
+    }
+    
+    for(n = 0; status; n++) {
+      if ((n % (ps->opt).checkpoint) == 0) {
+        appendCheckpoint(ps, trk);
+      }
+      
+      smfparse_read(ps, &ent, pSrc);
+      if (ent.status < 0) {
+        status = 0;
+        *pErr = ent.status;
+      } else if (ent.status == SMF_TYPE_END_TRACK) {
+        break;
+      }
+    }
+  }
+  
+  ps->filter = filter;
+  ps->pTempo = pTempo;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Find a track chunk in the chunk index of a parser object.
+ * 
+ * The index must cover the track, which it always does for the tracks
+ * that the header declares.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object that has an index, or is building one
+ * 
+ *   trk - the zero-based number of the track
+ * 
+ * Return:
+ * 
+ *   the track chunk in the index
+ */
+static const SMF_CHUNK *indexedTrack(SMFPARSE *ps, int32_t trk) {
+  
+  int32_t i = 0;
+  int32_t tracks = 0;
+  const SMF_CHUNK *pc = NULL;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (trk < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Count the track chunks until the requested one */
+  for(i = 0; i < ps->icount; i++) {
+    if ((ps->pIdx)[i].type == UINT32_C(0x4d54726b)) {
+      if (tracks == trk) {
+        pc = &((ps->pIdx)[i]);
+        break;
+      }
+      tracks++;
+    }
+  }
+  if (pc == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Return the chunk */
+  return pc;
+}
+
+/*
+ * Make a copy of the track chunks in the chunk index of a parser
+ * object.
+ * 
+ * The index must contain exactly the given number of track chunks,
+ * which must be at least one.  The returned array should be released
+ * with free().
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object that has an index
+ * 
+ *   count - the number of track chunks
+ * 
+ * Return:
+ * 
+ *   a dynamically allocated array of the track chunks
+ */
+static SMF_CHUNK *trackChunks(SMFPARSE *ps, int32_t count) {
+  
+  SMF_CHUNK *pTracks = NULL;
+  const SMF_CHUNK *pc = NULL;
+  int32_t i = 0;
+  int32_t j = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (count < 1)) {
+    fault(__LINE__);
+  }
+  if (!(ps->has_index)) {
+    fault(__LINE__);
+  }
+  
+  /* Copy the track chunks */
+  pTracks = (SMF_CHUNK *) resizeBlock(NULL, count, sizeof(SMF_CHUNK));
+  
+  for(i = 0; i < ps->icount; i++) {
+    pc = &((ps->pIdx)[i]);
+    if (pc->type == UINT32_C(0x4d54726b)) {
+      if (j >= count) {
+        fault(__LINE__);
+      }
+      memcpy(&(pTracks[j]), pc, sizeof(SMF_CHUNK));
+      j++;
+    }
+  }
+  if (j != count) {
+    fault(__LINE__);
+  }
+  
+  return pTracks;
+}
+
+/*
+ * Run a worker of a parallel decoding job.
+ * 
+ * The worker keeps taking the next track from the job and decoding it
+ * with its own parser object and a memory source over the track data,
+ * until there are no tracks left.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ */
+static void runWorker(PARALLEL_JOB *pj) {
+  
+  int32_t trk = 0;
+  int64_t start = 0;
+  int64_t avail = 0;
+  int result = 0;
+  const SMF_CHUNK *pc = NULL;
+  
+  SMFPARSE *ps = NULL;
+  SMF_TRACK *pt = NULL;
+  SMFSOURCE *pSrc = NULL;
+  
+  /* Check parameters */
+  if (pj == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate the decoder state of this worker */
+  ps = smfparse_alloc_ex(&(pj->opt));
+  pt = smftrack_alloc();
+  
+  /* Decode tracks until there are none left */
+  for(;;) {
+    /* Take the next track */
+#ifdef SMF_POSIX
+    if (pj->threaded) {
+      if (pthread_mutex_lock(&(pj->lock))) {
+        fault(__LINE__);
+      }
+    }
+#endif
+    
+    trk = pj->next;
+    if (trk < (pj->head).nTracks) {
+      (pj->next)++;
+    }
+
+#ifdef SMF_POSIX
+    if (pj->threaded) {
+      if (pthread_mutex_unlock(&(pj->lock))) {
+        fault(__LINE__);
+      }
+    }
+#endif
+    
+    if (trk >= (pj->head).nTracks) {
+      break;
+    }
+    
+    /* Make a source over the part of the track data that is actually
+     * present, so that a truncated file reports EOF as usual */
+    pc = &((pj->pTracks)[trk]);
+    start = pc->offset + 8;
+    avail = pj->len - start;
+    if (avail > pc->length) {
+      avail = pc->length;
+    }
+    
+    if (avail > 0) {
+      pSrc = smfsource_new_memory(&((pj->pData)[start]), avail);
+    } else {
+      pSrc = smfsource_new_memory(NULL, 0);
+    }
+    
+    /* Decode the track and pass it to the callback */
+    enterTrack(ps, &(pj->head), trk, pc);
+    result = smfparse_read_track(ps, pt, pSrc);
+    smfsource_close(pSrc);
+    pSrc = NULL;
+    
+    pj->fTrack(pj->pCustom, trk, result, pt);
+    
+    /* Record the error if this is the lowest-numbered failing track */
+    if (result < 0) {
+#ifdef SMF_POSIX
+      if (pj->threaded) {
+        if (pthread_mutex_lock(&(pj->lock))) {
+          fault(__LINE__);
+        }
+      }
+#endif
+      
+      if ((pj->err_trk < 0) || (trk < pj->err_trk)) {
+        pj->err = result;
+        pj->err_trk = trk;
+      }
+
+#ifdef SMF_POSIX
+      if (pj->threaded) {
+        if (pthread_mutex_unlock(&(pj->lock))) {
+          fault(__LINE__);
+        }
+      }
+#endif
+    }
+  }
+  
+  /* Release the decoder state */
+  smftrack_free(pt);
+  smfparse_free(ps);
+}
+
+#ifdef SMF_POSIX
+
+/*
+ * Thread entry point for the additional workers of a parallel decoding
+ * job.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the job
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *parallel_thread(void *pArg) {
+  runWorker((PARALLEL_JOB *) pArg);
+  return NULL;
+}
+
+#endif
+
+/*
+ * Open an input source for one file of a batch parsing job.
+ * 
+ * Files in memory and files on disk that fit into the read buffer of
+ * the worker are read through pMem, the reusable memory source of the
+ * worker, which is pointed at the file bytes.  Files on disk are first
+ * read into the buffer *ppBuf with capacity *pCap, which grows as
+ * needed.  Bytes more than one chunk header beyond the max_file limit
+ * are not read, since they could never be parsed anyway, while the
+ * chunk header that crosses the limit is still read so that the parser
+ * reports SMF_ERR_HUGE_FILE for it just like on every other path.
+ * Files on disk that are still too big for the buffer get a new handle
+ * source of their own instead, which the caller must close.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   pf - the file to open
+ * 
+ *   pMem - the reusable memory source of the worker
+ * 
+ *   ppBuf - the read buffer of the worker
+ * 
+ *   pCap - the capacity of the read buffer
+ * 
+ *   pErr - receives an error code if there is a failure
+ * 
+ * Return:
+ * 
+ *   the source to read the file from, which is either pMem or a new
+ *   source, or NULL if the file could not be opened
+ */
+static SMFSOURCE *openBatchFile(
+    const BATCH_JOB      * pj,
+    const SMF_BATCH_FILE * pf,
+    SMFSOURCE            * pMem,
+    uint8_t             ** ppBuf,
+    int32_t              * pCap,
+    int                  * pErr) {
+  
+  int status = 1;
+  int32_t new_cap = 0;
+  int64_t len = 0;
+  FILE *fh = NULL;
+  const uint8_t *pData = NULL;
+  SMFSOURCE *pSrc = NULL;
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pf == NULL) || (pMem == NULL) ||
+      (ppBuf == NULL) || (pCap == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Files in memory are used in place */
+  if (pf->pPath == NULL) {
+    pData = (const uint8_t *) pf->pData;
+    len = pf->len;
+  }
+  
+  /* Open files on disk and determine how much of them to read */
+  if (pf->pPath != NULL) {
+    fh = fopen(pf->pPath, "rb");
+    if (fh == NULL) {
+      status = 0;
+      *pErr = SMF_ERR_OPEN_FILE;
+    }
+    
+    if (status) {
+      len = startHandle(fh);
+      if (len < 0) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+      }
+    }
+    
+    if (status) {
+      if ((len > (pj->opt).max_file) &&
+          (len - (pj->opt).max_file > 8)) {
+        len = (pj->opt).max_file + 8;
+      }
+    }
+  }
+  
+  /* Read files on disk that fit into the read buffer */
+  if (status && (fh != NULL) && (len <= INT32_MAX)) {
+    if (len > *pCap) {
+      new_cap = growCapacity(*pCap, (int32_t) len);
+      *ppBuf = (uint8_t *) resizeBlockWith(
+                  &((pj->opt).alloc), *ppBuf, new_cap, 1);
+      *pCap = new_cap;
+    }
+    
+    if (len > 0) {
+      if (fread(*ppBuf, 1, (size_t) len, fh) != (size_t) len) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+      }
+    }
+    
+    pData = *ppBuf;
+    fclose(fh);
+    fh = NULL;
+  }
+  
+  /* Give bigger files on disk a handle source, which takes ownership
+   * of the file handle; otherwise, point the memory source at the
+   * bytes */
+  if (status && (fh != NULL)) {
+    pSrc = smfsource_new_handle_ex(fh, 1, 1, &((pj->opt).alloc), pErr);
+    fh = NULL;
+    
+  } else if (status) {
+    if (len > 0) {
+      smfsource_rebind_memory(pMem, pData, len);
+    } else {
+      smfsource_rebind_memory(pMem, NULL, 0);
+    }
+    pSrc = pMem;
+  }
+  
+  /* Close the file if it is still open after a failure */
+  if (fh != NULL) {
+    fclose(fh);
+    fh = NULL;
+  }
+  
+  /* Return the source or NULL */
+  return pSrc;
+}
+
+/*
+ * Run a worker of a batch parsing job.
+ * 
+ * The worker keeps taking the next file from the job and parsing it
+ * with its own parser object, memory source, and read buffer, which
+ * are reused for every file, until there are no files left.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ */
+static void runBatch(BATCH_JOB *pj) {
+  
+  int more = 0;
+  int result = 0;
+  int32_t i = 0;
+  int32_t cap = 0;
+  uint8_t *pBuf = NULL;
+  
+  SMF_ENTITY ent;
+  SMFPARSE *ps = NULL;
+  SMFSOURCE *pMem = NULL;
+  SMFSOURCE *pSrc = NULL;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  /* Check parameters */
+  if (pj == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate the parsing state of this worker */
+  ps = smfparse_alloc_ex(&(pj->opt));
+  smfparse_set_filter(ps, pj->mask);
+  pMem = newMemorySource(NULL, 0, NULL, NULL, &((pj->opt).alloc));
+  
+  /* Parse files until there are none left */
+  for(;;) {
+    /* Take the next file */
+#ifdef SMF_POSIX
+    if (pj->threaded) {
+      if (pthread_mutex_lock(&(pj->lock))) {
+        fault(__LINE__);
+      }
+    }
+#endif
+    
+    i = pj->next;
+    if (i < pj->count) {
+      (pj->next)++;
+    }
+
+#ifdef SMF_POSIX
+    if (pj->threaded) {
+      if (pthread_mutex_unlock(&(pj->lock))) {
+        fault(__LINE__);
+      }
+    }
+#endif
+    
+    if (i >= pj->count) {
+      break;
+    }
+    
+    /* Open the file */
+    result = 0;
+    pSrc = openBatchFile(
+              pj, &((pj->pFiles)[i]), pMem, &pBuf, &cap, &result);
+    
+    /* Parse the file from the start, passing each entity to the
+     * callback, until EOF, an error, or the callback stops it */
+    if (pSrc != NULL) {
+      smfparse_reset(ps);
+      more = 1;
+      while (more) {
+        smfparse_read(ps, &ent, pSrc);
+        if (ent.status <= 0) {
+          more = 0;
+        }
+        if (pj->fEntity != NULL) {
+          if (!(pj->fEntity(pj->pCustom, i, &ent))) {
+            more = 0;
+          }
+        }
+      }
+      if (ent.status < 0) {
+        result = ent.status;
+      }
+      
+      if (pSrc != pMem) {
+        smfsource_close(pSrc);
+      }
+      pSrc = NULL;
+    }
+    
+    /* Report the result */
+    if (pj->pResults != NULL) {
+      (pj->pResults)[i] = result;
+    }
+    if (pj->fFile != NULL) {
+      pj->fFile(pj->pCustom, i, result);
+    }
+    
+    /* Count the file if it failed */
+    if (result < 0) {
+#ifdef SMF_POSIX
+      if (pj->threaded) {
+        if (pthread_mutex_lock(&(pj->lock))) {
+          fault(__LINE__);
+        }
+      }
+#endif
+      
+      (pj->failed)++;
+
+#ifdef SMF_POSIX
+      if (pj->threaded) {
+        if (pthread_mutex_unlock(&(pj->lock))) {
+          fault(__LINE__);
+        }
+      }
+#endif
+    }
+  }
+  
+  /* Release the parsing state */
+  if (pBuf != NULL) {
+    memFree(&((pj->opt).alloc), pBuf);
+    pBuf = NULL;
+  }
+  smfsource_close(pMem);
+  smfparse_free(ps);
+}
+
+#ifdef SMF_POSIX
+
+/*
+ * Thread entry point for the additional workers of a batch parsing
+ * job.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the job
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *batch_thread(void *pArg) {
+  runBatch((BATCH_JOB *) pArg);
+  return NULL;
+}
+
+#endif
+
+/*
+ * Update the time state of a parser object after an entity has been
+ * read successfully.
+ * 
+ * This maintains the absolute tick offset within the current track,
+ * stores it in the entity, and builds the attached tempo map, if there
+ * is one.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pEnt - the entity that was read
+ */
+static void trackTime(SMFPARSE *ps, SMF_ENTITY *pEnt) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnt == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Update the tick offset and report it in the entity */
+  if (pEnt->status == SMF_TYPE_BEGIN_TRACK) {
+    ps->tick = 0;
+    pEnt->tick = 0;
+  } else if (pEnt->delta >= 0) {
+    ps->tick += (int64_t) pEnt->delta;
+    pEnt->tick = ps->tick;
+  }
+  
+  /* Update the tempo map */
+  if (ps->pTempo != NULL) {
+    if (pEnt->status == SMF_TYPE_HEADER) {
+      smftempo_clear(ps->pTempo, &((pEnt->pHead)->ts));
+      
+    } else if ((pEnt->status == SMF_TYPE_TEMPO) &&
+                (ps->trkcount == 1)) {
+      smftempo_add(ps->pTempo, ps->tick, pEnt->beat_dur);
+    }
+  }
+}
+
+/*
+ * Compute the time of a tempo change in a tempo map from the tempo
+ * change before it.
+ * 
+ * The first tempo change is always at time zero.
+ * 
+ * Parameters:
+ * 
+ *   pm - the tempo map
+ * 
+ *   i - the index of the tempo change
+ */
+static void timeTempo(SMFTEMPO *pm, int32_t i) {
+  
+  const TEMPO_POINT *pPrev = NULL;
+  TEMPO_POINT *pt = NULL;
+  int64_t dt = 0;
+  int64_t den = 0;
+  int64_t r = 0;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  if ((i < 0) || (i >= pm->count)) {
+    fault(__LINE__);
+  }
+  
+  /* Compute the time */
+  pt = &((pm->pPt)[i]);
+  if ((i < 1) || ((pm->ts).subdiv < 1)) {
+    pt->us  = 0;
+    pt->rem = 0;
+    
+  } else {
+    /* Split the tick distance so that the products can't overflow */
+    pPrev = &((pm->pPt)[i - 1]);
+    den = (int64_t) (pm->ts).subdiv;
+    dt = pt->tick - pPrev->tick;
+    r = pPrev->rem + ((dt % den) * pPrev->beat_dur);
+    
+    pt->us  = pPrev->us + ((dt / den) * pPrev->beat_dur) + (r / den);
+    pt->rem = (int32_t) (r % den);
+  }
+}
+
+/*
+ * Check whether the waiting event of one cursor of a merger comes before
+ * the waiting event of another cursor.
+ * 
+ * Parameters:
+ * 
+ *   pm - the merger
+ * 
+ *   a - the index of the first cursor
+ * 
+ *   b - the index of the second cursor
+ * 
+ * Return:
+ * 
+ *   non-zero if the event of cursor a comes first, zero otherwise
+ */
+static int mergeBefore(const SMFMERGE *pm, int32_t a, int32_t b) {
+  
+  int64_t ta = 0;
+  int64_t tb = 0;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  if ((a < 0) || (a >= pm->ntrk) || (b < 0) || (b >= pm->ntrk)) {
+    fault(__LINE__);
+  }
+  
+  /* Compare the tick offsets and then the track numbers */
+  ta = (pm->pCur)[a].tick;
+  tb = (pm->pCur)[b].tick;
+  
+  return ((ta < tb) || ((ta == tb) && (a < b)));
+}
+
+/*
+ * Add a cursor that has an event waiting to the heap of a merger.
+ * 
+ * Parameters:
+ * 
+ *   pm - the merger
+ * 
+ *   c - the index of the cursor
+ */
+static void mergePush(SMFMERGE *pm, int32_t c) {
+  
+  int32_t i = 0;
+  int32_t parent = 0;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  if ((c < 0) || (c >= pm->ntrk) || (pm->hcount >= pm->ntrk)) {
+    fault(__LINE__);
+  }
+  
+  /* Sift the new element up */
+  i = pm->hcount;
+  (pm->hcount)++;
+  
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!mergeBefore(pm, c, (pm->pHeap)[parent])) {
+      break;
+    }
+    (pm->pHeap)[i] = (pm->pHeap)[parent];
+    i = parent;
+  }
+  
+  (pm->pHeap)[i] = c;
+}
+
+/*
+ * Remove the cursor with the earliest waiting event from the heap of a
+ * merger.
+ * 
+ * The heap must not be empty.
+ * 
+ * Parameters:
+ * 
+ *   pm - the merger
+ * 
+ * Return:
+ * 
+ *   the index of the cursor that was removed
+ */
+static int32_t mergePop(SMFMERGE *pm) {
+  
+  int32_t result = 0;
+  int32_t c = 0;
+  int32_t i = 0;
+  int32_t child = 0;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  if (pm->hcount < 1) {
+    fault(__LINE__);
+  }
+  
+  /* Take the root and sift the last element down from the root */
+  result = (pm->pHeap)[0];
+  (pm->hcount)--;
+  
+  if (pm->hcount > 0) {
+    c = (pm->pHeap)[pm->hcount];
+    i = 0;
+    
+    for(;;) {
+      child = (2 * i) + 1;
+      if (child >= pm->hcount) {
+        break;
+      }
+      if (child + 1 < pm->hcount) {
+        if (mergeBefore(pm, (pm->pHeap)[child + 1], (pm->pHeap)[child])) {
+          child++;
+        }
+      }
+      if (!mergeBefore(pm, (pm->pHeap)[child], c)) {
+        break;
+      }
+      (pm->pHeap)[i] = (pm->pHeap)[child];
+      i = child;
+    }
+    
+    (pm->pHeap)[i] = c;
+  }
+  
+  return result;
+}
+
+/*
+ * Read the next event of a track into its cursor and add the cursor to
+ * the heap of a merger.
+ * 
+ * If the tracks are read from the shared input source, the source is
+ * positioned for the cursor first, if necessary.
+ * 
+ * Parameters:
+ * 
+ *   pm - the merger
+ * 
+ *   c - the index of the cursor
+ * 
+ * Return:
+ * 
+ *   zero or a negative error code
+ */
+static int mergeAdvance(SMFMERGE *pm, int32_t c) {
+  
+  int err = 0;
+  MERGE_CURSOR *pc = NULL;
+  SMFSOURCE *pSrc = NULL;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  if ((c < 0) || (c >= pm->ntrk)) {
+    fault(__LINE__);
+  }
+  
+  pc = &((pm->pCur)[c]);
+  
+  /* Determine the source, positioning the shared source if it was last
+   * used for another cursor */
+  if (pc->pSub != NULL) {
+    pSrc = pc->pSub;
+    
+  } else {
+    pSrc = pm->pSrc;
+    if (pm->owner != c) {
+      pm->owner = -1;
+      if (!smfsource_rewind(pSrc)) {
+        err = SMF_ERR_IO;
+      }
+      if (!err) {
+        if (!skipSource(pSrc,
+              (pc->ck).offset + 8 + ((pc->ck).length - (pc->ps)->ckrem))) {
+          err = SMF_ERR_IO;
+        }
+      }
+      if (!err) {
+        pm->owner = c;
+      }
+    }
+  }
+  
+  /* Read the event and queue the cursor */
+  if (!err) {
+    smfparse_read(pc->ps, &(pc->ent), pSrc);
+    if ((pc->ent).status < 0) {
+      err = (pc->ent).status;
+    }
+  }
+  
+  if (!err) {
+    if ((pc->ent).status < SMF_TYPE_END_TRACK) {
+      fault(__LINE__);
+    }
+    pc->tick += (int64_t) (pc->ent).delta;
+    mergePush(pm, c);
+  }
+  
+  return err;
+}
+
+/*
+ * End the sounding note of a channel and key in a note pairing engine
+ * at the current tick offset, and queue its note span.
+ * 
+ * The slot must have a sounding note.
+ * 
+ * Parameters:
+ * 
+ *   pn - the note pairing engine
+ * 
+ *   ch - the channel
+ * 
+ *   key - the key
+ * 
+ *   off_vel - the release velocity, or -1 if none
+ */
+static void closeNote(SMFNOTES *pn, int ch, int key, int off_vel) {
+  
+  NOTE_SLOT *pSlot = NULL;
+  SMF_NOTE *pNote = NULL;
+  
+  /* Check parameters */
+  if (pn == NULL) {
+    fault(__LINE__);
+  }
+  if ((ch < 0) || (ch > 15) || (key < 0) || (key > SMF_MAX_DATA)) {
+    fault(__LINE__);
+  }
+  
+  pSlot = &((pn->slot)[ch][key]);
+  if (pSlot->depth < 1) {
+    fault(__LINE__);
+  }
+  
+  /* Make room in the queue */
+  if (pn->qlen >= pn->qcap) {
+    if (pn->qlen >= INT32_MAX) {
+      fault(__LINE__);
+    }
+    pn->qcap = growCapacity(pn->qcap, pn->qlen + 1);
+    pn->pQ = (SMF_NOTE *) resizeBlock(pn->pQ, pn->qcap, sizeof(SMF_NOTE));
+  }
+  
+  /* Queue the note span */
+  pNote = &((pn->pQ)[pn->qlen]);
+  (pn->qlen)++;
+  
+  pNote->start   = pSlot->start;
+  pNote->dur     = pn->tick - pSlot->start;
+  pNote->trk     = pn->trk;
+  pNote->ch      = ch;
+  pNote->key     = key;
+  pNote->on_vel  = pSlot->vel;
+  pNote->off_vel = off_vel;
+  
+  /* Clear the slot */
+  pSlot->start = 0;
+  pSlot->vel   = 0;
+  pSlot->depth = 0;
+  (pn->sounding)--;
+}
+
+/*
+ * End all sounding notes in a note pairing engine at the current tick
+ * offset, in order of channel and then key.
+ * 
+ * Parameters:
+ * 
+ *   pn - the note pairing engine
+ */
+static void closeAllNotes(SMFNOTES *pn) {
+  
+  int ch = 0;
+  int key = 0;
+  
+  /* Check parameters */
+  if (pn == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Close every sounding note */
+  for(ch = 0; (ch < 16) && (pn->sounding > 0); ch++) {
+    for(key = 0; key <= SMF_MAX_DATA; key++) {
+      if ((pn->slot)[ch][key].depth > 0) {
+        closeNote(pn, ch, key, -1);
+      }
+    }
+  }
+}
+
+/*
+ * Set a chase state to the initial state, before any events.
+ * 
+ * Parameters:
+ * 
+ *   pst - the state to clear
+ */
+static void clearChase(CHASE_STATE *pst) {
+  
+  int ch = 0;
+  int ctl = 0;
+  
+  /* Check parameters */
+  if (pst == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Clear the state */
+  memset(pst, 0, sizeof(CHASE_STATE));
+  for(ch = 0; ch < 16; ch++) {
+    for(ctl = 0; ctl <= SMF_MAX_DATA; ctl++) {
+      (pst->ctl)[ch][ctl] = -1;
+    }
+    (pst->program)[ch] = -1;
+    (pst->pressure)[ch] = -1;
+    (pst->bend)[ch] = 0;
+  }
+  pst->beat_dur = -1;
+}
+
+/*
+ * Apply a state change to a chase state.
+ * 
+ * Parameters:
+ * 
+ *   pst - the state to update
+ * 
+ *   pc - the state change
+ */
+static void applyChase(CHASE_STATE *pst, const CHASE_CHANGE *pc) {
+  
+  int key = 0;
+  
+  /* Check parameters */
+  if ((pst == NULL) || (pc == NULL)) {
+    fault(__LINE__);
+  }
+  if ((pc->ch > 15) || (pc->ctl > SMF_MAX_DATA)) {
+    fault(__LINE__);
+  }
+  
+  /* Apply the change */
+  switch (pc->type) {
+    case SMF_TYPE_CONTROL:
+      (pst->ctl)[pc->ch][pc->ctl] = (int16_t) pc->val;
+      break;
+    
+    case SMF_TYPE_PROGRAM:
+      (pst->program)[pc->ch] = (int16_t) pc->val;
+      break;
+    
+    case SMF_TYPE_CH_AFTERTOUCH:
+      (pst->pressure)[pc->ch] = (int16_t) pc->val;
+      break;
+    
+    case SMF_TYPE_PITCH_BEND:
+      (pst->bend)[pc->ch] = (int16_t) pc->val;
+      break;
+    
+    case SMF_TYPE_TEMPO:
+      pst->beat_dur = pc->val;
+      break;
+    
+    case SMF_TYPE_TIME_SIG:
+      pst->has_time_sig = 1;
+      (pst->tsig).numerator   = (int) (pc->val & 0xff);
+      (pst->tsig).click       = (int) ((pc->val >> 8) & 0xff);
+      (pst->tsig).beat_unit   = (int) ((pc->val >> 16) & 0xff);
+      (pst->tsig).denominator = 1 << ((pc->val >> 24) & 0xff);
+      break;
+    
+    case SMF_TYPE_KEY_SIG:
+      key = (int) (pc->val & 0xff);
+      if (key > 127) {
+        key -= 256;
+      }
+      pst->has_key_sig = 1;
+      (pst->ksig).key      = key;
+      (pst->ksig).is_minor = (int) ((pc->val >> 8) & 0x1);
+      break;
+    
+    default:
+      fault(__LINE__);
+  }
+}
+
+/*
+ * Append the state change of an entity to a chase object.
+ * 
+ * Entities that do not affect the chase state are ignored, and so are
+ * Control Change messages with a controller number out of range, which
+ * the parser never returns.
+ * 
+ * Parameters:
+ * 
+ *   pc - the chase object
+ * 
+ *   pEnt - the entity
+ * 
+ *   tick - the absolute tick offset of the entity
+ * 
+ * Return:
+ * 
+ *   non-zero if a state change was appended, zero if the entity was
+ *   ignored
+ */
+static int recordChase(
+    SMFCHASE         * pc,
+    const SMF_ENTITY * pEnt,
+    int64_t            tick) {
+  
+  int result = 1;
+  int32_t val = 0;
+  int32_t d = 0;
+  int ctl = 0;
+  CHASE_CHANGE *pChg = NULL;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pEnt == NULL) || (tick < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Determine the value of the change */
+  switch (pEnt->status) {
+    case SMF_TYPE_CONTROL:
+      ctl = pEnt->ctl;
+      if ((ctl < 0) || (ctl > SMF_MAX_DATA)) {
+        result = 0;
+      }
+      val = (int32_t) pEnt->val;
+      break;
+    
+    case SMF_TYPE_PROGRAM:
+    case SMF_TYPE_CH_AFTERTOUCH:
+      val = (int32_t) pEnt->val;
+      break;
+    
+    case SMF_TYPE_PITCH_BEND:
+      val = (int32_t) pEnt->bend;
+      break;
+    
+    case SMF_TYPE_TEMPO:
+      val = pEnt->beat_dur;
+      break;
+    
+    case SMF_TYPE_TIME_SIG:
+      d = 0;
+      while ((d < 24) && ((1 << d) < (pEnt->tsig)->denominator)) {
+        d++;
+      }
+      val = ((int32_t) ((pEnt->tsig)->numerator & 0xff)) |
+            (((int32_t) ((pEnt->tsig)->click & 0xff)) << 8) |
+            (((int32_t) ((pEnt->tsig)->beat_unit & 0xff)) << 16) |
+            (d << 24);
+      break;
+    
+    case SMF_TYPE_KEY_SIG:
+      val = ((int32_t) ((pEnt->ksig)->key & 0xff)) |
+            ((pEnt->ksig)->is_minor ? 0x100 : 0);
+      break;
+    
+    default:
+      result = 0;
+  }
+  
+  /* Make room for the change */
+  if (result && (pc->ccount >= pc->ccap)) {
+    if (pc->ccount >= INT32_MAX) {
+      fault(__LINE__);
+    }
+    pc->ccap = growCapacity(pc->ccap, pc->ccount + 1);
+    pc->pChg = (CHASE_CHANGE *) resizeBlock(
+                  pc->pChg, pc->ccap, sizeof(CHASE_CHANGE));
+  }
+  
+  /* Store the change */
+  if (result) {
+    pChg = &((pc->pChg)[pc->ccount]);
+    (pc->ccount)++;
+    
+    pChg->tick = tick;
+    pChg->val  = val;
+    pChg->type = (uint8_t) pEnt->status;
+    if (pEnt->ch >= 0) {
+      pChg->ch = (uint8_t) pEnt->ch;
+    } else {
+      pChg->ch = 0;
+    }
+    pChg->ctl  = (uint8_t) ctl;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Append a snapshot of a chase state to a chase object.
+ * 
+ * The snapshot includes all the state changes that have been appended
+ * so far.
+ * 
+ * Parameters:
+ * 
+ *   pc - the chase object
+ * 
+ *   tick - the tick offset of the snapshot
+ * 
+ *   pst - the state to store
+ */
+static void snapChase(SMFCHASE *pc, int64_t tick, const CHASE_STATE *pst) {
+  
+  CHASE_SNAPSHOT *pSnap = NULL;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (tick < 0) || (pst == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Make room for the snapshot */
+  if (pc->scount >= pc->scap) {
+    if (pc->scount >= INT32_MAX) {
+      fault(__LINE__);
+    }
+    pc->scap = growCapacity(pc->scap, pc->scount + 1);
+    pc->pSnap = (CHASE_SNAPSHOT *) resizeBlock(
+                  pc->pSnap, pc->scap, sizeof(CHASE_SNAPSHOT));
+  }
+  
+  /* Store the snapshot */
+  pSnap = &((pc->pSnap)[pc->scount]);
+  (pc->scount)++;
+  
+  pSnap->tick = tick;
+  pSnap->pos  = pc->ccount;
+  memcpy(&(pSnap->st), pst, sizeof(CHASE_STATE));
+}
+
+/*
+ * Place a section of a binary cache.
+ * 
+ * The section is placed at the current position rounded up to a
+ * multiple of eight bytes, and the position is advanced past it.
+ * 
+ * Parameters:
+ * 
+ *   pPos - the current position, which is updated
+ * 
+ *   count - the number of elements in the section
+ * 
+ *   esize - the size of each element in bytes
+ * 
+ * Return:
+ * 
+ *   the byte offset of the section
+ */
+static int64_t cacheSection(int64_t *pPos, int32_t count, size_t esize) {
+  
+  int64_t result = 0;
+  
+  /* Check parameters */
+  if ((pPos == NULL) || (count < 0) || (esize < 1) || (esize > 8)) {
+    fault(__LINE__);
+  }
+  
+  /* Align and advance; the counts are all 32-bit, so this cannot
+   * overflow */
+  result = ((*pPos + 7) / 8) * 8;
+  *pPos = result + (((int64_t) count) * ((int64_t) esize));
+  
+  return result;
+}
+
+/*
+ * Compute the section offsets and the total length of a binary cache
+ * from the counts in the layout structure.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layout, whose counts must be filled in
+ */
+static void cacheLayout(CACHE_LAYOUT *pl) {
+  
+  int64_t pos = 0;
+  
+  /* Check parameters */
+  if (pl == NULL) {
+    fault(__LINE__);
+  }
+  if ((pl->nck < 0) || (pl->ntm < 0) || (pl->nev < 0) ||
+      (pl->npay < 0) || (pl->narena < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Place the sections in order of decreasing element size */
+  pos = ((int64_t) CACHE_HEAD) * 4;
+  
+  pl->ck_off   = cacheSection(&pos, pl->nck, sizeof(int64_t));
+  pl->tm_tick  = cacheSection(&pos, pl->ntm, sizeof(int64_t));
+  pl->ck_type  = cacheSection(&pos, pl->nck, sizeof(uint32_t));
+  pl->ck_len   = cacheSection(&pos, pl->nck, sizeof(int32_t));
+  pl->ck_first = cacheSection(&pos, pl->nck, sizeof(int32_t));
+  pl->ck_count = cacheSection(&pos, pl->nck, sizeof(int32_t));
+  pl->tm_beat  = cacheSection(&pos, pl->ntm, sizeof(int32_t));
+  pl->ev_tick  = cacheSection(&pos, pl->nev, sizeof(uint32_t));
+  pl->ev_aux   = cacheSection(&pos, pl->nev, sizeof(int32_t));
+  pl->pay_off  = cacheSection(&pos, pl->npay, sizeof(int32_t));
+  pl->pay_len  = cacheSection(&pos, pl->npay, sizeof(int32_t));
+  pl->ev_type  = cacheSection(&pos, pl->nev, 1);
+  pl->ev_ch    = cacheSection(&pos, pl->nev, 1);
+  pl->ev_d1    = cacheSection(&pos, pl->nev, 1);
+  pl->ev_d2    = cacheSection(&pos, pl->nev, 1);
+  pl->arena    = cacheSection(&pos, pl->narena, 1);
+  
+  pl->total = ((pos + 7) / 8) * 8;
+}
+
+/*
+ * Check the header and the tables of a binary cache and construct a
+ * cache object over it.
+ * 
+ * pData must be aligned to eight bytes.  pCopy and pMap are the owners
+ * of the bytes as described for the SMFCACHE structure.  They are
+ * released if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   pData - the cache bytes
+ * 
+ *   len - the number of cache bytes
+ * 
+ *   pCopy - the dynamically allocated copy that holds the bytes, or
+ *   NULL
+ * 
+ *   pMap - the memory-mapped source that holds the bytes, or NULL
+ * 
+ *   pErr - receives an error code if the function fails
+ * 
+ * Return:
+ * 
+ *   the new cache object, or NULL if the cache is not valid
+ */
+static SMFCACHE *openCache(
+    const uint8_t * pData,
+    int64_t         len,
+    uint8_t       * pCopy,
+    SMFSOURCE     * pMap,
+    int           * pErr) {
+  
+  int status = 1;
+  int32_t i = 0;
+  int32_t tracks = 0;
+  const uint32_t *pw = NULL;
+  SMFCACHE *pc = NULL;
+  CACHE_LAYOUT lay;
+  SMF_HEADER head;
+  
+  /* Initialize structures */
+  memset(&lay, 0, sizeof(CACHE_LAYOUT));
+  memset(&head, 0, sizeof(SMF_HEADER));
+  
+  /* Check parameters */
+  if ((pData == NULL) || (len < 0) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Check the header words */
+  if (len < ((int64_t) CACHE_HEAD) * 4) {
+    status = 0;
+  }
+  
+  if (status) {
+    pw = (const uint32_t *) pData;
+    if ((pw[0] != CACHE_MAGIC) ||
+        (pw[1] != SMF_CACHE_VERSION) ||
+        (pw[2] > 2) ||
+        (pw[3] < 1) || (pw[3] > 0xffff) ||
+        (pw[4] < 1) || (pw[4] > 0x7fff)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if ((pw[5] != 0) && (pw[5] != 24) && (pw[5] != 25) &&
+        (pw[5] != 29) && (pw[5] != 30)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    for(i = 6; i < CACHE_HEAD; i++) {
+      if (((i < 11) && (pw[i] > INT32_MAX)) ||
+          ((i >= 11) && (pw[i] != 0))) {
+        status = 0;
+        break;
+      }
+    }
+  }
+  
+  /* Get the layout, which must match the length exactly */
+  if (status) {
+    head.fmt        = (int) pw[2];
+    head.nTracks    = (int32_t) pw[3];
+    head.ts.subdiv  = (int32_t) pw[4];
+    head.ts.frame_rate = (int) pw[5];
+    
+    lay.nck    = (int32_t) pw[6];
+    lay.ntm    = (int32_t) pw[7];
+    lay.nev    = (int32_t) pw[8];
+    lay.npay   = (int32_t) pw[9];
+    lay.narena = (int32_t) pw[10];
+    cacheLayout(&lay);
+    
+    if (lay.total != len) {
+      status = 0;
+    }
+  }
+  
+  /* Construct the cache object */
+  if (status) {
+    pc = (SMFCACHE *) calloc(1, sizeof(SMFCACHE));
+    if (pc == NULL) {
+      fault(__LINE__);
+    }
+    
+    pc->pData = pData;
+    pc->len   = len;
+    pc->pCopy = pCopy;
+    pc->pMap  = pMap;
+    memcpy(&(pc->head), &head, sizeof(SMF_HEADER));
+    memcpy(&(pc->lay), &lay, sizeof(CACHE_LAYOUT));
+    
+    pc->ck_off   = (const int64_t  *) (pData + lay.ck_off);
+    pc->ck_type  = (const uint32_t *) (pData + lay.ck_type);
+    pc->ck_len   = (const int32_t  *) (pData + lay.ck_len);
+    pc->ck_first = (const int32_t  *) (pData + lay.ck_first);
+    pc->ck_count = (const int32_t  *) (pData + lay.ck_count);
+    pc->tm_tick  = (const int64_t  *) (pData + lay.tm_tick);
+    pc->tm_beat  = (const int32_t  *) (pData + lay.tm_beat);
+    pc->ev_tick  = (const uint32_t *) (pData + lay.ev_tick);
+    pc->ev_aux   = (const int32_t  *) (pData + lay.ev_aux);
+    pc->ev_type  = pData + lay.ev_type;
+    pc->ev_ch    = pData + lay.ev_ch;
+    pc->ev_d1    = pData + lay.ev_d1;
+    pc->ev_d2    = pData + lay.ev_d2;
+    pc->pay_off  = (const int32_t  *) (pData + lay.pay_off);
+    pc->pay_len  = (const int32_t  *) (pData + lay.pay_len);
+    pc->arena    = pData + lay.arena;
+    
+    pc->ps     = NULL;
+    pc->status = 0;
+    pc->ck     = 0;
+    pc->ev     = 0;
+    pc->evend  = 0;
+  }
+  
+  /* Check the chunk index, which must start with the header chunk and
+   * give every declared track a range of events that ends with the End
+   * Of Track */
+  if (status) {
+    if ((lay.nck < 1) || ((pc->ck_type)[0] != UINT32_C(0x4d546864))) {
+      status = 0;
+    }
+  }
+  for(i = 0; status && (i < lay.nck); i++) {
+    if (((pc->ck_off)[i] < 0) || ((pc->ck_len)[i] < 0)) {
+      status = 0;
+      
+    } else if ((pc->ck_type)[i] == UINT32_C(0x4d54726b)) {
+      if (((pc->ck_first)[i] < 0) || ((pc->ck_count)[i] < 1) ||
+          ((pc->ck_first)[i] > lay.nev - (pc->ck_count)[i])) {
+        status = 0;
+      } else if ((pc->ev_type)[(pc->ck_first)[i] + (pc->ck_count)[i] - 1]
+                  != SMF_TYPE_END_TRACK) {
+        status = 0;
+      }
+      tracks++;
+      
+    } else if (((pc->ck_first)[i] != -1) || ((pc->ck_count)[i] != 0) ||
+                ((i > 0) && ((pc->ck_type)[i] == UINT32_C(0x4d546864)))) {
+      status = 0;
+    }
+  }
+  if (status && (tracks != head.nTracks)) {
+    status = 0;
+  }
+  
+  /* Check the tempo map and the payload table */
+  for(i = 0; status && (i < lay.ntm); i++) {
+    if (((pc->tm_tick)[i] < 0) ||
+        ((pc->tm_beat)[i] < 1) || ((pc->tm_beat)[i] > SMF_MAX_BEAT)) {
+      status = 0;
+    }
+  }
+  for(i = 0; status && (i < lay.npay); i++) {
+    if (((pc->pay_off)[i] < 0) || ((pc->pay_len)[i] < 1) ||
+        ((pc->pay_off)[i] > lay.narena - (pc->pay_len)[i])) {
+      status = 0;
+    }
+  }
+  
+  /* Set up the parser object that decodes payloads */
+  if (status) {
+    pc->ps = smfparse_alloc();
+    memcpy(&((pc->ps)->head), &head, sizeof(SMF_HEADER));
+  }
+  
+  /* On failure, release everything */
+  if (!status) {
+    *pErr = SMF_ERR_CACHE;
+    free(pc);
+    pc = NULL;
+    free(pCopy);
+    if (pMap != NULL) {
+      smfsource_close(pMap);
+    }
+  }
+  
+  /* Return the cache object or NULL */
+  return pc;
+}
+
+/*
+ * Decode the next event of the current track of a cache object.
+ * 
+ * There must be an event left in the track.  The entity structure is
+ * assumed to be in a reset state.
+ * 
+ * Parameters:
+ * 
+ *   pc - the cache object
+ * 
+ *   pEnt - the entity structure to fill in
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the event is not valid
+ */
+static int cacheEvent(SMFCACHE *pc, SMF_ENTITY *pEnt) {
+  
+  int status = 1;
+  int err = 0;
+  int type = 0;
+  int ch = 0;
+  int d1 = 0;
+  int d2 = 0;
+  int32_t i = 0;
+  int32_t aux = 0;
+  uint32_t prev = 0;
+  uint32_t tick = 0;
+  SMFPARSE *ps = NULL;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pEnt == NULL)) {
+    fault(__LINE__);
+  }
+  if (pc->ev >= pc->evend) {
+    fault(__LINE__);
+  }
+  
+  /* Get the event columns */
+  i    = pc->ev;
+  type = (pc->ev_type)[i];
+  ch   = (pc->ev_ch)[i];
+  d1   = (pc->ev_d1)[i];
+  d2   = (pc->ev_d2)[i];
+  aux  = (pc->ev_aux)[i];
+  tick = (pc->ev_tick)[i];
+  
+  if (i > (pc->ck_first)[pc->ck - 1]) {
+    prev = (pc->ev_tick)[i - 1];
+  }
+  
+  /* Check the time and the payload index, and that End Of Track is the
+   * last event exactly */
+  if ((tick < prev) || (tick - prev > (uint32_t) SMF_MAX_VARINT) ||
+      (aux < -1) || (aux >= (pc->lay).npay) ||
+      ((type == SMF_TYPE_END_TRACK) != (i == pc->evend - 1))) {
+    status = 0;
+  }
+  
+  /* Channel messages are filled in directly, the End Of Track has no
+   * data, and everything else is decoded by the parser from the stored
+   * payload */
+  if (status) {
+    pEnt->delta = (int32_t) (tick - prev);
+    pEnt->tick  = (int64_t) tick;
+    
+    if ((type >= SMF_TYPE_NOTE_OFF) && (type <= SMF_TYPE_PITCH_BEND)) {
+      if ((ch > 15) || (d1 > SMF_MAX_DATA) || (d2 > SMF_MAX_DATA) ||
+          (aux != -1)) {
+        status = 0;
+      }
+      
+      if (status) {
+        pEnt->status = type;
+        pEnt->ch = ch;
+        
+        if (type == SMF_TYPE_CONTROL) {
+          pEnt->ctl = d1;
+          pEnt->val = d2;
+          
+        } else if ((type == SMF_TYPE_PROGRAM) ||
+                    (type == SMF_TYPE_CH_AFTERTOUCH)) {
+          pEnt->val = d1;
+          
+        } else if (type == SMF_TYPE_PITCH_BEND) {
+          pEnt->bend = ((d2 << 7) | d1) + SMF_MIN_BEND;
+          
+        } else {
+          pEnt->key = d1;
+          pEnt->val = d2;
+        }
+      }
+      
+    } else if (type == SMF_TYPE_END_TRACK) {
+      if (aux != -1) {
+        status = 0;
+      }
+      if (status) {
+        pEnt->status = SMF_TYPE_END_TRACK;
+      }
+      
+    } else if ((type >= SMF_TYPE_SYSEX) && (type <= SMF_TYPE_META)) {
+      ps = pc->ps;
+      ps->status = 1;
+      ps->ckrem  = 0;
+      if (aux >= 0) {
+        ps->pPay = &((pc->arena)[(pc->pay_off)[aux]]);
+        ps->plen = (pc->pay_len)[aux];
+      } else {
+        ps->pPay = NULL;
+        ps->plen = 0;
+      }
+      
+      if (type == SMF_TYPE_SYSEX) {
+        status = parseEvent(ps, pEnt, 0xf0, -1, -1, pEnt->delta, &err);
+      } else if (type == SMF_TYPE_SYSESC) {
+        status = parseEvent(ps, pEnt, 0xf7, -1, -1, pEnt->delta, &err);
+      } else {
+        status = parseEvent(ps, pEnt, 0xff, d1, -1, pEnt->delta, &err);
+      }
+      
+      if (status && (pEnt->status != type)) {
+        status = 0;
+      }
+      
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Move to the next event */
+  if (status) {
+    (pc->ev)++;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Store a copy of a text payload in a nul-terminated buffer of an
+ * SMF_PROBE structure.
+ * 
+ * Parameters:
+ * 
+ *   ppBuf - the buffer pointer, which is allocated or grown as needed
+ * 
+ *   pCap - the buffer capacity including the nul terminator
+ * 
+ *   pLen - receives the text length, not including the nul terminator
+ * 
+ *   pData - the text payload, which may only be NULL if len is zero
+ * 
+ *   len - the length of the text payload
+ */
+static void storeText(
+    uint8_t       ** ppBuf,
+    int32_t        * pCap,
+    int32_t        * pLen,
+    const uint8_t  * pData,
+    int32_t          len) {
+  
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if ((ppBuf == NULL) || (pCap == NULL) || (pLen == NULL)) {
+    fault(__LINE__);
+  }
+  if ((len < 0) || (len >= INT32_MAX) || ((pData == NULL) && (len > 0))) {
+    fault(__LINE__);
+  }
+  
+  /* Make room for the text and the terminator */
+  if (len + 1 > *pCap) {
+    new_cap = growCapacity(*pCap, len + 1);
+    *ppBuf = (uint8_t *) resizeBlock(*ppBuf, new_cap, 1);
+    *pCap = new_cap;
+  }
+  
+  /* Copy the text */
+  if (len > 0) {
+    memcpy(*ppBuf, pData, (size_t) len);
+  }
+  (*ppBuf)[len] = (uint8_t) 0;
+  *pLen = len;
+}
+
+/*
+ * Parse the events at the start of a track for smfparse_probe(), and
+ * then skip the rest of the track.
+ * 
+ * The parser must be set up within the track, with ckrem holding the
+ * full length of the track data and the input source positioned at the
+ * start of the track data.  Events are parsed as long as they start
+ * within the first scan bytes of the track.  The first title and
+ * copyright text events are stored in the probe structure, if the probe
+ * structure doesn't have them yet.  Parsing errors just end the scan.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the input source
+ * 
+ *   scan - the number of bytes to scan, or zero
+ * 
+ *   pProbe - the probe structure
+ */
+static void scanTrack(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t     scan,
+    SMF_PROBE * pProbe) {
+  
+  int skip = 0;
+  int err = 0;
+  int32_t len = 0;
+  SMF_ENTITY ent;
+  
+  /* Initialize structures */
+  memcpy(&ent, &m_blank, sizeof(SMF_ENTITY));
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (scan < 0) || (pProbe == NULL)) {
+    fault(__LINE__);
+  }
+  if ((ps->status != 1) || (ps->ckrem < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Parse events that start within the scanned bytes */
+  len = ps->ckrem;
+  while (len - ps->ckrem < scan) {
+    ps->blen = 0;
+    memcpy(&ent, &m_blank, sizeof(SMF_ENTITY));
+    if (!readEvent(ps, &ent, pSrc, &skip, &err)) {
+      break;
+    }
+    
+    if (ent.status == SMF_TYPE_END_TRACK) {
+      break;
+      
+    } else if ((!skip) && (ent.status == SMF_TYPE_TEXT)) {
+      if ((ent.txtype == SMF_TEXT_TITLE) && (pProbe->title_len < 0)) {
+        storeText(&(pProbe->title), &(pProbe->title_cap),
+          &(pProbe->title_len), ent.buf_ptr, ent.buf_len);
+          
+      } else if ((ent.txtype == SMF_TEXT_COPYRIGHT) &&
+                  (pProbe->copyright_len < 0)) {
+        storeText(&(pProbe->copyright), &(pProbe->copyright_cap),
+          &(pProbe->copyright_len), ent.buf_ptr, ent.buf_len);
+      }
+    }
+  }
+  
+  /* Skip the rest of the track; if this fails, the next chunk header
+   * read will fail too */
+  if (ps->ckrem > 0) {
+    smfsource_skip(pSrc, ps->ckrem);
+  }
+  ps->ckrem = -1;
+}
+
+/*
+ * Make room in the output buffer of a writer for n more bytes.
+ * 
+ * The buffer holds fewer than 2 GiB, so SMF_ERR_HUGE_FILE is reported
+ * if there is not enough room.  For writers around file handles, the
+ * buffer only holds the output that has not been written out yet.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   n - the number of bytes to make room for
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int reserveWrite(SMFWRITE *pw, int32_t n, int *pErr) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pw == NULL) || (n < 0) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Check the size limit */
+  if (n > INT32_MAX - pw->blen) {
+    status = 0;
+    *pErr = SMF_ERR_HUGE_FILE;
+  }
+  
+  /* Grow the buffer if necessary */
+  if (status && (pw->blen + n > pw->bcap)) {
+    pw->bcap = growCapacity(pw->bcap, pw->blen + n);
+    pw->pBuf = (uint8_t *) resizeBlock(pw->pBuf, pw->bcap, 1);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append bytes to the output buffer of a writer.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   pData - the bytes to append, which may only be NULL if len is zero
+ * 
+ *   len - the number of bytes to append
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int putWrite(
+    SMFWRITE      * pw,
+    const uint8_t * pData,
+    int32_t         len,
+    int           * pErr) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pw == NULL) || (len < 0) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  if ((pData == NULL) && (len > 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Append the bytes */
+  if (len > 0) {
+    if (!reserveWrite(pw, len, pErr)) {
+      status = 0;
+    }
+    if (status) {
+      memcpy(&((pw->pBuf)[pw->blen]), pData, (size_t) len);
+      pw->blen += len;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Write out the output buffer of a writer to its file handle, if it
+ * holds at least min bytes.
+ * 
+ * Nothing is written if the writer has no file handle, or if it is
+ * within a track chunk and the handle cannot seek, because then the
+ * chunk length must be filled in before the chunk is written out.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   min - the minimum number of buffered bytes to write out, or zero to
+ *   write out everything
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int flushWrite(SMFWRITE *pw, int32_t min, int *pErr) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pw == NULL) || (min < 0) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Write out the buffer if it is time */
+  if ((pw->fh != NULL) &&
+      (pw->blen > 0) &&
+      (pw->blen >= min) &&
+      (pw->can_seek || (pw->stage != WRITE_STAGE_TRACK))) {
+    if (fwrite(pw->pBuf, 1, (size_t) pw->blen, pw->fh) !=
+          (size_t) pw->blen) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+    if (status) {
+      pw->flushed += (int64_t) pw->blen;
+      pw->blen = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Move the file position of a file handle that supports random access
+ * by a given distance.
+ * 
+ * Parameters:
+ * 
+ *   fh - the file handle
+ * 
+ *   dist - the distance in bytes, which may be negative
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int seekHandle(FILE *fh, int64_t dist) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if (fh == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Seek from the current position */
+#if defined(SMF_POSIX)
+  if (fseeko(fh, (off_t) dist, SEEK_CUR)) {
+    status = 0;
+  }
+#elif defined(_WIN32)
+  if (_fseeki64(fh, dist, SEEK_CUR)) {
+    status = 0;
+  }
+#else
+  if ((dist < LONG_MIN) || (dist > LONG_MAX)) {
+    status = 0;
+  }
+  if (status) {
+    if (fseek(fh, (long) dist, SEEK_CUR)) {
+      status = 0;
+    }
+  }
+#endif
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Overwrite bytes that have already been passed to a writer.
+ * 
+ * pos is the byte offset from the start of the output.  The bytes must
+ * either all still be in the output buffer, or they must all have been
+ * written out already.  In the latter case, the file handle must support
+ * random access, and the writer seeks back to overwrite them.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   pos - the byte offset of the bytes to overwrite
+ * 
+ *   pData - the new bytes
+ * 
+ *   len - the number of bytes
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int patchWrite(
+    SMFWRITE      * pw,
+    int64_t         pos,
+    const uint8_t * pData,
+    int32_t         len,
+    int           * pErr) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pw == NULL) || (pos < 0) || (pData == NULL) || (len < 1) ||
+      (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  if (pos >= pw->flushed) {
+    /* Still in the buffer */
+    if (pos - pw->flushed > (int64_t) (pw->blen - len)) {
+      fault(__LINE__);
+    }
+    memcpy(&((pw->pBuf)[pos - pw->flushed]), pData, (size_t) len);
+    
+  } else {
+    /* Already written out, so seek back from the end of the output and
+     * then return to it */
+    if ((pw->fh == NULL) || (!(pw->can_seek)) ||
+        (pos > pw->flushed - len)) {
+      fault(__LINE__);
+    }
+    
+    if (!seekHandle(pw->fh, pos - pw->flushed)) {
+      status = 0;
+    }
+    if (status) {
+      if (fwrite(pData, 1, (size_t) len, pw->fh) != (size_t) len) {
+        status = 0;
+      }
+    }
+    if (status) {
+      if (!seekHandle(pw->fh, pw->flushed - (pos + len))) {
+        status = 0;
+      }
+    }
+    if (!status) {
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Encode a variable-length quantity with the fewest bytes.
+ * 
+ * Parameters:
+ * 
+ *   pBuf - receives the encoded bytes, with room for at least four
+ * 
+ *   v - the value, in range zero up to SMF_MAX_VARINT
+ * 
+ * Return:
+ * 
+ *   the number of bytes written, in range one to four
+ */
+static int32_t encodeVar(uint8_t *pBuf, int32_t v) {
+  
+  int32_t n = 0;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pBuf == NULL) || (v < 0) || (v > SMF_MAX_VARINT)) {
+    fault(__LINE__);
+  }
+  
+  /* Count the seven-bit groups */
+  n = 1;
+  while ((n < 4) && ((v >> (7 * n)) != 0)) {
+    n++;
+  }
+  
+  /* Write the groups from the most significant, with the high bit set
+   * on all but the last */
+  for(i = 0; i < n; i++) {
+    pBuf[i] = (uint8_t) ((v >> (7 * (n - 1 - i))) & 0x7f);
+    if (i < n - 1) {
+      pBuf[i] |= 0x80;
+    }
+  }
+  
+  /* Return count */
+  return n;
+}
+
+/*
+ * Write the header chunk of a MIDI file.
+ * 
+ * The track count is written as declared in the header, or zero if it
+ * is out of range, so that smfwrite_finish() can fill it in.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   ph - the header
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int writeHeader(SMFWRITE *pw, const SMF_HEADER *ph, int *pErr) {
+  
+  int status = 1;
+  int32_t division = 0;
+  uint8_t buf[14];
+  
+  /* Initialize buffer */
+  memset(buf, 0, sizeof(buf));
+  
+  /* Check parameters */
+  if ((pw == NULL) || (ph == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Check the format and time system */
+  if ((ph->fmt < 0) || (ph->fmt > 2)) {
+    status = 0;
+    *pErr = SMF_ERR_MIDI_FMT;
+  }
+  
+  if (status) {
+    if ((ph->ts).frame_rate == 0) {
+      if (((ph->ts).subdiv < 1) || ((ph->ts).subdiv > 32767)) {
+        status = 0;
+        *pErr = SMF_ERR_HEADER;
+      }
+      
+    } else {
+      if ((((ph->ts).frame_rate != 24) &&
+            ((ph->ts).frame_rate != 25) &&
+            ((ph->ts).frame_rate != 29) &&
+            ((ph->ts).frame_rate != 30)) ||
+          ((ph->ts).subdiv < 1) || ((ph->ts).subdiv > 255)) {
+        status = 0;
+        *pErr = SMF_ERR_HEADER;
+      }
+    }
+  }
+  
+  /* Encode the division, with SMPTE frame rates negated in the high
+   * byte */
+  if (status) {
+    if ((ph->ts).frame_rate == 0) {
+      division = (ph->ts).subdiv;
+    } else {
+      division = ((int32_t) (256 - (ph->ts).frame_rate) << 8) |
+                  (ph->ts).subdiv;
+    }
+  }
+  
+  /* Remember the header */
+  if (status) {
+    pw->fmt = ph->fmt;
+    memcpy(&(pw->ts), &(ph->ts), sizeof(SMF_TIMESYS));
+    if ((ph->nTracks >= 0) && (ph->nTracks <= 65535)) {
+      pw->declared = ph->nTracks;
+    } else {
+      pw->declared = 0;
+    }
+  }
+  
+  /* Write the header chunk */
+  if (status) {
+    memcpy(buf, "MThd", 4);
+    buf[7]  = (uint8_t) 6;
+    buf[9]  = (uint8_t) ph->fmt;
+    buf[10] = (uint8_t) (pw->declared >> 8);
+    buf[11] = (uint8_t) (pw->declared & 0xff);
+    buf[12] = (uint8_t) (division >> 8);
+    buf[13] = (uint8_t) (division & 0xff);
+    
+    if (!putWrite(pw, buf, 14, pErr)) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Encode an event within a track chunk.
+ * 
+ * The entity must be one of the types that occur within tracks, from
+ * SMF_TYPE_END_TRACK to SMF_TYPE_META.  Values out of range are
+ * reported with the error codes of the parser.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   pEnt - the entity to encode
+ * 
+ *   pErr - receives an error code in case of failure
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int writeEvent(SMFWRITE *pw, const SMF_ENTITY *pEnt, int *pErr) {
+  
+  int status = 1;
+  int ev = 0;
+  int a = -1;
+  int b = 0;
+  int dcount = 0;
+  int d = 0;
+  int32_t bend = 0;
+  int32_t n = 0;
+  int32_t plen = 0;
+  const uint8_t *pPay = NULL;
+  const SMF_TIMECODE *ptc = NULL;
+  
+  uint8_t head[16];
+  uint8_t pay[8];
+  
+  /* Initialize buffers */
+  memset(head, 0, sizeof(head));
+  memset(pay, 0, sizeof(pay));
+  
+  /* Check parameters */
+  if ((pw == NULL) || (pEnt == NULL) || (pErr == NULL)) {
+    fault(__LINE__);
+  }
+  if ((pEnt->status < SMF_TYPE_END_TRACK) ||
+      (pEnt->status > SMF_TYPE_META)) {
+    fault(__LINE__);
+  }
+  
+  /* Check the delta time */
+  if ((pEnt->delta < 0) || (pEnt->delta > SMF_MAX_VARINT)) {
+    status = 0;
+    *pErr = SMF_ERR_TIME_RANGE;
+  }
+  
+  /* Check the channel of MIDI messages before it goes into the status
+   * byte */
+  if (status && (pEnt->status >= SMF_TYPE_NOTE_OFF) &&
+      (pEnt->status <= SMF_TYPE_PITCH_BEND)) {
+    if ((pEnt->ch < 0) || (pEnt->ch > 15)) {
+      status = 0;
+      *pErr = SMF_ERR_MIDI_DATA;
+    }
+  }
+  
+  /* MIDI messages have a status byte and dcount data bytes, while the
+   * other events have a lead byte and then a payload, with the
+   * meta-event type in "A" for meta-events */
+  if (status) {
+    ev = 0xff;
+    a = m_code[pEnt->status];
+    
+    switch (pEnt->status) {
+      case SMF_TYPE_NOTE_OFF:
+      case SMF_TYPE_NOTE_ON:
+      case SMF_TYPE_KEY_AFTERTOUCH:
+        ev = m_code[pEnt->status] | pEnt->ch;
+        a = pEnt->key;
+        b = pEnt->val;
+        dcount = 2;
+        break;
+      
+      case SMF_TYPE_CONTROL:
+        ev = m_code[pEnt->status] | pEnt->ch;
+        a = pEnt->ctl;
+        b = pEnt->val;
+        dcount = 2;
+        break;
+      
+      case SMF_TYPE_PROGRAM:
+      case SMF_TYPE_CH_AFTERTOUCH:
+        ev = m_code[pEnt->status] | pEnt->ch;
+        a = pEnt->val;
+        dcount = 1;
+        break;
+      
+      case SMF_TYPE_PITCH_BEND:
+        ev = m_code[pEnt->status] | pEnt->ch;
+        if ((pEnt->bend < SMF_MIN_BEND) || (pEnt->bend > SMF_MAX_BEND)) {
+          status = 0;
+          *pErr = SMF_ERR_MIDI_DATA;
+        }
+        if (status) {
+          bend = (int32_t) (pEnt->bend - SMF_MIN_BEND);
+          a = (int) (bend & 0x7f);
+          b = (int) (bend >> 7);
+        }
+        dcount = 2;
+        break;
+      
+      case SMF_TYPE_SYSEX:
+      case SMF_TYPE_SYSESC:
+        ev = m_code[pEnt->status];
+        a = -1;
+        pPay = pEnt->buf_ptr;
+        plen = pEnt->buf_len;
+        break;
+      
+      case SMF_TYPE_SEQ_NUM:
+        if ((pEnt->seq_num < 0) || (pEnt->seq_num > 65535)) {
+          status = 0;
+          *pErr = SMF_ERR_SEQ_NUM;
+        }
+        pay[0] = (uint8_t) ((pEnt->seq_num >> 8) & 0xff);
+        pay[1] = (uint8_t) (pEnt->seq_num & 0xff);
+        pPay = pay;
+        plen = 2;
+        break;
+      
+      case SMF_TYPE_TEXT:
+        if ((pEnt->txtype < 0x01) || (pEnt->txtype > 0x07)) {
+          status = 0;
+          *pErr = SMF_ERR_BAD_EVENT;
+        }
+        a = pEnt->txtype;
+        pPay = pEnt->buf_ptr;
+        plen = pEnt->buf_len;
+        break;
+      
+      case SMF_TYPE_CH_PREFIX:
+        if ((pEnt->ch < 0) || (pEnt->ch > 15)) {
+          status = 0;
+          *pErr = SMF_ERR_CH_PREFIX;
+        }
+        pay[0] = (uint8_t) (pEnt->ch & 0x0f);
+        pPay = pay;
+        plen = 1;
+        break;
+      
+      case SMF_TYPE_END_TRACK:
+        break;
+      
+      case SMF_TYPE_TEMPO:
+        if ((pEnt->beat_dur < 1) || (pEnt->beat_dur > SMF_MAX_BEAT)) {
+          status = 0;
+          *pErr = SMF_ERR_SET_TEMPO;
+        }
+        pay[0] = (uint8_t) ((pEnt->beat_dur >> 16) & 0xff);
+        pay[1] = (uint8_t) ((pEnt->beat_dur >> 8) & 0xff);
+        pay[2] = (uint8_t) (pEnt->beat_dur & 0xff);
+        pPay = pay;
+        plen = 3;
+        break;
+      
+      case SMF_TYPE_SMPTE:
+        ptc = pEnt->tcode;
+        if (ptc == NULL) {
+          fault(__LINE__);
+        }
+        if ((ptc->hour   > 23) ||
+            (ptc->minute > 59) ||
+            (ptc->second > 59) ||
+            (ptc->frame  > 29) ||
+            (ptc->ff     > 99)) {
+          status = 0;
+          *pErr = SMF_ERR_SMPTE_OFF;
+        }
+        if (status &&
+            ((pw->ts).frame_rate > 0) && ((pw->ts).frame_rate < 29)) {
+          if (ptc->frame >= (pw->ts).frame_rate) {
+            status = 0;
+            *pErr = SMF_ERR_SMPTE_OFF;
+          }
+        }
+        if (status && ((pw->ts).frame_rate == 29)) {
+          if (((ptc->minute % 10) != 0) && (ptc->frame < 2)) {
+            status = 0;
+            *pErr = SMF_ERR_SMPTE_OFF;
+          }
+        }
+        pay[0] = ptc->hour;
+        pay[1] = ptc->minute;
+        pay[2] = ptc->second;
+        pay[3] = ptc->frame;
+        pay[4] = ptc->ff;
+        pPay = pay;
+        plen = 5;
+        break;
+      
+      case SMF_TYPE_TIME_SIG:
+        if (pEnt->tsig == NULL) {
+          fault(__LINE__);
+        }
+        if (((pEnt->tsig)->numerator < 1) ||
+            ((pEnt->tsig)->numerator > SMF_MAX_BYTE) ||
+            ((pEnt->tsig)->click < 1) ||
+            ((pEnt->tsig)->click > SMF_MAX_BYTE) ||
+            ((pEnt->tsig)->beat_unit < 1) ||
+            ((pEnt->tsig)->beat_unit > SMF_MAX_BYTE)) {
+          status = 0;
+          *pErr = SMF_ERR_TIME_SIG;
+        }
+        
+        /* The denominator is stored as its base-2 logarithm, so it must
+         * be a power of two */
+        d = 0;
+        while ((d < 15) && ((1 << d) < (pEnt->tsig)->denominator)) {
+          d++;
+        }
+        if (status && (((pEnt->tsig)->denominator != (1 << d)) ||
+              ((pEnt->tsig)->denominator > SMF_MAX_TIME_DENOM))) {
+          status = 0;
+          *pErr = SMF_ERR_TIME_SIG;
+        }
+        
+        pay[0] = (uint8_t) ((pEnt->tsig)->numerator & 0xff);
+        pay[1] = (uint8_t) d;
+        pay[2] = (uint8_t) ((pEnt->tsig)->click & 0xff);
+        pay[3] = (uint8_t) ((pEnt->tsig)->beat_unit & 0xff);
+        pPay = pay;
+        plen = 4;
+        break;
+      
+      case SMF_TYPE_KEY_SIG:
+        if (pEnt->ksig == NULL) {
+          fault(__LINE__);
+        }
+        if (((pEnt->ksig)->key < SMF_MIN_KEYSIG) ||
+            ((pEnt->ksig)->key > SMF_MAX_KEYSIG) ||
+            (((pEnt->ksig)->is_minor != 0) &&
+              ((pEnt->ksig)->is_minor != 1))) {
+          status = 0;
+          *pErr = SMF_ERR_KEY_SIG;
+        }
+        pay[0] = (uint8_t) ((pEnt->ksig)->key & 0xff);
+        pay[1] = (uint8_t) ((pEnt->ksig)->is_minor & 0xff);
+        pPay = pay;
+        plen = 2;
+        break;
+      
+      case SMF_TYPE_META:
+        /* Meta-events with a type the parser interprets would not read
+         * back as the same entity */
+        if ((pEnt->meta_type < 0) || (pEnt->meta_type > SMF_MAX_BYTE)) {
+          status = 0;
+          *pErr = SMF_ERR_BAD_EVENT;
+        }
+        if (status) {
+          if (eventType(0xff, pEnt->meta_type) != SMF_TYPE_META) {
+            status = 0;
+            *pErr = SMF_ERR_BAD_EVENT;
+          }
+        }
+        a = pEnt->meta_type;
+        pPay = pEnt->buf_ptr;
+        plen = pEnt->buf_len;
+        break;
+      
+      default:
+        fault(__LINE__);
+    }
+  }
+  
+  /* Check the data bytes of MIDI messages, and the length of
+   * payloads */
+  if (status && (dcount > 0)) {
+    if ((a < 0) || (a > SMF_MAX_DATA) ||
+        ((dcount > 1) && ((b < 0) || (b > SMF_MAX_DATA)))) {
+      status = 0;
+      *pErr = SMF_ERR_MIDI_DATA;
+    }
+  }
+  
+  if (status && (dcount < 1)) {
+    if ((plen < 0) || ((pPay == NULL) && (plen > 0))) {
+      fault(__LINE__);
+    }
+    if (plen > SMF_MAX_VARINT) {
+      status = 0;
+      *pErr = SMF_ERR_BIG_PAYLOAD;
+    }
+  }
+  
+  /* Encode the delta time, the status byte unless running status
+   * applies, and the data bytes or the payload length */
+  if (status) {
+    n = encodeVar(head, pEnt->delta);
+    
+    if (dcount > 0) {
+      if (ev != pw->run) {
+        head[n++] = (uint8_t) ev;
+      }
+      pw->run = ev;
+      
+      head[n++] = (uint8_t) a;
+      if (dcount > 1) {
+        head[n++] = (uint8_t) b;
+      }
+      
+    } else {
+      /* System Exclusive and meta-events cancel running status */
+      pw->run = -1;
+      
+      head[n++] = (uint8_t) ev;
+      if (ev == 0xff) {
+        head[n++] = (uint8_t) a;
+      }
+      n += encodeVar(&(head[n]), plen);
+    }
+  }
+  
+  /* Write the event */
+  if (status) {
+    if (!putWrite(pw, head, n, pErr)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (!putWrite(pw, pPay, plen, pErr)) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Compute the new capacity of a dynamically allocated array that must
+ * be able to hold at least n elements.
+ * 
+ * If cap is already at least n, it is returned as-is.  Otherwise, the
+ * result is ARRAY_INIT doubled as often as necessary to reach n, but no
+ * more than INT32_MAX.
+ * 
+ * Parameters:
+ * 
+ *   cap - the current capacity
+ * 
+ *   n - the required capacity, zero or greater
+ * 
+ * Return:
+ * 
+ *   the new capacity
+ */
+static int32_t growCapacity(int32_t cap, int32_t n) {
+  
+  int32_t result = 0;
+  
+  /* Check parameters */
+  if ((cap < 0) || (n < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Only grow if necessary */
+  if (n > cap) {
+    result = ARRAY_INIT;
+    while (result < n) {
+      if (result > INT32_MAX / 2) {
+        result = INT32_MAX;
+      } else {
+        result *= 2;
+      }
+    }
+  } else {
+    result = cap;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Allocate or reallocate a memory block to hold an array of count
+ * elements that are each esize bytes.
+ * 
+ * If p is NULL, a new block is allocated.  Otherwise, the existing block
+ * is resized, preserving its contents.  A fault occurs if the memory
+ * can't be allocated.
+ * 
+ * The block is allocated on the C heap.  Use resizeBlockWith() for
+ * blocks that belong to a parser object with a custom allocator.
+ * 
+ * Parameters:
+ * 
+ *   p - the existing block, or NULL
+ * 
+ *   count - the number of elements, greater than zero
+ * 
+ *   esize - the size of each element in bytes, greater than zero
+ * 
+ * Return:
+ * 
+ *   the new block
+ */
+static void *resizeBlock(void *p, int32_t count, size_t esize) {
+  return resizeBlockWith(NULL, p, count, esize);
+}
+
+/*
+ * Allocate or reallocate a memory block to hold an array of count
+ * elements that are each esize bytes, using a given allocator.
+ * 
+ * This is the same as resizeBlock(), except that the block is
+ * allocated with pa, which may be NULL to use the C heap.  The block
+ * must always be resized and released with the same allocator.
+ * 
+ * Parameters:
+ * 
+ *   pa - the allocator, or NULL
+ * 
+ *   p - the existing block, or NULL
+ * 
+ *   count - the number of elements, greater than zero
+ * 
+ *   esize - the size of each element in bytes, greater than zero
+ * 
+ * Return:
+ * 
+ *   the new block
+ */
+static void *resizeBlockWith(
+    const SMF_ALLOCATOR * pa,
+    void                * p,
+    int32_t               count,
+    size_t                esize) {
+  
+  /* Check parameters */
+  if ((count < 1) || (esize < 1)) {
+    fault(__LINE__);
+  }
+  if ((size_t) count > SIZE_MAX / esize) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate or expand block */
+  return memRealloc(pa, p, ((size_t) count) * esize);
+}
+
+/*
+ * Append an event to an SMF_TRACK structure.
+ * 
+ * pEnt is the parsed event, which must be a MIDI message, a
+ * System-Exclusive event, or a meta-event.  pPay and plen are the raw
+ * data payload of the event, which is copied into the payload arena if
+ * it is not empty.  pPay may only be NULL if plen is zero.
+ * 
+ * Parameters:
+ * 
+ *   pt - the track structure
+ * 
+ *   pEnt - the parsed event
+ * 
+ *   tick - the time offset of the event
+ * 
+ *   pPay - the raw data payload
+ * 
+ *   plen - the length of the raw data payload
+ */
+static void appendTrackEvent(
+    SMF_TRACK        * pt,
+    const SMF_ENTITY * pEnt,
+    uint32_t           tick,
+    const uint8_t    * pPay,
+    int32_t            plen) {
+  
+  int32_t cap = 0;
+  int32_t aux = -1;
+  int32_t bend = 0;
+  int ch = SMF_TRACK_NO_CH;
+  int d1 = 0;
+  int d2 = 0;
+  
+  /* Check parameters */
+  if ((pt == NULL) || (pEnt == NULL) || (plen < 0) ||
+      ((pPay == NULL) && (plen > 0))) {
+    fault(__LINE__);
+  }
+  if (pt->count >= INT32_MAX) {
+    fault(__LINE__);
+  }
+  
+  /* Make room in the event columns */
+  if (pt->count >= pt->cap) {
+    cap = growCapacity(pt->cap, pt->count + 1);
+    pt->tick = (uint32_t *) resizeBlock(pt->tick, cap, sizeof(uint32_t));
+    pt->type = (uint8_t *) resizeBlock(pt->type, cap, 1);
+    pt->ch   = (uint8_t *) resizeBlock(pt->ch,   cap, 1);
+    pt->d1   = (uint8_t *) resizeBlock(pt->d1,   cap, 1);
+    pt->d2   = (uint8_t *) resizeBlock(pt->d2,   cap, 1);
+    pt->aux  = (int32_t *) resizeBlock(pt->aux,  cap, sizeof(int32_t));
+    pt->cap  = cap;
+  }
+  
+  /* Store the payload if there is one */
+  if (plen > 0) {
+    if ((pt->pay_count >= INT32_MAX) ||
+        (plen > INT32_MAX - pt->arena_len)) {
+      fault(__LINE__);
+    }
+    
+    if (pt->pay_count >= pt->pay_cap) {
+      cap = growCapacity(pt->pay_cap, pt->pay_count + 1);
+      pt->pay_off = (int32_t *) resizeBlock(
+                      pt->pay_off, cap, sizeof(int32_t));
+      pt->pay_len = (int32_t *) resizeBlock(
+                      pt->pay_len, cap, sizeof(int32_t));
+      pt->pay_cap = cap;
+    }
+    
+    if (plen > pt->arena_cap - pt->arena_len) {
+      cap = growCapacity(pt->arena_cap, pt->arena_len + plen);
+      pt->arena = (uint8_t *) resizeBlock(pt->arena, cap, 1);
+      pt->arena_cap = cap;
+    }
+    
+    memcpy(&((pt->arena)[pt->arena_len]), pPay, (size_t) plen);
+    (pt->pay_off)[pt->pay_count] = pt->arena_len;
+    (pt->pay_len)[pt->pay_count] = plen;
+    aux = pt->pay_count;
+    
+    (pt->pay_count)++;
+    pt->arena_len += plen;
+  }
+  
+  /* Determine the channel and data bytes */
+  switch (pEnt->status) {
+    case SMF_TYPE_NOTE_OFF:
+    case SMF_TYPE_NOTE_ON:
+    case SMF_TYPE_KEY_AFTERTOUCH:
+      ch = pEnt->ch;
+      d1 = pEnt->key;
+      d2 = pEnt->val;
+      break;
+    
+    case SMF_TYPE_CONTROL:
+      ch = pEnt->ch;
+      d1 = pEnt->ctl;
+      d2 = pEnt->val;
+      break;
+    
+    case SMF_TYPE_PROGRAM:
+    case SMF_TYPE_CH_AFTERTOUCH:
+      ch = pEnt->ch;
+      d1 = pEnt->val;
+      break;
+    
+    case SMF_TYPE_PITCH_BEND:
+      ch = pEnt->ch;
+      bend = (int32_t) (pEnt->bend - SMF_MIN_BEND);
+      d1 = (int) (bend & 0x7f);
+      d2 = (int) (bend >> 7);
+      break;
+    
+    case SMF_TYPE_SYSEX:
+    case SMF_TYPE_SYSESC:
+      break;
+    
+    case SMF_TYPE_TEXT:
+      d1 = pEnt->txtype;
+      break;
+    
+    case SMF_TYPE_CH_PREFIX:
+      ch = pEnt->ch;
+      d1 = m_code[pEnt->status];
+      break;
+    
+    case SMF_TYPE_SEQ_NUM:
+    case SMF_TYPE_END_TRACK:
+    case SMF_TYPE_TEMPO:
+    case SMF_TYPE_SMPTE:
+    case SMF_TYPE_TIME_SIG:
+    case SMF_TYPE_KEY_SIG:
+      d1 = m_code[pEnt->status];
+      break;
+    
+    case SMF_TYPE_META:
+      d1 = pEnt->meta_type;
+      break;
+    
+    default:
+      fault(__LINE__);
+  }
+  
+  /* Store the event */
+  (pt->tick)[pt->count] = tick;
+  (pt->type)[pt->count] = (uint8_t) pEnt->status;
+  (pt->ch  )[pt->count] = (uint8_t) ch;
+  (pt->d1  )[pt->count] = (uint8_t) d1;
+  (pt->d2  )[pt->count] = (uint8_t) d2;
+  (pt->aux )[pt->count] = aux;
+  
+  (pt->count)++;
+}
+
+/*
+ * Refill the refill buffer of a source object that has a block read
+ * callback.
+ * 
+ * The source must be in normal state, it must have a block read
+ * callback, and the refill buffer must be empty.
+ * 
+ * If the block read callback returns an I/O error, the source object
+ * changes to error state.  If the block read callback reports End Of
+ * File, the source object changes to EOF state.  Otherwise, the refill
+ * buffer is filled with at least one byte.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object
+ * 
+ * Return:
+ * 
+ *   non-zero if at least one byte was buffered, zero if the source is
+ *   now in error or EOF state
+ */
+static int refillSource(SMFSOURCE *pSrc) {
+  
+  int status = 1;
+  int32_t n = 0;
+  
+  /* Check parameters and state */
+  if (pSrc == NULL) {
+    fault(__LINE__);
+  }
+  if ((pSrc->state != SOURCE_STATE_NORMAL) ||
+      (pSrc->fReadBlock == NULL) ||
+      (pSrc->bpos < pSrc->blen)) {
+    fault(__LINE__);
+  }
+  
+  /* Reset buffer */
+  pSrc->bpos = 0;
+  pSrc->blen = 0;
+  
+  /* Call through to the block read callback */
+  n = pSrc->fReadBlock(pSrc->pInstance, pSrc->pBlock, SOURCE_BLOCK);
+  SOURCE_STAT(pSrc, cb_block);
+  
+  /* Handle the different outcomes */
+  if (n == SMFSOURCE_IOERR) {
+    status = 0;
+    pSrc->state = SOURCE_STATE_ERROR;
+    
+  } else if (n == 0) {
+    status = 0;
+    pSrc->state = SOURCE_STATE_EOF;
+    
+  } else if ((n > 0) && (n <= SOURCE_BLOCK)) {
+    pSrc->pWin = pSrc->pBlock;
+    pSrc->blen = n;
+    
+  } else {
+    fault(__LINE__);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Construct a memory-resident source object.
+ * 
+ * The memory-resident source reads directly from the len bytes at
+ * pData, which must remain valid and unchanged until the source object
+ * is closed.  pData may only be NULL if len is zero.
+ * 
+ * pInstance and fClose are stored in the source object so that the
+ * owner of the memory can be notified when the source is closed.
+ * fClose may be NULL if no notification is needed.
+ * 
+ * The source object is allocated with pa, or on the C heap if pa is
+ * NULL.
+ * 
+ * Parameters:
+ * 
+ *   pData - the input bytes
+ * 
+ *   len - the number of input bytes
+ * 
+ *   pInstance - value passed through to the close callback
+ * 
+ *   fClose - the close function callback or NULL
+ * 
+ *   pa - the allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object
+ */
+static SMFSOURCE *newMemorySource(
+    const uint8_t       * pData,
+    int64_t               len,
+    void                * pInstance,
+    smfsource_fp_close    fClose,
+    const SMF_ALLOCATOR * pa) {
+  
+  SMFSOURCE *ps = NULL;
+  
+  /* Check parameters */
+  if ((len < 0) || ((pData == NULL) && (len > 0))) {
+    fault(__LINE__);
+  }
+  if (pa != NULL) {
+    checkAllocator(pa);
+  }
+  
+  /* Allocate new source object */
+  ps = (SMFSOURCE *) memAlloc(pa, sizeof(SMFSOURCE));
+  if (pa != NULL) {
+    memcpy(&(ps->alloc), pa, sizeof(SMF_ALLOCATOR));
+  }
+  
+  /* Initialize object */
+  ps->state      = SOURCE_STATE_NORMAL;
+  ps->pInstance  = pInstance;
+  ps->is_mem     = 1;
+  ps->fRead      = NULL;
+  ps->fReadBlock = NULL;
+  ps->fRewind    = NULL;
+  ps->fClose     = fClose;
+  ps->fSkip      = NULL;
+  ps->pWin       = pData;
+  ps->pBlock     = NULL;
+  ps->blen       = len;
+  ps->bpos       = 0;
+#ifdef SMF_ENABLE_STATS
+  ps->pStats     = NULL;
+#endif
+  
+  /* Return new object */
+  return ps;
+}
+
+/*
+ * Construct a source object with a block read callback.
+ * 
+ * This is the implementation of smfsource_custom_block(), except that
+ * the source object and its refill buffer are allocated with pa, or on
+ * the C heap if pa is NULL.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - value passed through to the callbacks
+ * 
+ *   fReadBlock - the block read function callback
+ * 
+ *   fRewind - the rewind function callback or NULL
+ * 
+ *   fClose - the close function callback or NULL
+ * 
+ *   fSkip - the skip function callback or NULL
+ * 
+ *   pa - the allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object
+ */
+static SMFSOURCE *newBlockSource(
+    void                   * pInstance,
+    smfsource_fp_readBlock   fReadBlock,
+    smfsource_fp_rewind      fRewind,
+    smfsource_fp_close       fClose,
+    smfsource_fp_skip        fSkip,
+    const SMF_ALLOCATOR    * pa) {
+  
+  SMFSOURCE *ps = NULL;
+  
+  /* Check parameters */
+  if (fReadBlock == NULL) {
+    fault(__LINE__);
+  }
+  if (pa != NULL) {
+    checkAllocator(pa);
+  }
+  
+  /* Allocate new source object and its refill buffer */
+  ps = (SMFSOURCE *) memAlloc(pa, sizeof(SMFSOURCE));
+  if (pa != NULL) {
+    memcpy(&(ps->alloc), pa, sizeof(SMF_ALLOCATOR));
+  }
+  
+  ps->pBlock = (uint8_t *) memAlloc(pa, (size_t) SOURCE_BLOCK);
+  
+  /* Initialize object */
+  ps->state      = SOURCE_STATE_NORMAL;
+  ps->pInstance  = pInstance;
+  ps->is_mem     = 0;
+  ps->fRead      = NULL;
+  ps->fReadBlock = fReadBlock;
+  ps->fRewind    = fRewind;
+  ps->fClose     = fClose;
+  ps->fSkip      = fSkip;
+  ps->pWin       = ps->pBlock;
+  ps->blen       = 0;
+  ps->bpos       = 0;
+#ifdef SMF_ENABLE_STATS
+  ps->pStats     = NULL;
+#endif
+  
+  /* Return new object */
+  return ps;
+}
+
+/*
+ * Determine the total length of a file handle that supports random
+ * access, using 64-bit file offsets where the platform provides them.
+ * 
+ * The file position is left at the end of the file.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file handle
+ * 
+ * Return:
+ * 
+ *   the length of the file in bytes, or -1 if it could not be
+ *   determined
+ */
+static int64_t handleLength(FILE *pIn) {
+  
+  int64_t result = -1;
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Seek to the end and query the file position */
+#if defined(SMF_POSIX)
+  if (!fseeko(pIn, 0, SEEK_END)) {
+    result = (int64_t) ftello(pIn);
+  }
+#elif defined(_WIN32)
+  if (!_fseeki64(pIn, 0, SEEK_END)) {
+    result = (int64_t) _ftelli64(pIn);
+  }
+#else
+  if (!fseek(pIn, 0, SEEK_END)) {
+    result = (int64_t) ftell(pIn);
+  }
+#endif
+  
+  /* Normalize errors */
+  if (result < 0) {
+    result = -1;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Prepare a file handle that supports random access for reading from
+ * the beginning.
+ * 
+ * The total length of the file is determined and then the file is
+ * rewound.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file handle
+ * 
+ * Return:
+ * 
+ *   the length of the file in bytes, or -1 if the length could not be
+ *   determined or the rewind failed
+ */
+static int64_t startHandle(FILE *pIn) {
+  
+  int64_t result = -1;
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Find the length */
+  result = handleLength(pIn);
+  
+  /* Rewind the file */
+  if (result >= 0) {
+    errno = 0;
+    rewind(pIn);
+    if (errno) {
+      result = -1;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Implementation of the block read callback for HANDLE_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_readBlock function pointer
+ * type for the interface.
+ */
+static int32_t handle_source_readBlock(
+    void    * pInstance,
+    uint8_t * pBuf,
+    int32_t   len) {
+  
+  HANDLE_SOURCE *ps = NULL;
+  int32_t result = 0;
+  size_t n = 0;
+  
+  /* Check parameters */
+  if ((pInstance == NULL) || (pBuf == NULL) || (len < 1)) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  ps = (HANDLE_SOURCE *) pInstance;
+  
+  /* If we know the file length, check that this read does not go beyond
+   * the end of the file, shortening the read so that it stops at the end
+   * of the file */
+  if (ps->flen >= 0) {
+    if (ps->fptr >= ps->flen) {
+      len = 0;
+    } else if (len > ps->flen - ps->fptr) {
+      len = (int32_t) (ps->flen - ps->fptr);
+    }
+  }
+  
+  /* Read from file unless we are at the end */
+  if (len > 0) {
+    n = fread(pBuf, 1, (size_t) len, ps->fh);
+    if (ferror(ps->fh)) {
+      result = SMFSOURCE_IOERR;
+    } else {
+      result = (int32_t) n;
+    }
+  }
+  
+  /* If read was successful, increase the file pointer */
+  if (result > 0) {
+    ps->fptr += result;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Implementation of the rewind callback for HANDLE_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_rewind function pointer
+ * type for the interface.
+ * 
+ * This callback must only be registered for handles that support random
+ * access.
+ */
+static int handle_source_rewind(void *pInstance) {
+  
+  int status = 1;
+  HANDLE_SOURCE *ps = NULL;
+  
+  /* Check parameter */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data and make sure random access supported */
+  ps = (HANDLE_SOURCE *) pInstance;
+  if (!(ps->can_seek)) {
+    fault(__LINE__);
+  }
+  
+  /* Attempt a rewind */
+  errno = 0;
+  rewind(ps->fh);
+  if (errno) {
+    status = 0;
+  }
+  
+  /* If successful rewind, reset byte offset field */
+  if (status) {
+    ps->fptr = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Implementation of the close callback for HANDLE_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_close function pointer type
+ * for the interface.
+ */
+static int handle_source_close(void *pInstance) {
+  
+  int status = 1;
+  HANDLE_SOURCE *ps = NULL;
+  SMF_ALLOCATOR alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SMF_ALLOCATOR));
+  
+  /* Check parameter */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  ps = (HANDLE_SOURCE *) pInstance;
+  
+  /* If we are the owner of the file handle, close it */
+  if (ps->is_owner) {
+    if (fclose(ps->fh)) {
+      status = 0;
+    }
+  }
+  
+  /* Clear file handle and release instance data with the allocator it
+   * came from */
+  ps->fh = NULL;
+  memcpy(&alloc, &(ps->alloc), sizeof(SMF_ALLOCATOR));
+  memFree(&alloc, ps);
+  ps = NULL;
+  pInstance = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Implementation of the skip callback for HANDLE_SOURCE.
+ * 
+ * See the implementation of the smfsource_fp_skip function pointer type
+ * for the interface.
+ * 
+ * If the handle supports random access, this seeks ahead.  Otherwise,
+ * the skipped bytes are read into a scratch buffer in large blocks and
+ * discarded, which still avoids going through the refill buffer of the
+ * source one block at a time.
+ */
+static int handle_source_skip(void *pInstance, int32_t skip) {
+  
+  HANDLE_SOURCE *ps = NULL;
+  int status = 1;
+  size_t n = 0;
+  size_t got = 0;
+  uint8_t scratch[HANDLE_SKIP];
+  
+  /* Check parameters */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  if (skip < 0) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  ps = (HANDLE_SOURCE *) pInstance;
+  
+  /* If skip would go beyond end of file, shorten skip so it just goes
+   * to the end of the file */
+  if (ps->can_seek && (skip > ps->flen - ps->fptr)) {
+    skip = (int32_t) (ps->flen - ps->fptr);
+  }
+  
+  /* Without random access, read and discard the skipped bytes, stopping
+   * early at the end of the file */
+  if ((!(ps->can_seek)) && (skip > 0)) {
+    while (skip > 0) {
+      if (skip > HANDLE_SKIP) {
+        n = (size_t) HANDLE_SKIP;
+      } else {
+        n = (size_t) skip;
+      }
+      
+      got = fread(scratch, 1, n, ps->fh);
+      ps->fptr += (int64_t) got;
+      skip -= (int32_t) got;
+      
+      if (got < n) {
+        if (ferror(ps->fh)) {
+          status = 0;
+        }
+        break;
+      }
+    }
+    skip = 0;
+  }
+  
+  /* Only proceed if non-zero skip */
+  if (skip > 0) {
+    /* Attempt to seek ahead */
+    if (fseek(ps->fh, (long) skip, SEEK_CUR)) {
+      status = 0;
+    }
+    
+    /* If successful, update file pointer */
+    if (status) {
+      ps->fptr += skip;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+#ifdef SMF_POSIX
+
+/*
+ * Implementation of the close callback for MMAP_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_close function pointer type
+ * for the interface.
+ */
+static int mmap_source_close(void *pInstance) {
+  
+  int status = 1;
+  MMAP_SOURCE *ps = NULL;
+  
+  /* Check parameter */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  ps = (MMAP_SOURCE *) pInstance;
+  
+  /* Release the mapping if there is one */
+  if (ps->pMap != NULL) {
+    if (munmap(ps->pMap, ps->mlen)) {
+      status = 0;
+    }
+  }
+  
+  /* Release instance data */
+  ps->pMap = NULL;
+  free(ps);
+  ps = NULL;
+  pInstance = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Thread entry point for the reader thread of a PREFETCH_SOURCE.
+ * 
+ * The thread keeps filling the slot after the filled slots of the ring
+ * until the ring is full, the end of the file or an error is reached,
+ * or it is asked to stop.  If the ring is dropped while a slot is being
+ * read, the read is discarded.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the instance data
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *prefetch_thread(void *pArg) {
+  
+  PREFETCH_SOURCE *pp = NULL;
+  int32_t slot = 0;
+  int32_t gen = 0;
+  int64_t off = 0;
+  size_t n = 0;
+  ssize_t got = 0;
+  
+  /* Check parameters */
+  if (pArg == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  pp = (PREFETCH_SOURCE *) pArg;
+  
+  if (pthread_mutex_lock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  while (!(pp->stop)) {
+    /* Wait while there is nothing to do */
+    if ((pp->done) || (pp->count >= pp->depth)) {
+      if (pthread_cond_wait(&(pp->cv_space), &(pp->lock))) {
+        fault(__LINE__);
+      }
+      
+    } else {
+      /* Claim the next slot and read it without holding the lock */
+      slot = (pp->head + pp->count) % pp->depth;
+      off = pp->roff;
+      gen = pp->gen;
+      
+      n = (size_t) SMF_PREFETCH_BLOCK;
+      if (pp->flen - off < (int64_t) n) {
+        n = (size_t) (pp->flen - off);
+      }
+      
+      if (pthread_mutex_unlock(&(pp->lock))) {
+        fault(__LINE__);
+      }
+      
+      got = 0;
+      if (n > 0) {
+        do {
+          got = pread(
+                  pp->fd,
+                  &((pp->pRing)[((size_t) slot) * SMF_PREFETCH_BLOCK]),
+                  n,
+                  (off_t) off);
+        } while ((got < 0) && (errno == EINTR));
+      }
+      
+      if (pthread_mutex_lock(&(pp->lock))) {
+        fault(__LINE__);
+      }
+      
+      /* Publish the slot, unless the ring was dropped meanwhile */
+      if (gen == pp->gen) {
+        if (got < 0) {
+          (pp->pFill)[slot] = SMFSOURCE_IOERR;
+          (pp->count)++;
+          pp->done = 1;
+          
+        } else if (got == 0) {
+          pp->done = 1;
+          
+        } else {
+          (pp->pFill)[slot] = (int32_t) got;
+          (pp->count)++;
+          pp->roff += (int64_t) got;
+        }
+        
+        if (pthread_cond_signal(&(pp->cv_data))) {
+          fault(__LINE__);
+        }
+      }
+    }
+  }
+  
+  if (pthread_mutex_unlock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  return NULL;
+}
+
+/*
+ * Drop all the read-ahead blocks of a PREFETCH_SOURCE and restart the
+ * reader thread at a new file offset.
+ * 
+ * The caller must hold the lock.  The offset is clamped to the length
+ * of the file.
+ * 
+ * Parameters:
+ * 
+ *   pp - the instance data
+ * 
+ *   offset - the new reading position
+ */
+static void dropPrefetch(PREFETCH_SOURCE *pp, int64_t offset) {
+  
+  /* Check parameters */
+  if ((pp == NULL) || (offset < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Clamp the offset */
+  if (offset > pp->flen) {
+    offset = pp->flen;
+  }
+  
+  /* Empty the ring and move both positions */
+  pp->head  = 0;
+  pp->count = 0;
+  pp->spos  = 0;
+  pp->coff  = offset;
+  pp->roff  = offset;
+  pp->done  = 0;
+  (pp->gen)++;
+  
+  /* Wake up the reader thread */
+  if (pthread_cond_signal(&(pp->cv_space))) {
+    fault(__LINE__);
+  }
+}
+
+/*
+ * Implementation of the block read callback for PREFETCH_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_readBlock function pointer
+ * type for the interface.
+ * 
+ * This only waits for the reader thread if the ring is empty.
+ * Otherwise, it copies as much as it can from the filled slots.
+ */
+static int32_t prefetch_source_readBlock(
+    void    * pInstance,
+    uint8_t * pBuf,
+    int32_t   len) {
+  
+  PREFETCH_SOURCE *pp = NULL;
+  int32_t result = 0;
+  int32_t fill = 0;
+  int32_t n = 0;
+  
+  /* Check parameters */
+  if ((pInstance == NULL) || (pBuf == NULL) || (len < 1)) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  pp = (PREFETCH_SOURCE *) pInstance;
+  
+  if (pthread_mutex_lock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  /* Wait until there is a filled slot or the reader is done */
+  while ((pp->count < 1) && (!(pp->done))) {
+    if (pthread_cond_wait(&(pp->cv_data), &(pp->lock))) {
+      fault(__LINE__);
+    }
+  }
+  
+  /* Copy from the filled slots, emptying each one that is used up */
+  while ((result < len) && (pp->count > 0)) {
+    fill = (pp->pFill)[pp->head];
+    if (fill < 0) {
+      if (result < 1) {
+        result = SMFSOURCE_IOERR;
+      }
+      break;
+    }
+    
+    n = fill - pp->spos;
+    if (n > len - result) {
+      n = len - result;
+    }
+    memcpy(
+      &(pBuf[result]),
+      &((pp->pRing)[
+          ((size_t) pp->head) * SMF_PREFETCH_BLOCK + pp->spos]),
+      (size_t) n);
+    
+    result += n;
+    pp->spos += n;
+    pp->coff += (int64_t) n;
+    
+    if (pp->spos >= fill) {
+      pp->head = (pp->head + 1) % pp->depth;
+      (pp->count)--;
+      pp->spos = 0;
+      if (pthread_cond_signal(&(pp->cv_space))) {
+        fault(__LINE__);
+      }
+    }
+  }
+  
+  if (pthread_mutex_unlock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Implementation of the rewind callback for PREFETCH_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_rewind function pointer
+ * type for the interface.
+ */
+static int prefetch_source_rewind(void *pInstance) {
+  
+  PREFETCH_SOURCE *pp = NULL;
+  
+  /* Check parameter */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  pp = (PREFETCH_SOURCE *) pInstance;
+  
+  /* Drop the ring and start reading again from the beginning */
+  if (pthread_mutex_lock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  dropPrefetch(pp, 0);
+  
+  if (pthread_mutex_unlock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  return 1;
+}
+
+/*
+ * Implementation of the close callback for PREFETCH_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_close function pointer type
+ * for the interface.
+ */
+static int prefetch_source_close(void *pInstance) {
+  
+  int status = 1;
+  PREFETCH_SOURCE *pp = NULL;
+  
+  /* Check parameter */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  pp = (PREFETCH_SOURCE *) pInstance;
+  
+  /* Stop the reader thread and wait for it */
+  if (pthread_mutex_lock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  pp->stop = 1;
+  if (pthread_cond_signal(&(pp->cv_space))) {
+    fault(__LINE__);
+  }
+  
+  if (pthread_mutex_unlock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  if (pthread_join(pp->thread, NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Release the file and the instance data */
+  if (close(pp->fd)) {
+    status = 0;
+  }
+  
+  pthread_cond_destroy(&(pp->cv_space));
+  pthread_cond_destroy(&(pp->cv_data));
+  pthread_mutex_destroy(&(pp->lock));
+  
+  free(pp->pFill);
+  free(pp->pRing);
+  free(pp);
+  pp = NULL;
+  pInstance = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Implementation of the skip callback for PREFETCH_SOURCE.
+ * 
+ * See the specification of the smfsource_fp_skip function pointer type
+ * for the interface.
+ * 
+ * Skips that end within the filled slots just consume them.  Otherwise,
+ * the ring is dropped and the reader thread is moved past the skipped
+ * bytes, so they are never read.
+ */
+static int prefetch_source_skip(void *pInstance, int32_t skip) {
+  
+  PREFETCH_SOURCE *pp = NULL;
+  int32_t fill = 0;
+  int32_t n = 0;
+  
+  /* Check parameters */
+  if (pInstance == NULL) {
+    fault(__LINE__);
+  }
+  if (skip < 0) {
+    fault(__LINE__);
+  }
+  
+  /* Cast instance data */
+  pp = (PREFETCH_SOURCE *) pInstance;
+  
+  if (pthread_mutex_lock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  /* Consume the filled slots as far as the skip goes */
+  while ((skip > 0) && (pp->count > 0)) {
+    fill = (pp->pFill)[pp->head];
+    if (fill < 0) {
+      break;
+    }
+    
+    n = fill - pp->spos;
+    if (n > skip) {
+      n = skip;
+    }
+    
+    skip -= n;
+    pp->spos += n;
+    pp->coff += (int64_t) n;
+    
+    if (pp->spos >= fill) {
+      pp->head = (pp->head + 1) % pp->depth;
+      (pp->count)--;
+      pp->spos = 0;
+      if (pthread_cond_signal(&(pp->cv_space))) {
+        fault(__LINE__);
+      }
+    }
+  }
+  
+  /* If the skip goes beyond the filled slots, drop the ring and move
+   * the reader thread past the skipped bytes */
+  if (skip > 0) {
+    dropPrefetch(pp, pp->coff + skip);
+  }
+  
+  if (pthread_mutex_unlock(&(pp->lock))) {
+    fault(__LINE__);
+  }
+  
+  return 1;
+}
+
+#endif
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications
+ */
+
+/*
+ * smf_set_fault function.
+ */
+void smf_set_fault(smf_fp_fault fFault) {
+  m_fault = fFault;
+}
+
+#ifdef SMF_POSIX
+
+/*
+ * smf_set_thread_fault function.
+ */
+int smf_set_thread_fault(smf_fp_thread_fault fFault, void *pCustom) {
+  
+  int status = 1;
+  FAULT_SLOT *pSlot = NULL;
+  
+  /* Make sure the key exists */
+  if (pthread_once(&m_fault_once, &initFaultKey) != 0) {
+    status = 0;
+  }
+  if (status && (!m_fault_ok)) {
+    status = 0;
+  }
+  
+  if (status) {
+    pSlot = (FAULT_SLOT *) pthread_getspecific(m_fault_key);
+  }
+  
+  if (status && (fFault != NULL)) {
+    /* Install the handler, allocating a slot on first use */
+    if (pSlot == NULL) {
+      pSlot = (FAULT_SLOT *) malloc(sizeof(FAULT_SLOT));
+      if (pSlot == NULL) {
+        status = 0;
+      }
+      if (status) {
+        if (pthread_setspecific(m_fault_key, pSlot)) {
+          free(pSlot);
+          pSlot = NULL;
+          status = 0;
+        }
+      }
+    }
+    
+    if (status) {
+      pSlot->fFault  = fFault;
+      pSlot->pCustom = pCustom;
+    }
+    
+  } else if (status && (pSlot != NULL)) {
+    /* Remove the handler */
+    if (pthread_setspecific(m_fault_key, NULL)) {
+      status = 0;
+    }
+    if (status) {
+      free(pSlot);
+      pSlot = NULL;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+#endif
+
+/*
+ * smfsource_custom function.
+ */
+SMFSOURCE *smfsource_custom(
+    void                * pInstance,
+    smfsource_fp_read     fRead,
+    smfsource_fp_rewind   fRewind,
+    smfsource_fp_close    fClose,
+    smfsource_fp_skip     fSkip) {
+  
+  SMFSOURCE *ps = NULL;
+  
+  /* Check parameters */
+  if (fRead == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate new source object */
+  ps = (SMFSOURCE *) calloc(1, sizeof(SMFSOURCE));
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Initialize object */
+  ps->state      = SOURCE_STATE_NORMAL;
+  ps->pInstance  = pInstance;
+  ps->is_mem     = 0;
+  ps->fRead      = fRead;
+  ps->fReadBlock = NULL;
+  ps->fRewind    = fRewind;
+  ps->fClose     = fClose;
+  ps->fSkip      = fSkip;
+  ps->pWin       = NULL;
+  ps->pBlock     = NULL;
+  ps->blen       = 0;
+  ps->bpos       = 0;
+#ifdef SMF_ENABLE_STATS
+  ps->pStats     = NULL;
+#endif
+  
+  /* Return new object */
+  return ps;
+}
+
+/*
+ * smfsource_custom_block function.
+ */
+SMFSOURCE *smfsource_custom_block(
+    void                   * pInstance,
+    smfsource_fp_readBlock   fReadBlock,
+    smfsource_fp_rewind      fRewind,
+    smfsource_fp_close       fClose,
+    smfsource_fp_skip        fSkip) {
+  return newBlockSource(pInstance, fReadBlock, fRewind, fClose, fSkip, NULL);
+}
+
+/*
+ * smfsource_new_handle function.
+ */
+SMFSOURCE *smfsource_new_handle(
+    FILE * pIn,
+    int    is_owner,
+    int    can_seek,
+    int  * pErr) {
+  return smfsource_new_handle_ex(pIn, is_owner, can_seek, NULL, pErr);
+}
+
+/*
+ * smfsource_new_handle_ex function.
+ */
+SMFSOURCE *smfsource_new_handle_ex(
+    FILE                * pIn,
+    int                   is_owner,
+    int                   can_seek,
+    const SMF_ALLOCATOR * pAlloc,
+    int                 * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int64_t flen = -1;
+  
+  HANDLE_SOURCE *ph = NULL;
+  SMFSOURCE *ps = NULL;
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    fault(__LINE__);
+  }
+  if (pAlloc != NULL) {
+    checkAllocator(pAlloc);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* If random access supported, attempt to find the file length and
+   * rewind the file */
+  if (can_seek) {
+    flen = startHandle(pIn);
+    if (flen < 0) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  /* Allocate new handle source structure */
+  if (status) {
+    ph = (HANDLE_SOURCE *) memAlloc(pAlloc, sizeof(HANDLE_SOURCE));
+    if (pAlloc != NULL) {
+      memcpy(&(ph->alloc), pAlloc, sizeof(SMF_ALLOCATOR));
+    }
+  }
+  
+  /* Fill in the handle source structure */
+  if (status) {
+    ph->fh = pIn;
+    ph->fptr = 0;
+    
+    if (can_seek) {
+      ph->flen = flen;
+    } else {
+      ph->flen = -1;
+    }
+    
+    if (is_owner) {
+      ph->is_owner = 1;
+    } else {
+      ph->is_owner = 0;
+    }
+    
+    if (can_seek) {
+      ph->can_seek = 1;
+    } else {
+      ph->can_seek = 0;
+    }
+  }
+  
+  /* Construct the new input source */
+  if (status) {
+    if (can_seek) {
+      ps = newBlockSource(
+              ph,
+              &handle_source_readBlock,
+              &handle_source_rewind,
+              &handle_source_close,
+              &handle_source_skip,
+              pAlloc);
+    } else {
+      ps = newBlockSource(
+              ph,
+              &handle_source_readBlock,
+              NULL,
+              &handle_source_close,
+              &handle_source_skip,
+              pAlloc);
+    }
+  }
+  
+  /* Return the new source, or NULL */
+  return ps;
+}
+
+/*
+ * smfsource_new_path function.
+ */
+SMFSOURCE *smfsource_new_path(const char *pPath, int *pErr) {
+  return smfsource_new_path_ex(pPath, NULL, pErr);
+}
+
+/*
+ * smfsource_new_path_ex function.
+ */
+SMFSOURCE *smfsource_new_path_ex(
+    const char          * pPath,
+    const SMF_ALLOCATOR * pAlloc,
+    int                 * pErr) {
+  
+  int dummy = 0;
+  int status = 1;
+  FILE *fh = NULL;
+  SMFSOURCE *ps = NULL;
+  
+  /* Check parameters */
+  if (pPath == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* If pErr not provided, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Reset pErr */
+  *pErr = 0;
+  
+  /* Open the file */
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    status = 0;
+    *pErr = SMF_ERR_OPEN_FILE;
+  }
+  
+  /* Call through */
+  if (status) {
+    ps = smfsource_new_handle_ex(fh, 1, 1, pAlloc, pErr);
+  }
+  
+  /* Return source object or NULL */
+  return ps;
+}
+
+/*
+ * smfsource_new_memory function.
+ */
+SMFSOURCE *smfsource_new_memory(const void *pData, int64_t len) {
+  return smfsource_new_memory_ex(pData, len, NULL);
+}
+
+/*
+ * smfsource_new_memory_ex function.
+ */
+SMFSOURCE *smfsource_new_memory_ex(
+    const void          * pData,
+    int64_t               len,
+    const SMF_ALLOCATOR * pAlloc) {
+  
+  /* Check parameters */
+  if ((len < 0) || ((pData == NULL) && (len > 0))) {
+    fault(__LINE__);
+  }
+  
+  /* Call through */
+  return newMemorySource((const uint8_t *) pData, len, NULL, NULL, pAlloc);
+}
+
+#ifdef SMF_POSIX
+
+/*
+ * smfsource_new_mmap function.
+ */
+SMFSOURCE *smfsource_new_mmap(const char *pPath, int *pErr) {
+  
+  int dummy = 0;
+  int status = 1;
+  int fd = -1;
+  struct stat st;
+  void *pMap = NULL;
+  size_t mlen = 0;
+  
+  MMAP_SOURCE *pm = NULL;
+  SMFSOURCE *ps = NULL;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if (pPath == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* If pErr not provided, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Reset pErr */
+  *pErr = 0;
+  
+  /* Open the file */
+  fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    status = 0;
+    *pErr = SMF_ERR_OPEN_FILE;
+  }
+  
+  /* Determine the file length and make sure it is in range */
+  if (status) {
+    if (fstat(fd, &st)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  if (status) {
+    if ((st.st_size < 0) ||
+        ((uintmax_t) st.st_size > (uintmax_t) SIZE_MAX)) {
+      status = 0;
+      *pErr = SMF_ERR_HUGE_FILE;
+    } else {
+      mlen = (size_t) st.st_size;
+    }
+  }
+  
+  /* Map the file if it is not empty, and let the system know that it
+   * will mostly be read sequentially */
+  if (status && (mlen > 0)) {
+    pMap = mmap(NULL, mlen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pMap == MAP_FAILED) {
+      pMap = NULL;
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+    
+    if (status) {
+      posix_madvise(pMap, mlen, POSIX_MADV_SEQUENTIAL);
+    }
+  }
+  
+  /* The mapping stays valid after the file descriptor is closed */
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  
+  /* Allocate and fill in the mapping instance structure */
+  if (status) {
+    pm = (MMAP_SOURCE *) calloc(1, sizeof(MMAP_SOURCE));
+    if (pm == NULL) {
+      fault(__LINE__);
+    }
+    pm->pMap = pMap;
+    pm->mlen = mlen;
+  }
+  
+  /* Construct the new input source */
+  if (status) {
+    ps = newMemorySource(
+            (const uint8_t *) pMap,
+            (int64_t) mlen,
+            pm,
+            &mmap_source_close,
+            NULL);
+  }
+  
+  /* Return source object or NULL */
+  return ps;
+}
+
+/*
+ * smfsource_new_prefetch function.
+ */
+SMFSOURCE *smfsource_new_prefetch(
+    const char * pPath,
+    int32_t      depth,
+    int        * pErr) {
+  
+  int dummy = 0;
+  int status = 1;
+  int fd = -1;
+  int64_t flen = 0;
+  struct stat st;
+  
+  PREFETCH_SOURCE *pp = NULL;
+  SMFSOURCE *ps = NULL;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (depth < 1) || (depth > SMF_MAX_PREFETCH)) {
+    fault(__LINE__);
+  }
+  
+  /* If pErr not provided, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Reset pErr */
+  *pErr = 0;
+  
+  /* Open the file and determine its length */
+  fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    status = 0;
+    *pErr = SMF_ERR_OPEN_FILE;
+  }
+  
+  if (status) {
+    if (fstat(fd, &st)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  if (status) {
+    if (st.st_size < 0) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    } else {
+      flen = (int64_t) st.st_size;
+    }
+  }
+  
+  /* Allocate and fill in the instance structure */
+  if (status) {
+    pp = (PREFETCH_SOURCE *) calloc(1, sizeof(PREFETCH_SOURCE));
+    if (pp == NULL) {
+      fault(__LINE__);
+    }
+    
+    pp->pRing = (uint8_t *) malloc(
+                  ((size_t) depth) * SMF_PREFETCH_BLOCK);
+    pp->pFill = (int32_t *) calloc((size_t) depth, sizeof(int32_t));
+    if ((pp->pRing == NULL) || (pp->pFill == NULL)) {
+      fault(__LINE__);
+    }
+    
+    pp->fd    = fd;
+    pp->flen  = flen;
+    pp->depth = depth;
+    pp->head  = 0;
+    pp->count = 0;
+    pp->spos  = 0;
+    pp->coff  = 0;
+    pp->roff  = 0;
+    pp->gen   = 0;
+    pp->done  = 0;
+    pp->stop  = 0;
+    
+    if (pthread_mutex_init(&(pp->lock), NULL) ||
+        pthread_cond_init(&(pp->cv_data), NULL) ||
+        pthread_cond_init(&(pp->cv_space), NULL)) {
+      fault(__LINE__);
+    }
+  }
+  
+  /* Start the reader thread */
+  if (status) {
+    if (pthread_create(&(pp->thread), NULL, &prefetch_thread, pp)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+      
+      pthread_cond_destroy(&(pp->cv_space));
+      pthread_cond_destroy(&(pp->cv_data));
+      pthread_mutex_destroy(&(pp->lock));
+      free(pp->pFill);
+      free(pp->pRing);
+      free(pp);
+      pp = NULL;
+    }
+  }
+  
+  /* Close the file if we failed */
+  if ((!status) && (fd >= 0)) {
+    close(fd);
+    fd = -1;
+  }
+  
+  /* Construct the new input source */
+  if (status) {
+    ps = newBlockSource(
+            pp,
+            &prefetch_source_readBlock,
+            &prefetch_source_rewind,
+            &prefetch_source_close,
+            &prefetch_source_skip,
+            NULL);
+  }
+  
+  /* Return source object or NULL */
+  return ps;
+}
+
+#endif
+
+/*
+ * smfsource_close function.
+ */
+int smfsource_close(SMFSOURCE *pSrc) {
+  int status = 1;
+  SMF_ALLOCATOR alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SMF_ALLOCATOR));
+  
+  /* Only proceed if non-NULL passed */
+  if (pSrc != NULL) {
+    
+    /* Get the allocator the source came from */
+    memcpy(&alloc, &(pSrc->alloc), sizeof(SMF_ALLOCATOR));
+    
+    /* If destructor is registered, invoke it */
+    if (pSrc->fClose != NULL) {
+      if (!(pSrc->fClose(pSrc->pInstance))) {
+        status = 0;
+      }
+    }
+    
+    /* Release refill buffer if allocated */
+    if (pSrc->pBlock != NULL) {
+      memFree(&alloc, pSrc->pBlock);
+      pSrc->pBlock = NULL;
+    }
+    
+    /* Release memory block */
+    memFree(&alloc, pSrc);
+    pSrc = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfsource_rebind_handle function.
+ */
+int smfsource_rebind_handle(
+    SMFSOURCE * pSrc,
+    FILE      * pIn,
+    int         is_owner,
+    int         can_seek,
+    int       * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int64_t flen = -1;
+  HANDLE_SOURCE *ph = NULL;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (pIn == NULL)) {
+    fault(__LINE__);
+  }
+  if (pSrc->fReadBlock != &handle_source_readBlock) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Get the instance data */
+  ph = (HANDLE_SOURCE *) pSrc->pInstance;
+  
+  /* If random access supported, attempt to find the file length and
+   * rewind the file, leaving the source unchanged on failure */
+  if (can_seek) {
+    flen = startHandle(pIn);
+    if (flen < 0) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  /* Bind the new handle, releasing the previous handle if we own it;
+   * the new handle is bound even if closing the previous one fails */
+  if (status) {
+    if (ph->is_owner && (ph->fh != pIn)) {
+      if (fclose(ph->fh)) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+      }
+    }
+    
+    ph->fh = pIn;
+    ph->fptr = 0;
+    
+    if (can_seek) {
+      ph->flen = flen;
+      ph->can_seek = 1;
+      pSrc->fRewind = &handle_source_rewind;
+      pSrc->fSkip = &handle_source_skip;
+    } else {
+      ph->flen = -1;
+      ph->can_seek = 0;
+      pSrc->fRewind = NULL;
+      pSrc->fSkip = &handle_source_skip;
+    }
+    
+    if (is_owner) {
+      ph->is_owner = 1;
+    } else {
+      ph->is_owner = 0;
+    }
+    
+    pSrc->state = SOURCE_STATE_NORMAL;
+    pSrc->pWin  = pSrc->pBlock;
+    pSrc->blen  = 0;
+    pSrc->bpos  = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfsource_rebind_path function.
+ */
+int smfsource_rebind_path(SMFSOURCE *pSrc, const char *pPath, int *pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  FILE *fh = NULL;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (pPath == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* If pErr not provided, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Reset pErr */
+  *pErr = 0;
+  
+  /* Open the file */
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    status = 0;
+    *pErr = SMF_ERR_OPEN_FILE;
+  }
+  
+  /* Call through, closing the new file if it could not be bound */
+  if (status) {
+    if (!smfsource_rebind_handle(pSrc, fh, 1, 1, pErr)) {
+      status = 0;
+      if (((HANDLE_SOURCE *) pSrc->pInstance)->fh != fh) {
+        fclose(fh);
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfsource_rebind_memory function.
+ */
+void smfsource_rebind_memory(
+    SMFSOURCE  * pSrc,
+    const void * pData,
+    int64_t      len) {
+  
+  /* Check parameters */
+  if (pSrc == NULL) {
+    fault(__LINE__);
+  }
+  if ((!(pSrc->is_mem)) || (pSrc->fClose != NULL)) {
+    fault(__LINE__);
+  }
+  if ((len < 0) || ((pData == NULL) && (len > 0))) {
+    fault(__LINE__);
+  }
+  
+  /* Point the window at the new input */
+  pSrc->state = SOURCE_STATE_NORMAL;
+  pSrc->pWin  = (const uint8_t *) pData;
+  pSrc->blen  = len;
+  pSrc->bpos  = 0;
+}
+
+/*
+ * smfsource_canRewind function.
+ */
+int smfsource_canRewind(SMFSOURCE *pSrc) {
+  
+  int result = 0;
+  
+  /* Check parameters */
+  if (pSrc == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Query object */
+  if (pSrc->is_mem || (pSrc->fRewind != NULL)) {
+    result = 1;
+  } else {
+    result = 0;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfsource_rewind function.
+ */
+int smfsource_rewind(SMFSOURCE *pSrc) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if (pSrc == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Memory-resident sources are rewound directly on the window and
+   * never fail */
+  if (pSrc->is_mem) {
+    pSrc->bpos = 0;
+    
+  } else {
+    /* If rewinding not supported, fail without any state change */
+    if (pSrc->fRewind == NULL) {
+      status = 0;
+    }
+    
+    /* If in double-error mode, fail without attempting rewind again */
+    if (status) {
+      if (pSrc->state == SOURCE_STATE_DOUBLE) {
+        status = 0;
+      }
+    }
+    
+    /* If we got here successfully, discard anything in the refill
+     * buffer and attempt a rewind */
+    if (status) {
+      pSrc->bpos = 0;
+      pSrc->blen = 0;
+      SOURCE_STAT(pSrc, cb_rewind);
+      if (!pSrc->fRewind(pSrc->pInstance)) {
+        status = 0;
+        pSrc->state = SOURCE_STATE_DOUBLE;
+      }
+    }
+  }
+  
+  /* If rewind was successful, clear any error or EOF state */
+  if (status) {
+    pSrc->state = SOURCE_STATE_NORMAL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfsource_skip function.
+ */
+int smfsource_skip(SMFSOURCE *pSrc, int32_t skip) {
+  
+  int status = 1;
+  int32_t i = 0;
+  int c = 0;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (skip < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* If in an error state, fail */
+  if ((pSrc->state == SOURCE_STATE_ERROR) ||
+      (pSrc->state == SOURCE_STATE_DOUBLE)) {
+    status = 0;
+  }
+  
+  /* Count the skip */
+  if (status && (skip > 0)) {
+    SOURCE_STAT(pSrc, skips);
+  }
+  
+  /* Skip over anything that is in the window first; for memory-resident
+   * sources, this is the whole rest of the input, so that nothing else
+   * needs to be done */
+  if (status && (skip > 0)) {
+    if (skip <= pSrc->blen - pSrc->bpos) {
+      pSrc->bpos += skip;
+      skip = 0;
+      
+    } else {
+      skip -= (int32_t) (pSrc->blen - pSrc->bpos);
+      pSrc->bpos = pSrc->blen;
+    }
+  }
+  
+  /* Only proceed if non-zero skip distance and in normal state */
+  if (status && (skip > 0) && (pSrc->state == SOURCE_STATE_NORMAL)) {
+    /* Check whether we have a skip callback */
+    if (pSrc->is_mem) {
+      /* Memory-resident source was already skipped to end of input, so
+       * the rest of the skip goes beyond EOF */
+      skip = 0;
+      pSrc->state = SOURCE_STATE_EOF;
+      
+    } else if (pSrc->fSkip != NULL) {
+      /* We have a skip callback, so use that */
+      SOURCE_STAT(pSrc, cb_skip);
+      if (!pSrc->fSkip(pSrc->pInstance, skip)) {
+        status = 0;
+        pSrc->state = SOURCE_STATE_ERROR;
+      }
+      
+    } else if (pSrc->fReadBlock != NULL) {
+      /* We don't have a skip callback, so fill the refill buffer
+       * repeatedly and skip over what we buffered, stopping early if we
+       * hit EOF or an error */
+      SOURCE_STAT(pSrc, skip_loops);
+      while (skip > 0) {
+        if (!refillSource(pSrc)) {
+          if (pSrc->state == SOURCE_STATE_ERROR) {
+            status = 0;
+          }
+          break;
+        }
+        
+        if (skip <= pSrc->blen) {
+          pSrc->bpos = skip;
+          skip = 0;
+          
+        } else {
+          skip -= (int32_t) pSrc->blen;
+          pSrc->bpos = pSrc->blen;
+        }
+      }
+      
+    } else {
+      /* We don't have a skip callback, so use read callback
+       * repeatedly */
+      SOURCE_STAT(pSrc, skip_loops);
+      for(i = 0; i < skip; i++) {
+        /* Attempt a read */
+        c = pSrc->fRead(pSrc->pInstance);
+        SOURCE_STAT(pSrc, cb_read);
+        
+        /* If we got EOF, then leave loop successfully after changing to
+         * EOF state; if we got an error, then leave loop in error after
+         * changing to error state */
+        if (c == SMFSOURCE_EOF) {
+          pSrc->state = SOURCE_STATE_EOF;
+          break;
+          
+        } else if (c == SMFSOURCE_IOERR) {
+          status = 0;
+          pSrc->state = SOURCE_STATE_ERROR;
+          break;
+        }
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfsource_read function.
+ */
+int smfsource_read(SMFSOURCE *pSrc) {
+  
+  int c = 0;
+  
+  /* Check parameters */
+  if (pSrc == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* If in an error state, fail */
+  if ((pSrc->state == SOURCE_STATE_ERROR) ||
+      (pSrc->state == SOURCE_STATE_DOUBLE)) {
+    c = SMFSOURCE_IOERR;
+  }
+  
+  /* Call through if in normal state; else, if in EOF state, set an EOF
+   * return */
+  if (c != SMFSOURCE_IOERR) {
+    if ((pSrc->state == SOURCE_STATE_NORMAL) && pSrc->is_mem) {
+      /* Memory-resident source, so take the next byte from the window
+       * or switch to EOF state at the end of the window */
+      if (pSrc->bpos < pSrc->blen) {
+        c = (pSrc->pWin)[pSrc->bpos];
+        (pSrc->bpos)++;
+      } else {
+        c = SMFSOURCE_EOF;
+        pSrc->state = SOURCE_STATE_EOF;
+      }
+      
+    } else if ((pSrc->state == SOURCE_STATE_NORMAL) &&
+        (pSrc->fReadBlock != NULL)) {
+      /* Block source, so take the next byte from the refill buffer,
+       * refilling it first if it is empty */
+      if (pSrc->bpos >= pSrc->blen) {
+        if (!refillSource(pSrc)) {
+          if (pSrc->state == SOURCE_STATE_EOF) {
+            c = SMFSOURCE_EOF;
+          } else {
+            c = SMFSOURCE_IOERR;
+          }
+        }
+      }
+      
+      if (c >= 0) {
+        c = (pSrc->pWin)[pSrc->bpos];
+        (pSrc->bpos)++;
+      }
+      
+    } else if (pSrc->state == SOURCE_STATE_NORMAL) {
+      c = pSrc->fRead(pSrc->pInstance);
+      SOURCE_STAT(pSrc, cb_read);
+      
+      if (c == SMFSOURCE_IOERR) {
+        pSrc->state = SOURCE_STATE_ERROR;
+      
+      } else if (c == SMFSOURCE_EOF) {
+        pSrc->state = SOURCE_STATE_EOF;
+      }
+      
+    } else if (pSrc->state == SOURCE_STATE_EOF) {
+      c = SMFSOURCE_EOF;
+      
+    } else {
+      fault(__LINE__);
+    }
+  }
+  
+  /* Return result */
+  return c;
+}
+
+/*
+ * smfsource_readBlock function.
+ */
+int32_t smfsource_readBlock(SMFSOURCE *pSrc, uint8_t *pBuf, int32_t len) {
+  
+  int32_t result = 0;
+  int32_t n = 0;
+  int c = 0;
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (len < 0) || ((pBuf == NULL) && (len > 0))) {
+    fault(__LINE__);
+  }
+  
+  /* If in an error state, fail */
+  if ((pSrc->state == SOURCE_STATE_ERROR) ||
+      (pSrc->state == SOURCE_STATE_DOUBLE)) {
+    result = SMFSOURCE_IOERR;
+  }
+  
+  /* Keep reading until we have everything or we reach EOF or error */
+  while ((result >= 0) && (result < len) &&
+          (pSrc->state == SOURCE_STATE_NORMAL)) {
+    
+    if (pSrc->bpos < pSrc->blen) {
+      /* Copy as much as we can from the window */
+      if (pSrc->blen - pSrc->bpos < len - result) {
+        n = (int32_t) (pSrc->blen - pSrc->bpos);
+      } else {
+        n = len - result;
+      }
+      memcpy(&(pBuf[result]), &((pSrc->pWin)[pSrc->bpos]), (size_t) n);
+      pSrc->bpos += n;
+      result += n;
+      
+    } else if (pSrc->is_mem) {
+      /* Memory-resident source that is out of data */
+      pSrc->state = SOURCE_STATE_EOF;
+      
+    } else if ((pSrc->fReadBlock != NULL) &&
+                (len - result >= SOURCE_BLOCK)) {
+      /* Block source with a big request remaining, so bypass the refill
+       * buffer and read directly into the caller's buffer */
+      n = pSrc->fReadBlock(
+              pSrc->pInstance, &(pBuf[result]), len - result);
+      SOURCE_STAT(pSrc, cb_block);
+      if (n == SMFSOURCE_IOERR) {
+        pSrc->state = SOURCE_STATE_ERROR;
+        result = SMFSOURCE_IOERR;
+        
+      } else if (n == 0) {
+        pSrc->state = SOURCE_STATE_EOF;
+        
+      } else if ((n > 0) && (n <= len - result)) {
+        result += n;
+        
+      } else {
+        fault(__LINE__);
+      }
+      
+    } else if (pSrc->fReadBlock != NULL) {
+      /* Block source with a small request remaining, so refill the
+       * buffer and then copy from it */
+      if (!refillSource(pSrc)) {
+        if (pSrc->state == SOURCE_STATE_ERROR) {
+          result = SMFSOURCE_IOERR;
+        }
+      }
+      
+    } else {
+      /* Byte source, so read a byte at a time */
+      c = smfsource_read(pSrc);
+      if (c == SMFSOURCE_IOERR) {
+        result = SMFSOURCE_IOERR;
+      } else if (c >= 0) {
+        pBuf[result] = (uint8_t) c;
+        result++;
+      }
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfparse_defaults function.
+ */
+void smfparse_defaults(SMF_OPTIONS *pOpt) {
+  
+  /* Check parameters */
+  if (pOpt == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Fill in defaults */
+  memset(pOpt, 0, sizeof(SMF_OPTIONS));
+  
+  pOpt->max_payload  = SMF_DEFAULT_MAX_PAYLOAD;
+  pOpt->init_payload = 0;
+  pOpt->max_file     = SMF_DEFAULT_MAX_FILE;
+  pOpt->checkpoint   = 0;
+  pOpt->validate     = SMF_VALIDATE_STRICT;
+}
+
+/*
+ * smfparse_alloc function.
+ */
+SMFPARSE *smfparse_alloc(void) {
+  return smfparse_alloc_ex(NULL);
+}
+
+/*
+ * smfparse_alloc_ex function.
+ */
+SMFPARSE *smfparse_alloc_ex(const SMF_OPTIONS *pOpt) {
+  SMFPARSE *ps = NULL;
+  
+  /* Check options */
+  if (pOpt != NULL) {
+    if ((pOpt->max_payload < 0) ||
+        (pOpt->max_payload > SMF_MAX_VARINT) ||
+        (pOpt->init_payload < 0) ||
+        (pOpt->init_payload > pOpt->max_payload) ||
+        (pOpt->max_file < 1) ||
+        (pOpt->checkpoint < 0) ||
+        (pOpt->validate < SMF_VALIDATE_STRICT) ||
+        (pOpt->validate > SMF_VALIDATE_LENIENT)) {
+      fault(__LINE__);
+    }
+    checkAllocator(&(pOpt->alloc));
+  }
+  
+  if (pOpt != NULL) {
+    ps = (SMFPARSE *) memAlloc(&(pOpt->alloc), sizeof(SMFPARSE));
+  } else {
+    ps = (SMFPARSE *) memAlloc(NULL, sizeof(SMFPARSE));
+  }
+  
+  ps->status    = 0;
+  ps->ckrem     = -1;
+  ps->trkcount  = 0;
+  ps->foff      = 0;
+  ps->blen      = 0;
+  ps->bcap      = 0;
+  ps->bptr      = NULL;
+  ps->pPay      = NULL;
+  ps->plen      = 0;
+  ps->run       = -1;
+  ps->has_index = 0;
+  ps->pIdx      = NULL;
+  ps->icount    = 0;
+  ps->icap      = 0;
+  ps->pCkpt     = NULL;
+  ps->ccount    = 0;
+  ps->ccap      = 0;
+  ps->tick      = 0;
+  ps->repairs   = 0;
+  ps->pTempo    = NULL;
+  ps->filter    = SMF_FILTER_ALL;
+  ps->pQueue    = NULL;
+  ps->qcap      = 0;
+  ps->qlen      = 0;
+  ps->qpos      = 0;
+  ps->pFeed     = NULL;
+  ps->fin       = 0;
+  ps->wait      = 0;
+  ps->need      = 0;
+  ps->fError    = NULL;
+  ps->pError    = NULL;
+  ps->ebyte     = -1;
+  ps->hold      = 0;
+  memset(&(ps->err), 0, sizeof(SMF_ERRINFO));
+  
+#ifdef SMF_ENABLE_STATS
+  memset(&(ps->stats), 0, sizeof(SMF_STATS));
+  ps->fClock    = NULL;
+  ps->pClock    = NULL;
+#endif
+  
+  if (pOpt != NULL) {
+    memcpy(&(ps->opt), pOpt, sizeof(SMF_OPTIONS));
+  } else {
+    smfparse_defaults(&(ps->opt));
+  }
+  
+  /* Allocate the data buffer up front if requested */
+  if ((ps->opt).init_payload > 0) {
+    ps->bptr = (uint8_t *) memRealloc(
+                  &((ps->opt).alloc), NULL, (size_t) (ps->opt).init_payload);
+    ps->bcap = (ps->opt).init_payload;
+  }
+  
+  return ps;
+}
+
+/*
+ * smfparse_free function.
+ */
+void smfparse_free(SMFPARSE *ps) {
+  
+  SMF_ALLOCATOR alloc;
+  
+  memset(&alloc, 0, sizeof(SMF_ALLOCATOR));
+  
+  if (ps != NULL) {
+    memcpy(&alloc, &((ps->opt).alloc), sizeof(SMF_ALLOCATOR));
+    if (ps->bptr != NULL) {
+      memFree(&alloc, ps->bptr);
+      ps->bptr = NULL;
+    }
+    if (ps->pIdx != NULL) {
+      memFree(&alloc, ps->pIdx);
+      ps->pIdx = NULL;
+    }
+    if (ps->pCkpt != NULL) {
+      memFree(&alloc, ps->pCkpt);
+      ps->pCkpt = NULL;
+    }
+    if (ps->pQueue != NULL) {
+      memFree(&alloc, ps->pQueue);
+      ps->pQueue = NULL;
+    }
+    if (ps->pFeed != NULL) {
+      smfsource_close(ps->pFeed);
+      ps->pFeed = NULL;
+    }
+    memFree(&alloc, ps);
+    ps = NULL;
+  }
+}
+
+/*
+ * smfparse_reset function.
+ */
+void smfparse_reset(SMFPARSE *ps) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Return the parse to the start, keeping the data buffer */
+  resetParser(ps);
+  
+  /* Forget the chunk index of the previous input */
+  ps->has_index = 0;
+  ps->icount    = 0;
+  ps->ccount    = 0;
+  
+  /* Empty the feed queue, keeping its buffer */
+  ps->qlen = 0;
+  ps->qpos = 0;
+  ps->fin  = 0;
+  ps->wait = 0;
+  ps->need = 0;
+}
+
+/*
+ * smfparse_read function.
+ */
+void smfparse_read(SMFPARSE *ps, SMF_ENTITY *pEnt, SMFSOURCE *pSrc) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnt == NULL) || (pSrc == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Empty the data buffer and reset entity structure */
+  ps->blen = 0;
+  memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+  
+  /* Read the entity */
+  readEntity(ps, pEnt, pSrc);
+}
+
+/*
+ * smfparse_run function.
+ */
+int smfparse_run(
+    SMFPARSE           * ps,
+    SMFSOURCE          * pSrc,
+    const SMF_HANDLERS * pHandlers,
+    void               * pCustom) {
+  
+  int result = 0;
+  int more = 1;
+  uint32_t filter = 0;
+  uint32_t mask = 0;
+  const SMF_HANDLERS *ph = NULL;
+  SMF_ENTITY ent;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (pHandlers == NULL)) {
+    fault(__LINE__);
+  }
+  ph = pHandlers;
+  
+  /* Only decode the event types that have handlers, leaving the mask
+   * at SMF_FILTER_ALL if they all do so that nothing has to be
+   * filtered */
+  mask = SMF_FILTER_ALL;
+  if (ph->fNoteOff == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_NOTE_OFF);
+  }
+  if (ph->fNoteOn == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_NOTE_ON);
+  }
+  if (ph->fKeyAftertouch == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_KEY_AFTERTOUCH);
+  }
+  if (ph->fControl == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_CONTROL);
+  }
+  if (ph->fProgram == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_PROGRAM);
+  }
+  if (ph->fChAftertouch == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_CH_AFTERTOUCH);
+  }
+  if (ph->fPitchBend == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_PITCH_BEND);
+  }
+  if (ph->fSysex == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_SYSEX);
+  }
+  if (ph->fSysesc == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_SYSESC);
+  }
+  if (ph->fSeqNum == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_SEQ_NUM);
+  }
+  if (ph->fText == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_TEXT);
+  }
+  if (ph->fChPrefix == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_CH_PREFIX);
+  }
+  if (ph->fTempo == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_TEMPO);
+  }
+  if (ph->fSmpte == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_SMPTE);
+  }
+  if (ph->fTimeSig == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_TIME_SIG);
+  }
+  if (ph->fKeySig == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_KEY_SIG);
+  }
+  if (ph->fMeta == NULL) {
+    mask &= ~SMF_FILTER(SMF_TYPE_META);
+  }
+  
+  filter = ps->filter;
+  ps->filter = filter & mask;
+  
+  /* Read and dispatch entities until EOF, an error, or a handler stops
+   * the run */
+  while (more) {
+    ps->blen = 0;
+    memcpy(&ent, &m_blank, sizeof(SMF_ENTITY));
+    readEntity(ps, &ent, pSrc);
+    
+    switch (ent.status) {
+      case SMF_TYPE_HEADER:
+        if (ph->fHeader != NULL) {
+          more = ph->fHeader(pCustom, ent.pHead);
+        }
+        break;
+      
+      case SMF_TYPE_CHUNK:
+        if (ph->fChunk != NULL) {
+          more = ph->fChunk(pCustom, ent.chunk_type);
+        }
+        break;
+      
+      case SMF_TYPE_BEGIN_TRACK:
+        if (ph->fBeginTrack != NULL) {
+          more = ph->fBeginTrack(pCustom, ps->trkcount - 1, ent.tick);
+        }
+        break;
+      
+      case SMF_TYPE_END_TRACK:
+        if (ph->fEndTrack != NULL) {
+          more = ph->fEndTrack(pCustom, ps->trkcount - 1, ent.tick);
+        }
+        break;
+      
+      case SMF_TYPE_NOTE_OFF:
+        more = ph->fNoteOff(pCustom, ent.tick, ent.ch, ent.key, ent.val);
+        break;
+      
+      case SMF_TYPE_NOTE_ON:
+        more = ph->fNoteOn(pCustom, ent.tick, ent.ch, ent.key, ent.val);
+        break;
+      
+      case SMF_TYPE_KEY_AFTERTOUCH:
+        more = ph->fKeyAftertouch(
+                  pCustom, ent.tick, ent.ch, ent.key, ent.val);
+        break;
+      
+      case SMF_TYPE_CONTROL:
+        more = ph->fControl(pCustom, ent.tick, ent.ch, ent.ctl, ent.val);
+        break;
+      
+      case SMF_TYPE_PROGRAM:
+        more = ph->fProgram(pCustom, ent.tick, ent.ch, ent.val);
+        break;
+      
+      case SMF_TYPE_CH_AFTERTOUCH:
+        more = ph->fChAftertouch(pCustom, ent.tick, ent.ch, ent.val);
+        break;
+      
+      case SMF_TYPE_PITCH_BEND:
+        more = ph->fPitchBend(pCustom, ent.tick, ent.ch, ent.bend);
+        break;
+      
+      case SMF_TYPE_SYSEX:
+        more = ph->fSysex(
+                  pCustom, ent.tick, 0xf0, ent.buf_ptr, ent.buf_len);
+        break;
+      
+      case SMF_TYPE_SYSESC:
+        more = ph->fSysesc(
+                  pCustom, ent.tick, 0xf7, ent.buf_ptr, ent.buf_len);
+        break;
+      
+      case SMF_TYPE_SEQ_NUM:
+        more = ph->fSeqNum(pCustom, ent.tick, ent.seq_num);
+        break;
+      
+      case SMF_TYPE_TEXT:
+        more = ph->fText(
+                  pCustom, ent.tick, ent.txtype, ent.buf_ptr, ent.buf_len);
+        break;
+      
+      case SMF_TYPE_CH_PREFIX:
+        more = ph->fChPrefix(pCustom, ent.tick, ent.ch);
+        break;
+      
+      case SMF_TYPE_TEMPO:
+        more = ph->fTempo(pCustom, ent.tick, ent.beat_dur);
+        break;
+      
+      case SMF_TYPE_SMPTE:
+        more = ph->fSmpte(pCustom, ent.tick, ent.tcode);
+        break;
+      
+      case SMF_TYPE_TIME_SIG:
+        more = ph->fTimeSig(pCustom, ent.tick, ent.tsig);
+        break;
+      
+      case SMF_TYPE_KEY_SIG:
+        more = ph->fKeySig(pCustom, ent.tick, ent.ksig);
+        break;
+      
+      case SMF_TYPE_META:
+        more = ph->fMeta(
+                  pCustom, ent.tick, ent.meta_type,
+                  ent.buf_ptr, ent.buf_len);
+        break;
+      
+      default:
+        more = 0;
+    }
+    
+    result = ent.status;
+  }
+  
+  /* Restore the event filter */
+  ps->filter = filter;
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfparse_feed function.
+ */
+int32_t smfparse_feed(
+    SMFPARSE   * ps,
+    const void * pData,
+    int32_t      len,
+    SMF_ENTITY * pEnts,
+    int32_t      max) {
+  
+  int32_t count = 0;
+  int32_t new_cap = 0;
+  int retry = 0;
+  SMF_ENTITY *pe = NULL;
+  SMFSOURCE *pSrc = NULL;
+  
+  int sv_status = 0;
+  int32_t sv_ckrem = 0;
+  int32_t sv_trkcount = 0;
+  int64_t sv_foff = 0;
+  int sv_run = 0;
+  int64_t sv_tick = 0;
+  int64_t sv_repairs = 0;
+  int32_t sv_blen = 0;
+  
+#ifdef SMF_ENABLE_STATS
+  SMF_STATS sv_stats;
+  
+  memset(&sv_stats, 0, sizeof(SMF_STATS));
+#endif
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnts == NULL) || (max < 1)) {
+    fault(__LINE__);
+  }
+  if ((len < SMF_FEED_END) || ((pData == NULL) && (len > 0))) {
+    fault(__LINE__);
+  }
+  if (ps->fin && (len > 0)) {
+    fault(__LINE__);
+  }
+  
+  /* Allocate the feed source on first use */
+  if (ps->pFeed == NULL) {
+    ps->pFeed = smfsource_new_memory_ex(NULL, 0, &((ps->opt).alloc));
+  }
+  pSrc = ps->pFeed;
+  
+  /* Drop the input that was parsed by the previous call, which
+   * invalidates the payloads it returned */
+  if (ps->qpos > 0) {
+    if (ps->qlen > ps->qpos) {
+      memmove(
+        ps->pQueue,
+        &((ps->pQueue)[ps->qpos]),
+        (size_t) (ps->qlen - ps->qpos));
+    }
+    ps->qlen -= ps->qpos;
+    ps->wait -= ps->qpos;
+    ps->qpos = 0;
+  }
+  ps->blen = 0;
+  
+  /* Append the new input to the queue, or note the end of the input;
+   * input that would make the queue too big for 32-bit offsets puts the
+   * parser into an error state instead */
+  if ((len > 0) && (len > INT32_MAX - ps->qlen)) {
+    setError(ps, SMF_ERR_HUGE_FILE);
+    
+  } else if (len > 0) {
+    if (ps->qlen + len > ps->qcap) {
+      new_cap = growCapacity(ps->qcap, ps->qlen + len);
+      ps->pQueue = (uint8_t *) resizeBlockWith(
+                      &((ps->opt).alloc), ps->pQueue, new_cap, 1);
+      ps->qcap = new_cap;
+    }
+    memcpy(&((ps->pQueue)[ps->qlen]), pData, (size_t) len);
+    ps->qlen += len;
+    
+  } else if (len == SMF_FEED_END) {
+    ps->fin = 1;
+  }
+  
+  /* Parse entities until the array is full, the input runs out, or the
+   * parse is over */
+  while (count < max) {
+    pe = &(pEnts[count]);
+    memcpy(pe, &m_blank, sizeof(SMF_ENTITY));
+    
+    /* Don't try again before more of a partial entity has arrived,
+     * unless the parser is already in an error state */
+    if ((!(ps->fin)) && (ps->status >= 0) && (ps->qlen < ps->wait)) {
+      pe->status = SMF_TYPE_NEED_MORE;
+      STAT_ADD(ps, entities[SMF_TYPE_NEED_MORE], 1);
+      count++;
+      break;
+    }
+    
+    /* Save the parsing state so that a partial entity can be undone */
+    sv_status   = ps->status;
+    sv_ckrem    = ps->ckrem;
+    sv_trkcount = ps->trkcount;
+    sv_foff     = ps->foff;
+    sv_run      = ps->run;
+    sv_tick     = ps->tick;
+    sv_repairs  = ps->repairs;
+    sv_blen     = ps->blen;
+#ifdef SMF_ENABLE_STATS
+    memcpy(&sv_stats, &(ps->stats), sizeof(SMF_STATS));
+#endif
+    
+    /* Point the feed source at the unparsed input and parse */
+    pSrc->state = SOURCE_STATE_NORMAL;
+    pSrc->pWin  = NULL;
+    pSrc->blen  = ps->qlen - ps->qpos;
+    pSrc->bpos  = 0;
+    if (ps->pQueue != NULL) {
+      pSrc->pWin = &((ps->pQueue)[ps->qpos]);
+    }
+    
+    ps->need = 0;
+    ps->hold = 1;
+    readEntity(ps, pe, pSrc);
+    ps->hold = 0;
+    
+    /* The entity is incomplete if the input ran out before the end of
+     * the input was signaled, either as an EOF error or as a skip that
+     * went beyond the queue */
+    retry = 0;
+    if (!(ps->fin)) {
+      if ((pe->status == SMF_ERR_EOF) ||
+          ((pe->status >= 0) && (pSrc->state == SOURCE_STATE_EOF))) {
+        retry = 1;
+      }
+    }
+    
+    if (retry) {
+      /* Undo the attempt and wait for more input */
+      ps->status   = sv_status;
+      ps->ckrem    = sv_ckrem;
+      ps->trkcount = sv_trkcount;
+      ps->foff     = sv_foff;
+      ps->run      = sv_run;
+      ps->tick     = sv_tick;
+      ps->repairs  = sv_repairs;
+      ps->blen     = sv_blen;
+      ps->pPay     = NULL;
+      ps->plen     = 0;
+#ifdef SMF_ENABLE_STATS
+      memcpy(&(ps->stats), &sv_stats, sizeof(SMF_STATS));
+#endif
+      
+      ps->wait = ((int64_t) ps->qlen) + 1;
+      if (ps->qpos + ps->need > ps->wait) {
+        ps->wait = ps->qpos + ps->need;
+      }
+      
+      memcpy(pe, &m_blank, sizeof(SMF_ENTITY));
+      pe->status = SMF_TYPE_NEED_MORE;
+      STAT_ADD(ps, entities[SMF_TYPE_NEED_MORE], 1);
+      count++;
+      break;
+    }
+    
+    /* Consume the parsed input, and report an error that this attempt
+     * ran into now that it is final */
+    ps->qpos += (int32_t) pSrc->bpos;
+    count++;
+    
+    if ((pe->status < 0) && (sv_status >= 0)) {
+      notifyError(ps);
+    }
+    
+    if (pe->status <= 0) {
+      break;
+    }
+  }
+  
+  /* Return the number of entities */
+  return count;
+}
+
+/*
+ * smfparse_set_filter function.
+ */
+void smfparse_set_filter(SMFPARSE *ps, uint32_t mask) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Set the filter */
+  ps->filter = mask;
+}
+
+/*
+ * smfparse_stats function.
+ */
+int smfparse_stats(const SMFPARSE *ps, SMF_STATS *pStats) {
+  
+  int result = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pStats == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Copy the counters, or report zeros if they are compiled out */
+#ifdef SMF_ENABLE_STATS
+  memcpy(pStats, &(ps->stats), sizeof(SMF_STATS));
+  result = 1;
+#else
+  memset(pStats, 0, sizeof(SMF_STATS));
+  result = 0;
+#endif
+  
+  return result;
+}
+
+/*
+ * smfparse_repairs function.
+ */
+int64_t smfparse_repairs(const SMFPARSE *ps) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Return the count */
+  return ps->repairs;
+}
+
+/*
+ * smfparse_clear_stats function.
+ */
+void smfparse_clear_stats(SMFPARSE *ps) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Clear the counters */
+#ifdef SMF_ENABLE_STATS
+  memset(&(ps->stats), 0, sizeof(SMF_STATS));
+#endif
+}
+
+/*
+ * smfparse_set_clock function.
+ */
+void smfparse_set_clock(SMFPARSE *ps, smf_fp_clock fClock, void *pCustom) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Register the clock */
+#ifdef SMF_ENABLE_STATS
+  ps->fClock = fClock;
+  ps->pClock = pCustom;
+#else
+  (void) fClock;
+  (void) pCustom;
+#endif
+}
+
+/*
+ * smfparse_set_error function.
+ */
+void smfparse_set_error(
+    SMFPARSE          * ps,
+    smfparse_fp_error   fError,
+    void              * pCustom) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Register the callback */
+  ps->fError = fError;
+  ps->pError = pCustom;
+}
+
+/*
+ * smfparse_error function.
+ */
+int smfparse_error(const SMFPARSE *ps, SMF_ERRINFO *pInfo) {
+  
+  int result = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pInfo == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Copy the recorded error, or describe the current position */
+  if (ps->status < 0) {
+    memcpy(pInfo, &(ps->err), sizeof(SMF_ERRINFO));
+    result = 1;
+    
+  } else {
+    describeState(ps, pInfo);
+    pInfo->status_byte = -1;
+  }
+  
+  return result;
+}
+
+/*
+ * smfparse_read_batch function.
+ */
+int32_t smfparse_read_batch(
+    SMFPARSE   * ps,
+    SMF_ENTITY * pEnts,
+    int32_t      max,
+    SMFSOURCE  * pSrc) {
+  
+  int32_t count = 0;
+  int32_t i = 0;
+  int32_t old_len = 0;
+  int32_t off = 0;
+  int stop = 0;
+  SMF_ENTITY *pEnt = NULL;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pEnts == NULL) || (max < 1) || (pSrc == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Empty the data buffer, which will collect the copied payloads of
+   * the whole batch */
+  ps->blen = 0;
+  
+  /* Read entities until the array is full or we hit a stopping point */
+  while ((count < max) && (!stop)) {
+    pEnt = &(pEnts[count]);
+    memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+    
+    old_len = ps->blen;
+    readEntity(ps, pEnt, pSrc);
+    count++;
+    
+    /* If the payload was copied into the data buffer, clear the pointer
+     * for now, since the buffer may yet be reallocated during the batch;
+     * payloads that were only parsed into entity fields are dropped from
+     * the buffer again, so that it only holds the payloads of entities
+     * that use the data buffer */
+    if (ps->blen > old_len) {
+      if (pEnt->buf_len > 0) {
+        pEnt->buf_ptr = NULL;
+      } else {
+        ps->blen = old_len;
+      }
+    }
+    
+    /* Stop after errors, after entities that are not track events, and
+     * after entities that refer to structures owned by the parser, which
+     * are overwritten by the next entity of the same type */
+    switch (pEnt->status) {
+      case SMF_TYPE_EOF:
+      case SMF_TYPE_HEADER:
+      case SMF_TYPE_CHUNK:
+      case SMF_TYPE_BEGIN_TRACK:
+      case SMF_TYPE_END_TRACK:
+      case SMF_TYPE_SMPTE:
+      case SMF_TYPE_TIME_SIG:
+      case SMF_TYPE_KEY_SIG:
+        stop = 1;
+        break;
+      
+      default:
+        if (pEnt->status < 0) {
+          stop = 1;
+        }
+    }
+    
+    /* Stop once the data buffer reaches the payload limit, so that the
+     * next payload can always be appended */
+    if ((ps->blen > 0) && (ps->blen >= (ps->opt).max_payload)) {
+      stop = 1;
+    }
+  }
+  
+  /* Now that the data buffer is settled, point the copied payloads into
+   * it, which are in the same order as the entities */
+  for(i = 0; i < count; i++) {
+    pEnt = &(pEnts[i]);
+    if ((pEnt->buf_len > 0) && (pEnt->buf_ptr == NULL)) {
+      pEnt->buf_ptr = &((ps->bptr)[off]);
+      off += pEnt->buf_len;
+    }
+  }
+  
+  /* Return count */
+  return count;
+}
+
+/*
+ * smfparse_index function.
+ */
+int smfparse_index(
+    SMFPARSE   * ps,
+    SMFSOURCE  * pSrc,
+    SMF_HEADER * pHead,
+    int        * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int32_t tracks = 0;
+  int64_t offset = 0;
+  
+  uint32_t ck_type = 0;
+  int32_t ck_len = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL)) {
+    fault(__LINE__);
+  }
+  if (!smfsource_canRewind(pSrc)) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Discard any previous index and start over from the beginning */
+  ps->has_index = 0;
+  ps->icount = 0;
+  ps->ccount = 0;
+  resetParser(ps);
+  
+  if (!smfsource_rewind(pSrc)) {
+    status = 0;
+    *pErr = SMF_ERR_IO;
+  }
+  
+  /* Read the header chunk, which is the first chunk in the index */
+  if (status) {
+    if (!readHeaderChunk(ps, pSrc, pErr)) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    appendChunk(ps, UINT32_C(0x4d546864), 0, (int32_t) (ps->foff - 8));
+  }
+  
+  /* Read chunk headers and skip chunk data until we have seen all the
+   * declared tracks */
+  while (status && (tracks < (ps->head).nTracks)) {
+    offset = ps->foff;
+    
+    if (!readChunkHead(&ck_type, &ck_len, pSrc, pErr)) {
+      status = 0;
+    }
+    
+    if (status) {
+      if (!addChunkLength(ps, ck_len, pErr)) {
+        status = 0;
+      }
+    }
+    
+    if (status) {
+      if (ck_type == UINT32_C(0x4d546864)) {
+        status = 0;
+        *pErr = SMF_ERR_MULTI_HEAD;
+        
+      } else if (ck_type == UINT32_C(0x4d54726b)) {
+        tracks++;
+      }
+    }
+    
+    if (status) {
+      appendChunk(ps, ck_type, offset, ck_len);
+      if (!smfsource_skip(pSrc, ck_len)) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+      }
+    }
+  }
+  
+  /* Record checkpoints within the tracks if requested */
+  if (status && ((ps->opt).checkpoint > 0)) {
+    if (!buildCheckpoints(ps, pSrc, pErr)) {
+      status = 0;
+    }
+  }
+  
+  /* Go back to the start */
+  if (status) {
+    if (!smfsource_rewind(pSrc)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  
+  /* Keep the index and reset the parser, or else discard the index and
+   * go into error state */
+  if (status) {
+    if ((ps->opt).checkpoint < 1) {
+      memcpy(&(ps->ihead), &(ps->head), sizeof(SMF_HEADER));
+    }
+    ps->has_index = 1;
+    resetParser(ps);
+    
+    if (pHead != NULL) {
+      memcpy(pHead, &(ps->ihead), sizeof(SMF_HEADER));
+    }
+    
+  } else {
+    ps->icount = 0;
+    ps->ccount = 0;
+    setError(ps, *pErr);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfparse_chunk_count function.
+ */
+int32_t smfparse_chunk_count(SMFPARSE *ps) {
+  
+  int32_t result = 0;
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Get count if there is an index */
+  if (ps->has_index) {
+    result = ps->icount;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfparse_chunk function.
+ */
+const SMF_CHUNK *smfparse_chunk(SMFPARSE *ps, int32_t i) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  if ((!(ps->has_index)) || (i < 0) || (i >= ps->icount)) {
+    fault(__LINE__);
+  }
+  
+  /* Return the chunk */
+  return &((ps->pIdx)[i]);
+}
+
+/*
+ * smfparse_seek_track function.
+ */
+int smfparse_seek_track(
+    SMFPARSE  * ps,
+    int32_t     trk,
+    SMFSOURCE * pSrc,
+    int       * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  const SMF_CHUNK *pc = NULL;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL)) {
+    fault(__LINE__);
+  }
+  if (!(ps->has_index)) {
+    fault(__LINE__);
+  }
+  if ((trk < 0) || (trk >= (ps->ihead).nTracks)) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Find the track chunk, which the index must have since it covers all
+   * the declared tracks */
+  pc = indexedTrack(ps, trk);
+  
+  /* Reset the parser, then rewind and skip to the chunk data */
+  resetParser(ps);
+  
+  if (!smfsource_rewind(pSrc)) {
+    status = 0;
+    *pErr = SMF_ERR_IO;
+  }
+  
+  if (status) {
+    if (!skipSource(pSrc, pc->offset + 8)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
     }
+  }
+  
+  /* Set up the parser as if it had just begun the track, or else go
+   * into error state */
+  if (status) {
+    enterTrack(ps, &(ps->ihead), trk, pc);
     
-    pEnt->delta = delta;
-    pEnt->buf_len = ps->blen;
-    if (pEnt->buf_len > 0) {
-      pEnt->buf_ptr = ps->bptr;
+  } else {
+    setError(ps, *pErr);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfparse_seek_tick function.
+ */
+int smfparse_seek_tick(
+    SMFPARSE   * ps,
+    int32_t      trk,
+    int64_t      tick,
+    SMFSOURCE  * pSrc,
+    SMF_ENTITY * pEnt,
+    int        * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  const SMF_CHUNK *pc = NULL;
+  const CHECKPOINT *pk = NULL;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (pEnt == NULL)) {
+    fault(__LINE__);
+  }
+  if (!(ps->has_index)) {
+    fault(__LINE__);
+  }
+  if ((trk < 0) || (trk >= (ps->ihead).nTracks) || (tick < 0)) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return and reset entity structure */
+  *pErr = 0;
+  memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+  
+  /* Find the track chunk */
+  pc = indexedTrack(ps, trk);
+  
+  /* Binary search for the first checkpoint that is not before the tick
+   * offset in the track; the one before it, if it is in the same track,
+   * is the checkpoint to start from */
+  lo = 0;
+  hi = ps->ccount;
+  while (lo < hi) {
+    mid = lo + ((hi - lo) / 2);
+    if (((ps->pCkpt)[mid].trk < trk) ||
+        (((ps->pCkpt)[mid].trk == trk) &&
+          ((ps->pCkpt)[mid].tick < tick))) {
+      lo = mid + 1;
     } else {
-      pEnt->buf_ptr = NULL;
+      hi = mid;
     }
-    
-  } else if (ev == 0xff) {
-    /* Meta-event, so there should be an "A" parameter with the event
-     * type and no "B" parameter */
-    if ((a == -1) || (b != -1)) {
-      fault(__LINE__);
+  }
+  if (lo > 0) {
+    if ((ps->pCkpt)[lo - 1].trk == trk) {
+      pk = &((ps->pCkpt)[lo - 1]);
     }
-    
-    /* Handle the different meta-events */
-    if (a == 0x00) {
-      /* Sequence Number, so there should be exactly two buffered data
-       * bytes */
-      if (ps->blen != 2) {
-        status = 0;
-        *pErr = SMF_ERR_SEQ_NUM;
-      }
-      
-      /* Decode the payload as a big-endian 16-bit value containing the
-       * sequence number */
-      if (status) {
-        pEnt->seq_num =
-          (((int32_t) (ps->bptr)[0]) << 8) |
-           ((int32_t) (ps->bptr)[1]);
-      }
-      
-      /* Also set the status and delta */
-      if (status) {
-        pEnt->status = SMF_TYPE_SEQ_NUM;
-        pEnt->delta = delta;
-      }
-      
-    } else if ((a >= 0x01) && (a <= 0x07)) {
-      /* One of the text events, so use the "A" parameter as the text
-       * subclass, and also set the status, delta, and data buffer */
-      pEnt->status = SMF_TYPE_TEXT;
-      pEnt->delta = delta;
-      pEnt->buf_len = ps->blen;
-      if (pEnt->buf_len > 0) {
-        pEnt->buf_ptr = ps->bptr;
-      } else {
-        pEnt->buf_ptr = NULL;
-      }
-      pEnt->txtype = a;
-      
-    } else if (a == 0x20) {
-      /* MIDI channel prefix, so there should be exactly one buffered
-       * data byte */
-      if (ps->blen != 1) {
-        status = 0;
-        *pErr = SMF_ERR_CH_PREFIX;
-      }
-      
-      /* Get the buffered data byte into "B" */
-      if (status) {
-        b = (ps->bptr)[0];
-      }
-      
-      /* The buffered data byte must be in range 0-15 */
-      if (status) {
-        if ((b < 0) || (b > 15)) {
-          status = 0;
-          *pErr = SMF_ERR_CH_PREFIX;
-        }
-      }
-      
-      /* Set the status, delta, and channel */
-      if (status) {
-        pEnt->status = SMF_TYPE_CH_PREFIX;
-        pEnt->delta = delta;
-        pEnt->ch = b;
-      }
-      
-    } else if (a == 0x2f) {
-      /* End Of Track, so there should be no buffered data bytes */
-      if (ps->blen != 0) {
-        status = 0;
-        *pErr = SMF_ERR_BAD_EOT;
-      }
-      
-      /* Verify that chunk remaining bytes are zero and then set to -1
-       * to leave the chunk */
-      if (status) {
-        if (ps->ckrem != 0) {
-          fault(__LINE__);
-        }
-        ps->ckrem = -1;
-      }
-      
-      /* Set the status and delta */
-      if (status) {
-        pEnt->status = SMF_TYPE_END_TRACK;
-        pEnt->delta = delta;
-      }
-      
-    } else if (a == 0x51) {
-      /* Set Tempo, so there should be exactly 3 data bytes */
-      if (ps->blen != 3) {
+  }
+  
+  /* Reset the parser, then rewind and skip to the checkpoint or to the
+   * start of the track data */
+  resetParser(ps);
+  
+  if (!smfsource_rewind(pSrc)) {
+    status = 0;
+    *pErr = SMF_ERR_IO;
+  }
+  
+  if (status) {
+    if (pk != NULL) {
+      if (!skipSource(pSrc, pk->pos)) {
         status = 0;
-        *pErr = SMF_ERR_SET_TEMPO;
-      }
-      
-      /* Verify the bytes aren't all zero */
-      if (status) {
-        if (((ps->bptr)[0] == 0) && ((ps->bptr)[1] == 0) &&
-            ((ps->bptr)[2] == 0)) {
-          status = 0;
-          *pErr = SMF_ERR_SET_TEMPO;
-        }
-      }
-      
-      /* Set the status, delta, and beat duration */
-      if (status) {
-        pEnt->status = SMF_TYPE_TEMPO;
-        pEnt->delta = delta;
-        pEnt->beat_dur =
-          (((int32_t) (ps->bptr)[0]) << 16) |
-          (((int32_t) (ps->bptr)[1]) <<  8) |
-          (((int32_t) (ps->bptr)[2]));
+        *pErr = SMF_ERR_IO;
       }
-      
-    } else if (a == 0x54) {
-      /* SMPTE Offset, so there should be exactly 5 data bytes */
-      if (ps->blen != 5) {
+    } else {
+      if (!skipSource(pSrc, pc->offset + 8)) {
         status = 0;
-        *pErr = SMF_ERR_SMPTE_OFF;
-      }
-      
-      /* Clear the timecode structure and read the data bytes into it */
-      if (status) {
-        memset(&(ps->rTC), 0, sizeof(SMF_TIMECODE));
-        (ps->rTC).hour   = (ps->bptr)[0];
-        (ps->rTC).minute = (ps->bptr)[1];
-        (ps->rTC).second = (ps->bptr)[2];
-        (ps->rTC).frame  = (ps->bptr)[3];
-        (ps->rTC).ff     = (ps->bptr)[4];
-      }
-      
-      /* Check the ranges of all the fields */
-      if (status) {
-        if (((ps->rTC).hour   > 23) ||
-            ((ps->rTC).minute > 59) ||
-            ((ps->rTC).second > 59) ||
-            ((ps->rTC).frame  > 29) ||
-            ((ps->rTC).ff     > 99)) {
-          status = 0;
-          *pErr = SMF_ERR_SMPTE_OFF;
-        }
+        *pErr = SMF_ERR_IO;
       }
+    }
+  }
+  
+  /* Restore the parsing state */
+  if (status) {
+    enterTrack(ps, &(ps->ihead), trk, pc);
+    if (pk != NULL) {
+      ps->ckrem = pk->ckrem;
+      ps->run   = pk->run;
+      ps->tick  = pk->tick;
+    }
+  }
+  
+  /* Decode forward to the first entity at or after the tick offset */
+  while (status) {
+    smfparse_read(ps, pEnt, pSrc);
+    if (pEnt->status < 0) {
+      status = 0;
+      *pErr = pEnt->status;
       
-      /* If the MIDI file is in an SMPTE timing mode and the frame rate
-       * is 24 or 25, then enforce restricted range (the 29 value uses
-       * the same range as 30 because of drop-frame) */
-      if (status) {
-        if (((ps->head).ts.frame_rate >  0) &&
-            ((ps->head).ts.frame_rate < 29)) {
-          if ((ps->rTC).frame >= (ps->head).ts.frame_rate) {
-            status = 0;
-            *pErr = SMF_ERR_SMPTE_OFF;
-          }
-        }
+    } else if ((pEnt->status == SMF_TYPE_END_TRACK) ||
+                (pEnt->tick >= tick)) {
+      break;
+    }
+  }
+  
+  /* Go into error state on failure */
+  if (!status) {
+    setError(ps, *pErr);
+    pEnt->status = *pErr;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfprobe_alloc function.
+ */
+SMF_PROBE *smfprobe_alloc(void) {
+  SMF_PROBE *pProbe = NULL;
+  
+  pProbe = (SMF_PROBE *) calloc(1, sizeof(SMF_PROBE));
+  if (pProbe == NULL) {
+    fault(__LINE__);
+  }
+  
+  pProbe->count         = 0;
+  pProbe->pTracks       = NULL;
+  pProbe->title_len     = -1;
+  pProbe->title         = NULL;
+  pProbe->copyright_len = -1;
+  pProbe->copyright     = NULL;
+  pProbe->cap           = 0;
+  pProbe->title_cap     = 0;
+  pProbe->copyright_cap = 0;
+  
+  return pProbe;
+}
+
+/*
+ * smfprobe_free function.
+ */
+void smfprobe_free(SMF_PROBE *pProbe) {
+  
+  if (pProbe != NULL) {
+    free(pProbe->pTracks);
+    free(pProbe->title);
+    free(pProbe->copyright);
+    free(pProbe);
+    pProbe = NULL;
+  }
+}
+
+/*
+ * smfparse_probe function.
+ */
+int smfparse_probe(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t     scan,
+    SMF_PROBE * pProbe,
+    int       * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int err = 0;
+  int32_t new_cap = 0;
+  int64_t offset = 0;
+  uint32_t filter = 0;
+  SMF_CHUNK *pc = NULL;
+  
+  uint32_t ck_type = 0;
+  int32_t ck_len = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pSrc == NULL) || (scan < 0) || (pProbe == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Empty the probe structure */
+  memset(&(pProbe->head), 0, sizeof(SMF_HEADER));
+  pProbe->count         = 0;
+  pProbe->title_len     = -1;
+  pProbe->copyright_len = -1;
+  
+  /* Only text events are of interest while scanning */
+  filter = ps->filter;
+  ps->filter = SMF_FILTER(SMF_TYPE_TEXT);
+  
+  /* Start over and read the header */
+  resetParser(ps);
+  if (!readHeaderChunk(ps, pSrc, pErr)) {
+    status = 0;
+  }
+  if (status) {
+    memcpy(&(pProbe->head), &(ps->head), sizeof(SMF_HEADER));
+  }
+  
+  /* Go through the chunks until all declared tracks have been found or
+   * the input ends */
+  while (status && (pProbe->count < (ps->head).nTracks)) {
+    /* Read the chunk header, stopping without error at the end of the
+     * input */
+    offset = ps->foff;
+    if (!readChunkHead(&ck_type, &ck_len, pSrc, &err)) {
+      if (err != SMF_ERR_EOF) {
+        status = 0;
+        *pErr = err;
       }
-      
-      /* If the MIDI file is in SMPTE drop-frame timing and the minutes
-       * are neither zero nor divisible by 10, then enforce that neither
-       * frame 0 nor 1 are used because those timecodes are dropped */
-      if (status) {
-        if ((ps->head).ts.frame_rate == 29) {
-          if (((ps->rTC).minute % 10) != 0) {
-            if ((ps->rTC).frame < 2) {
-              status = 0;
-              *pErr = SMF_ERR_SMPTE_OFF;
-            }
-          }
+      break;
+    }
+    
+    /* Make sure chunk is within the file size limit */
+    if (!addChunkLength(ps, ck_len, pErr)) {
+      status = 0;
+    }
+    
+    /* Record and scan track chunks, and skip other chunks */
+    if (status) {
+      if (ck_type == UINT32_C(0x4d54726b)) {
+        if (pProbe->count >= pProbe->cap) {
+          new_cap = growCapacity(pProbe->cap, pProbe->count + 1);
+          pProbe->pTracks = (SMF_CHUNK *) resizeBlock(
+                              pProbe->pTracks, new_cap, sizeof(SMF_CHUNK));
+          pProbe->cap = new_cap;
         }
-      }
-      
-      /* Set the status, delta, and timecode fields */
-      if (status) {
-        pEnt->status = SMF_TYPE_SMPTE;
-        pEnt->delta = delta;
-        pEnt->tcode = &(ps->rTC);
-      }
-      
-    } else if (a == 0x58) {
-      /* Time Signature, so there should be exactly 4 data bytes */
-      if (ps->blen != 4) {
+        
+        pc = &((pProbe->pTracks)[pProbe->count]);
+        pc->type   = ck_type;
+        pc->offset = offset;
+        pc->length = ck_len;
+        (pProbe->count)++;
+        
+        ps->status   = 1;
+        ps->ckrem    = ck_len;
+        ps->trkcount = pProbe->count;
+        ps->run      = -1;
+        scanTrack(ps, pSrc, scan, pProbe);
+        
+      } else if (ck_type == UINT32_C(0x4d546864)) {
         status = 0;
-        *pErr = SMF_ERR_TIME_SIG;
-      }
-      
-      /* Clear the time signature structure and read the data bytes
-       * into it */
-      if (status) {
-        memset(&(ps->rTS), 0, sizeof(SMF_TIMESIG));
-        (ps->rTS).numerator = (ps->bptr)[0];
-        (ps->rTS).denominator = (ps->bptr)[1];
-        (ps->rTS).click = (ps->bptr)[2];
-        (ps->rTS).beat_unit = (ps->bptr)[3];
-      }
-      
-      /* Numerator, click, and beat unit should be at least one */
-      if (status) {
-        if (((ps->rTS).numerator < 1) ||
-            ((ps->rTS).click     < 1) ||
-            ((ps->rTS).beat_unit < 1)) {
+        *pErr = SMF_ERR_MULTI_HEAD;
+        
+      } else {
+        if (!smfsource_skip(pSrc, ck_len)) {
           status = 0;
-          *pErr = SMF_ERR_TIME_SIG;
+          *pErr = SMF_ERR_IO;
         }
       }
+    }
+  }
+  
+  /* Put the parser back into its initial state */
+  resetParser(ps);
+  ps->filter = filter;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smftrack_alloc function.
+ */
+SMF_TRACK *smftrack_alloc(void) {
+  SMF_TRACK *pt = NULL;
+  
+  pt = (SMF_TRACK *) calloc(1, sizeof(SMF_TRACK));
+  if (pt == NULL) {
+    fault(__LINE__);
+  }
+  
+  pt->count     = 0;
+  pt->tick      = NULL;
+  pt->type      = NULL;
+  pt->ch        = NULL;
+  pt->d1        = NULL;
+  pt->d2        = NULL;
+  pt->aux       = NULL;
+  pt->pay_count = 0;
+  pt->pay_off   = NULL;
+  pt->pay_len   = NULL;
+  pt->arena_len = 0;
+  pt->arena     = NULL;
+  pt->cap       = 0;
+  pt->pay_cap   = 0;
+  pt->arena_cap = 0;
+  
+  return pt;
+}
+
+/*
+ * smftrack_free function.
+ */
+void smftrack_free(SMF_TRACK *pTrack) {
+  
+  if (pTrack != NULL) {
+    free(pTrack->tick);
+    free(pTrack->type);
+    free(pTrack->ch);
+    free(pTrack->d1);
+    free(pTrack->d2);
+    free(pTrack->aux);
+    free(pTrack->pay_off);
+    free(pTrack->pay_len);
+    free(pTrack->arena);
+    free(pTrack);
+    pTrack = NULL;
+  }
+}
+
+/*
+ * smfparse_read_track function.
+ */
+int smfparse_read_track(SMFPARSE *ps, SMF_TRACK *pTrack, SMFSOURCE *pSrc) {
+  
+  int result = 0;
+  int done = 0;
+  int in_track = 0;
+  uint32_t tick = 0;
+  SMF_ENTITY ent;
+  
+  /* Initialize structures */
+  memcpy(&ent, &m_blank, sizeof(SMF_ENTITY));
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pTrack == NULL) || (pSrc == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Empty the track structure */
+  pTrack->count     = 0;
+  pTrack->pay_count = 0;
+  pTrack->arena_len = 0;
+  
+  /* If we are not inside a track, read entities until a track begins or
+   * we reach EOF or an error */
+  if ((ps->status == 1) && (ps->ckrem >= 0)) {
+    in_track = 1;
+  }
+  
+  while ((!in_track) && (!done)) {
+    ps->blen = 0;
+    memcpy(&ent, &m_blank, sizeof(SMF_ENTITY));
+    readEntity(ps, &ent, pSrc);
+    
+    if (ent.status == SMF_TYPE_BEGIN_TRACK) {
+      in_track = 1;
       
-      /* Denominator should not exceed 15 so we can safely perform the
-       * shifting */
-      if (status) {
-        if ((ps->rTS).denominator > 15) {
-          status = 0;
-          *pErr = SMF_ERR_TIME_SIG;
-        }
-      }
+    } else if ((ent.status == SMF_TYPE_EOF) || (ent.status < 0)) {
+      result = ent.status;
+      done = 1;
+    }
+  }
+  
+  /* Decode the events of the track, up to and including End Of Track;
+   * the parser leaves the raw payload of each event in pPay and plen */
+  while (in_track && (!done)) {
+    ps->blen = 0;
+    memcpy(&ent, &m_blank, sizeof(SMF_ENTITY));
+    readEntity(ps, &ent, pSrc);
+    
+    if (ent.status < 0) {
+      result = ent.status;
+      done = 1;
       
-      /* Decode the denominator as a power of two, such that a
-       * denominator of 0 decodes to 1, 1 to 2, 2 to 4, 3 to 8, and so
-       * forth; then, make sure it is in range */
-      if (status) {
-        (ps->rTS).denominator = 1 << ((ps->rTS).denominator);
-        if ((ps->rTS).denominator > SMF_MAX_TIME_DENOM) {
-          status = 0;
-          *pErr = SMF_ERR_TIME_SIG;
-        }
-      }
+    } else if ((uint32_t) ent.delta > UINT32_MAX - tick) {
+      result = SMF_ERR_TIME_RANGE;
+      setError(ps, SMF_ERR_TIME_RANGE);
+      done = 1;
       
-      /* Set the status, delta, and time signature */
-      if (status) {
-        pEnt->status = SMF_TYPE_TIME_SIG;
-        pEnt->delta = delta;
-        pEnt->tsig = &(ps->rTS);
-      }
+    } else {
+      tick += (uint32_t) ent.delta;
+      appendTrackEvent(pTrack, &ent, tick, ps->pPay, ps->plen);
       
-    } else if (a == 0x59) {
-      /* Key signature, so there should be exactly 2 data bytes */
-      if (ps->blen != 2) {
-        status = 0;
-        *pErr = SMF_ERR_KEY_SIG;
+      if (ent.status == SMF_TYPE_END_TRACK) {
+        result = SMF_TYPE_END_TRACK;
+        done = 1;
       }
-      
-      /* Clear the key signature structure and read in the data bytes */
-      if (status) {
-        memset(&(ps->rKS), 0, sizeof(SMF_KEYSIG));
-        (ps->rKS).key = (ps->bptr)[0];
-        (ps->rKS).is_minor = (ps->bptr)[1];
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfparse_parallel function.
+ */
+int smfparse_parallel(
+    const void        * pData,
+    int64_t             len,
+    const SMF_OPTIONS * pOpt,
+    int32_t             threads,
+    smfparse_fp_track   fTrack,
+    void              * pCustom,
+    SMF_HEADER        * pHead,
+    int               * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int32_t i = 0;
+  int32_t started = 0;
+  
+  PARALLEL_JOB job;
+  SMFPARSE *ps = NULL;
+  SMFSOURCE *pSrc = NULL;
+#ifdef SMF_POSIX
+  pthread_t *pThreads = NULL;
+#endif
+  
+  /* Initialize structures */
+  memset(&job, 0, sizeof(PARALLEL_JOB));
+  
+  /* Check parameters */
+  if ((len < 0) || ((pData == NULL) && (len > 0)) ||
+      (threads < 1) || (fTrack == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Set up the job */
+  job.pData    = (const uint8_t *) pData;
+  job.len      = len;
+  job.pTracks  = NULL;
+  job.fTrack   = fTrack;
+  job.pCustom  = pCustom;
+  job.next     = 0;
+  job.err      = 0;
+  job.err_trk  = -1;
+  job.threaded = 0;
+  
+  if (pOpt != NULL) {
+    memcpy(&(job.opt), pOpt, sizeof(SMF_OPTIONS));
+  } else {
+    smfparse_defaults(&(job.opt));
+  }
+  
+  /* Index the file and collect the track chunks */
+  ps = smfparse_alloc_ex(&(job.opt));
+  pSrc = smfsource_new_memory(pData, len);
+  
+  if (!smfparse_index(ps, pSrc, &(job.head), pErr)) {
+    status = 0;
+  }
+  
+  if (status) {
+    job.pTracks = trackChunks(ps, (job.head).nTracks);
+    
+    if (pHead != NULL) {
+      memcpy(pHead, &(job.head), sizeof(SMF_HEADER));
+    }
+  }
+  
+  smfsource_close(pSrc);
+  pSrc = NULL;
+  smfparse_free(ps);
+  ps = NULL;
+  
+  /* Never use more threads than there are tracks */
+  if (status) {
+    if (threads > (job.head).nTracks) {
+      threads = (job.head).nTracks;
+    }
+  }
+  
+  /* Start the additional worker threads, if the platform has them; if
+   * a thread can't be started, just carry on with the ones we have */
+#ifdef SMF_POSIX
+  if (status && (threads > 1)) {
+    if (pthread_mutex_init(&(job.lock), NULL)) {
+      fault(__LINE__);
+    }
+    job.threaded = 1;
+    
+    pThreads = (pthread_t *) resizeBlock(
+                  NULL, threads - 1, sizeof(pthread_t));
+    for(started = 0; started < threads - 1; started++) {
+      if (pthread_create(
+            &(pThreads[started]), NULL, &parallel_thread, &job)) {
+        break;
       }
-      
-      /* Decode the key value in two's-complement */
-      if (status) {
-        if ((ps->rKS).key > 0x7f) {
-          (ps->rKS).key = (ps->rKS).key - 0x100;
-        }
+    }
+  }
+#endif
+  
+  /* The calling thread is a worker too */
+  if (status) {
+    runWorker(&job);
+  }
+  
+  /* Wait for the additional worker threads to finish */
+#ifdef SMF_POSIX
+  if (job.threaded) {
+    for(i = 0; i < started; i++) {
+      if (pthread_join(pThreads[i], NULL)) {
+        fault(__LINE__);
       }
-      
-      /* Check ranges */
-      if (status) {
-        if (((ps->rKS).key < SMF_MIN_KEYSIG) ||
-            ((ps->rKS).key > SMF_MAX_KEYSIG)) {
-          status = 0;
-          *pErr = SMF_ERR_KEY_SIG;
-        }
+    }
+    free(pThreads);
+    pThreads = NULL;
+    pthread_mutex_destroy(&(job.lock));
+  }
+#else
+  (void) i;
+  (void) started;
+#endif
+  
+  /* Report the error of the lowest-numbered failing track */
+  if (status && (job.err_trk >= 0)) {
+    status = 0;
+    *pErr = job.err;
+  }
+  
+  /* Release the track chunks */
+  if (job.pTracks != NULL) {
+    free(job.pTracks);
+    job.pTracks = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfparse_batch function.
+ */
+int32_t smfparse_batch(
+    const SMF_BATCH_FILE * pFiles,
+    int32_t                count,
+    const SMF_OPTIONS    * pOpt,
+    uint32_t               mask,
+    int32_t                threads,
+    smfparse_fp_entity     fEntity,
+    smfparse_fp_file       fFile,
+    void                 * pCustom,
+    int                  * pResults) {
+  
+  int32_t i = 0;
+  int32_t started = 0;
+  const SMF_BATCH_FILE *pf = NULL;
+  
+  BATCH_JOB job;
+#ifdef SMF_POSIX
+  pthread_t *pThreads = NULL;
+#endif
+  
+  /* Initialize structures */
+  memset(&job, 0, sizeof(BATCH_JOB));
+  
+  /* Check parameters */
+  if ((count < 0) || ((pFiles == NULL) && (count > 0)) ||
+      (threads < 1)) {
+    fault(__LINE__);
+  }
+  for(i = 0; i < count; i++) {
+    pf = &(pFiles[i]);
+    if (pf->pPath == NULL) {
+      if ((pf->len < 0) || ((pf->pData == NULL) && (pf->len > 0))) {
+        fault(__LINE__);
       }
-      if (status) {
-        if (((ps->rKS).is_minor != 1) &&
-            ((ps->rKS).is_minor != 0)) {
-          status = 0;
-          *pErr = SMF_ERR_KEY_SIG;
-        }
+    }
+  }
+  
+  /* Set up the job */
+  job.pFiles   = pFiles;
+  job.count    = count;
+  job.mask     = mask;
+  job.fEntity  = fEntity;
+  job.fFile    = fFile;
+  job.pCustom  = pCustom;
+  job.pResults = pResults;
+  job.next     = 0;
+  job.failed   = 0;
+  job.threaded = 0;
+  
+  if (pOpt != NULL) {
+    memcpy(&(job.opt), pOpt, sizeof(SMF_OPTIONS));
+  } else {
+    smfparse_defaults(&(job.opt));
+  }
+  
+  /* Never use more threads than there are files */
+  if (threads > count) {
+    threads = count;
+  }
+  
+  /* Start the additional worker threads, if the platform has them; if
+   * a thread can't be started, just carry on with the ones we have */
+#ifdef SMF_POSIX
+  if (threads > 1) {
+    if (pthread_mutex_init(&(job.lock), NULL)) {
+      fault(__LINE__);
+    }
+    job.threaded = 1;
+    
+    pThreads = (pthread_t *) resizeBlock(
+                  NULL, threads - 1, sizeof(pthread_t));
+    for(started = 0; started < threads - 1; started++) {
+      if (pthread_create(
+            &(pThreads[started]), NULL, &batch_thread, &job)) {
+        break;
       }
-      
-      /* Set the status, delta, and key signature */
-      if (status) {
-        pEnt->status = SMF_TYPE_KEY_SIG;
-        pEnt->delta = delta;
-        pEnt->ksig = &(ps->rKS);
+    }
+  }
+#endif
+  
+  /* The calling thread is a worker too */
+  if (count > 0) {
+    runBatch(&job);
+  }
+  
+  /* Wait for the additional worker threads to finish */
+#ifdef SMF_POSIX
+  if (job.threaded) {
+    for(i = 0; i < started; i++) {
+      if (pthread_join(pThreads[i], NULL)) {
+        fault(__LINE__);
       }
-      
-    } else {
-      /* Sequencer-specific meta-event or some undocumented meta-event,
-       * so use a META entity and set the status, delta, data buffer,
-       * and meta_type */
-      pEnt->status = SMF_TYPE_META;
-      pEnt->delta = delta;
-      pEnt->buf_len = ps->blen;
-      if (pEnt->buf_len > 0) {
-        pEnt->buf_ptr = ps->bptr;
+    }
+    free(pThreads);
+    pThreads = NULL;
+    pthread_mutex_destroy(&(job.lock));
+  }
+#else
+  (void) started;
+#endif
+  
+  /* Return the number of failed files */
+  return job.failed;
+}
+
+/*
+ * smftempo_alloc function.
+ */
+SMFTEMPO *smftempo_alloc(void) {
+  SMFTEMPO *pm = NULL;
+  
+  pm = (SMFTEMPO *) calloc(1, sizeof(SMFTEMPO));
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  
+  (pm->ts).subdiv     = 0;
+  (pm->ts).frame_rate = 0;
+  
+  pm->pPt   = (TEMPO_POINT *) resizeBlock(
+                NULL, ARRAY_INIT, sizeof(TEMPO_POINT));
+  pm->cap   = ARRAY_INIT;
+  pm->count = 1;
+  pm->cur   = 0;
+  
+  (pm->pPt)[0].tick     = 0;
+  (pm->pPt)[0].us       = 0;
+  (pm->pPt)[0].rem      = 0;
+  (pm->pPt)[0].beat_dur = DEFAULT_BEAT_DUR;
+  
+  return pm;
+}
+
+/*
+ * smftempo_free function.
+ */
+void smftempo_free(SMFTEMPO *pm) {
+  
+  if (pm != NULL) {
+    free(pm->pPt);
+    free(pm);
+    pm = NULL;
+  }
+}
+
+/*
+ * smftempo_clear function.
+ */
+void smftempo_clear(SMFTEMPO *pm, const SMF_TIMESYS *pts) {
+  
+  /* Check parameters */
+  if ((pm == NULL) || (pts == NULL)) {
+    fault(__LINE__);
+  }
+  if ((pts->subdiv < 1) || (pts->subdiv > 32767)) {
+    fault(__LINE__);
+  }
+  if ((pts->frame_rate != 0) && (pts->frame_rate != 24) &&
+      (pts->frame_rate != 25) && (pts->frame_rate != 29) &&
+      (pts->frame_rate != 30)) {
+    fault(__LINE__);
+  }
+  
+  /* Set the time system and go back to the default tempo */
+  memcpy(&(pm->ts), pts, sizeof(SMF_TIMESYS));
+  
+  pm->count = 1;
+  pm->cur   = 0;
+  (pm->pPt)[0].beat_dur = DEFAULT_BEAT_DUR;
+  timeTempo(pm, 0);
+}
+
+/*
+ * smftempo_add function.
+ */
+void smftempo_add(SMFTEMPO *pm, int64_t tick, int32_t beat_dur) {
+  
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  int32_t i = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    fault(__LINE__);
+  }
+  if ((tick < 0) || (beat_dur < 1) || (beat_dur > INT32_C(0xffffff))) {
+    fault(__LINE__);
+  }
+  
+  /* Find the index of the first tempo change at or after the tick,
+   * checking the common case of appending first */
+  if (tick > (pm->pPt)[pm->count - 1].tick) {
+    i = pm->count;
+    
+  } else {
+    lo = 0;
+    hi = pm->count - 1;
+    while (lo < hi) {
+      mid = lo + ((hi - lo) / 2);
+      if ((pm->pPt)[mid].tick < tick) {
+        lo = mid + 1;
       } else {
-        pEnt->buf_ptr = NULL;
+        hi = mid;
       }
-      pEnt->meta_type = a;
     }
+    i = lo;
+  }
+  
+  /* Replace an existing tempo change at the same tick, or else insert a
+   * new one */
+  if ((i < pm->count) && ((pm->pPt)[i].tick == tick)) {
+    (pm->pPt)[i].beat_dur = beat_dur;
     
-  } else if ((ev >= 0x80) && (ev <= 0xef)) {
-    /* MIDI message, so first split into a message and a channel */
-    msg = ev & 0xf0;
-    ch  = ev & 0x0f;
+  } else {
+    if (pm->count >= pm->cap) {
+      new_cap = growCapacity(pm->cap, pm->count + 1);
+      pm->pPt = (TEMPO_POINT *) resizeBlock(
+                  pm->pPt, new_cap, sizeof(TEMPO_POINT));
+      pm->cap = new_cap;
+    }
     
-    /* Make sure that all messages except 0xC0 and 0xD0 have both
-     * parameters, and 0xC0 and 0xD0 have only the "A" parameter */
-    if ((msg == 0xc0) || (msg == 0xd0)) {
-      if ((a == -1) || (b != -1)) {
-        fault(__LINE__);
-      }
+    if (i < pm->count) {
+      memmove(
+        &((pm->pPt)[i + 1]),
+        &((pm->pPt)[i]),
+        ((size_t) (pm->count - i)) * sizeof(TEMPO_POINT));
+    }
+    (pm->count)++;
+    
+    (pm->pPt)[i].tick     = tick;
+    (pm->pPt)[i].beat_dur = beat_dur;
+  }
+  
+  /* Recompute the times of the changed tempo change and the ones that
+   * follow it */
+  while (i < pm->count) {
+    timeTempo(pm, i);
+    i++;
+  }
+}
+
+/*
+ * smftempo_micros function.
+ */
+int64_t smftempo_micros(SMFTEMPO *pm, int64_t tick) {
+  
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  int32_t i = 0;
+  int64_t num = 0;
+  int64_t den = 0;
+  int64_t dt = 0;
+  int64_t result = 0;
+  const TEMPO_POINT *pt = NULL;
+  
+  /* Check parameters */
+  if ((pm == NULL) || (tick < 0)) {
+    fault(__LINE__);
+  }
+  if ((pm->ts).subdiv < 1) {
+    fault(__LINE__);
+  }
+  
+  if ((pm->ts).frame_rate != 0) {
+    /* SMPTE timing, so there are frame_rate * subdiv ticks per second,
+     * or (30000 / 1001) * subdiv for the frame rate value of 29 */
+    if ((pm->ts).frame_rate == 29) {
+      num = INT64_C(100100);
+      den = INT64_C(3) * (int64_t) (pm->ts).subdiv;
     } else {
-      if ((a == -1) || (b == -1)) {
-        fault(__LINE__);
-      }
+      num = INT64_C(1000000);
+      den = (int64_t) (pm->ts).frame_rate * (int64_t) (pm->ts).subdiv;
     }
     
-    /* Make sure that the defined parameters have their most significant
-     * bits clear */
-    if ((a >= 0) && (a > 0x7f)) {
-      status = 0;
-      *pErr = SMF_ERR_MIDI_DATA;
+    result = ((tick / den) * num) + (((tick % den) * num) / den);
+    
+  } else {
+    /* Metrical timing, so find the last tempo change at or before the
+     * tick, trying the tempo change of the last lookup and the one
+     * after it before searching */
+    i = pm->cur;
+    if (i >= pm->count) {
+      i = 0;
     }
-    if (status) {
-      if ((b >= 0) && (b > 0x7f)) {
-        status = 0;
-        *pErr = SMF_ERR_MIDI_DATA;
+    
+    if (((pm->pPt)[i].tick <= tick) &&
+        ((i >= pm->count - 1) || ((pm->pPt)[i + 1].tick > tick))) {
+      /* Same tempo change as the last lookup */
+      
+    } else if ((i < pm->count - 1) &&
+                ((pm->pPt)[i + 1].tick <= tick) &&
+                ((i >= pm->count - 2) || ((pm->pPt)[i + 2].tick > tick))) {
+      /* The tempo change after the last lookup */
+      i++;
+      
+    } else {
+      /* Binary search for the last tempo change at or before tick,
+       * which exists because the first one is at tick zero */
+      lo = 0;
+      hi = pm->count - 1;
+      while (lo < hi) {
+        mid = hi - ((hi - lo) / 2);
+        if ((pm->pPt)[mid].tick <= tick) {
+          lo = mid;
+        } else {
+          hi = mid - 1;
+        }
       }
+      i = lo;
     }
+    pm->cur = i;
     
-    /* Set the delta and channel for all MIDI messages */
-    if (status) {
-      pEnt->delta = delta;
-      pEnt->ch = ch;
+    /* Split the tick distance so that the products can't overflow */
+    pt = &((pm->pPt)[i]);
+    den = (int64_t) (pm->ts).subdiv;
+    dt = tick - pt->tick;
+    
+    result = pt->us + ((dt / den) * pt->beat_dur) +
+              ((pt->rem + ((dt % den) * pt->beat_dur)) / den);
+  }
+  
+  return result;
+}
+
+/*
+ * smfparse_set_tempo function.
+ */
+void smfparse_set_tempo(SMFPARSE *ps, SMFTEMPO *pm) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* Attach the map */
+  ps->pTempo = pm;
+}
+
+/*
+ * smfmerge_alloc function.
+ */
+SMFMERGE *smfmerge_alloc(
+    SMFSOURCE         * pSrc,
+    const SMF_OPTIONS * pOpt,
+    SMF_HEADER        * pHead,
+    int               * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int err = 0;
+  int32_t i = 0;
+  int64_t start = 0;
+  int64_t avail = 0;
+  
+  SMF_HEADER head;
+  SMFPARSE *ps = NULL;
+  SMF_CHUNK *pTracks = NULL;
+  SMFMERGE *pm = NULL;
+  MERGE_CURSOR *pc = NULL;
+  
+  /* Initialize structures */
+  memset(&head, 0, sizeof(SMF_HEADER));
+  
+  /* Check parameters */
+  if (pSrc == NULL) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Index the file and collect the track chunks */
+  ps = smfparse_alloc_ex(pOpt);
+  if (!smfparse_index(ps, pSrc, &head, pErr)) {
+    status = 0;
+  }
+  if (status) {
+    pTracks = trackChunks(ps, head.nTracks);
+  }
+  smfparse_free(ps);
+  ps = NULL;
+  
+  /* Allocate the merger */
+  if (status) {
+    pm = (SMFMERGE *) calloc(1, sizeof(SMFMERGE));
+    if (pm == NULL) {
+      fault(__LINE__);
     }
     
-    /* Set the status and message-specific data */
-    if (status) {
-      if (msg == 0x80) {
-        pEnt->status = SMF_TYPE_NOTE_OFF;
-        pEnt->key = a;
-        pEnt->val = b;
-        
-      } else if (msg == 0x90) {
-        pEnt->status = SMF_TYPE_NOTE_ON;
-        pEnt->key = a;
-        pEnt->val = b;
-        
-      } else if (msg == 0xa0) {
-        pEnt->status = SMF_TYPE_KEY_AFTERTOUCH;
-        pEnt->key = a;
-        pEnt->val = b;
-        
-      } else if (msg == 0xb0) {
-        pEnt->status = SMF_TYPE_CONTROL;
-        pEnt->ctl = a;
-        pEnt->val = b;
-        
-      } else if (msg == 0xc0) {
-        pEnt->status = SMF_TYPE_PROGRAM;
-        pEnt->val = a;
-        
-      } else if (msg == 0xd0) {
-        pEnt->status = SMF_TYPE_CH_AFTERTOUCH;
-        pEnt->val = a;
-        
-      } else if (msg == 0xe0) {
-        pEnt->status = SMF_TYPE_PITCH_BEND;
-        pEnt->bend = ((b << 7) | a) - 8192;
+    pm->status = 0;
+    pm->pSrc   = pSrc;
+    pm->owner  = -1;
+    pm->ntrk   = head.nTracks;
+    pm->pCur   = (MERGE_CURSOR *) resizeBlock(
+                    NULL, pm->ntrk, sizeof(MERGE_CURSOR));
+    pm->pHeap  = (int32_t *) resizeBlock(
+                    NULL, pm->ntrk, sizeof(int32_t));
+    pm->hcount = 0;
+    pm->last   = -1;
+    pm->tick   = 0;
+  }
+  
+  /* Set up a cursor at the start of each track, with a memory source
+   * over just the track data if the input is memory-resident */
+  if (status) {
+    for(i = 0; i < pm->ntrk; i++) {
+      pc = &((pm->pCur)[i]);
+      memcpy(&(pc->ck), &(pTracks[i]), sizeof(SMF_CHUNK));
+      memcpy(&(pc->ent), &m_blank, sizeof(SMF_ENTITY));
+      pc->tick = 0;
+      pc->pSub = NULL;
+      
+      if (pSrc->is_mem) {
+        start = (pc->ck).offset + 8;
+        avail = pSrc->blen - start;
+        if (avail > (pc->ck).length) {
+          avail = (pc->ck).length;
+        }
         
-      } else {
-        fault(__LINE__);
+        if (avail > 0) {
+          pc->pSub = smfsource_new_memory(&((pSrc->pWin)[start]), avail);
+        } else {
+          pc->pSub = smfsource_new_memory(NULL, 0);
+        }
+      }
+      
+      pc->ps = smfparse_alloc_ex(pOpt);
+      enterTrack(pc->ps, &head, i, &(pc->ck));
+    }
+  }
+  
+  /* Read the first event of each track */
+  if (status) {
+    for(i = 0; i < pm->ntrk; i++) {
+      err = mergeAdvance(pm, i);
+      if (err) {
+        pm->status = err;
+        break;
+      }
+    }
+  }
+  
+  /* Return the header */
+  if (status && (pHead != NULL)) {
+    memcpy(pHead, &head, sizeof(SMF_HEADER));
+  }
+  
+  /* Release the track chunks */
+  if (pTracks != NULL) {
+    free(pTracks);
+    pTracks = NULL;
+  }
+  
+  /* Return the merger or NULL */
+  return pm;
+}
+
+/*
+ * smfmerge_free function.
+ */
+void smfmerge_free(SMFMERGE *pm) {
+  
+  int32_t i = 0;
+  
+  if (pm != NULL) {
+    for(i = 0; i < pm->ntrk; i++) {
+      smfparse_free((pm->pCur)[i].ps);
+      if ((pm->pCur)[i].pSub != NULL) {
+        smfsource_close((pm->pCur)[i].pSub);
       }
     }
+    free(pm->pCur);
+    free(pm->pHeap);
+    free(pm);
+    pm = NULL;
+  }
+}
+
+/*
+ * smfmerge_read function.
+ */
+void smfmerge_read(
+    SMFMERGE   * pm,
+    SMF_ENTITY * pEnt,
+    int32_t    * pTrk,
+    int64_t    * pTick) {
+  
+  int err = 0;
+  int32_t c = 0;
+  const MERGE_CURSOR *pc = NULL;
+  
+  /* Check parameters */
+  if ((pm == NULL) || (pEnt == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Reset entity structure */
+  memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+  
+  /* Advance the cursor of the event that was returned last */
+  if ((pm->status == 0) && (pm->last >= 0)) {
+    err = mergeAdvance(pm, pm->last);
+    pm->last = -1;
+    if (err) {
+      pm->status = err;
+    }
+  }
+  
+  /* If all tracks have ended, go to EOF state */
+  if ((pm->status == 0) && (pm->hcount < 1)) {
+    pm->status = 1;
+  }
+  
+  /* Return the earliest waiting event, or else EOF or the error */
+  if (pm->status == 0) {
+    c = mergePop(pm);
+    pc = &((pm->pCur)[c]);
+    
+    memcpy(pEnt, &(pc->ent), sizeof(SMF_ENTITY));
+    pEnt->delta = (int32_t) (pc->tick - pm->tick);
+    pm->tick = pc->tick;
+    
+    if ((pc->ent).status != SMF_TYPE_END_TRACK) {
+      pm->last = c;
+    }
+    
+    if (pTrk != NULL) {
+      *pTrk = c;
+    }
+    if (pTick != NULL) {
+      *pTick = pc->tick;
+    }
     
   } else {
-    status = 0;
-    *pErr = SMF_ERR_BAD_EVENT;
+    if (pm->status > 0) {
+      pEnt->status = SMF_TYPE_EOF;
+    } else {
+      pEnt->status = pm->status;
+    }
+    
+    if (pTrk != NULL) {
+      *pTrk = -1;
+    }
+    if (pTick != NULL) {
+      *pTick = pm->tick;
+    }
   }
-  
-  /* Return status */
-  return status;
 }
 
 /*
- * Read an event from within a track.
- * 
- * The parser state must have a status code of 1 and a ckrem value that
- * is zero or greater.  The entity structure is assumed to be in a reset
- * state.
- * 
- * If the read operation fails, the entity is not modified and the
- * parser status is not changed.  Instead, the error code is written to
- * pErr and zero is returned.
- * 
- * Parameters:
- * 
- *   ps - the parser object
- * 
- *   pEnt - the entity to fill in
- * 
- *   pSrc - the input source to read from
- * 
- *   pErr - receives an error code if there is a failure
- * 
- * Return:
- * 
- *   non-zero if successful, zero if failure
+ * smfnotes_alloc function.
  */
-static int readEvent(
-    SMFPARSE   * ps,
-    SMF_ENTITY * pEnt,
-    SMFSOURCE  * pSrc,
-    int        * pErr) {
+SMFNOTES *smfnotes_alloc(int policy) {
   
-  int status = 1;
-  int c = 0;
-  int d = 0;
-  int a = -1;
-  int b = -1;
-  int32_t delta = 0;
-  int32_t vl = 0;
-  int32_t vi = 0;
+  SMFNOTES *pn = NULL;
   
   /* Check parameters */
-  if ((ps == NULL) || (pEnt == NULL) ||
-      (pSrc == NULL) || (pErr == NULL)) {
+  if ((policy != SMF_NOTES_RETRIGGER) &&
+      (policy != SMF_NOTES_EXTEND) &&
+      (policy != SMF_NOTES_NEST)) {
     fault(__LINE__);
   }
   
-  /* Check state */
-  if ((ps->status != 1) || (ps->ckrem < 0)) {
+  /* Allocate the engine, which also clears the slot table */
+  pn = (SMFNOTES *) calloc(1, sizeof(SMFNOTES));
+  if (pn == NULL) {
     fault(__LINE__);
   }
   
-  /* Reset data buffer */
-  ps->blen = 0;
+  pn->policy   = policy;
+  pn->trk      = -1;
+  pn->tick     = 0;
+  pn->sounding = 0;
+  pn->pQ       = NULL;
+  pn->qcap     = 0;
+  pn->qlen     = 0;
+  pn->qpos     = 0;
+  
+  /* Return the engine */
+  return pn;
+}
+
+/*
+ * smfnotes_free function.
+ */
+void smfnotes_free(SMFNOTES *pn) {
+  if (pn != NULL) {
+    free(pn->pQ);
+    free(pn);
+    pn = NULL;
+  }
+}
+
+/*
+ * smfnotes_reset function.
+ */
+void smfnotes_reset(SMFNOTES *pn) {
   
-  /* Read the delta value */
-  delta = readChunkVar(pSrc, &(ps->ckrem), pErr);
-  if (delta < 0) {
-    status = 0;
+  /* Check parameters */
+  if (pn == NULL) {
+    fault(__LINE__);
   }
   
-  /* Read a byte to determine how to proceed */
-  if (status) {
-    c = readChunkByte(pSrc, &(ps->ckrem), pErr);
-    if (c < 0) {
-      status = 0;
-    }
+  /* Clear the state but keep the queue allocation */
+  memset(pn->slot, 0, sizeof(pn->slot));
+  pn->trk      = -1;
+  pn->tick     = 0;
+  pn->sounding = 0;
+  pn->qlen     = 0;
+  pn->qpos     = 0;
+}
+
+/*
+ * smfnotes_put function.
+ */
+void smfnotes_put(SMFNOTES *pn, const SMF_ENTITY *pEnt) {
+  
+  int ch = 0;
+  int key = 0;
+  int off_vel = 0;
+  NOTE_SLOT *pSlot = NULL;
+  
+  /* Check parameters */
+  if ((pn == NULL) || (pEnt == NULL)) {
+    fault(__LINE__);
   }
   
-  /* If we got a byte that doesn't have its most significant bit set,
-   * then we need to retrieve a running status byte and set this byte we
-   * just read as the "A" byte */
-  if (status && (c < 0x80)) {
-    if (ps->run < 0) {
-      status = 0;
-      *pErr = SMF_ERR_RUN_STATUS;
-    }
-    
-    if (status) {
-      a = c;
-      c = ps->run;
-    }
+  /* Advance the time of entities that have a delta */
+  if ((pEnt->status > SMF_TYPE_BEGIN_TRACK) &&
+      (pEnt->status != SMF_TYPE_NEED_MORE) &&
+      (pEnt->delta > 0)) {
+    pn->tick += (int64_t) pEnt->delta;
   }
   
-  /* Handle the different cases of status byte to read the whole
-   * message; we might already have read the "A" parameter for MIDI
-   * messages if running status was used */
-  if (status) {
-    if (((c >= 0x80) && (c <= 0xbf)) || ((c >= 0xe0) && (c <= 0xef))) {
-      /* MIDI message that has two parameters "A" and "B" */
-      if (a < 0) {
-        a = readChunkByte(pSrc, &(ps->ckrem), pErr);
-        if (a < 0) {
-          status = 0;
-        }
-      }
-      
-      if (status) {
-        b = readChunkByte(pSrc, &(ps->ckrem), pErr);
-        if (b < 0) {
-          status = 0;
-        }
-      }
-      
-    } else if ((c >= 0xc0) && (c <= 0xdf)) {
-      /* MIDI message that has one parameter "A" */
-      if (a < 0) {
-        a = readChunkByte(pSrc, &(ps->ckrem), pErr);
-        if (a < 0) {
-          status = 0;
-        }
-      }
-      
-    } else if ((c == 0xf0) || (c == 0xf7)) {
-      /* System-Exclusive event that has a variable-length size and then
-       * a payload which we read into the data buffer */
-      vl = readChunkVar(pSrc, &(ps->ckrem), pErr);
-      if (vl < 0) {
-        status = 0;
-      }
-      
-      /* Read the data payload */
-      if (status) {
-        for(vi = 0; vi < vl; vi++) {
-          d = readChunkByte(pSrc, &(ps->ckrem), pErr);
-          if (d < 0) {
-            status = 0;
-            break;
-          }
-          if (!pushBuffer(ps, d)) {
-            status = 0;
-            *pErr = SMF_ERR_BIG_PAYLOAD;
-            break;
-          }
+  /* Handle the entity */
+  if (pEnt->status == SMF_TYPE_BEGIN_TRACK) {
+    /* Notes never carry over between tracks */
+    closeAllNotes(pn);
+    (pn->trk)++;
+    pn->tick = 0;
+    
+  } else if (pEnt->status == SMF_TYPE_END_TRACK) {
+    closeAllNotes(pn);
+    
+  } else if ((pEnt->status == SMF_TYPE_NOTE_ON) ||
+              (pEnt->status == SMF_TYPE_NOTE_OFF)) {
+    ch  = pEnt->ch;
+    key = pEnt->key;
+    if ((ch < 0) || (ch > 15) || (key < 0) || (key > SMF_MAX_DATA)) {
+      fault(__LINE__);
+    }
+    pSlot = &((pn->slot)[ch][key]);
+    
+    if ((pEnt->status == SMF_TYPE_NOTE_ON) && (pEnt->val > 0)) {
+      /* Key-down, so apply the policy if the key is already sounding */
+      if (pSlot->depth > 0) {
+        if (pn->policy == SMF_NOTES_RETRIGGER) {
+          closeNote(pn, ch, key, -1);
+        } else if (pn->policy == SMF_NOTES_NEST) {
+          (pSlot->depth)++;
         }
       }
       
-    } else if (c == 0xff) {
-      /* Meta-event that has a type we will store in "A" (no running
-       * status allowed here) and then a variable-length size and then a
-       * payload which we read into the data buffer */
-      a = readChunkByte(pSrc, &(ps->ckrem), pErr);
-      if (a < 0) {
-        status = 0;
+      if (pSlot->depth < 1) {
+        pSlot->start = pn->tick;
+        pSlot->vel   = pEnt->val;
+        pSlot->depth = 1;
+        (pn->sounding)++;
       }
       
-      if (status) {
-        vl = readChunkVar(pSrc, &(ps->ckrem), pErr);
-        if (vl < 0) {
-          status = 0;
-        }
+    } else if (pSlot->depth > 0) {
+      /* Key-up of a sounding note; a Note-On with zero velocity counts
+       * as a Note-Off with the default release velocity */
+      if (pEnt->status == SMF_TYPE_NOTE_OFF) {
+        off_vel = pEnt->val;
+      } else {
+        off_vel = 64;
       }
       
-      if (status) {
-        for(vi = 0; vi < vl; vi++) {
-          d = readChunkByte(pSrc, &(ps->ckrem), pErr);
-          if (d < 0) {
-            status = 0;
-            break;
-          }
-          if (!pushBuffer(ps, d)) {
-            status = 0;
-            *pErr = SMF_ERR_BIG_PAYLOAD;
-            break;
-          }
-        }
+      if (pSlot->depth > 1) {
+        (pSlot->depth)--;
+      } else {
+        closeNote(pn, ch, key, off_vel);
       }
-      
-    } else {
-      /* Something invalid */
-      status = 0;
-      *pErr = SMF_ERR_BAD_EVENT;
     }
   }
+}
+
+/*
+ * smfnotes_get function.
+ */
+int smfnotes_get(SMFNOTES *pn, SMF_NOTE *pNote) {
   
-  /* If we have a MIDI message status byte, update running status; else,
-   * clear running status */
+  int result = 0;
+  
+  /* Check parameters */
+  if ((pn == NULL) || (pNote == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Return the next queued span, emptying the queue after the last */
+  if (pn->qpos < pn->qlen) {
+    memcpy(pNote, &((pn->pQ)[pn->qpos]), sizeof(SMF_NOTE));
+    (pn->qpos)++;
+    result = 1;
+    
+    if (pn->qpos >= pn->qlen) {
+      pn->qlen = 0;
+      pn->qpos = 0;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfnotes_read function.
+ */
+int smfnotes_read(
+    SMFNOTES  * pn,
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    SMF_NOTE  * pNote) {
+  
+  int result = 0;
+  SMF_ENTITY ent;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  
+  /* Check parameters */
+  if ((pn == NULL) || (ps == NULL) || (pSrc == NULL) || (pNote == NULL)) {
+    fault(__LINE__);
+  }
+  
+  /* Read entities until a note span is completed or the file ends */
+  result = 1;
+  while (!smfnotes_get(pn, pNote)) {
+    smfparse_read(ps, &ent, pSrc);
+    if (ent.status <= SMF_TYPE_EOF) {
+      result = ent.status;
+      break;
+    }
+    smfnotes_put(pn, &ent);
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * smfchase_alloc function.
+ */
+SMFCHASE *smfchase_alloc(
+    SMFSOURCE         * pSrc,
+    const SMF_OPTIONS * pOpt,
+    int32_t             interval,
+    int               * pErr) {
+  
+  int status = 1;
+  int dummy = 0;
+  int dirty = 0;
+  int32_t i = 0;
+  int64_t tick = 0;
+  int64_t next = 0;
+  
+  SMFMERGE *pm = NULL;
+  SMFCHASE *pc = NULL;
+  SMF_ENTITY ent;
+  CHASE_STATE st;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SMF_ENTITY));
+  memset(&st, 0, sizeof(CHASE_STATE));
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (interval < 1)) {
+    fault(__LINE__);
+  }
+  
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* Merge the tracks, skipping everything that does not affect the
+   * chase state; the first event of each track has already been read,
+   * so those are filtered below instead */
+  pm = smfmerge_alloc(pSrc, pOpt, NULL, pErr);
+  if (pm == NULL) {
+    status = 0;
+  }
   if (status) {
-    if ((c >= 0x80) && (c <= 0xef)) {
-      ps->run = c;
-      
-    } else {
-      ps->run = -1;
+    for(i = 0; i < pm->ntrk; i++) {
+      smfparse_set_filter(((pm->pCur)[i]).ps, CHASE_FILTER);
     }
   }
   
-  /* For the End Of Track meta-event (type 2F), skip any remaining data
-   * in the track */
-  if (status && (c == 0xff) && (a == 0x2f)) {
-    if (!smfsource_skip(pSrc, ps->ckrem)) {
+  /* Allocate the chase object with the initial snapshot */
+  if (status) {
+    pc = (SMFCHASE *) calloc(1, sizeof(SMFCHASE));
+    if (pc == NULL) {
+      fault(__LINE__);
+    }
+    
+    pc->interval = interval;
+    pc->pChg     = NULL;
+    pc->ccount   = 0;
+    pc->ccap     = 0;
+    pc->pSnap    = NULL;
+    pc->scount   = 0;
+    pc->scap     = 0;
+    
+    clearChase(&st);
+    snapChase(pc, 0, &st);
+    next = (int64_t) interval;
+  }
+  
+  /* Record the state changes, taking a snapshot when an interval
+   * boundary is crossed after the state has changed */
+  while (status) {
+    smfmerge_read(pm, &ent, NULL, &tick);
+    if (ent.status < 0) {
+      *pErr = ent.status;
       status = 0;
-      *pErr = SMF_ERR_IO;
+    } else if (ent.status == SMF_TYPE_EOF) {
+      break;
     }
-    if (status) {
-      ps->ckrem = 0;
+    
+    if (status && ((CHASE_FILTER & SMF_FILTER(ent.status)) != 0)) {
+      if (tick >= next) {
+        if (dirty) {
+          snapChase(pc, tick - (tick % interval), &st);
+          dirty = 0;
+        }
+        if (tick - (tick % interval) > INT64_MAX - interval) {
+          next = INT64_MAX;
+        } else {
+          next = tick - (tick % interval) + interval;
+        }
+      }
+      
+      if (recordChase(pc, &ent, tick)) {
+        applyChase(&st, &((pc->pChg)[pc->ccount - 1]));
+        dirty = 1;
+      }
     }
   }
   
-  /* Parse the event */
-  if (status) {
-    if (!parseEvent(ps, pEnt, c, a, b, delta, pErr)) {
-      status = 0;
-    }
+  /* Release the merger, and the chase object if there was an error */
+  smfmerge_free(pm);
+  pm = NULL;
+  
+  if (!status) {
+    smfchase_free(pc);
+    pc = NULL;
   }
   
-  /* Return status */
-  return status;
+  /* Return the chase object or NULL */
+  return pc;
 }
 
 /*
- * Implementation of the read callback for HANDLE_SOURCE.
- * 
- * See the specification of the smfsource_fp_read function pointer type
- * for the interface.
+ * smfchase_free function.
+ */
+void smfchase_free(SMFCHASE *pc) {
+  if (pc != NULL) {
+    free(pc->pChg);
+    free(pc->pSnap);
+    free(pc);
+    pc = NULL;
+  }
+}
+
+/*
+ * smfchase_query function.
  */
-static int handle_source_read(void *pInstance) {
+void smfchase_query(const SMFCHASE *pc, int64_t tick, SMF_CHASE *pState) {
   
-  HANDLE_SOURCE *ps = NULL;
-  int c = 0;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  int32_t i = 0;
+  int ch = 0;
+  int ctl = 0;
   
-  /* Check parameter */
-  if (pInstance == NULL) {
+  const CHASE_SNAPSHOT *pSnap = NULL;
+  CHASE_STATE st;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(CHASE_STATE));
+  
+  /* Check parameters */
+  if ((pc == NULL) || (tick < 0) || (pState == NULL)) {
+    fault(__LINE__);
+  }
+  if (pc->scount < 1) {
     fault(__LINE__);
   }
   
-  /* Cast instance data */
-  ps = (HANDLE_SOURCE *) pInstance;
-  
-  /* If we don't know the file length, check that this read won't exceed
-   * the size limit; if we know the file length, check that this read
-   * does not go beyond the end of the file; in the former case, a
-   * failed check causes an I/O error, while in the latter case a failed
-   * check causes EOF condition */
-  if (ps->flen < 0) {
-    if (ps->fptr >= HANDLE_FILE_MAXLEN) {
-      c = SMFSOURCE_IOERR;
-    }
-  } else {
-    if (ps->fptr >= ps->flen) {
-      c = SMFSOURCE_EOF;
+  /* Find the last snapshot at or before the tick, which exists because
+   * the first snapshot is at tick zero */
+  lo = 0;
+  hi = pc->scount - 1;
+  while (lo < hi) {
+    mid = lo + ((hi - lo + 1) / 2);
+    if ((pc->pSnap)[mid].tick <= tick) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
     }
   }
+  pSnap = &((pc->pSnap)[lo]);
   
-  /* Read from file if we're not already in a special condition */
-  if (c >= 0) {
-    c = fgetc(ps->fh);
-    if (c == EOF) {
-      if (feof(ps->fh)) {
-        c = SMFSOURCE_EOF;
-      } else {
-        c = SMFSOURCE_IOERR;
-      }
+  /* Replay the state changes up to and including the tick */
+  memcpy(&st, &(pSnap->st), sizeof(CHASE_STATE));
+  for(i = pSnap->pos; i < pc->ccount; i++) {
+    if ((pc->pChg)[i].tick > tick) {
+      break;
     }
+    applyChase(&st, &((pc->pChg)[i]));
   }
   
-  /* If read was successful, increase the file pointer */
-  if (c >= 0) {
-    (ps->fptr)++;
+  /* Expand the state */
+  memset(pState, 0, sizeof(SMF_CHASE));
+  pState->tick = tick;
+  for(ch = 0; ch < 16; ch++) {
+    for(ctl = 0; ctl <= SMF_MAX_DATA; ctl++) {
+      (pState->ctl)[ch][ctl] = (int) (st.ctl)[ch][ctl];
+    }
+    (pState->program)[ch]  = (int) (st.program)[ch];
+    (pState->pressure)[ch] = (int) (st.pressure)[ch];
+    (pState->bend)[ch]     = (int) (st.bend)[ch];
   }
+  pState->beat_dur = st.beat_dur;
   
-  /* Return result */
-  return c;
+  pState->has_time_sig = st.has_time_sig;
+  memcpy(&(pState->tsig), &(st.tsig), sizeof(SMF_TIMESIG));
+  
+  pState->has_key_sig = st.has_key_sig;
+  memcpy(&(pState->ksig), &(st.ksig), sizeof(SMF_KEYSIG));
 }
 
 /*
- * Implementation of the rewind callback for HANDLE_SOURCE.
- * 
- * See the specification of the smfsource_fp_rewind function pointer
- * type for the interface.
- * 
- * This callback must only be registered for handles that support random
- * access.
+ * smfcache_build function.
  */
-static int handle_source_rewind(void *pInstance) {
+int smfcache_build(
+    SMFSOURCE          * pSrc,
+    const SMF_OPTIONS  * pOpt,
+    void              ** ppBlob,
+    int64_t            * pLen,
+    int                * pErr) {
   
   int status = 1;
-  HANDLE_SOURCE *ps = NULL;
+  int dummy = 0;
+  int r = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t t = 0;
+  int32_t ntrk = 0;
+  int64_t nev = 0;
+  int64_t npay = 0;
+  int64_t narena = 0;
+  int32_t ev_base = 0;
+  int32_t pay_base = 0;
+  int32_t arena_base = 0;
+  
+  uint8_t *pBlob = NULL;
+  uint32_t *pw = NULL;
+  const uint8_t *pp = NULL;
+  SMFPARSE *ps = NULL;
+  SMF_TRACK **ppTracks = NULL;
+  SMF_TRACK *pt = NULL;
+  const SMF_CHUNK *pk = NULL;
   
-  /* Check parameter */
-  if (pInstance == NULL) {
+  CACHE_LAYOUT lay;
+  SMF_HEADER head;
+  
+  /* Initialize structures */
+  memset(&lay, 0, sizeof(CACHE_LAYOUT));
+  memset(&head, 0, sizeof(SMF_HEADER));
+  
+  /* Check parameters */
+  if ((pSrc == NULL) || (ppBlob == NULL) || (pLen == NULL)) {
     fault(__LINE__);
   }
   
-  /* Cast instance data and make sure random access supported */
-  ps = (HANDLE_SOURCE *) pInstance;
-  if (!(ps->can_seek)) {
-    fault(__LINE__);
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
   }
   
-  /* Attempt a rewind */
-  errno = 0;
-  rewind(ps->fh);
-  if (errno) {
+  /* Clear error return and results */
+  *pErr = 0;
+  *ppBlob = NULL;
+  *pLen = 0;
+  
+  /* Index the file */
+  ps = smfparse_alloc_ex(pOpt);
+  if (!smfparse_index(ps, pSrc, &head, pErr)) {
     status = 0;
   }
   
-  /* If successful rewind, reset byte offset field */
+  /* Decode every track */
   if (status) {
-    ps->fptr = 0;
+    ntrk = head.nTracks;
+    ppTracks = (SMF_TRACK **) calloc((size_t) ntrk, sizeof(SMF_TRACK *));
+    if (ppTracks == NULL) {
+      fault(__LINE__);
+    }
+    
+    for(t = 0; t < ntrk; t++) {
+      ppTracks[t] = smftrack_alloc();
+      r = smfparse_read_track(ps, ppTracks[t], pSrc);
+      if (r != SMF_TYPE_END_TRACK) {
+        status = 0;
+        if (r < 0) {
+          *pErr = r;
+        } else {
+          *pErr = SMF_ERR_EOF;
+        }
+        break;
+      }
+      
+      nev    += (ppTracks[t])->count;
+      npay   += (ppTracks[t])->pay_count;
+      narena += (ppTracks[t])->arena_len;
+    }
   }
   
-  /* Return status */
-  return status;
-}
-
-/*
- * Implementation of the close callback for HANDLE_SOURCE.
- * 
- * See the specification of the smfsource_fp_close function pointer type
- * for the interface.
- */
-static int handle_source_close(void *pInstance) {
-  
-  int status = 1;
-  HANDLE_SOURCE *ps = NULL;
-  
-  /* Check parameter */
-  if (pInstance == NULL) {
-    fault(__LINE__);
+  /* Get the counts, which must all fit in 32 bits */
+  if (status) {
+    if ((nev > INT32_MAX) || (npay > INT32_MAX) || (narena > INT32_MAX) ||
+        (smfparse_chunk_count(ps) > INT32_MAX)) {
+      status = 0;
+      *pErr = SMF_ERR_HUGE_FILE;
+    }
   }
   
-  /* Cast instance data */
-  ps = (HANDLE_SOURCE *) pInstance;
-  
-  /* If we are the owner of the file handle, close it */
-  if (ps->is_owner) {
-    if (fclose(ps->fh)) {
+  if (status) {
+    lay.nck    = smfparse_chunk_count(ps);
+    lay.nev    = (int32_t) nev;
+    lay.npay   = (int32_t) npay;
+    lay.narena = (int32_t) narena;
+    
+    pt = ppTracks[0];
+    for(i = 0; i < pt->count; i++) {
+      if ((pt->type)[i] == SMF_TYPE_TEMPO) {
+        (lay.ntm)++;
+      }
+    }
+    
+    cacheLayout(&lay);
+    if ((uint64_t) lay.total > (uint64_t) SIZE_MAX) {
       status = 0;
+      *pErr = SMF_ERR_HUGE_FILE;
     }
   }
   
-  /* Clear file handle and release instance data */
-  ps->fh = NULL;
-  free(ps);
-  ps = NULL;
-  pInstance = NULL;
-  
-  /* Return status */
-  return status;
-}
-
-/*
- * Implementation of the skip callback for HANDLE_SOURCE.
- * 
- * See the implementation of the smfsource_fp_skip function pointer type
- * for the interface.
- * 
- * This callback must only be registered for handles that support random
- * access.
- */
-static int handle_source_skip(void *pInstance, int32_t skip) {
+  /* Allocate the cache zero-filled, so that padding is deterministic */
+  if (status) {
+    pBlob = (uint8_t *) calloc(1, (size_t) lay.total);
+    if (pBlob == NULL) {
+      fault(__LINE__);
+    }
+  }
   
-  HANDLE_SOURCE *ps = NULL;
-  int status = 1;
+  /* Write the header words */
+  if (status) {
+    pw = (uint32_t *) pBlob;
+    pw[ 0] = CACHE_MAGIC;
+    pw[ 1] = SMF_CACHE_VERSION;
+    pw[ 2] = (uint32_t) head.fmt;
+    pw[ 3] = (uint32_t) head.nTracks;
+    pw[ 4] = (uint32_t) head.ts.subdiv;
+    pw[ 5] = (uint32_t) head.ts.frame_rate;
+    pw[ 6] = (uint32_t) lay.nck;
+    pw[ 7] = (uint32_t) lay.ntm;
+    pw[ 8] = (uint32_t) lay.nev;
+    pw[ 9] = (uint32_t) lay.npay;
+    pw[10] = (uint32_t) lay.narena;
+  }
   
-  /* Check parameters */
-  if (pInstance == NULL) {
-    fault(__LINE__);
+  /* Write the chunk index, giving each track chunk its range of
+   * events */
+  if (status) {
+    t = 0;
+    for(i = 0; i < lay.nck; i++) {
+      pk = smfparse_chunk(ps, i);
+      ((int64_t  *) (pBlob + lay.ck_off ))[i] = pk->offset;
+      ((uint32_t *) (pBlob + lay.ck_type))[i] = pk->type;
+      ((int32_t  *) (pBlob + lay.ck_len ))[i] = pk->length;
+      
+      if (pk->type == UINT32_C(0x4d54726b)) {
+        ((int32_t *) (pBlob + lay.ck_first))[i] = ev_base;
+        ((int32_t *) (pBlob + lay.ck_count))[i] = (ppTracks[t])->count;
+        ev_base += (ppTracks[t])->count;
+        t++;
+      } else {
+        ((int32_t *) (pBlob + lay.ck_first))[i] = -1;
+        ((int32_t *) (pBlob + lay.ck_count))[i] = 0;
+      }
+    }
+    if (t != ntrk) {
+      fault(__LINE__);
+    }
   }
-  if (skip < 0) {
-    fault(__LINE__);
+  
+  /* Write the tempo map from the Set Tempo events of the first track */
+  if (status) {
+    pt = ppTracks[0];
+    j = 0;
+    for(i = 0; i < pt->count; i++) {
+      if ((pt->type)[i] == SMF_TYPE_TEMPO) {
+        pp = &((pt->arena)[(pt->pay_off)[(pt->aux)[i]]]);
+        ((int64_t *) (pBlob + lay.tm_tick))[j] = (int64_t) (pt->tick)[i];
+        ((int32_t *) (pBlob + lay.tm_beat))[j] =
+          (((int32_t) pp[0]) << 16) |
+          (((int32_t) pp[1]) <<  8) |
+           ((int32_t) pp[2]);
+        j++;
+      }
+    }
   }
   
-  /* Cast instance data and make sure random access supported */
-  ps = (HANDLE_SOURCE *) pInstance;
-  if (!(ps->can_seek)) {
-    fault(__LINE__);
+  /* Write the event columns, the payload table, and the arena, moving
+   * the indices and offsets of each track past those of the tracks
+   * before it */
+  if (status) {
+    ev_base = 0;
+    for(t = 0; t < ntrk; t++) {
+      pt = ppTracks[t];
+      
+      if (pt->count > 0) {
+        memcpy((uint32_t *) (pBlob + lay.ev_tick) + ev_base, pt->tick,
+                ((size_t) pt->count) * sizeof(uint32_t));
+        memcpy(pBlob + lay.ev_type + ev_base, pt->type, (size_t) pt->count);
+        memcpy(pBlob + lay.ev_ch   + ev_base, pt->ch,   (size_t) pt->count);
+        memcpy(pBlob + lay.ev_d1   + ev_base, pt->d1,   (size_t) pt->count);
+        memcpy(pBlob + lay.ev_d2   + ev_base, pt->d2,   (size_t) pt->count);
+      }
+      for(i = 0; i < pt->count; i++) {
+        if ((pt->aux)[i] >= 0) {
+          ((int32_t *) (pBlob + lay.ev_aux))[ev_base + i] =
+            (pt->aux)[i] + pay_base;
+        } else {
+          ((int32_t *) (pBlob + lay.ev_aux))[ev_base + i] = -1;
+        }
+      }
+      
+      for(i = 0; i < pt->pay_count; i++) {
+        ((int32_t *) (pBlob + lay.pay_off))[pay_base + i] =
+          (pt->pay_off)[i] + arena_base;
+        ((int32_t *) (pBlob + lay.pay_len))[pay_base + i] =
+          (pt->pay_len)[i];
+      }
+      if (pt->arena_len > 0) {
+        memcpy(pBlob + lay.arena + arena_base, pt->arena,
+                (size_t) pt->arena_len);
+      }
+      
+      ev_base    += pt->count;
+      pay_base   += pt->pay_count;
+      arena_base += pt->arena_len;
+    }
   }
   
-  /* If skip would go beyond end of file, shorten skip so it just goes
-   * to the end of the file */
-  if (skip > ps->flen - ps->fptr) {
-    skip = ps->flen - ps->fptr;
+  /* Return the cache */
+  if (status) {
+    *ppBlob = pBlob;
+    *pLen = lay.total;
   }
   
-  /* Only proceed if non-zero skip */
-  if (skip > 0) {
-    /* Attempt to seek ahead */
-    if (fseek(ps->fh, (long) skip, SEEK_CUR)) {
-      status = 0;
-    }
-    
-    /* If successful, update file pointer */
-    if (status) {
-      ps->fptr += skip;
+  /* Release the decoded tracks and the parser */
+  if (ppTracks != NULL) {
+    for(t = 0; t < ntrk; t++) {
+      smftrack_free(ppTracks[t]);
     }
+    free(ppTracks);
+    ppTracks = NULL;
   }
+  smfparse_free(ps);
+  ps = NULL;
   
   /* Return status */
   return status;
 }
 
 /*
- * Public function implementations
- * ===============================
- * 
- * See the header for specifications
- */
-
-/*
- * smf_set_fault function.
+ * smfcache_open function.
  */
-void smf_set_fault(smf_fp_fault fFault) {
-  m_fault = fFault;
-}
-
-/*
- * smfsource_custom function.
- */
-SMFSOURCE *smfsource_custom(
-    void                * pInstance,
-    smfsource_fp_read     fRead,
-    smfsource_fp_rewind   fRewind,
-    smfsource_fp_close    fClose,
-    smfsource_fp_skip     fSkip) {
+SMFCACHE *smfcache_open(const void *pData, int64_t len, int *pErr) {
   
-  SMFSOURCE *ps = NULL;
+  int dummy = 0;
+  uint8_t *pCopy = NULL;
+  SMFCACHE *pc = NULL;
   
   /* Check parameters */
-  if (fRead == NULL) {
+  if ((len < 0) || ((pData == NULL) && (len > 0))) {
     fault(__LINE__);
   }
   
-  /* Allocate new source object */
-  ps = (SMFSOURCE *) calloc(1, sizeof(SMFSOURCE));
-  if (ps == NULL) {
-    fault(__LINE__);
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
   }
   
-  /* Initialize object */
-  ps->state     = SOURCE_STATE_NORMAL;
-  ps->pInstance = pInstance;
-  ps->fRead     = fRead;
-  ps->fRewind   = fRewind;
-  ps->fClose    = fClose;
-  ps->fSkip     = fSkip;
+  /* Clear error return */
+  *pErr = 0;
   
-  /* Return new object */
-  return ps;
+  /* Use the bytes in place if they are aligned, or else copy them */
+  if (len < (int64_t) (CACHE_HEAD * 4)) {
+    *pErr = SMF_ERR_CACHE;
+    
+  } else if ((((uintptr_t) pData) % 8) == 0) {
+    pc = openCache((const uint8_t *) pData, len, NULL, NULL, pErr);
+    
+  } else if ((uint64_t) len > (uint64_t) SIZE_MAX) {
+    *pErr = SMF_ERR_HUGE_FILE;
+    
+  } else {
+    pCopy = (uint8_t *) malloc((size_t) len);
+    if (pCopy == NULL) {
+      fault(__LINE__);
+    }
+    memcpy(pCopy, pData, (size_t) len);
+    pc = openCache(pCopy, len, pCopy, NULL, pErr);
+  }
+  
+  /* Return the cache object or NULL */
+  return pc;
 }
 
 /*
- * smfsource_new_handle function.
+ * smfcache_open_path function.
  */
-SMFSOURCE *smfsource_new_handle(
-    FILE * pIn,
-    int    is_owner,
-    int    can_seek,
-    int  * pErr) {
+SMFCACHE *smfcache_open_path(const char *pPath, int *pErr) {
   
-  int status = 1;
   int dummy = 0;
-  long flen = -1;
-  
-  HANDLE_SOURCE *ph = NULL;
-  SMFSOURCE *ps = NULL;
+  SMFCACHE *pc = NULL;
+#ifdef SMF_POSIX
+  SMFSOURCE *pMap = NULL;
+#else
+  FILE *fh = NULL;
+  int64_t len = 0;
+  uint8_t *pCopy = NULL;
+#endif
   
   /* Check parameters */
-  if (pIn == NULL) {
+  if (pPath == NULL) {
     fault(__LINE__);
   }
   
@@ -1754,490 +11789,687 @@ SMFSOURCE *smfsource_new_handle(
   
   /* Clear error return */
   *pErr = 0;
+
+#ifdef SMF_POSIX
+  /* Map the file and use the mapped bytes in place, since mappings are
+   * page-aligned */
+  pMap = smfsource_new_mmap(pPath, pErr);
+  if (pMap != NULL) {
+    if (pMap->blen < (int64_t) (CACHE_HEAD * 4)) {
+      *pErr = SMF_ERR_CACHE;
+      smfsource_close(pMap);
+      pMap = NULL;
+    } else {
+      pc = openCache(pMap->pWin, pMap->blen, NULL, pMap, pErr);
+    }
+  }
+#else
+  /* Read the whole file into memory */
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    *pErr = SMF_ERR_OPEN_FILE;
+  }
   
-  /* If random access supported, attempt to find the file length and
-   * rewind the file */
-  if (can_seek) {
-    if (fseek(pIn, 0, SEEK_END)) {
-      status = 0;
+  if (fh != NULL) {
+    len = startHandle(fh);
+    if (len < 0) {
       *pErr = SMF_ERR_IO;
+    } else if ((uint64_t) len > (uint64_t) SIZE_MAX) {
+      *pErr = SMF_ERR_HUGE_FILE;
+    } else if (len < (int64_t) (CACHE_HEAD * 4)) {
+      *pErr = SMF_ERR_CACHE;
     }
-    
-    if (status) {
-      flen = ftell(pIn);
-      if (flen < 0) {
-        status = 0;
-        *pErr = SMF_ERR_IO;
-      } else if (flen > HANDLE_FILE_MAXLEN) {
-        status = 0;
-        *pErr = SMF_ERR_HUGE_FILE;
-      }
+  }
+  
+  if ((fh != NULL) && (*pErr == 0)) {
+    pCopy = (uint8_t *) malloc((size_t) len);
+    if (pCopy == NULL) {
+      fault(__LINE__);
     }
-    
-    if (status) {
-      errno = 0;
-      rewind(pIn);
-      if (errno) {
-        status = 0;
-        *pErr = SMF_ERR_IO;
-      }
+    if (fread(pCopy, 1, (size_t) len, fh) != (size_t) len) {
+      *pErr = SMF_ERR_IO;
+      free(pCopy);
+      pCopy = NULL;
     }
   }
   
-  /* Allocate new handle source structure */
-  if (status) {
-    ph = (HANDLE_SOURCE *) calloc(1, sizeof(HANDLE_SOURCE));
-    if (ph == NULL) {
-      fault(__LINE__);
+  if (fh != NULL) {
+    fclose(fh);
+    fh = NULL;
+  }
+  
+  if (pCopy != NULL) {
+    pc = openCache(pCopy, len, pCopy, NULL, pErr);
+  }
+#endif
+  
+  /* Return the cache object or NULL */
+  return pc;
+}
+
+/*
+ * smfcache_close function.
+ */
+void smfcache_close(SMFCACHE *pc) {
+  if (pc != NULL) {
+    smfparse_free(pc->ps);
+    free(pc->pCopy);
+    if (pc->pMap != NULL) {
+      smfsource_close(pc->pMap);
     }
+    free(pc);
+    pc = NULL;
+  }
+}
+
+/*
+ * smfcache_read function.
+ */
+void smfcache_read(SMFCACHE *pc, SMF_ENTITY *pEnt) {
+  
+  int32_t k = 0;
+  SMFPARSE *ps = NULL;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pEnt == NULL)) {
+    fault(__LINE__);
   }
   
-  /* Fill in the handle source structure */
-  if (status) {
-    ph->fh = pIn;
-    ph->fptr = 0;
+  /* Reset entity structure */
+  memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+  ps = pc->ps;
+  
+  /* Return the header first, then an event if we are inside a track, or
+   * else the next chunk or EOF */
+  if (pc->status == 0) {
+    memcpy(&(ps->rHead), &(pc->head), sizeof(SMF_HEADER));
+    pEnt->status = SMF_TYPE_HEADER;
+    pEnt->pHead = &(ps->rHead);
+    pc->status = 1;
+    pc->ck = 1;
     
-    if (can_seek) {
-      ph->flen = (int32_t) flen;
-    } else {
-      ph->flen = -1;
+  } else if ((pc->status == 1) && (pc->ev < pc->evend)) {
+    if (!cacheEvent(pc, pEnt)) {
+      memcpy(pEnt, &m_blank, sizeof(SMF_ENTITY));
+      pc->status = SMF_ERR_CACHE;
     }
     
-    if (is_owner) {
-      ph->is_owner = 1;
-    } else {
-      ph->is_owner = 0;
-    }
+  } else if ((pc->status == 1) && (pc->ck < (pc->lay).nck)) {
+    k = pc->ck;
+    (pc->ck)++;
     
-    if (can_seek) {
-      ph->can_seek = 1;
+    if ((pc->ck_type)[k] == UINT32_C(0x4d54726b)) {
+      pEnt->status = SMF_TYPE_BEGIN_TRACK;
+      pEnt->tick = 0;
+      pc->ev    = (pc->ck_first)[k];
+      pc->evend = pc->ev + (pc->ck_count)[k];
     } else {
-      ph->can_seek = 0;
+      pEnt->status = SMF_TYPE_CHUNK;
+      pEnt->chunk_type = (pc->ck_type)[k];
     }
+    
+  } else if (pc->status >= 1) {
+    pc->status = 2;
   }
   
-  /* Construct the new input source */
-  if (status) {
-    if (can_seek) {
-      ps = smfsource_custom(
-              ph,
-              &handle_source_read,
-              &handle_source_rewind,
-              &handle_source_close,
-              &handle_source_skip);
-    } else {
-      ps = smfsource_custom(
-              ph,
-              &handle_source_read,
-              NULL,
-              &handle_source_close,
-              NULL);
-    }
+  /* Report EOF or the error state */
+  if (pc->status == 2) {
+    pEnt->status = SMF_TYPE_EOF;
+  } else if (pc->status < 0) {
+    pEnt->status = pc->status;
   }
-  
-  /* Return the new source, or NULL */
-  return ps;
 }
 
 /*
- * smfsource_new_path function.
+ * smfcache_rewind function.
  */
-SMFSOURCE *smfsource_new_path(const char *pPath, int *pErr) {
-  
-  int dummy = 0;
-  int status = 1;
-  FILE *fh = NULL;
-  SMFSOURCE *ps = NULL;
+void smfcache_rewind(SMFCACHE *pc) {
   
   /* Check parameters */
-  if (pPath == NULL) {
+  if (pc == NULL) {
     fault(__LINE__);
   }
   
-  /* If pErr not provided, redirect to dummy */
-  if (pErr == NULL) {
-    pErr = &dummy;
+  /* Go back to the header */
+  pc->status = 0;
+  pc->ck     = 0;
+  pc->ev     = 0;
+  pc->evend  = 0;
+}
+
+/*
+ * smfcache_chunk_count function.
+ */
+int32_t smfcache_chunk_count(const SMFCACHE *pc) {
+  
+  /* Check parameters */
+  if (pc == NULL) {
+    fault(__LINE__);
   }
   
-  /* Reset pErr */
-  *pErr = 0;
+  /* Return the count */
+  return (pc->lay).nck;
+}
+
+/*
+ * smfcache_chunk function.
+ */
+void smfcache_chunk(const SMFCACHE *pc, int32_t i, SMF_CHUNK *pChunk) {
   
-  /* Open the file */
-  fh = fopen(pPath, "rb");
-  if (fh == NULL) {
-    status = 0;
-    *pErr = SMF_ERR_OPEN_FILE;
+  /* Check parameters */
+  if ((pc == NULL) || (pChunk == NULL)) {
+    fault(__LINE__);
+  }
+  if ((i < 0) || (i >= (pc->lay).nck)) {
+    fault(__LINE__);
   }
   
-  /* Call through */
-  if (status) {
-    ps = smfsource_new_handle(fh, 1, 1, pErr);
+  /* Copy the chunk out of the columns */
+  memset(pChunk, 0, sizeof(SMF_CHUNK));
+  pChunk->type   = (pc->ck_type)[i];
+  pChunk->offset = (pc->ck_off)[i];
+  pChunk->length = (pc->ck_len)[i];
+}
+
+/*
+ * smfcache_tempo function.
+ */
+void smfcache_tempo(const SMFCACHE *pc, SMFTEMPO *pm) {
+  
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pm == NULL)) {
+    fault(__LINE__);
   }
   
-  /* Return source object or NULL */
-  return ps;
+  /* Rebuild the map */
+  smftempo_clear(pm, &((pc->head).ts));
+  for(i = 0; i < (pc->lay).ntm; i++) {
+    smftempo_add(pm, (pc->tm_tick)[i], (pc->tm_beat)[i]);
+  }
 }
 
 /*
- * smfsource_close function.
+ * smfwrite_new_buffer function.
  */
-int smfsource_close(SMFSOURCE *pSrc) {
-  int status = 1;
+SMFWRITE *smfwrite_new_buffer(void) {
   
-  /* Only proceed if non-NULL passed */
-  if (pSrc != NULL) {
-    
-    /* If destructor is registered, invoke it */
-    if (pSrc->fClose != NULL) {
-      if (!(pSrc->fClose(pSrc->pInstance))) {
-        status = 0;
-      }
-    }
-    
-    /* Release memory block */
-    free(pSrc);
-    pSrc = NULL;
+  SMFWRITE *pw = NULL;
+  
+  /* Allocate the writer */
+  pw = (SMFWRITE *) calloc(1, sizeof(SMFWRITE));
+  if (pw == NULL) {
+    fault(__LINE__);
   }
   
-  /* Return status */
-  return status;
+  pw->status   = 0;
+  pw->stage    = WRITE_STAGE_HEAD;
+  pw->fh       = NULL;
+  pw->is_owner = 0;
+  pw->can_seek = 0;
+  pw->pBuf     = NULL;
+  pw->blen     = 0;
+  pw->bcap     = 0;
+  pw->flushed  = 0;
+  pw->fmt      = 0;
+  pw->declared = 0;
+  pw->ntrk     = 0;
+  pw->trk_pos  = 0;
+  pw->run      = -1;
+  
+  /* Return the writer */
+  return pw;
 }
 
 /*
- * smfsource_canRewind function.
+ * smfwrite_new_handle function.
  */
-int smfsource_canRewind(SMFSOURCE *pSrc) {
+SMFWRITE *smfwrite_new_handle(FILE *pOut, int is_owner, int can_seek) {
   
-  int result = 0;
+  SMFWRITE *pw = NULL;
   
   /* Check parameters */
-  if (pSrc == NULL) {
+  if (pOut == NULL) {
     fault(__LINE__);
   }
   
-  /* Query object */
-  if (pSrc->fRewind != NULL) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Allocate a buffer writer and attach the handle */
+  pw = smfwrite_new_buffer();
+  
+  pw->fh = pOut;
+  if (is_owner) {
+    pw->is_owner = 1;
+  }
+  if (can_seek) {
+    pw->can_seek = 1;
   }
   
-  /* Return result */
-  return result;
+  /* Return the writer */
+  return pw;
 }
 
 /*
- * smfsource_rewind function.
+ * smfwrite_new_path function.
  */
-int smfsource_rewind(SMFSOURCE *pSrc) {
+SMFWRITE *smfwrite_new_path(const char *pPath, int *pErr) {
   
-  int status = 1;
+  int dummy = 0;
+  FILE *fh = NULL;
+  SMFWRITE *pw = NULL;
   
   /* Check parameters */
-  if (pSrc == NULL) {
+  if (pPath == NULL) {
     fault(__LINE__);
   }
   
-  /* If rewinding not supported, fail without any state change */
-  if (pSrc->fRewind == NULL) {
-    status = 0;
+  /* If pErr not provided, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
   }
   
-  /* If in double-error mode, fail without attempting rewind again */
-  if (status) {
-    if (pSrc->state == SOURCE_STATE_DOUBLE) {
-      status = 0;
-    }
+  /* Reset pErr */
+  *pErr = 0;
+  
+  /* Create the file and wrap it */
+  fh = fopen(pPath, "wb");
+  if (fh == NULL) {
+    *pErr = SMF_ERR_OPEN_FILE;
+  } else {
+    pw = smfwrite_new_handle(fh, 1, 1);
   }
   
-  /* If we got here successfully, attempt a rewind */
-  if (status) {
-    if (!pSrc->fRewind(pSrc->pInstance)) {
-      status = 0;
-      pSrc->state = SOURCE_STATE_DOUBLE;
+  /* Return the writer or NULL */
+  return pw;
+}
+
+/*
+ * smfwrite_free function.
+ */
+void smfwrite_free(SMFWRITE *pw) {
+  if (pw != NULL) {
+    if ((pw->fh != NULL) && pw->is_owner) {
+      fclose(pw->fh);
     }
+    pw->fh = NULL;
+    free(pw->pBuf);
+    free(pw);
+    pw = NULL;
   }
-  
-  /* Return status */
-  return status;
 }
 
 /*
- * smfsource_skip function.
+ * smfwrite_put function.
  */
-int smfsource_skip(SMFSOURCE *pSrc, int32_t skip) {
+int smfwrite_put(SMFWRITE *pw, const SMF_ENTITY *pEnt, int *pErr) {
   
   int status = 1;
-  int32_t i = 0;
-  int c = 0;
+  int dummy = 0;
+  int64_t len = 0;
+  uint8_t buf[8];
+  
+  /* Initialize buffer */
+  memset(buf, 0, sizeof(buf));
   
   /* Check parameters */
-  if ((pSrc == NULL) || (skip < 0)) {
+  if ((pw == NULL) || (pEnt == NULL)) {
     fault(__LINE__);
   }
   
-  /* If in an error state, fail */
-  if ((pSrc->state == SOURCE_STATE_ERROR) ||
-      (pSrc->state == SOURCE_STATE_DOUBLE)) {
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
+  
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* If the writer has failed, fail again */
+  if (pw->status < 0) {
     status = 0;
+    *pErr = pw->status;
   }
   
-  /* Only proceed if non-zero skip distance and in normal state */
-  if (status && (skip > 0) && (pSrc->state == SOURCE_STATE_NORMAL)) {
-    /* Check whether we have a skip callback */
-    if (pSrc->fSkip != NULL) {
-      /* We have a skip callback, so use that */
-      if (!pSrc->fSkip(pSrc->pInstance, skip)) {
-        status = 0;
-        pSrc->state = SOURCE_STATE_ERROR;
+  /* Check that the entity is allowed in the current stage */
+  if (status) {
+    if (pEnt->status == SMF_TYPE_HEADER) {
+      if (pw->stage != WRITE_STAGE_HEAD) {
+        fault(__LINE__);
+      }
+      
+    } else if ((pEnt->status == SMF_TYPE_CHUNK) ||
+                (pEnt->status == SMF_TYPE_BEGIN_TRACK)) {
+      if (pw->stage != WRITE_STAGE_CHUNK) {
+        fault(__LINE__);
+      }
+      
+    } else if (pEnt->status == SMF_TYPE_EOF) {
+      if ((pw->stage != WRITE_STAGE_CHUNK) &&
+          (pw->stage != WRITE_STAGE_DONE)) {
+        fault(__LINE__);
+      }
+      
+    } else if ((pEnt->status >= SMF_TYPE_END_TRACK) &&
+                (pEnt->status <= SMF_TYPE_META)) {
+      if (pw->stage != WRITE_STAGE_TRACK) {
+        fault(__LINE__);
       }
       
     } else {
-      /* We don't have a skip callback, so use read callback
-       * repeatedly */
-      for(i = 0; i < skip; i++) {
-        /* Attempt a read */
-        c = pSrc->fRead(pSrc->pInstance);
-        
-        /* If we got EOF, then leave loop successfully after changing to
-         * EOF state; if we got an error, then leave loop in error after
-         * changing to error state */
-        if (c == SMFSOURCE_EOF) {
-          pSrc->state = SOURCE_STATE_EOF;
-          break;
-          
-        } else if (c == SMFSOURCE_IOERR) {
+      fault(__LINE__);
+    }
+  }
+  
+  /* Write the header, start a track, or encode an event */
+  if (status && (pEnt->status == SMF_TYPE_HEADER)) {
+    if (pEnt->pHead == NULL) {
+      fault(__LINE__);
+    }
+    if (!writeHeader(pw, pEnt->pHead, pErr)) {
+      status = 0;
+    }
+    if (status) {
+      pw->stage = WRITE_STAGE_CHUNK;
+    }
+    
+  } else if (status && (pEnt->status == SMF_TYPE_BEGIN_TRACK)) {
+    if ((pw->fmt == 0) && (pw->ntrk > 0)) {
+      status = 0;
+      *pErr = SMF_ERR_MULTI_TRACK;
+    } else if (pw->ntrk >= 65535) {
+      status = 0;
+      *pErr = SMF_ERR_HEADER;
+    }
+    
+    /* Write the chunk header with a length to fill in later */
+    if (status) {
+      pw->trk_pos = pw->flushed + (int64_t) pw->blen;
+      memcpy(buf, "MTrk", 4);
+      if (!putWrite(pw, buf, 8, pErr)) {
+        status = 0;
+      }
+    }
+    if (status) {
+      (pw->ntrk)++;
+      pw->run = -1;
+      pw->stage = WRITE_STAGE_TRACK;
+    }
+    
+  } else if (status && (pEnt->status >= SMF_TYPE_END_TRACK)) {
+    if (!writeEvent(pw, pEnt, pErr)) {
+      status = 0;
+    }
+    
+    /* At the End Of Track, fill in the chunk length */
+    if (status && (pEnt->status == SMF_TYPE_END_TRACK)) {
+      len = (pw->flushed + (int64_t) pw->blen) - (pw->trk_pos + 8);
+      if (len > INT32_MAX) {
+        status = 0;
+        *pErr = SMF_ERR_HUGE_CHUNK;
+      }
+      if (status) {
+        buf[0] = (uint8_t) ((len >> 24) & 0xff);
+        buf[1] = (uint8_t) ((len >> 16) & 0xff);
+        buf[2] = (uint8_t) ((len >> 8) & 0xff);
+        buf[3] = (uint8_t) (len & 0xff);
+        if (!patchWrite(pw, pw->trk_pos + 4, buf, 4, pErr)) {
           status = 0;
-          pSrc->state = SOURCE_STATE_ERROR;
-          break;
         }
       }
+      if (status) {
+        pw->stage = WRITE_STAGE_CHUNK;
+      }
+    }
+  }
+  
+  /* Write out the buffer if it has filled up */
+  if (status) {
+    if (!flushWrite(pw, WRITE_BLOCK, pErr)) {
+      status = 0;
     }
   }
   
+  /* If there was an error, go into error state */
+  if (!status) {
+    pw->status = *pErr;
+  }
+  
   /* Return status */
   return status;
 }
 
 /*
- * smfsource_read function.
+ * smfwrite_copy function.
  */
-int smfsource_read(SMFSOURCE *pSrc) {
+int smfwrite_copy(
+    SMFWRITE        * pw,
+    SMFSOURCE       * pSrc,
+    const SMF_CHUNK * pChunk,
+    int             * pErr) {
   
-  int c = 0;
+  int status = 1;
+  int dummy = 0;
+  int is_track = 0;
+  int32_t rem = 0;
+  int32_t n = 0;
+  int32_t got = 0;
+  uint8_t buf[8];
+  
+  /* Initialize buffer */
+  memset(buf, 0, sizeof(buf));
   
   /* Check parameters */
-  if (pSrc == NULL) {
+  if ((pw == NULL) || (pSrc == NULL) || (pChunk == NULL)) {
     fault(__LINE__);
   }
-  
-  /* If in an error state, fail */
-  if ((pSrc->state == SOURCE_STATE_ERROR) ||
-      (pSrc->state == SOURCE_STATE_DOUBLE)) {
-    c = SMFSOURCE_IOERR;
+  if ((pChunk->offset < 0) || (pChunk->length < 0) ||
+      (pChunk->type == UINT32_C(0x4d546864))) {
+    fault(__LINE__);
   }
   
-  /* Call through if in normal state; else, if in EOF state, set an EOF
-   * return */
-  if (c != SMFSOURCE_IOERR) {
-    if (pSrc->state == SOURCE_STATE_NORMAL) {
-      c = pSrc->fRead(pSrc->pInstance);
-      
-      if (c == SMFSOURCE_IOERR) {
-        pSrc->state = SOURCE_STATE_ERROR;
-      
-      } else if (c == SMFSOURCE_EOF) {
-        pSrc->state = SOURCE_STATE_EOF;
-      }
-      
-    } else if (pSrc->state == SOURCE_STATE_EOF) {
-      c = SMFSOURCE_EOF;
-      
-    } else {
-      fault(__LINE__);
-    }
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
   }
   
-  /* Return result */
-  return c;
-}
-
-/*
- * smfparse_alloc function.
- */
-SMFPARSE *smfparse_alloc(void) {
-  SMFPARSE *ps = NULL;
+  /* Clear error return */
+  *pErr = 0;
   
-  ps = (SMFPARSE *) calloc(1, sizeof(SMFPARSE));
-  if (ps == NULL) {
+  /* If the writer has failed, fail again */
+  if (pw->status < 0) {
+    status = 0;
+    *pErr = pw->status;
+  }
+  
+  /* Copies are only allowed between chunks */
+  if (status && (pw->stage != WRITE_STAGE_CHUNK)) {
     fault(__LINE__);
   }
   
-  ps->status   = 0;
-  ps->ckrem    = -1;
-  ps->trkcount = 0;
-  ps->blen     = 0;
-  ps->bcap     = 0;
-  ps->bptr     = NULL;
-  ps->run      = -1;
+  /* Track chunks count towards the tracks of the file */
+  if (status) {
+    is_track = (pChunk->type == UINT32_C(0x4d54726b));
+    if (is_track && (pw->fmt == 0) && (pw->ntrk > 0)) {
+      status = 0;
+      *pErr = SMF_ERR_MULTI_TRACK;
+    } else if (is_track && (pw->ntrk >= 65535)) {
+      status = 0;
+      *pErr = SMF_ERR_HEADER;
+    }
+  }
   
-  return ps;
-}
-
-/*
- * smfparse_free function.
- */
-void smfparse_free(SMFPARSE *ps) {
+  /* Position the source at the chunk data */
+  if (status) {
+    if (!smfsource_rewind(pSrc)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
+  if (status) {
+    if (!skipSource(pSrc, pChunk->offset + 8)) {
+      status = 0;
+      *pErr = SMF_ERR_IO;
+    }
+  }
   
-  if (ps != NULL) {
-    if (ps->bptr != NULL) {
-      free(ps->bptr);
-      ps->bptr = NULL;
+  /* Write the chunk header */
+  if (status) {
+    buf[0] = (uint8_t) ((pChunk->type >> 24) & 0xff);
+    buf[1] = (uint8_t) ((pChunk->type >> 16) & 0xff);
+    buf[2] = (uint8_t) ((pChunk->type >> 8) & 0xff);
+    buf[3] = (uint8_t) (pChunk->type & 0xff);
+    buf[4] = (uint8_t) ((pChunk->length >> 24) & 0xff);
+    buf[5] = (uint8_t) ((pChunk->length >> 16) & 0xff);
+    buf[6] = (uint8_t) ((pChunk->length >> 8) & 0xff);
+    buf[7] = (uint8_t) (pChunk->length & 0xff);
+    if (!putWrite(pw, buf, 8, pErr)) {
+      status = 0;
     }
-    free(ps);
-    ps = NULL;
   }
+  
+  /* Copy the chunk data straight into the output buffer, one block at
+   * a time */
+  rem = pChunk->length;
+  while (status && (rem > 0)) {
+    n = rem;
+    if (n > WRITE_BLOCK) {
+      n = WRITE_BLOCK;
+    }
+    
+    if (!reserveWrite(pw, n, pErr)) {
+      status = 0;
+    }
+    if (status) {
+      got = smfsource_readBlock(pSrc, &((pw->pBuf)[pw->blen]), n);
+      if (got == SMFSOURCE_IOERR) {
+        status = 0;
+        *pErr = SMF_ERR_IO;
+      } else if (got < n) {
+        status = 0;
+        *pErr = SMF_ERR_EOF;
+      }
+    }
+    if (status) {
+      pw->blen += n;
+      rem -= n;
+      if (!flushWrite(pw, WRITE_BLOCK, pErr)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Count the track */
+  if (status && is_track) {
+    (pw->ntrk)++;
+  }
+  
+  /* If there was an error, go into error state */
+  if (!status) {
+    pw->status = *pErr;
+  }
+  
+  /* Return status */
+  return status;
 }
 
 /*
- * smfparse_read function.
+ * smfwrite_finish function.
  */
-void smfparse_read(SMFPARSE *ps, SMF_ENTITY *pEnt, SMFSOURCE *pSrc) {
+int smfwrite_finish(SMFWRITE *pw, int *pErr) {
   
   int status = 1;
-  int err_code = 0;
+  int dummy = 0;
+  uint8_t buf[2];
   
-  uint32_t ck_type = 0;
-  int32_t ck_len = 0;
+  /* Initialize buffer */
+  memset(buf, 0, sizeof(buf));
   
   /* Check parameters */
-  if ((ps == NULL) || (pEnt == NULL) || (pSrc == NULL)) {
+  if (pw == NULL) {
     fault(__LINE__);
   }
   
-  /* Reset entity structure */
-  memset(pEnt, 0, sizeof(SMF_ENTITY));
-  
-  pEnt->status     = 0;
-  pEnt->pHead      = NULL;
-  pEnt->chunk_type = 0;
-  pEnt->delta      = -1;
-  pEnt->ch         = -1;
-  pEnt->key        = -1;
-  pEnt->ctl        = -1;
-  pEnt->val        = -1;
-  pEnt->bend       = 0;
-  pEnt->buf_len    = 0;
-  pEnt->buf_ptr    = NULL;
-  pEnt->seq_num    = -1;
-  pEnt->txtype     = -1;
-  pEnt->beat_dur   = -1;
-  pEnt->tcode      = NULL;
-  pEnt->tsig       = NULL;
-  pEnt->ksig       = NULL;
-  pEnt->meta_type  = -1;
+  /* If no error return given, redirect to dummy */
+  if (pErr == NULL) {
+    pErr = &dummy;
+  }
   
-  /* Determine what to do */
-  if (ps->status < 0) {
-    /* We are in an error state, so just use that */
+  /* Clear error return */
+  *pErr = 0;
+  
+  /* If the writer has failed, fail again */
+  if (pw->status < 0) {
     status = 0;
-    err_code = ps->status;
-    
-  } else if (ps->status == 0) {
-    /* We are in initial state, so read the header chunk */
-    if (!readHeaderChunk(&(ps->head), pSrc, &err_code)) {
+    *pErr = pw->status;
+  }
+  
+  /* The file can only be finished between chunks */
+  if (status && (pw->stage != WRITE_STAGE_CHUNK)) {
+    fault(__LINE__);
+  }
+  
+  /* There must be at least one track */
+  if (status && (pw->ntrk < 1)) {
+    status = 0;
+    *pErr = SMF_ERR_NO_TRACKS;
+  }
+  
+  /* Fill in the track count if it differs from the declared one; the
+   * header is the first thing in the output */
+  if (status && (pw->ntrk != pw->declared)) {
+    if ((pw->flushed > 0) && (!(pw->can_seek))) {
       status = 0;
+      *pErr = SMF_ERR_HEADER;
     }
-    
-    /* Change to header-read state */
-    if (status) {
-      ps->status = 1;
-    }
-    
-    /* Copy parsed header into header return structure */
     if (status) {
-      memcpy(&(ps->rHead), &(ps->head), sizeof(SMF_HEADER));
+      buf[0] = (uint8_t) (pw->ntrk >> 8);
+      buf[1] = (uint8_t) (pw->ntrk & 0xff);
+      if (!patchWrite(pw, 10, buf, 2, pErr)) {
+        status = 0;
+      }
     }
-    
-    /* Set up header entity */
     if (status) {
-      pEnt->status = SMF_TYPE_HEADER;
-      pEnt->pHead  = &(ps->rHead);
+      pw->declared = pw->ntrk;
     }
-    
-  } else if (ps->status == 2) {
-    /* We are in EOF state, so just use that */
-    pEnt->status = SMF_TYPE_EOF;
-    
-  } else if ((ps->status == 1) && (ps->ckrem < 0)) {
-    /* We've read the header but are outside of any chunk -- check first
-     * whether there's another declared track to read */
-    if (ps->trkcount < (ps->head).nTracks) {
-      /* More declared tracks remain to be read, so read a chunk
-       * header */
-      if (!readChunkHead(&ck_type, &ck_len, pSrc, &err_code)) {
-        status = 0;
-      }
-      
-      /* Check the chunk type */
-      if (status) {
-        if (ck_type == UINT32_C(0x4d54726b)) {
-          /* Track chunk, so increase track count and load the track
-           * length */
-          (ps->trkcount)++;
-          ps->ckrem = ck_len;
-          
-          /* Return BEGIN_TRACK entity and reset running status */
-          pEnt->status = SMF_TYPE_BEGIN_TRACK;
-          ps->run = -1;
-          
-        } else if (ck_type == UINT32_C(0x4d546864)) {
-          /* Another MIDI header chunk, which shouldn't happen */
-          status = 0;
-          err_code = SMF_ERR_MULTI_HEAD;
-          
-        } else {
-          /* Unrecognized chunk type, which is OK, so skip its data
-           * payload and report it */
-          if (!smfsource_skip(pSrc, ck_len)) {
-            status = 0;
-            err_code = SMF_ERR_IO;
-          }
-          
-          if (status) {
-            pEnt->status = SMF_TYPE_CHUNK;
-            pEnt->chunk_type = ck_type;
-          }
-        }
-      }
-      
-    } else {
-      /* We've read all the declared tracks, so go to EOF state and
-       * return EOF */
-      ps->status = 2;
-      pEnt->status = SMF_TYPE_EOF;
+  }
+  
+  /* Write out everything */
+  if (status) {
+    if (!flushWrite(pw, 0, pErr)) {
+      status = 0;
     }
-    
-  } else if ((ps->status == 1) && (ps->ckrem >= 0)) {
-    /* We're inside a track, so read an event */
-    if (!readEvent(ps, pEnt, pSrc, &err_code)) {
+  }
+  if (status && (pw->fh != NULL)) {
+    if (fflush(pw->fh)) {
       status = 0;
+      *pErr = SMF_ERR_IO;
     }
-    
+  }
+  
+  /* Update the stage, or go into error state */
+  if (status) {
+    pw->stage = WRITE_STAGE_DONE;
   } else {
-    fault(__LINE__);
+    pw->status = *pErr;
   }
   
-  /* If status indicates failure, copy error code into entity, make sure
-   * that entity status is negative, and copy into parser status */
-  if (!status) {
-    if (err_code >= 0) {
-      fault(__LINE__);
-    }
-    
-    pEnt->status = err_code;
-    ps->status   = err_code;
+  /* Return status */
+  return status;
+}
+
+/*
+ * smfwrite_buffer function.
+ */
+const uint8_t *smfwrite_buffer(const SMFWRITE *pw, int64_t *pLen) {
+  
+  /* Check parameters */
+  if ((pw == NULL) || (pLen == NULL)) {
+    fault(__LINE__);
   }
+  
+  /* Return the buffered bytes */
+  *pLen = (int64_t) pw->blen;
+  return pw->pBuf;
 }
 
 /*
@@ -2252,7 +12484,7 @@ const char *smf_errorString(int code) {
       break;
     
     case SMF_ERR_HUGE_FILE:
-      pResult = "MIDI file exceeds 1 GiB in size";
+      pResult = "MIDI file exceeds the size limit";
       break;
     
     case SMF_ERR_OPEN_FILE:
@@ -2343,6 +12575,14 @@ const char *smf_errorString(int code) {
       pResult = "Invalid data bytes in MIDI message";
       break;
     
+    case SMF_ERR_TIME_RANGE:
+      pResult = "MIDI tick offset or delta time is out of range";
+      break;
+    
+    case SMF_ERR_CACHE:
+      pResult = "Invalid or incompatible binary cache";
+      break;
+    
     default:
       pResult = "Unknown error";
   }
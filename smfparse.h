@@ -12,6 +12,45 @@
 #include <stdint.h>
 #include <stdio.h>
 
+/*
+ * Platform detection
+ * ==================
+ */
+
+/*
+ * SMF_POSIX is defined on POSIX platforms.  Functions that are only
+ * available on POSIX platforms, such as smfsource_new_mmap(), are only
+ * declared when this is defined.
+ * 
+ * On POSIX platforms, smfparse_parallel() uses POSIX threads, so the
+ * library must be linked with the threads library (-pthread).
+ * 
+ * Define SMF_NO_POSIX when building both the library and its clients to
+ * leave out the POSIX-only functions even on POSIX platforms.
+ */
+#ifndef SMF_NO_POSIX
+#if defined(__unix__) || defined(__unix) || \
+      (defined(__APPLE__) && defined(__MACH__))
+#define SMF_POSIX
+#endif
+#endif
+
+/*
+ * Build options
+ * =============
+ */
+
+/*
+ * Define SMF_ENABLE_STATS when building the library to make parser
+ * objects maintain the instrumentation counters that smfparse_stats()
+ * reports.  When it is not defined, the counters are compiled out
+ * entirely, so they cost nothing, and smfparse_stats() reports zeros.
+ * 
+ * Clients do not need to define it, because the counters are internal
+ * to the library and the declarations in this header are the same
+ * either way.
+ */
+
 /*
  * Constants
  * =========
@@ -75,6 +114,34 @@
 #define SMF_MIN_KEYSIG (-7)
 #define SMF_MAX_KEYSIG ( 7)
 
+/*
+ * The default limits used for parser objects when no options are given.
+ * 
+ * SMF_DEFAULT_MAX_PAYLOAD is the default maximum size in bytes of the
+ * data payload of a single event, which is 32 KiB.
+ * 
+ * SMF_DEFAULT_MAX_FILE is the default maximum size in bytes of the MIDI
+ * data that will be parsed, which is 1 GiB.
+ * 
+ * See SMF_OPTIONS for further information.
+ */
+#define SMF_DEFAULT_MAX_PAYLOAD INT32_C(32768)
+#define SMF_DEFAULT_MAX_FILE    INT64_C(1073741824)
+
+/*
+ * The size in bytes of each block that a prefetching source reads
+ * ahead, and the maximum number of blocks it can hold (see
+ * smfsource_new_prefetch()).
+ */
+#define SMF_PREFETCH_BLOCK INT32_C(65536)
+#define SMF_MAX_PREFETCH   INT32_C(1024)
+
+/*
+ * The value used in the ch column of an SMF_TRACK for events that are
+ * not associated with a MIDI channel.
+ */
+#define SMF_TRACK_NO_CH (0xff)
+
 /*
  * Special return values for SMFSOURCE callbacks.
  */
@@ -85,7 +152,7 @@
  * SMF error codes.
  */
 #define SMF_ERR_IO          ( -1) /* I/O error */
-#define SMF_ERR_HUGE_FILE   ( -2) /* Input file exceeds 1 GiB */
+#define SMF_ERR_HUGE_FILE   ( -2) /* Input file exceeds size limit */
 #define SMF_ERR_OPEN_FILE   ( -3) /* Failed to open input file */
 #define SMF_ERR_EOF         ( -4) /* Unexpected end of file */
 #define SMF_ERR_HUGE_CHUNK  ( -5) /* Chunk size out of range */
@@ -108,6 +175,8 @@
 #define SMF_ERR_TIME_SIG    (-22) /* Invalid Time Signature event */
 #define SMF_ERR_KEY_SIG     (-23) /* Invalid Key Signature event */
 #define SMF_ERR_MIDI_DATA   (-24) /* Invalid MIDI data bytes */
+#define SMF_ERR_TIME_RANGE  (-25) /* Tick offset or delta out of range */
+#define SMF_ERR_CACHE       (-26) /* Invalid or incompatible cache */
 
 /*
  * SMF entity type constants.
@@ -122,6 +191,9 @@
  * All other entities only occur when a track is open.  The entity
  * SMF_TYPE_END_TRACK will close a track.  No track will be open at the
  * end of parsing.
+ * 
+ * SMF_TYPE_NEED_MORE is not part of the MIDI file.  It is only returned
+ * by smfparse_feed() when more input is needed.
  */
 #define SMF_TYPE_EOF            ( 0)  /* End Of File */
 #define SMF_TYPE_HEADER         ( 1)  /* MIDI file header chunk */
@@ -145,6 +217,85 @@
 #define SMF_TYPE_TIME_SIG       (19)  /* Time Signature meta-event */
 #define SMF_TYPE_KEY_SIG        (20)  /* Key Signature meta-event */
 #define SMF_TYPE_META           (21)  /* Other kind of meta-event */
+#define SMF_TYPE_NEED_MORE      (22)  /* More input is needed */
+
+/*
+ * Event filter masks for smfparse_set_filter().
+ * 
+ * SMF_FILTER() gives the mask bit of an SMF_TYPE_ constant.  The masks
+ * of several types are combined with bitwise OR.  SMF_FILTER_ALL lets
+ * every entity through, which is the default.
+ */
+#define SMF_FILTER(t)  (UINT32_C(1) << (t))
+#define SMF_FILTER_ALL (UINT32_C(0xffffffff))
+
+/*
+ * The number of entity types counted by the entities array of
+ * SMF_STATS, which covers every SMF_TYPE_ constant.
+ */
+#define SMF_STATS_TYPES (23)
+
+/*
+ * The length to pass to smfparse_feed() to signal the end of the input.
+ */
+#define SMF_FEED_END (-1)
+
+/*
+ * Overlapping note policies for smfnotes_alloc().
+ * 
+ * These determine what happens when a Note-On arrives for a channel and
+ * key that already has a sounding note.
+ * 
+ * RETRIGGER ends the sounding note at the new Note-On, without a
+ * release velocity, and starts a new note.
+ * 
+ * EXTEND ignores the new Note-On, so the sounding note lasts until the
+ * next Note-Off for that key.
+ * 
+ * NEST counts the Note-Ons, so the sounding note lasts until as many
+ * Note-Offs have arrived for that key as there were Note-Ons.
+ */
+#define SMF_NOTES_RETRIGGER (0)
+#define SMF_NOTES_EXTEND    (1)
+#define SMF_NOTES_NEST      (2)
+
+/*
+ * Validation levels for the validate option of SMF_OPTIONS.
+ * 
+ * STRICT checks everything and fails on the first problem.  This is
+ * the default.
+ * 
+ * TRUSTED is for input that is already known to be valid, such as
+ * files written by your own software.  The range checks on the values
+ * within events are skipped, which includes the fields of Channel
+ * Prefix, SMPTE Offset, Time Signature, and Key Signature meta-events.
+ * The data bytes of MIDI messages are masked to seven bits rather than
+ * checked.  Everything needed to decode the input safely is still
+ * checked, including the structure of the chunks, the payload lengths
+ * of meta-events, and that Set Tempo is not zero, so invalid input
+ * still can't cause undefined behavior or faults in the tempo map and
+ * note pairing engine, but it may decode into wrong values, or into
+ * values that are out of range in the meta-events.
+ * 
+ * LENIENT checks everything like STRICT, but recovers from two common
+ * defects in files found in the wild rather than failing.  Data bytes
+ * without a running status byte (SMF_ERR_RUN_STATUS) are discarded up
+ * to the next status byte.  A track chunk that ends without an End Of
+ * Track meta-event (SMF_ERR_OPEN_TRACK), including in the middle of an
+ * event, has an END_TRACK entity reported at the end of the chunk,
+ * with any partial event dropped.  smfparse_repairs() counts how many
+ * times this happened.
+ */
+#define SMF_VALIDATE_STRICT  (0)
+#define SMF_VALIDATE_TRUSTED (1)
+#define SMF_VALIDATE_LENIENT (2)
+
+/*
+ * The version of the binary cache format written by smfcache_build().
+ * 
+ * smfcache_open() only accepts caches of this version.
+ */
+#define SMF_CACHE_VERSION (1)
 
 /*
  * SMF text entity subclass constants.
@@ -211,6 +362,54 @@ typedef struct SMFSOURCE_TAG SMFSOURCE;
 struct SMFPARSE_TAG;
 typedef struct SMFPARSE_TAG SMFPARSE;
 
+/*
+ * SMFTEMPO structure prototype.
+ * 
+ * Structure definition given in implementation file.
+ */
+struct SMFTEMPO_TAG;
+typedef struct SMFTEMPO_TAG SMFTEMPO;
+
+/*
+ * SMFMERGE structure prototype.
+ * 
+ * Structure definition given in implementation file.
+ */
+struct SMFMERGE_TAG;
+typedef struct SMFMERGE_TAG SMFMERGE;
+
+/*
+ * SMFNOTES structure prototype.
+ * 
+ * Structure definition given in implementation file.
+ */
+struct SMFNOTES_TAG;
+typedef struct SMFNOTES_TAG SMFNOTES;
+
+/*
+ * SMFCHASE structure prototype.
+ * 
+ * Structure definition given in implementation file.
+ */
+struct SMFCHASE_TAG;
+typedef struct SMFCHASE_TAG SMFCHASE;
+
+/*
+ * SMFCACHE structure prototype.
+ * 
+ * Structure definition given in implementation file.
+ */
+struct SMFCACHE_TAG;
+typedef struct SMFCACHE_TAG SMFCACHE;
+
+/*
+ * SMFWRITE structure prototype.
+ * 
+ * Structure definition given in implementation file.
+ */
+struct SMFWRITE_TAG;
+typedef struct SMFWRITE_TAG SMFWRITE;
+
 /*
  * SMF_TIMESYS structure representing the time system used within a MIDI
  * file.
@@ -481,6 +680,18 @@ typedef struct {
    */
   int32_t delta;
   
+  /*
+   * The absolute tick offset of this entity from the start of its
+   * track, which is the sum of all the delta times in the track up to
+   * and including this entity.
+   * 
+   * This is used for every entity that has a delta time offset, and it
+   * is zero for SMF_TYPE_BEGIN_TRACK.  Delta times of events that were
+   * dropped by the event filter are included.  For the other entities
+   * that do not have a delta, this field is set to -1 and ignored.
+   */
+  int64_t tick;
+  
   /*
    * The MIDI channel number associated with this entity.
    * 
@@ -630,7 +841,14 @@ typedef struct {
    * 
    * If non-NULL, the data buffer will be owned by the parser object.
    * It remains valid until the next call to read an entity, or until
-   * the parser object is freed (whichever occurs first).
+   * the parser object is freed (whichever occurs first).  For entities
+   * returned by smfparse_read_batch(), the next call to read an entity
+   * is the next read call after the batch.  When reading from a
+   * memory-resident input source (see smfsource_new_memory() and
+   * smfsource_new_mmap()), the pointer may instead point directly into
+   * the memory of the input source, in which case it also becomes
+   * invalid when the input source is closed.  In either case, the data
+   * must not be modified through this pointer.
    * 
    * For entities that do not use the data buffer, the length will be
    * set to zero and the pointer will be set to NULL.
@@ -732,135 +950,662 @@ typedef struct {
 } SMF_ENTITY;
 
 /*
- * Function pointer types
- * ======================
+ * SMF_ALLOCATOR structure for replacing the C heap with a custom memory
+ * allocator.
+ * 
+ * The three callbacks work like malloc(), realloc(), and free(), except
+ * that they also receive the pCustom value.  fAlloc and fRealloc must
+ * either return a block that is suitably aligned for any type, or NULL
+ * if the memory can't be allocated, which the library treats as a
+ * fault.  fFree is never called with NULL.
+ * 
+ * Either all three callbacks are set, or all three are NULL to use the
+ * C heap.  The callbacks may be called from any thread that uses an
+ * object that was allocated with them, so they must be thread-safe if
+ * smfparse_parallel() is used.
  */
+typedef struct {
+  
+  /*
+   * The allocation callbacks.
+   */
+  void * (*fAlloc)(void *pCustom, size_t size);
+  void * (*fRealloc)(void *pCustom, void *p, size_t size);
+  void   (*fFree)(void *pCustom, void *p);
+  
+  /*
+   * Value passed through to each callback.
+   */
+  void *pCustom;
+  
+} SMF_ALLOCATOR;
 
 /*
- * Callback function pointer type for a fault handler.
- * 
- * This function should not return.  The recommended implementation is
- * to display an error message and then exit the program.  If the
- * function returns, the internal fault wrapper will automatically end
- * the program anyways.
- * 
- * This function is NOT used for error conditions like I/O errors or
- * MIDI file syntax errors.  Rather, this is used for error conditions
- * that should never arise in a correctly written program.
- * 
- * The passed lnum is the __LINE__ within the smfparse.h module where
- * the fault occurred.
- * 
- * Parameters:
+ * SMF_OPTIONS structure for configuring a parser object.
  * 
- *   lnum - the line number of the fault (__LINE__)
+ * This is passed to smfparse_alloc_ex().  Always initialize the
+ * structure with smfparse_defaults() and then change the fields you are
+ * interested in, so that fields added in later versions of the library
+ * get their default values.
  */
-typedef void (*smf_fp_fault)(long lnum);
+typedef struct {
+  
+  /*
+   * The maximum size in bytes of the data payload of a single System
+   * Exclusive event, text event, or other meta-event.
+   * 
+   * Events with larger payloads cause an SMF_ERR_BIG_PAYLOAD error.
+   * This limit applies regardless of whether the payload actually needs
+   * to be copied into the parser object.
+   * 
+   * The range is zero up to SMF_MAX_VARINT, inclusive.  The default is
+   * SMF_DEFAULT_MAX_PAYLOAD.
+   */
+  int32_t max_payload;
+  
+  /*
+   * The initial capacity in bytes of the data buffer that the parser
+   * uses for payloads.
+   * 
+   * The buffer is allocated with this capacity when the parser object
+   * is constructed, and it only grows (by doubling, up to max_payload)
+   * if a payload larger than the current capacity is encountered.
+   * Setting this to max_payload means the buffer never has to grow
+   * while parsing.  Zero means the buffer is only allocated when it is
+   * first needed.
+   * 
+   * The range is zero up to max_payload, inclusive.  The default is
+   * zero.
+   */
+  int32_t init_payload;
+  
+  /*
+   * The maximum size in bytes of the MIDI data that will be parsed.
+   * 
+   * This counts all the chunks up to and including the chunk currently
+   * being parsed, including their chunk headers.  As soon as a chunk
+   * header is read that declares a chunk extending beyond this limit,
+   * parsing fails with SMF_ERR_HUGE_FILE.  Bytes in the input beyond the
+   * last track that is parsed do not count against the limit.
+   * 
+   * The range is one up to INT64_MAX, inclusive.  The default is
+   * SMF_DEFAULT_MAX_FILE.
+   */
+  int64_t max_file;
+  
+  /*
+   * The number of events between the checkpoints that smfparse_index()
+   * records within each track for smfparse_seek_tick().
+   * 
+   * Zero means no checkpoints are recorded, so smfparse_index() only
+   * reads the chunk headers.  Otherwise, smfparse_index() also decodes
+   * every track and records a checkpoint at the start of the track and
+   * before every event whose number within the track is a multiple of
+   * this value.  Each checkpoint takes a few dozen bytes.  Smaller
+   * values make seeking faster at the cost of more memory.
+   * 
+   * The range is zero up to INT32_MAX, inclusive.  The default is zero.
+   */
+  int32_t checkpoint;
+  
+  /*
+   * How thoroughly events are validated while parsing.
+   * 
+   * This is one of the SMF_VALIDATE_ constants.  The header chunk is
+   * always validated in full.  The default is SMF_VALIDATE_STRICT.
+   */
+  int validate;
+  
+  /*
+   * The memory allocator for the parser object and its internal
+   * buffers (see smfparse_alloc_ex()).
+   * 
+   * The default has all fields set to NULL, which uses the C heap.
+   */
+  SMF_ALLOCATOR alloc;
+  
+} SMF_OPTIONS;
 
 /*
- * Callback function pointer type for SMFSOURCE read functions.
- * 
- * This function shall read a single byte from the input source and
- * return the unsigned byte value, which must be in range 0 to 255
- * (inclusive).
- * 
- * If there are no bytes left to read, SMFSOURCE_EOF shall be returned.
- * The callback will not be invoked again unless the input source is
- * rewound.
- * 
- * If there is an error reading from the source, SMFSOURCE_IOERR shall
- * be returned.  No further callbacks will be made except to the rewind
- * and close callbacks.  If a rewind completes successfully, the input
- * source is returned to a non-error state.
- * 
- * The pInstance parameter is passed through from the constructor of the
- * SMFSOURCE object.
- * 
- * Parameters:
- * 
- *   pInstance - the passed-through instance pointer
- * 
- * Return:
- * 
- *   the unsigned byte value read from the input source, in range 0 to
- *   255, or one of the special conditions SMFSOURCE_EOF or
- *   SMFSOURCE_IOERR
+ * SMF_STATS structure that reports the instrumentation counters of a
+ * parser object.
+ * 
+ * This is filled in by smfparse_stats().  All counters start at zero
+ * when the parser is allocated and keep counting across files until
+ * they are cleared with smfparse_clear_stats().
+ * 
+ * The counters only cover input that is read while decoding entities,
+ * which is everything read by smfparse_read(), smfparse_read_batch(),
+ * and smfparse_feed(), and by the functions that decode through
+ * smfparse_read() on the same parser object.  That includes the tracks
+ * that smfparse_index() decodes to record checkpoints, and the events
+ * that smfparse_seek_tick() decodes to reach its tick offset.  The
+ * chunk scan of smfparse_index(), the repositioning done by
+ * smfparse_seek_track() and smfparse_seek_tick(), smfparse_probe(), and
+ * the separate parser objects of smfparse_parallel() and SMFMERGE are
+ * not counted.
+ * 
+ * The counters are only maintained if the library was built with
+ * SMF_ENABLE_STATS.
  */
-typedef int (*smfsource_fp_read)(void *pInstance);
+typedef struct {
+  
+  /*
+   * The number of input bytes consumed, including skipped bytes.
+   */
+  int64_t bytes;
+  
+  /*
+   * The number of entities returned, indexed by SMF_TYPE_ constant.
+   * 
+   * Entities that smfparse_feed() returns as SMF_TYPE_NEED_MORE are
+   * counted, but the attempts that were rolled back are not.
+   */
+  int64_t entities[SMF_STATS_TYPES];
+  
+  /*
+   * The number of error entities returned.
+   * 
+   * A parser that is in an error state returns the same error on every
+   * further read, and each of these is counted.
+   */
+  int64_t errors;
+  
+  /*
+   * The number of events that were skipped by the event filter.
+   */
+  int64_t filtered;
+  
+  /*
+   * The number of MIDI messages that used running status.
+   */
+  int64_t running;
+  
+  /*
+   * The number of events that were decoded directly from the input
+   * window of the source, without going through the byte-by-byte path.
+   */
+  int64_t fast;
+  
+  /*
+   * The number of payload bytes that were copied into the data buffer,
+   * and the number that were pointed to directly in the memory of a
+   * memory-resident source.
+   */
+  int64_t pay_copied;
+  int64_t pay_direct;
+  
+  /*
+   * The number of times the data buffer was allocated or grown.
+   */
+  int64_t grows;
+  
+  /*
+   * The number of non-empty skips that were requested from the source,
+   * and how many of those had to read through the skipped bytes because
+   * the source has no skip callback.
+   */
+  int64_t skips;
+  int64_t skip_loops;
+  
+  /*
+   * The number of invocations of each source callback.
+   */
+  int64_t cb_read;
+  int64_t cb_block;
+  int64_t cb_skip;
+  int64_t cb_rewind;
+  
+  /*
+   * The total time spent decoding entities, in the units of the clock
+   * registered with smfparse_set_clock(), or zero if there is none.
+   */
+  int64_t time;
+  
+} SMF_STATS;
 
 /*
- * Callback function pointer type for SMFSOURCE rewind functions.
- * 
- * Not all SMFSOURCE objects have to support this callback.  Only input
- * sources that support rewinding.
- * 
- * If successful, the input source shall be returned to the beginning of
- * input so that the input can be read through again.  Any I/O error
- * conditions must be cleared.
- * 
- * If unsuccessful, the input source is in an error state.  The only
- * callback that may still be made in this state is to the close
- * callback.
- * 
- * The pInstance parameter is passed through from the constructor of the
- * SMFSOURCE object.
+ * SMF_ERRINFO structure that describes where a parser object ran into
+ * an error.
  * 
- * Parameters:
- * 
- *   pInstance - the passed-through instance pointer
- * 
- * Return:
- * 
- *   non-zero if successful, zero if failure
+ * This is filled in by smfparse_error() and passed to the error
+ * callback registered with smfparse_set_error().  It describes the
+ * point at which the parser went into its error state, so it stays the
+ * same for as long as the parser remains in that state.
  */
-typedef int (*smfsource_fp_rewind)(void *pInstance);
+typedef struct {
+  
+  /*
+   * The error code, which is one of the SMF_ERR_ constants.
+   */
+  int code;
+  
+  /*
+   * The byte offset from the start of the input at which the error was
+   * detected.
+   * 
+   * Within a chunk, this is just past the last byte of the chunk that
+   * was read, which is usually just past the offending byte.  Outside
+   * of any chunk, it is the offset of the chunk header that could not
+   * be read, as declared by the lengths of the chunks before it.  This
+   * can be beyond the end of the input if one of those chunks is
+   * truncated.
+   */
+  int64_t offset;
+  
+  /*
+   * The zero-based number of the track chunk in which the error was
+   * detected, or -1 if it was not within a track chunk.
+   */
+  int32_t track;
+  
+  /*
+   * The absolute tick offset of the last event that was read within the
+   * track before the error, or -1 if the error was not within a track
+   * chunk.
+   */
+  int64_t tick;
+  
+  /*
+   * The status byte of the event that was being read when the error was
+   * detected, with running status applied, or -1 if the error was not
+   * within an event or the event has no status byte.
+   * 
+   * For a skipped or truncated event with an invalid byte where its
+   * status byte should be, this is the running status that was in
+   * effect, if any.
+   */
+  int status_byte;
+  
+} SMF_ERRINFO;
 
 /*
- * Callback function pointer type for SMFSOURCE close functions.
+ * SMF_CHUNK structure describing a chunk within a MIDI file.
  * 
- * Not all SMFSOURCE objects have to support this callback.  Only input
- * sources that need to clean up while closing down.
- * 
- * This function must always close down the input source.  The return
- * value indicates whether something went wrong during close down, which
- * a caller might then choose to warn the user about.  However,
- * returning failure does NOT mean that the input source remains open.
- * The input source is always closed down by this function no matter
- * what.
+ * This is used for the chunk index built by smfparse_index().
+ */
+typedef struct {
+  
+  /*
+   * The 32-bit chunk type, with the most significant byte being the
+   * first character of the chunk type.
+   */
+  uint32_t type;
+  
+  /*
+   * The byte offset of the chunk header from the start of the input.
+   */
+  int64_t offset;
+  
+  /*
+   * The length of the chunk data in bytes, not including the eight-byte
+   * chunk header.
+   */
+  int32_t length;
+  
+} SMF_CHUNK;
+
+/*
+ * SMF_TRACK structure storing a whole decoded track in columnar form.
+ * 
+ * Allocate with smftrack_alloc(), fill with smfparse_read_track(), and
+ * release with smftrack_free().  All the arrays are owned by the
+ * structure.  They are reused and grown as necessary each time the
+ * structure is filled, and they may be NULL while they are empty.  Do
+ * not modify any of the fields.
+ * 
+ * The events are stored in parallel arrays, where the same index into
+ * each array refers to the same event.  The event columns are the
+ * following:
+ * 
+ *   tick - the time offset of the event in delta time units, measured
+ *   from the start of the decoded events (normally the start of the
+ *   track)
+ * 
+ *   type - the SMF_TYPE_ constant of the event
+ * 
+ *   ch - the MIDI channel 0 to 15 for MIDI messages and Channel Prefix
+ *   meta-events, or SMF_TRACK_NO_CH for all other events
+ * 
+ *   d1, d2 - the two data bytes of MIDI messages, which are zero if not
+ *   used by the message; for SMF_TYPE_PITCH_BEND, d1 is the least
+ *   significant seven bits and d2 is the most significant seven bits of
+ *   the unsigned 14-bit bend value; for meta-events, d1 is the
+ *   meta-event type byte and d2 is zero; for System-Exclusive events,
+ *   both are zero
+ * 
+ *   aux - index into the payload table of the raw data payload of
+ *   System-Exclusive events and meta-events, or -1 if the event has no
+ *   payload bytes
+ * 
+ * Meta-events that the parser interprets, such as Set Tempo or Time
+ * Signature, are validated the same way as by smfparse_read(), but
+ * their payloads are stored raw.  The End Of Track meta-event is always
+ * the last event stored, so its tick is the duration of the track.
+ * 
+ * The payload table consists of the pay_off and pay_len arrays, with
+ * pay_count entries.  Each entry gives the byte offset and length of a
+ * payload within the arena, which holds arena_len bytes.
+ */
+typedef struct {
+  
+  /*
+   * The event columns, each holding count elements.
+   */
+  int32_t    count;
+  uint32_t * tick;
+  uint8_t  * type;
+  uint8_t  * ch;
+  uint8_t  * d1;
+  uint8_t  * d2;
+  int32_t  * aux;
+  
+  /*
+   * The payload table, each array holding pay_count elements.
+   */
+  int32_t   pay_count;
+  int32_t * pay_off;
+  int32_t * pay_len;
+  
+  /*
+   * The payload arena, holding arena_len bytes.
+   */
+  int32_t   arena_len;
+  uint8_t * arena;
+  
+  /*
+   * The allocated capacities of the event columns, the payload table,
+   * and the payload arena.
+   */
+  int32_t cap;
+  int32_t pay_cap;
+  int32_t arena_cap;
+  
+} SMF_TRACK;
+
+/*
+ * SMF_PROBE structure holding the summary of a MIDI file produced by
+ * smfparse_probe().
  * 
- * The pInstance parameter is passed through from the constructor of the
- * SMFSOURCE object.  If it points to a dynamically allocated memory
- * block, you should free it with this callback.
+ * Allocate with smfprobe_alloc(), fill with smfparse_probe(), and
+ * release with smfprobe_free().  The arrays are owned by the structure
+ * and reused across probes.
+ */
+typedef struct {
+  
+  /*
+   * The parsed header.
+   */
+  SMF_HEADER head;
+  
+  /*
+   * The track chunks that are actually present in the file, in file
+   * order.
+   * 
+   * count is the number of track chunks whose chunk header was found,
+   * which is at most the number of tracks declared in the header.  It
+   * is less if the file ends early.
+   */
+  int32_t     count;
+  SMF_CHUNK * pTracks;
+  
+  /*
+   * The data of the first Sequence/Track Name text meta-event and the
+   * first Copyright Notice text meta-event found in the scanned part of
+   * the tracks.
+   * 
+   * Each is a buffer of the given length with an extra nul terminator
+   * after it, or the length is -1 if no such event was found.  The text
+   * may contain nul bytes of its own.  The pointers are NULL until the
+   * first text is stored.
+   */
+  int32_t   title_len;
+  uint8_t * title;
+  int32_t   copyright_len;
+  uint8_t * copyright;
+  
+  /*
+   * The allocated capacities of the track array and the text buffers,
+   * the latter including the nul terminator.
+   */
+  int32_t cap;
+  int32_t title_cap;
+  int32_t copyright_cap;
+  
+} SMF_PROBE;
+
+/*
+ * SMF_NOTE structure that represents a note span, which is a Note-On
+ * paired with the Note-Off that ends it.
+ * 
+ * This is filled in by smfnotes_get() and smfnotes_read().
+ */
+typedef struct {
+  
+  /*
+   * The tick offset of the Note-On from the start of its track.
+   */
+  int64_t start;
+  
+  /*
+   * The duration of the note in ticks, zero or greater.
+   */
+  int64_t dur;
+  
+  /*
+   * The zero-based index of the track chunk that contains the note.
+   */
+  int32_t trk;
+  
+  /*
+   * The channel in range 0 to 15 and the key in range 0 to 127.
+   */
+  int ch;
+  int key;
+  
+  /*
+   * The velocity of the Note-On, in range 1 to 127.
+   */
+  int on_vel;
+  
+  /*
+   * The release velocity of the Note-Off in range 0 to 127.
+   * 
+   * A Note-On with zero velocity ends a note in the same way as a
+   * Note-Off with a release velocity of 64, so 64 is reported for those.
+   * If the note was ended by the overlapping note policy or by the end
+   * of the track rather than by a Note-Off, this is -1.
+   */
+  int off_vel;
+  
+} SMF_NOTE;
+
+/*
+ * SMF_CHASE structure that holds the effective playback state of a MIDI
+ * file at a given tick offset.
+ * 
+ * This is filled in by smfchase_query().  It reflects every Control
+ * Change, Program Change, Channel Pressure, Pitch Bend, Set Tempo, Time
+ * Signature, and Key Signature event at or before the tick, across all
+ * tracks.  Sending these values to a synthesizer before starting
+ * playback at the tick ("chasing") makes it sound the same as playing
+ * from the start of the file.
+ */
+typedef struct {
+  
+  /*
+   * The tick offset that the state was queried for.
+   */
+  int64_t tick;
+  
+  /*
+   * The current program of each channel, or -1 if the channel has not
+   * had a Program Change yet.
+   */
+  int program[16];
+  
+  /*
+   * The last value of each controller of each channel, indexed by
+   * channel and then controller, or -1 if the controller has not had a
+   * Control Change yet.
+   */
+  int ctl[16][128];
+  
+  /*
+   * The channel pressure of each channel, or -1 if the channel has not
+   * had a Channel Pressure message yet.
+   */
+  int pressure[16];
+  
+  /*
+   * The pitch bend of each channel, or zero (the centre position) if the
+   * channel has not had a Pitch Bend message yet.
+   */
+  int bend[16];
+  
+  /*
+   * The current beat duration in microseconds, or -1 if there has not
+   * been a Set Tempo meta-event yet.  MIDI files default to 500000
+   * microseconds per beat until the first tempo change.
+   */
+  int32_t beat_dur;
+  
+  /*
+   * The current time signature.  has_time_sig is zero and tsig is all
+   * zero if there has not been a Time Signature meta-event yet.
+   */
+  int         has_time_sig;
+  SMF_TIMESIG tsig;
+  
+  /*
+   * The current key signature.  has_key_sig is zero and ksig is all
+   * zero if there has not been a Key Signature meta-event yet.
+   */
+  int        has_key_sig;
+  SMF_KEYSIG ksig;
+  
+} SMF_CHASE;
+
+/*
+ * SMF_BATCH_FILE structure that names one input file of a batch run by
+ * smfparse_batch().
+ * 
+ * If pPath is not NULL, the file is read from that path and the other
+ * fields are ignored.  Otherwise, the file is the len bytes at pData,
+ * which must remain valid and unchanged until smfparse_batch() returns.
+ * pData may only be NULL if len is zero.
+ */
+typedef struct {
+  
+  /*
+   * The path to the MIDI file, or NULL for a file in memory.
+   */
+  const char *pPath;
+  
+  /*
+   * The MIDI file in memory, if pPath is NULL.
+   */
+  const void * pData;
+  int64_t      len;
+  
+} SMF_BATCH_FILE;
+
+/*
+ * Function pointer types
+ * ======================
+ */
+
+/*
+ * Callback function pointer type for a fault handler.
+ * 
+ * This function should not return.  The recommended implementation is
+ * to display an error message and then exit the program.  If the
+ * function returns, the internal fault wrapper will automatically end
+ * the program anyways.
+ * 
+ * This function is NOT used for error conditions like I/O errors or
+ * MIDI file syntax errors.  Rather, this is used for error conditions
+ * that should never arise in a correctly written program.
+ * 
+ * The passed lnum is the __LINE__ within the smfparse.h module where
+ * the fault occurred.
  * 
  * Parameters:
  * 
- *   pInstance - the passed-through instance pointer
+ *   lnum - the line number of the fault (__LINE__)
+ */
+typedef void (*smf_fp_fault)(long lnum);
+
+/*
+ * Callback function pointer type for a fault handler of a single
+ * thread.
+ * 
+ * This is the same as smf_fp_fault, except that the value of pCustom
+ * passed to smf_set_thread_fault() is passed through, so that the
+ * handler can find the recovery point of its thread.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the custom data pointer
+ * 
+ *   lnum - the line number of the fault (__LINE__)
+ */
+typedef void (*smf_fp_thread_fault)(void *pCustom, long lnum);
+
+/*
+ * Callback function pointer type for the clock of a parser object.
+ * 
+ * This function shall return the current time in any unit, such that
+ * the difference of two calls gives the time that passed between them.
+ * The value of pCustom passed to smfparse_set_clock() is passed
+ * through.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the custom data pointer
  * 
  * Return:
  * 
- *   non-zero if normal close-down, zero if closed down but something
- *   was abnormal during the close-down process
+ *   the current time
  */
-typedef int (*smfsource_fp_close)(void *pInstance);
+typedef int64_t (*smf_fp_clock)(void *pCustom);
 
 /*
- * Callback function pointer type for SMFSOURCE skip functions.
+ * Callback function pointer type for the error callback of a parser
+ * object.
  * 
- * Not all SMFSOURCE objects have to support this callback.  Only input
- * sources that have some random-access method for efficiently skipping
- * the file pointer ahead.  If not provided, skip operations will be
- * implemented by calling the read function repeatedly and discarding
- * what it returns.  That is, of course, much less efficient than having
- * a random-access seek-ahead.
+ * This function is called once each time the parser object goes into
+ * an error state, before the error is returned to the client.  pInfo
+ * describes the error (see SMF_ERRINFO), and it is only valid during
+ * the call.  The value of pCustom passed to smfparse_set_error() is
+ * passed through.
  * 
- * The skip value will always be greater than zero.  If the skip
- * distance would go beyond the end of the file, the source object
- * should position the file pointer so that the next read will return
- * SMFSOURCE_EOF.
+ * The callback is made on the thread that is using the parser object,
+ * and it must not call any function on that parser object.
  * 
- * If this function returns failure, no further callbacks will be made
- * except to the rewind and close callbacks.  If rewind completes
- * successfully, the input source will be returned to a non-error state.
+ * Parameters:
+ * 
+ *   pCustom - the custom data pointer
+ * 
+ *   pInfo - the description of the error
+ */
+typedef void (*smfparse_fp_error)(void *pCustom, const SMF_ERRINFO *pInfo);
+
+/*
+ * Callback function pointer type for SMFSOURCE read functions.
+ * 
+ * This function shall read a single byte from the input source and
+ * return the unsigned byte value, which must be in range 0 to 255
+ * (inclusive).
+ * 
+ * If there are no bytes left to read, SMFSOURCE_EOF shall be returned.
+ * The callback will not be invoked again unless the input source is
+ * rewound.
+ * 
+ * If there is an error reading from the source, SMFSOURCE_IOERR shall
+ * be returned.  No further callbacks will be made except to the rewind
+ * and close callbacks.  If a rewind completes successfully, the input
+ * source is returned to a non-error state.
  * 
  * The pInstance parameter is passed through from the constructor of the
  * SMFSOURCE object.
@@ -869,355 +1614,2790 @@ typedef int (*smfsource_fp_close)(void *pInstance);
  * 
  *   pInstance - the passed-through instance pointer
  * 
- *   skip - the number of bytes to skip ahead
- * 
  * Return:
  * 
- *   non-zero if successful, zero if failure
+ *   the unsigned byte value read from the input source, in range 0 to
+ *   255, or one of the special conditions SMFSOURCE_EOF or
+ *   SMFSOURCE_IOERR
  */
-typedef int (*smfsource_fp_skip)(void *pInstance, int32_t skip);
+typedef int (*smfsource_fp_read)(void *pInstance);
 
 /*
- * Public functions
- * ================
+ * Callback function pointer type for SMFSOURCE block read functions.
+ * 
+ * This is an alternative to the smfsource_fp_read callback for input
+ * sources that can efficiently deliver more than a single byte at a
+ * time.  The SMFSOURCE object keeps an internal refill buffer that it
+ * fills with this callback, so that the parser can work through the
+ * buffered bytes in memory without making a callback for every byte.
+ * 
+ * This function shall read up to len bytes from the input source into
+ * the buffer at pBuf and return the number of bytes that were actually
+ * read.  len will always be greater than zero.  Fewer bytes than
+ * requested may be returned, but if there is at least one byte left in
+ * the input, at least one byte must be returned.
+ * 
+ * If there are no bytes left to read, zero shall be returned.  The
+ * callback will not be invoked again unless the input source is
+ * rewound.
+ * 
+ * If there is an error reading from the source, SMFSOURCE_IOERR shall
+ * be returned.  No further callbacks will be made except to the rewind
+ * and close callbacks.  If a rewind completes successfully, the input
+ * source is returned to a non-error state.
+ * 
+ * The pInstance parameter is passed through from the constructor of the
+ * SMFSOURCE object.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - the passed-through instance pointer
+ * 
+ *   pBuf - the buffer to receive the bytes that are read
+ * 
+ *   len - the maximum number of bytes to read, greater than zero
+ * 
+ * Return:
+ * 
+ *   the number of bytes read into the buffer, in range 1 to len, or
+ *   zero if at end of input, or SMFSOURCE_IOERR if I/O error
  */
+typedef int32_t (*smfsource_fp_readBlock)(
+    void    * pInstance,
+    uint8_t * pBuf,
+    int32_t   len);
 
 /*
- * Set a fault handler.
+ * Callback function pointer type for SMFSOURCE rewind functions.
  * 
- * If a non-NULL value is passed, any currently registered fault handler
- * is overwritten with the new fault handler.  If a NULL value is
- * passed, any currently registered fault handler is uninstalled.
+ * Not all SMFSOURCE objects have to support this callback.  Only input
+ * sources that support rewinding.
  * 
- * The default fault handler that is used if a fault occurs but no fault
- * handler is installed will write an error message to standard error
- * and then exit the program with EXIT_FAILURE.  If you want a different
- * behavior, install a custom fault handler.
+ * If successful, the input source shall be returned to the beginning of
+ * input so that the input can be read through again.  Any I/O error
+ * conditions must be cleared.
+ * 
+ * If unsuccessful, the input source is in an error state.  The only
+ * callback that may still be made in this state is to the close
+ * callback.
+ * 
+ * The pInstance parameter is passed through from the constructor of the
+ * SMFSOURCE object.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - the passed-through instance pointer
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+typedef int (*smfsource_fp_rewind)(void *pInstance);
+
+/*
+ * Callback function pointer type for SMFSOURCE close functions.
+ * 
+ * Not all SMFSOURCE objects have to support this callback.  Only input
+ * sources that need to clean up while closing down.
+ * 
+ * This function must always close down the input source.  The return
+ * value indicates whether something went wrong during close down, which
+ * a caller might then choose to warn the user about.  However,
+ * returning failure does NOT mean that the input source remains open.
+ * The input source is always closed down by this function no matter
+ * what.
+ * 
+ * The pInstance parameter is passed through from the constructor of the
+ * SMFSOURCE object.  If it points to a dynamically allocated memory
+ * block, you should free it with this callback.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - the passed-through instance pointer
+ * 
+ * Return:
+ * 
+ *   non-zero if normal close-down, zero if closed down but something
+ *   was abnormal during the close-down process
+ */
+typedef int (*smfsource_fp_close)(void *pInstance);
+
+/*
+ * Callback function pointer type for SMFSOURCE skip functions.
+ * 
+ * Not all SMFSOURCE objects have to support this callback.  Only input
+ * sources that have some random-access method for efficiently skipping
+ * the file pointer ahead, or some faster way of discarding input than
+ * reading it through the source object, need to provide it.  For
+ * example, a source over a pipe can discard input by reading it in
+ * large blocks into a scratch buffer.  If not provided, skip operations
+ * will be implemented by calling the read function (or the block read
+ * function) repeatedly and discarding what it returns.  For byte
+ * sources, that means one callback per skipped byte.
+ * 
+ * The skip value will always be greater than zero.  If the skip
+ * distance would go beyond the end of the file, the source object
+ * should position the file pointer so that the next read will return
+ * SMFSOURCE_EOF.
+ * 
+ * If this function returns failure, no further callbacks will be made
+ * except to the rewind and close callbacks.  If rewind completes
+ * successfully, the input source will be returned to a non-error state.
+ * 
+ * The pInstance parameter is passed through from the constructor of the
+ * SMFSOURCE object.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - the passed-through instance pointer
+ * 
+ *   skip - the number of bytes to skip ahead
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+typedef int (*smfsource_fp_skip)(void *pInstance, int32_t skip);
+
+/*
+ * Callback function pointer type for receiving the tracks decoded by
+ * smfparse_parallel().
+ * 
+ * trk is the zero-based number of the track.  status is the result of
+ * decoding the track, as returned by smfparse_read_track(): either
+ * SMF_TYPE_END_TRACK if the whole track was decoded, or a negative
+ * error code.  pTrack holds the decoded events, which in case of an
+ * error are the events before the error.  pTrack is only valid until
+ * the callback returns.
+ * 
+ * The callback is invoked exactly once for each declared track, in no
+ * particular order, and it may be invoked concurrently from different
+ * threads, so it must be thread-safe.
+ * 
+ * The pCustom parameter is passed through from smfparse_parallel().
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the passed-through custom parameter
+ * 
+ *   trk - the zero-based track number
+ * 
+ *   status - the result of decoding the track
+ * 
+ *   pTrack - the decoded track
+ */
+typedef void (*smfparse_fp_track)(
+    void            * pCustom,
+    int32_t           trk,
+    int               status,
+    const SMF_TRACK * pTrack);
+
+/*
+ * Callback function pointer type for receiving the entities of the
+ * files parsed by smfparse_batch().
+ * 
+ * file is the zero-based index of the file within the batch.  pEnt is
+ * the entity, which is only valid until the callback returns.  The
+ * entities of each file are passed in order, starting with the header
+ * and ending with SMF_TYPE_EOF or an error, but the entities of
+ * different files may be interleaved and may be passed concurrently
+ * from different threads, so the callback must be thread-safe.
+ * 
+ * The pCustom parameter is passed through from smfparse_batch().
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the passed-through custom parameter
+ * 
+ *   file - the zero-based file index
+ * 
+ *   pEnt - the entity
+ * 
+ * Return:
+ * 
+ *   non-zero to continue with the file, zero to stop parsing it
+ */
+typedef int (*smfparse_fp_entity)(
+    void             * pCustom,
+    int32_t            file,
+    const SMF_ENTITY * pEnt);
+
+/*
+ * Callback function pointer type for learning that smfparse_batch() is
+ * done with a file.
+ * 
+ * file is the zero-based index of the file within the batch.  result
+ * is zero if the file was parsed successfully or the entity callback
+ * stopped it, or else a negative error code that can be passed to
+ * smf_errorString().  This is called exactly once for each file, after
+ * all its entities, from the thread that parsed it, so it must be
+ * thread-safe.
+ * 
+ * The pCustom parameter is passed through from smfparse_batch().
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the passed-through custom parameter
+ * 
+ *   file - the zero-based file index
+ * 
+ *   result - zero or the error code of the file
+ */
+typedef void (*smfparse_fp_file)(
+    void    * pCustom,
+    int32_t   file,
+    int       result);
+
+/*
+ * Callback function pointer types for the handlers that smfparse_run()
+ * dispatches entities to (see SMF_HANDLERS).
+ * 
+ * Each handler receives only the fields that are relevant for its
+ * entity type.  tick is the absolute tick offset of the event from the
+ * start of its track (see the tick field of SMF_ENTITY) and trk is the
+ * zero-based index of a track among the track chunks.  Pointers are
+ * only valid until the handler returns.
+ * 
+ * smfparse_fp_on_header receives the parsed header.
+ * 
+ * smfparse_fp_on_chunk receives the type of an unrecognized chunk.
+ * 
+ * smfparse_fp_on_track receives the start or the end of a track.  For
+ * the start, tick is always zero.
+ * 
+ * smfparse_fp_on_message receives channel messages with two data
+ * bytes: a is the key or the controller, and b is the velocity,
+ * pressure, or controller value.
+ * 
+ * smfparse_fp_on_channel receives channel messages with one value,
+ * which is the program, the pressure, or the pitch bend.
+ * 
+ * smfparse_fp_on_number receives meta-events with one number, which is
+ * the sequence number, the channel of a Channel Prefix, or the beat
+ * duration of a Set Tempo.
+ * 
+ * smfparse_fp_on_data receives the data payload of System-Exclusive
+ * events, text events, and other meta-events, where pData may only be
+ * NULL if len is zero.  kind is 0xF0 or 0xF7 for System-Exclusive
+ * events, the text type (see SMF_TEXT_) for text events, and the
+ * meta-event type for other meta-events.
+ * 
+ * smfparse_fp_on_smpte, smfparse_fp_on_time_sig, and
+ * smfparse_fp_on_key_sig receive the decoded SMPTE Offset, Time
+ * Signature, and Key Signature meta-events.
+ * 
+ * The pCustom parameter is passed through from smfparse_run().  Every
+ * handler returns non-zero to continue the run, or zero to stop it
+ * after this entity.
+ */
+typedef int (*smfparse_fp_on_header)(
+    void             * pCustom,
+    const SMF_HEADER * pHead);
+
+typedef int (*smfparse_fp_on_chunk)(
+    void     * pCustom,
+    uint32_t   chunk_type);
+
+typedef int (*smfparse_fp_on_track)(
+    void    * pCustom,
+    int32_t   trk,
+    int64_t   tick);
+
+typedef int (*smfparse_fp_on_message)(
+    void    * pCustom,
+    int64_t   tick,
+    int       ch,
+    int       a,
+    int       b);
+
+typedef int (*smfparse_fp_on_channel)(
+    void    * pCustom,
+    int64_t   tick,
+    int       ch,
+    int       val);
+
+typedef int (*smfparse_fp_on_number)(
+    void    * pCustom,
+    int64_t   tick,
+    int32_t   val);
+
+typedef int (*smfparse_fp_on_data)(
+    void          * pCustom,
+    int64_t         tick,
+    int             kind,
+    const uint8_t * pData,
+    int32_t         len);
+
+typedef int (*smfparse_fp_on_smpte)(
+    void               * pCustom,
+    int64_t              tick,
+    const SMF_TIMECODE * pTC);
+
+typedef int (*smfparse_fp_on_time_sig)(
+    void              * pCustom,
+    int64_t             tick,
+    const SMF_TIMESIG * pTS);
+
+typedef int (*smfparse_fp_on_key_sig)(
+    void              * pCustom,
+    int64_t             tick,
+    const SMF_KEYSIG  * pKS);
+
+/*
+ * SMF_HANDLERS structure that holds the handler of each entity type for
+ * smfparse_run().
+ * 
+ * Always clear the whole structure to zero and then set the handlers
+ * you are interested in, so that handlers added in later versions of
+ * the library are NULL.  Events whose handler is NULL are filtered out
+ * before they are decoded, in the same way as with
+ * smfparse_set_filter().
+ */
+typedef struct {
+  
+  /*
+   * Handlers for the structure of the file.
+   */
+  smfparse_fp_on_header fHeader;
+  smfparse_fp_on_chunk  fChunk;
+  smfparse_fp_on_track  fBeginTrack;
+  smfparse_fp_on_track  fEndTrack;
+  
+  /*
+   * Handlers for channel messages.
+   */
+  smfparse_fp_on_message fNoteOff;
+  smfparse_fp_on_message fNoteOn;
+  smfparse_fp_on_message fKeyAftertouch;
+  smfparse_fp_on_message fControl;
+  smfparse_fp_on_channel fProgram;
+  smfparse_fp_on_channel fChAftertouch;
+  smfparse_fp_on_channel fPitchBend;
+  
+  /*
+   * Handlers for System-Exclusive events and meta-events.
+   */
+  smfparse_fp_on_data     fSysex;
+  smfparse_fp_on_data     fSysesc;
+  smfparse_fp_on_number   fSeqNum;
+  smfparse_fp_on_data     fText;
+  smfparse_fp_on_number   fChPrefix;
+  smfparse_fp_on_number   fTempo;
+  smfparse_fp_on_smpte    fSmpte;
+  smfparse_fp_on_time_sig fTimeSig;
+  smfparse_fp_on_key_sig  fKeySig;
+  smfparse_fp_on_data     fMeta;
+  
+} SMF_HANDLERS;
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Set a fault handler.
+ * 
+ * If a non-NULL value is passed, any currently registered fault handler
+ * is overwritten with the new fault handler.  If a NULL value is
+ * passed, any currently registered fault handler is uninstalled.
+ * 
+ * The default fault handler that is used if a fault occurs but no fault
+ * handler is installed will write an error message to standard error
+ * and then exit the program with EXIT_FAILURE.  If you want a different
+ * behavior, install a custom fault handler.
+ * 
+ * Fault handlers must never return to the caller.  Undefined behavior
+ * occurs if they do.
+ * 
+ * The fault handler is shared by the whole process, so this function
+ * should be called before any other threads use the library.  Threads
+ * can override it with smf_set_thread_fault() on POSIX platforms.
+ * 
+ * See the function pointer type documentation for further information.
+ * 
+ * Parameters:
+ * 
+ *   fFault - the fault handler to install, or NULL
+ */
+void smf_set_fault(smf_fp_fault fFault);
+
+#ifdef SMF_POSIX
+/*
+ * Set a fault handler for the calling thread only.
+ * 
+ * This is only available on POSIX platforms (see SMF_POSIX).
+ * 
+ * When a fault occurs on a thread that has its own fault handler, that
+ * handler is called instead of the one installed with smf_set_fault().
+ * This allows a worker thread to recover from a fault on its own by
+ * jumping back to a recovery point with longjmp(), so that a bug in the
+ * handling of one file does not end the whole program.  pCustom is
+ * passed through to the handler, which could for example point to the
+ * jmp_buf of the thread.  Passing NULL for fFault removes the handler
+ * of the calling thread.
+ * 
+ * Thread fault handlers must still never return to the caller.  If one
+ * does, the process-wide fault handler is called as well, and then the
+ * program ends.  After jumping out of a fault, the library objects that
+ * the faulting call was using may be in an inconsistent state, so they
+ * should be abandoned without using or releasing them.  Other objects
+ * are not affected.
+ * 
+ * Faults on threads that the library starts internally, such as the
+ * reader threads of smfsource_new_prefetch(), always go to the
+ * process-wide fault handler.
+ * 
+ * Parameters:
+ * 
+ *   fFault - the fault handler for the calling thread, or NULL
+ * 
+ *   pCustom - passed through to the fault handler
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the handler could not be installed
+ *   because of a lack of resources
+ */
+int smf_set_thread_fault(smf_fp_thread_fault fFault, void *pCustom);
+#endif
+
+/*
+ * Create a custom SMFSOURCE object.
+ * 
+ * For most common cases, you can use one of the pre-made input source
+ * types, which use smfsource_new_ constructor functions.  If none of
+ * the pre-made input sources will work for you, then you can use this
+ * custom constructor to define your own input source.
+ * 
+ * pInstance can have any value, including NULL.  It will always be
+ * passed through as-is when invoking the callback functions.  If this
+ * points to a dynamically allocated memory block, it's a good idea to
+ * define an fClose destructor that will release the memory block and
+ * any resources owned by it.
+ * 
+ * fRead is the only callback that is required to be defined with a
+ * non-NULL value.  It allows bytes to be read from the input source in
+ * sequential order.  Input sources that can deliver whole blocks of
+ * bytes at a time should use smfsource_custom_block() instead, which
+ * avoids making a callback for every byte.
+ * 
+ * fRewind should only be defined for input sources that support
+ * rewinding back to the beginning.  For input sources that do not
+ * support this, pass NULL.
+ * 
+ * fClose is a destructor routine that is invoked when the input source
+ * is released.  You can pass NULL if you do not need a destructor
+ * routine.
+ * 
+ * fSkip is a callback for skipping ahead by a given number of bytes.
+ * It should be defined for input sources that support random access or
+ * that can discard input in bulk (see smfsource_fp_skip).  For input
+ * sources that do not support this, pass NULL.  If no skip callback is
+ * provided, skips will be simulated by repeatedly invoking the fRead
+ * callback, once for each skipped byte.
+ * 
+ * The returned object should eventually be freed with
+ * smfsource_close().
+ * 
+ * The object starts out without any error state.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - value passed through to all callbacks
+ * 
+ *   fRead - the required read function callback
+ * 
+ *   fRewind - the rewind function callback or NULL
+ * 
+ *   fClose - the close function callback or NULL
+ * 
+ *   fSkip - the skip function callback or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object
+ */
+SMFSOURCE *smfsource_custom(
+    void                * pInstance,
+    smfsource_fp_read     fRead,
+    smfsource_fp_rewind   fRewind,
+    smfsource_fp_close    fClose,
+    smfsource_fp_skip     fSkip);
+
+/*
+ * Create a custom SMFSOURCE object that reads blocks of bytes.
+ * 
+ * This is the same as smfsource_custom(), except that the required read
+ * callback is a block read callback instead of a byte read callback.
+ * The source object allocates an internal refill buffer which it fills
+ * with fReadBlock, and individual bytes are then served from this
+ * buffer.
+ * 
+ * If no skip callback is provided, skips will be simulated by reading
+ * blocks into the refill buffer and discarding them.
+ * 
+ * The returned object should eventually be freed with
+ * smfsource_close().
+ * 
+ * The object starts out without any error state.
+ * 
+ * Parameters:
+ * 
+ *   pInstance - value passed through to all callbacks
+ * 
+ *   fReadBlock - the required block read function callback
+ * 
+ *   fRewind - the rewind function callback or NULL
+ * 
+ *   fClose - the close function callback or NULL
+ * 
+ *   fSkip - the skip function callback or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object
+ */
+SMFSOURCE *smfsource_custom_block(
+    void                   * pInstance,
+    smfsource_fp_readBlock   fReadBlock,
+    smfsource_fp_rewind      fRewind,
+    smfsource_fp_close       fClose,
+    smfsource_fp_skip        fSkip);
+
+/*
+ * Construct an SMFSOURCE object around an open file handle.
+ * 
+ * pIn is the file handle, which should be open for reading.  You should
+ * not use the file handle while an SMFSOURCE object is open around it.
+ * 
+ * is_owner is non-zero if the SMFSOURCE object should act like the
+ * owner of the file handle.  Specifically, this means that the file
+ * handle will be closed when the SMFSOURCE object is closed.  You
+ * should NOT specify is_owner if you are wrapping stdin!
+ * 
+ * can_seek is non-zero if the given file handle supports random access.
+ * If this is non-zero, then rewinding will be available.  You should
+ * NOT specify can_seek if you are wrapping stdin!
+ * 
+ * If can_seek is specified, then this function will determine the total
+ * file length and then rewind the file.  This constructor can fail if
+ * determining the length or rewinding fails.
+ * 
+ * Skips seek ahead if can_seek is specified.  Otherwise, the skipped
+ * bytes are read in large blocks and discarded, so that skipping over
+ * unrecognized chunks and filtered payloads stays fast on pipes.
+ * 
+ * This input source implementation uses 64-bit file offsets, so it does
+ * not limit the length of the file by itself.  The amount of MIDI data
+ * that is parsed is limited by the parser instead (see SMF_OPTIONS).
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the constructor fails.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file handle to wrap
+ * 
+ *   is_owner - non-zero if handle should be closed when source object
+ *   is released
+ * 
+ *   can_seek - non-zero if handle supports random access
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object, or NULL if constructor failed
+ */
+SMFSOURCE *smfsource_new_handle(
+    FILE * pIn,
+    int    is_owner,
+    int    can_seek,
+    int  * pErr);
+
+/*
+ * Construct an SMFSOURCE object that wraps a file handle, using a custom
+ * memory allocator.
+ * 
+ * This is the same as smfsource_new_handle(), except that the source
+ * object, its instance data, and its refill buffer are allocated with
+ * pAlloc, which is copied into the source object.  The allocator must
+ * remain usable until the source object is closed.  If pAlloc is NULL
+ * or all its callbacks are NULL, the C heap is used.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file handle to wrap
+ * 
+ *   is_owner - non-zero if handle should be closed when source object
+ *   is released
+ * 
+ *   can_seek - non-zero if handle supports random access
+ * 
+ *   pAlloc - the allocator, or NULL
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object, or NULL if constructor failed
+ */
+SMFSOURCE *smfsource_new_handle_ex(
+    FILE                * pIn,
+    int                   is_owner,
+    int                   can_seek,
+    const SMF_ALLOCATOR * pAlloc,
+    int                 * pErr);
+
+/*
+ * Construct an SMFSOURCE object by opening a file at a given path.
+ * 
+ * This is a wrapper around smfsource_new_handle().  Files opened with
+ * this wrapper will always specify both is_owner and can_seek.  This
+ * means that rewinds are always supported when using this constructor.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the constructor fails.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the file path to open
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object, or NULL if constructor failed
+ */
+SMFSOURCE *smfsource_new_path(const char *pPath, int *pErr);
+
+/*
+ * Construct an SMFSOURCE object by opening a file at a given path,
+ * using a custom memory allocator.
+ * 
+ * This is a wrapper around smfsource_new_handle_ex() in the same way
+ * that smfsource_new_path() wraps smfsource_new_handle().
+ * 
+ * Parameters:
+ * 
+ *   pPath - the file path to open
+ * 
+ *   pAlloc - the allocator, or NULL
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object, or NULL if constructor failed
+ */
+SMFSOURCE *smfsource_new_path_ex(
+    const char          * pPath,
+    const SMF_ALLOCATOR * pAlloc,
+    int                 * pErr);
+
+/*
+ * Construct an SMFSOURCE object that reads from a buffer in memory.
+ * 
+ * pData points to the len bytes of input.  The memory is not copied,
+ * so it must remain valid and unchanged until the source object is
+ * closed, and the caller remains responsible for releasing it after the
+ * source object is closed.  pData may only be NULL if len is zero.
+ * 
+ * Memory sources always support rewinding, and skipping ahead is done
+ * in constant time.  When parsing from a memory source, the data
+ * payloads of entities point directly into the given memory rather
+ * than being copied into the parser object.
+ * 
+ * Parameters:
+ * 
+ *   pData - the input bytes
+ * 
+ *   len - the number of input bytes, zero or greater
+ * 
+ * Return:
+ * 
+ *   the new input source object
+ */
+SMFSOURCE *smfsource_new_memory(const void *pData, int64_t len);
+
+/*
+ * Construct an SMFSOURCE object that reads from a buffer in memory,
+ * using a custom memory allocator.
+ * 
+ * This is the same as smfsource_new_memory(), except that the source
+ * object is allocated with pAlloc, which is copied into the source
+ * object.  If pAlloc is NULL or all its callbacks are NULL, the C heap
+ * is used.  The input bytes are never copied, so they are not affected
+ * by the allocator.
+ * 
+ * Parameters:
+ * 
+ *   pData - the input bytes
+ * 
+ *   len - the number of input bytes, zero or greater
+ * 
+ *   pAlloc - the allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object
+ */
+SMFSOURCE *smfsource_new_memory_ex(
+    const void          * pData,
+    int64_t               len,
+    const SMF_ALLOCATOR * pAlloc);
+
+#ifdef SMF_POSIX
+/*
+ * Construct an SMFSOURCE object by memory-mapping a file at a given
+ * path.
+ * 
+ * This is only available on POSIX platforms (see SMF_POSIX).
+ * 
+ * The whole file is mapped read-only into memory and the resulting
+ * source behaves like a source from smfsource_new_memory() over the
+ * mapped bytes, so that rewinds are always supported, skips are done in
+ * constant time, and data payloads point directly into the mapped file.
+ * The mapping is released when the source object is closed.
+ * 
+ * The file should not be modified while it is mapped.
+ * 
+ * This constructor fails with SMF_ERR_HUGE_FILE if the file is too large
+ * to be mapped into the address space.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the constructor fails.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the file path to map
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object, or NULL if constructor failed
+ */
+SMFSOURCE *smfsource_new_mmap(const char *pPath, int *pErr);
+#endif
+
+#ifdef SMF_POSIX
+/*
+ * Construct an SMFSOURCE object that reads a file at a given path on a
+ * background thread.
+ * 
+ * This is only available on POSIX platforms (see SMF_POSIX).
+ * 
+ * The source works like one from smfsource_new_path(), except that a
+ * reader thread keeps up to depth blocks of SMF_PREFETCH_BLOCK bytes
+ * read ahead of the reading position, so that the parser rarely has to
+ * wait for storage.  This hides the latency of slow storage such as
+ * network filesystems.  depth must be in range 1 to SMF_MAX_PREFETCH,
+ * inclusive.
+ * 
+ * Skips within the blocks that have already been read ahead just drop
+ * those bytes.  Longer skips and rewinds drop all the blocks that were
+ * read ahead, and the reader thread starts again at the new position,
+ * so the skipped bytes are never read.  The reader thread is stopped
+ * when the source object is closed.
+ * 
+ * The file should not be modified while the source is open.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the constructor fails.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the file path to open
+ * 
+ *   depth - the maximum number of blocks to read ahead
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   the new input source object, or NULL if constructor failed
+ */
+SMFSOURCE *smfsource_new_prefetch(
+    const char * pPath,
+    int32_t      depth,
+    int        * pErr);
+#endif
+
+/*
+ * Release an SMFSOURCE object.
+ * 
+ * If NULL is passed, this function will succeed without doing anything.
+ * 
+ * Otherwise, the close callback of the source object will be invoked if
+ * defined, and then the source object will be released.
+ * 
+ * This function always releases the source object.  The return value
+ * merely indicates whether something went wrong during the close-down
+ * process, which you may want to warn the user about.  The source
+ * object will be released even if this function returns failure.
+ * 
+ * This function can be used on any source object regardless of its
+ * state.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object to close, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if regular close-down, zero if object is closed but
+ *   something went awry during the close-down process
+ */
+int smfsource_close(SMFSOURCE *pSrc);
+
+/*
+ * Rebind an SMFSOURCE object that wraps a file handle to a different
+ * file handle.
+ * 
+ * pSrc must have been constructed with smfsource_new_handle(),
+ * smfsource_new_path(), or one of their _ex variants, or a fault
+ * occurs.  The parameters have the same meaning as for
+ * smfsource_new_handle().  If the rebind succeeds, the source object
+ * reads from the start of the new handle in normal state, exactly as if
+ * it had been newly constructed, but without allocating anything.
+ * 
+ * If can_seek is specified and determining the length or rewinding the
+ * new handle fails, the function fails and the source object keeps the
+ * previous handle.  Otherwise, if the source object owns its previous
+ * handle, that handle is closed first, unless it is the same as pIn.
+ * If closing it fails, the function fails, but the source object is
+ * still bound to the new handle.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the handle source object to rebind
+ * 
+ *   pIn - the file handle to wrap
+ * 
+ *   is_owner - non-zero if handle should be closed when source object
+ *   is released or rebound
+ * 
+ *   can_seek - non-zero if handle supports random access
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+int smfsource_rebind_handle(
+    SMFSOURCE * pSrc,
+    FILE      * pIn,
+    int         is_owner,
+    int         can_seek,
+    int       * pErr);
+
+/*
+ * Rebind an SMFSOURCE object that wraps a file handle to a file at a
+ * given path.
+ * 
+ * This is a wrapper around smfsource_rebind_handle() that opens the
+ * file in the same way as smfsource_new_path().  If the file can't be
+ * opened or its length can't be determined, the function fails and the
+ * source object keeps its previous handle.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the handle source object to rebind
+ * 
+ *   pPath - the file path to open
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+int smfsource_rebind_path(SMFSOURCE *pSrc, const char *pPath, int *pErr);
+
+/*
+ * Rebind an SMFSOURCE object that reads from memory to a different
+ * buffer.
+ * 
+ * pSrc must have been constructed with smfsource_new_memory() or
+ * smfsource_new_memory_ex(), or a fault occurs.  After the call, the
+ * source object reads from the start of the len bytes at pData in
+ * normal state, with the same requirements on the memory as for
+ * smfsource_new_memory().  The previous buffer is no longer referenced.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the memory source object to rebind
+ * 
+ *   pData - the input bytes
+ * 
+ *   len - the number of input bytes, zero or greater
+ */
+void smfsource_rebind_memory(
+    SMFSOURCE  * pSrc,
+    const void * pData,
+    int64_t      len);
+
+/*
+ * Check whether a given SMFSOURCE object is capable of rewinding back
+ * to the beginning of input.
+ * 
+ * This function can be called on any SMFSOURCE object regardless of its
+ * state.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object to query
+ * 
+ * Return:
+ * 
+ *   non-zero if source can be rewound, zero if not
+ */
+int smfsource_canRewind(SMFSOURCE *pSrc);
+
+/*
+ * Rewind a given SMFSOURCE object back to the beginning of input and
+ * clear any error state or EOF state.
+ * 
+ * If called on an object that does not support rewinding, the function
+ * fails but does not change the error state of the object.
+ * 
+ * If called on an object that supports rewinding and is not in a
+ * double-error state, this function will attempt a rewind.  If
+ * successful, the error state is cleared in addition to rewinding back
+ * to beginning of input.  If failure, the object is changed to
+ * double-error state.
+ * 
+ * If called on an object that is in double-error state, then this
+ * function fails without making an actual attempt to rewind.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object to rewind
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if rewind failed
+ */
+int smfsource_rewind(SMFSOURCE *pSrc);
+
+/*
+ * Skip a source ahead by a given number of bytes.
+ * 
+ * The skip distance must be greater than or equal to zero.  If zero is
+ * passed, the function succeeds without doing anything, unless the
+ * object is already in an error state, in which case the function still
+ * fails.
+ * 
+ * This skip function can even be used with input sources that do not
+ * define a skip callback.  In that case, the skip will be simulated
+ * with repeated calls to the read callback or the block read callback.
+ * 
+ * If the skip would go beyond the end of the input, the skip is
+ * shortened so that the next read will read EOF.  The function will
+ * still succeed in this case.
+ * 
+ * If called on an object in error state, this function fails without
+ * actually attempting a skip.
+ * 
+ * If a skip is attempted but fails, the object is switched into an
+ * error state.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object
+ * 
+ *   skip - the non-negative skip distance
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if skip failed
+ */
+int smfsource_skip(SMFSOURCE *pSrc, int32_t skip);
+
+/*
+ * Read the next byte from a given input source object.
+ * 
+ * The return value is either an unsigned byte value in range 0 to 255
+ * (inclusive), or one of the special codes SMFSOURCE_EOF or
+ * SMFSOURCE_IOERR, indicating End Of File or I/O error, respectively.
+ * 
+ * If called on an object that is in error state, this function fails
+ * with an I/O error without actually attempting a read.
+ * 
+ * If a read is attempted but fails, the object is changed into an error
+ * state.
+ * 
+ * If the SMFSOURCE_EOF condition is returned, the object state switches
+ * to EOF state, which causes subsequent reads to also return EOF
+ * without actually attempting a read.  EOF state can be cleared with a
+ * successful rewind.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object
+ * 
+ * Return:
+ * 
+ *   an unsigned byte value that was read from input, or SMFSOURCE_EOF
+ *   if at end of file, or SMFSOURCE_IOERR if I/O error
+ */
+int smfsource_read(SMFSOURCE *pSrc);
+
+/*
+ * Read a block of bytes from a given input source object.
+ * 
+ * Up to len bytes are read into the buffer at pBuf.  len must be zero
+ * or greater, and pBuf may only be NULL if len is zero.  The function
+ * only returns fewer than len bytes if End Of File is reached, in which
+ * case the object state switches to EOF state just as it would for
+ * smfsource_read().
+ * 
+ * This is equivalent to calling smfsource_read() repeatedly, but it is
+ * much faster for sources that have a block read callback or that are
+ * memory-resident, because the bytes are copied in bulk.
+ * 
+ * If called on an object that is in error state, this function fails
+ * with an I/O error without actually attempting a read.  If a read is
+ * attempted but fails, the object is changed into an error state and
+ * the contents of the buffer are undefined.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source object
+ * 
+ *   pBuf - the buffer to receive the bytes
+ * 
+ *   len - the number of bytes to read
+ * 
+ * Return:
+ * 
+ *   the number of bytes read, in range zero to len, or SMFSOURCE_IOERR
+ *   if I/O error
+ */
+int32_t smfsource_readBlock(SMFSOURCE *pSrc, uint8_t *pBuf, int32_t len);
+
+/*
+ * Fill an options structure with the default parser options.
+ * 
+ * See SMF_OPTIONS for the defaults.
+ * 
+ * Parameters:
+ * 
+ *   pOpt - the options structure to initialize
+ */
+void smfparse_defaults(SMF_OPTIONS *pOpt);
+
+/*
+ * Allocate a new SMFPARSE object instance.
+ * 
+ * This is equivalent to smfparse_alloc_ex() with the default options.
+ * 
+ * The parser instance should eventually be released with
+ * smfparse_free().
+ * 
+ * Return:
+ * 
+ *   a new SMFPARSE object
+ */
+SMFPARSE *smfparse_alloc(void);
+
+/*
+ * Allocate a new SMFPARSE object instance with the given options.
+ * 
+ * pOpt is the options structure, which should have been initialized
+ * with smfparse_defaults() before changing any fields.  The options are
+ * copied into the parser object, so the structure does not need to
+ * remain valid after the call.  If NULL is passed, the default options
+ * are used.
+ * 
+ * A fault occurs if any of the options are out of range.
+ * 
+ * If the options specify a custom allocator, the parser object, its
+ * data buffer, its chunk index, and its feed queue are allocated with
+ * it, and the allocator must remain usable until the parser is freed.
+ * Objects that are returned to the caller, such as SMF_TRACK and
+ * SMF_PROBE structures, are always allocated on the C heap.
+ * 
+ * The parser instance should eventually be released with
+ * smfparse_free().  To parse many files in a row, consider reusing one
+ * parser with smfparse_reset() instead.
+ * 
+ * Parameters:
+ * 
+ *   pOpt - the parser options, or NULL
+ * 
+ * Return:
+ * 
+ *   a new SMFPARSE object
+ */
+SMFPARSE *smfparse_alloc_ex(const SMF_OPTIONS *pOpt);
+
+/*
+ * Free an SMFPARSE instance.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   ps - the SMFPARSE instance to release, or NULL
+ */
+void smfparse_free(SMFPARSE *ps);
+
+/*
+ * Reset an SMFPARSE instance so that it can parse another MIDI file.
+ * 
+ * The parser returns to the state it had right after allocation, so
+ * that the next read starts at the header of a new file, and any chunk
+ * index or fed input of the previous file is discarded.  The options,
+ * the event filter, and the attached tempo map are kept.
+ * 
+ * Unlike freeing the parser and allocating a new one, the memory that
+ * the parser has already allocated is kept for reuse, so a parser that
+ * is reset between many small files does not allocate again once its
+ * buffers have grown large enough.  Payloads of previously read
+ * entities are invalid after the reset.
+ * 
+ * The input source objects can likewise be reused for the next file
+ * with smfsource_rebind_handle(), smfsource_rebind_path(), or
+ * smfsource_rebind_memory().
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ */
+void smfparse_reset(SMFPARSE *ps);
+
+/*
+ * Read the next entity from a MIDI file.
+ * 
+ * ps is the parser object to use.  If the parser is in an error state,
+ * subsequent calls to read will just return the same error without
+ * reading any further.  If the parser had previously returned the
+ * entity SMF_TYPE_EOF, all subsequent calls will also return the entity
+ * SMF_TYPE_EOF without reading anything further.
+ * 
+ * pEnt is the entity structure to receive the results of the parse.
+ * Look at the status field to determine what entity was read or whether
+ * there was an error or End Of File.
+ * 
+ * pSrc is the input source to read data from.  Bytes are read in
+ * sequential order from this data source.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pEnt - the entity structure to fill with parsing results
+ * 
+ *   pSrc - the input source to read from
+ */
+void smfparse_read(SMFPARSE *ps, SMF_ENTITY *pEnt, SMFSOURCE *pSrc);
+
+/*
+ * Read a MIDI file through to the end, dispatching each entity to a
+ * handler.
+ * 
+ * This is an alternative to calling smfparse_read() in a loop and
+ * switching on the entity type.  Entities are read from pSrc until
+ * SMF_TYPE_EOF, an error, or a handler stops the run.  Each entity is
+ * passed to the handler for its type in pHandlers (see SMF_HANDLERS),
+ * with only the fields that are relevant for that type.
+ * 
+ * While the run lasts, the event filter of the parser is narrowed to
+ * the event types that have a handler, so events without one are
+ * skipped without being decoded.  Afterwards, the event filter set with
+ * smfparse_set_filter() is restored.  Events removed by that filter
+ * are not dispatched even if they have a handler.
+ * 
+ * The run can be continued with another call, or with smfparse_read().
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   pHandlers - the handlers
+ * 
+ *   pCustom - value passed through to the handlers
+ * 
+ * Return:
+ * 
+ *   SMF_TYPE_EOF if the whole file was read, the entity type at which a
+ *   handler stopped the run, or a negative error code
+ */
+int smfparse_run(
+    SMFPARSE           * ps,
+    SMFSOURCE          * pSrc,
+    const SMF_HANDLERS * pHandlers,
+    void               * pCustom);
+
+/*
+ * Push input into a parser object and read the entities that are now
+ * complete.
+ * 
+ * This is an alternative to reading from an input source, for input
+ * that arrives piece by piece, such as from a non-blocking socket.  The
+ * parser keeps a queue of input bytes that it has been given but has
+ * not parsed yet.  The len bytes at pData are copied to the end of the
+ * queue, and then as many entities as possible are parsed from the
+ * queue, up to max entities, and stored in pEnts in order.  pData may be
+ * NULL if len is zero.  Passing SMF_FEED_END as len signals that there
+ * is no more input, after which only zero or SMF_FEED_END may be passed.
+ * 
+ * If the queue runs out before the next entity is complete and the end
+ * of the input has not been signaled, an entity with the status
+ * SMF_TYPE_NEED_MORE is stored last.  The partially received entity
+ * stays in the queue and is parsed as soon as enough input has arrived.
+ * Once an SMF_TYPE_EOF entity or an error is stored, it is the last
+ * entity stored, and further calls will keep returning it just like
+ * smfparse_read() would.  Otherwise, if max entities were stored, call
+ * again with a length of zero to continue.
+ * 
+ * The entities are the same as those that smfparse_read() would read
+ * from the complete input, except that a file whose input ends early
+ * only fails with SMF_ERR_EOF after SMF_FEED_END is passed.  Pointers in
+ * the stored entities remain valid until the next call to this function
+ * or until the parser is released, whichever comes first.
+ * 
+ * An entity is parsed from its start each time it is attempted, but the
+ * parser waits until at least the rest of a partially received payload
+ * has arrived before trying again, so large payloads are not parsed
+ * over and over.  Data that the parser skips over, such as unrecognized
+ * chunks, is held in the queue until all of it has arrived.  The queue
+ * can hold at most INT32_MAX bytes.  If the new input would not fit,
+ * it is discarded and the parser goes into an error state with
+ * SMF_ERR_HUGE_FILE, which is stored as the entity status.
+ * 
+ * A parser that is fed should not be used with any input source.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pData - the input bytes, or NULL
+ * 
+ *   len - the number of input bytes, or SMF_FEED_END
+ * 
+ *   pEnts - the array of entity structures to fill
+ * 
+ *   max - the number of structures in the array, at least one
+ * 
+ * Return:
+ * 
+ *   the number of entities stored, at least one
+ */
+int32_t smfparse_feed(
+    SMFPARSE   * ps,
+    const void * pData,
+    int32_t      len,
+    SMF_ENTITY * pEnts,
+    int32_t      max);
+
+/*
+ * Set the event filter of a parser object.
+ * 
+ * mask is a combination of SMF_FILTER() bits for the entity types that
+ * should be returned, or SMF_FILTER_ALL to return everything.  Events
+ * within tracks whose type is not in the mask are skipped by the parser
+ * without being returned.  The delta times of the skipped events are
+ * added to the delta time of the next event that is returned, so that
+ * the timing of the returned events stays correct.  This can make the
+ * delta time larger than a single delta time in a MIDI file can be.
+ * If the sum does not fit in the delta field, parsing fails with
+ * SMF_ERR_TIME_RANGE.
+ * 
+ * SMF_TYPE_EOF, SMF_TYPE_HEADER, SMF_TYPE_CHUNK, SMF_TYPE_BEGIN_TRACK,
+ * and SMF_TYPE_END_TRACK entities are always returned, regardless of
+ * the mask.  If a tempo map is attached (see smfparse_set_tempo()),
+ * Set Tempo meta-events in the first track are still added to it when
+ * they are filtered out.
+ * 
+ * Skipping is cheaper than parsing.  The payloads of skipped System
+ * Exclusive and meta-events are skipped with smfsource_skip() rather
+ * than being read into the data buffer, and their contents are not
+ * validated, so the max_payload option does not apply to them.  Skipped
+ * MIDI messages are still checked for invalid data bytes, because those
+ * indicate that the track is corrupt.
+ * 
+ * The filter may be changed at any time, and stays in effect across
+ * smfparse_seek_track() and all of the reading functions.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   mask - the filter mask
+ */
+void smfparse_set_filter(SMFPARSE *ps, uint32_t mask);
+
+/*
+ * Get the instrumentation counters of a parser object.
+ * 
+ * The current counters are copied into pStats (see SMF_STATS).  If the
+ * library was not built with SMF_ENABLE_STATS, pStats is filled with
+ * zeros and zero is returned.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pStats - the structure to receive the counters
+ * 
+ * Return:
+ * 
+ *   non-zero if counters are maintained, zero if they were compiled out
+ */
+int smfparse_stats(const SMFPARSE *ps, SMF_STATS *pStats);
+
+/*
+ * Return the number of defects that a parser object has recovered from
+ * since it was constructed or last reset.
+ * 
+ * This is only ever non-zero for the SMF_VALIDATE_LENIENT level (see
+ * SMF_OPTIONS), which counts each run of discarded data bytes and each
+ * track chunk that was closed without an End Of Track meta-event.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ * Return:
+ * 
+ *   the number of repairs
+ */
+int64_t smfparse_repairs(const SMFPARSE *ps);
+
+/*
+ * Clear the instrumentation counters of a parser object back to zero.
+ * 
+ * smfparse_reset() does not clear the counters, so that they can add up
+ * over many files.  This function does nothing if the library was not
+ * built with SMF_ENABLE_STATS.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ */
+void smfparse_clear_stats(SMFPARSE *ps);
+
+/*
+ * Register a clock with a parser object, so that the time spent
+ * decoding entities is counted in the time field of SMF_STATS.
+ * 
+ * The clock is called twice for every entity that is decoded, so a
+ * cheap clock should be used.  Pass NULL for fClock to stop timing,
+ * which is the default.  This function does nothing if the library was
+ * not built with SMF_ENABLE_STATS.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   fClock - the clock callback, or NULL
+ * 
+ *   pCustom - passed through to the clock callback
+ */
+void smfparse_set_clock(SMFPARSE *ps, smf_fp_clock fClock, void *pCustom);
+
+/*
+ * Register an error callback with a parser object.
+ * 
+ * The callback is called each time the parser object goes into an error
+ * state while reading, feeding, indexing, seeking, or decoding into a
+ * track structure (see smfparse_fp_error).  Entities that smfparse_feed()
+ * is still waiting for more input to complete do not count as errors.
+ * Repeated reads in an error state that just return the error again do
+ * not call the callback again.  Pass NULL for fError to remove the
+ * callback, which is the default.
+ * 
+ * The callback and the error state belong to the parser object, so
+ * parsers used on different threads can have different callbacks.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   fError - the error callback, or NULL
+ * 
+ *   pCustom - passed through to the error callback
+ */
+void smfparse_set_error(
+    SMFPARSE          * ps,
+    smfparse_fp_error   fError,
+    void              * pCustom);
+
+/*
+ * Describe the error state of a parser object.
+ * 
+ * If the parser object is in an error state, pInfo is filled in with a
+ * description of the error (see SMF_ERRINFO) and non-zero is returned.
+ * Otherwise, pInfo describes the current position of the parser in the
+ * same way, with a code of zero and a status byte of -1, and zero is
+ * returned.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pInfo - the structure to receive the description
+ * 
+ * Return:
+ * 
+ *   non-zero if the parser object is in an error state, zero if not
+ */
+int smfparse_error(const SMFPARSE *ps, SMF_ERRINFO *pInfo);
+
+/*
+ * Read a batch of entities from a MIDI file.
+ * 
+ * This has the same effect as calling smfparse_read() repeatedly to
+ * fill the array pEnts, which has room for max entities, but it avoids
+ * the overhead of separate calls.  max must be at least one.  The
+ * return value is the number of entities that were written to the
+ * array, which is always in range one to max.
+ * 
+ * A batch ends early after any entity that is not a MIDI message or
+ * meta-event within a track (SMF_TYPE_HEADER, SMF_TYPE_CHUNK,
+ * SMF_TYPE_BEGIN_TRACK, SMF_TYPE_END_TRACK, and SMF_TYPE_EOF), after
+ * an error, and after any entity that refers to a structure owned by
+ * the parser object (SMF_TYPE_SMPTE, SMF_TYPE_TIME_SIG, and
+ * SMF_TYPE_KEY_SIG).  Check the status of the last entity in the batch
+ * to see whether it ended early for one of these reasons.  A batch may
+ * also end early if the data payloads in the batch add up to the
+ * max_payload option of the parser (see SMF_OPTIONS).
+ * 
+ * All the data payloads and structures referred to by the entities in
+ * the batch remain valid until the next call to read an entity, or
+ * until the parser object is freed (whichever occurs first).
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pEnts - the array of entity structures to fill
+ * 
+ *   max - the number of entity structures in the array
+ * 
+ *   pSrc - the input source to read from
+ * 
+ * Return:
+ * 
+ *   the number of entities read into the array
+ */
+int32_t smfparse_read_batch(
+    SMFPARSE   * ps,
+    SMF_ENTITY * pEnts,
+    int32_t      max,
+    SMFSOURCE  * pSrc);
+
+/*
+ * Build an index of the chunks in a MIDI file.
+ * 
+ * The input source must support rewinding (see smfsource_canRewind()).
+ * It is rewound, the header chunk is read, and then the header of each
+ * following chunk is read and its data skipped, until all the declared
+ * tracks have been seen.  Chunks after the last declared track are not
+ * indexed.  The type, offset, and length of every chunk is recorded in
+ * the parser object, including the header chunk, which is always the
+ * first chunk in the index.  Only the chunk headers are checked, so
+ * errors within the chunk data are only found once the chunks are
+ * actually parsed.
+ * 
+ * If the checkpoint option of the parser object is greater than zero,
+ * the events of every track are also decoded, and checkpoints of the
+ * parsing state are recorded at regular intervals for
+ * smfparse_seek_tick().  Errors within the tracks then make indexing
+ * fail.
+ * 
+ * If successful, the source is rewound again and the parser is reset to
+ * its initial state, keeping the index.  Parsing can then proceed from
+ * the start with smfparse_read() as usual, or smfparse_seek_track() can
+ * be used to jump directly to a track.  If pHead is not NULL, the parsed
+ * header is copied into it.
+ * 
+ * If the function fails, the parser is in an error state with the
+ * error code, just as smfparse_read() would have left it, and any
+ * previous index is discarded.
+ * 
+ * The index describes the input that was used to build it.  It remains
+ * in the parser object until it is rebuilt, the parser is freed, or
+ * indexing fails.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the rewindable input source to index
+ * 
+ *   pHead - receives the parsed header, or NULL
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+int smfparse_index(
+    SMFPARSE   * ps,
+    SMFSOURCE  * pSrc,
+    SMF_HEADER * pHead,
+    int        * pErr);
+
+/*
+ * Get the number of chunks in the index of a parser object.
+ * 
+ * If the parser object has no index, zero is returned.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ * Return:
+ * 
+ *   the number of chunks in the index
+ */
+int32_t smfparse_chunk_count(SMFPARSE *ps);
+
+/*
+ * Get a chunk from the index of a parser object.
+ * 
+ * i is the index of the chunk, which must be in range zero up to one
+ * less than smfparse_chunk_count().  The returned structure is owned by
+ * the parser object and remains valid until the index is rebuilt or
+ * discarded.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   i - the index of the chunk
+ * 
+ * Return:
+ * 
+ *   the chunk information
+ */
+const SMF_CHUNK *smfparse_chunk(SMFPARSE *ps, int32_t i);
+
+/*
+ * Position a parser directly at the start of a given track, using the
+ * chunk index.
+ * 
+ * The parser must have an index from smfparse_index(), and pSrc must be
+ * the rewindable input source the index was built from.  trk is the
+ * zero-based number of the track chunk, which must be less than the
+ * declared number of tracks.
+ * 
+ * The source is rewound and skipped ahead to the data of the track
+ * chunk, and the parser state is set up as if all the earlier chunks
+ * had been parsed and the SMF_TYPE_BEGIN_TRACK entity of the track had
+ * just been returned.  The next entity read is therefore the first
+ * event of the track.  After the track, parsing continues normally with
+ * the chunks that follow it.  This works regardless of the state the
+ * parser was in, including error and EOF states.
+ * 
+ * If the function fails, the parser is in an error state with the
+ * error code.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   trk - the zero-based track number
+ * 
+ *   pSrc - the input source the index was built from
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+int smfparse_seek_track(
+    SMFPARSE  * ps,
+    int32_t     trk,
+    SMFSOURCE * pSrc,
+    int       * pErr);
+
+/*
+ * Position a parser at a given tick offset within a track, using the
+ * chunk index and its checkpoints.
+ * 
+ * The requirements are the same as for smfparse_seek_track().  tick is
+ * the absolute tick offset within the track, which must not be
+ * negative.
+ * 
+ * The parser is restored to the last checkpoint of the track that lies
+ * before the tick offset, or to the start of the track if there is no
+ * such checkpoint, and decodes forward from there.  The first entity at
+ * or after the tick offset is stored in pEnt, just as smfparse_read()
+ * would have returned it.  This is SMF_TYPE_END_TRACK if the track ends
+ * before the tick offset.  The tick field of the entity gives its
+ * actual tick offset, and its delta is measured from the last event
+ * that was passed over.  Parsing then continues normally after the
+ * entity.
+ * 
+ * Without checkpoints (see the checkpoint option), this works but
+ * always decodes from the start of the track.  Entities dropped by the
+ * event filter are passed over as usual.
+ * 
+ * If the function fails, the parser is in an error state with the
+ * error code, which is also stored in pEnt.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   trk - the zero-based track number
+ * 
+ *   tick - the tick offset to seek to
+ * 
+ *   pSrc - the input source the index was built from
+ * 
+ *   pEnt - receives the first entity at or after the tick offset
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+int smfparse_seek_tick(
+    SMFPARSE   * ps,
+    int32_t      trk,
+    int64_t      tick,
+    SMFSOURCE  * pSrc,
+    SMF_ENTITY * pEnt,
+    int        * pErr);
+
+/*
+ * Allocate a new, empty SMF_PROBE structure.
+ * 
+ * The structure should eventually be released with smfprobe_free().
+ * 
+ * Return:
+ * 
+ *   a new SMF_PROBE structure
+ */
+SMF_PROBE *smfprobe_alloc(void);
+
+/*
+ * Free an SMF_PROBE structure.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pProbe - the SMF_PROBE structure to release, or NULL
+ */
+void smfprobe_free(SMF_PROBE *pProbe);
+
+/*
+ * Summarize a MIDI file without parsing all of its events.
+ * 
+ * The header chunk is parsed, and then the function jumps from chunk
+ * header to chunk header with smfsource_skip() until the declared
+ * number of track chunks has been found or the input ends.  Unlike
+ * reading the file, ending early is not an error.  The track chunks
+ * that were found are stored in pProbe, replacing anything from an
+ * earlier probe.  Since the track data is skipped, a track chunk whose
+ * data is cut short by the end of the input is not detected.
+ * 
+ * If scan is greater than zero, the events starting within the first
+ * scan bytes of each track are also parsed to look for the title and
+ * copyright text (see SMF_PROBE).  Scanning stops early at the End Of
+ * Track or at any parsing error within the track, which is not treated
+ * as an error of the probe.
+ * 
+ * The input source does not need to support rewinding.  It is left
+ * positioned after the last chunk that was examined.
+ * 
+ * The parser object is only used for its options and buffers.  It is
+ * reset to its initial state before the function returns, as if it had
+ * just been allocated, but its chunk index, tempo map, and event filter
+ * are kept.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the input source to read from
+ * 
+ *   scan - the number of bytes to scan at the start of each track for
+ *   text, or zero
+ * 
+ *   pProbe - the structure to fill
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+int smfparse_probe(
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    int32_t     scan,
+    SMF_PROBE * pProbe,
+    int       * pErr);
+
+/*
+ * Allocate a new, empty SMF_TRACK structure.
+ * 
+ * The structure should eventually be released with smftrack_free().
+ * 
+ * Return:
+ * 
+ *   a new SMF_TRACK structure
+ */
+SMF_TRACK *smftrack_alloc(void);
+
+/*
+ * Free an SMF_TRACK structure.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pTrack - the SMF_TRACK structure to release, or NULL
+ */
+void smftrack_free(SMF_TRACK *pTrack);
+
+/*
+ * Decode a whole track from a MIDI file into columnar form.
+ * 
+ * If the parser is not currently inside a track, entities are read and
+ * discarded until the next SMF_TYPE_BEGIN_TRACK, which includes reading
+ * the header if it has not been read yet.  Then, all the events of the
+ * track up to and including the End Of Track are decoded into pTrack,
+ * replacing anything that was in it before.  If the parser is already
+ * inside a track, the remaining events of that track are decoded.
+ * Afterwards, the parser is positioned after the track, so that it can
+ * be used with smfparse_read() or this function again.
+ * 
+ * The return value is SMF_TYPE_END_TRACK if a track was decoded, or
+ * SMF_TYPE_EOF if there are no more tracks, in which case pTrack is
+ * empty.  If there is an error, a negative SMF_ERR_ code is returned,
+ * the parser is in an error state just as it would be for
+ * smfparse_read(), and pTrack holds the events decoded before the
+ * error.  The tick column is 32-bit, so tracks that are too long for
+ * that fail with SMF_ERR_TIME_RANGE.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pTrack - the track structure to fill
+ * 
+ *   pSrc - the input source to read from
+ * 
+ * Return:
+ * 
+ *   SMF_TYPE_END_TRACK, SMF_TYPE_EOF, or a negative error code
+ */
+int smfparse_read_track(SMFPARSE *ps, SMF_TRACK *pTrack, SMFSOURCE *pSrc);
+
+/*
+ * Decode all the tracks of a MIDI file in memory in parallel.
+ * 
+ * pData points to the len bytes of the MIDI file, which are only read
+ * and must remain valid and unchanged until the function returns.
+ * pData may only be NULL if len is zero.  pOpt is the parser options to
+ * use, or NULL for the defaults.
+ * 
+ * The file is first indexed with smfparse_index().  Since running
+ * status is reset at the start of each track, the tracks can then be
+ * decoded independently of each other.  Up to the given number of
+ * threads, including the calling thread, each take tracks one at a
+ * time and decode them with their own parser object and
+ * smfparse_read_track(), passing each decoded track to fTrack.  threads
+ * must be at least one.  On platforms without POSIX threads (see
+ * SMF_POSIX), all tracks are decoded in the calling thread.
+ * 
+ * Unlike a sequential parse, an error in one track does not prevent the
+ * other tracks from being decoded, so every declared track is passed to
+ * fTrack even if some fail.  However, the function itself only succeeds
+ * if indexing succeeded and every track was decoded without error.  If
+ * pHead is not NULL, the parsed header is copied into it when indexing
+ * succeeds.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.  If indexing succeeded but
+ * tracks failed, this is the error of the lowest-numbered track that
+ * failed.
+ * 
+ * Parameters:
+ * 
+ *   pData - the MIDI file bytes
+ * 
+ *   len - the number of bytes
+ * 
+ *   pOpt - the parser options, or NULL
+ * 
+ *   threads - the maximum number of threads to use
+ * 
+ *   fTrack - the callback that receives each decoded track
+ * 
+ *   pCustom - value passed through to the callback
+ * 
+ *   pHead - receives the parsed header, or NULL
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if all tracks were decoded successfully, zero if failure
+ */
+int smfparse_parallel(
+    const void        * pData,
+    int64_t             len,
+    const SMF_OPTIONS * pOpt,
+    int32_t             threads,
+    smfparse_fp_track   fTrack,
+    void              * pCustom,
+    SMF_HEADER        * pHead,
+    int               * pErr);
+
+/*
+ * Parse a batch of independent MIDI files on multiple threads.
+ * 
+ * pFiles is an array of count files (see SMF_BATCH_FILE), where count
+ * is zero or greater.  pOpt is the parser options to use, or NULL for
+ * the defaults.  mask is the event filter (see smfparse_set_filter()),
+ * so pass SMF_FILTER_ALL to get every event.
+ * 
+ * Up to the given number of threads, including the calling thread,
+ * each take files one at a time and parse them from the beginning to
+ * the end.  threads must be at least one.  On platforms without POSIX
+ * threads (see SMF_POSIX), all files are parsed in the calling thread.
+ * Each thread owns one parser object and one read buffer that are
+ * reused for all the files it parses, so the cost per file is little
+ * more than opening and reading it.  Files on disk are read into the
+ * read buffer in one go, except for files too big for that, which are
+ * read through a handle source instead.
+ * 
+ * Every entity of each file is passed to fEntity, if it is not NULL,
+ * which may stop parsing the file early.  Then, fFile is called for
+ * the file, if it is not NULL.  If pResults is not NULL, it must point
+ * to an array of count elements, which receives the result of each
+ * file in the same form as is passed to fFile: zero on success or a
+ * negative error code that can be passed to smf_errorString().
+ * 
+ * An error in one file does not affect the rest of the batch.
+ * 
+ * Parameters:
+ * 
+ *   pFiles - the files to parse
+ * 
+ *   count - the number of files
+ * 
+ *   pOpt - the parser options, or NULL
+ * 
+ *   mask - the event filter mask
+ * 
+ *   threads - the maximum number of threads to use
+ * 
+ *   fEntity - the callback that receives each entity, or NULL
+ * 
+ *   fFile - the callback that receives each file result, or NULL
+ * 
+ *   pCustom - value passed through to the callbacks
+ * 
+ *   pResults - receives the result of each file, or NULL
+ * 
+ * Return:
+ * 
+ *   the number of files that failed
+ */
+int32_t smfparse_batch(
+    const SMF_BATCH_FILE * pFiles,
+    int32_t                count,
+    const SMF_OPTIONS    * pOpt,
+    uint32_t               mask,
+    int32_t                threads,
+    smfparse_fp_entity     fEntity,
+    smfparse_fp_file       fFile,
+    void                 * pCustom,
+    int                  * pResults);
+
+/*
+ * Allocate a new tempo map.
+ * 
+ * A tempo map converts absolute tick offsets within a track into
+ * microseconds from the start of the track.  It holds a time system and
+ * a sorted list of tempo changes.  The new map has no time system yet,
+ * so it must be given one with smftempo_clear() or by attaching it to a
+ * parser with smfparse_set_tempo() before conversions are made.
+ * 
+ * The map should eventually be released with smftempo_free().
+ * 
+ * Return:
+ * 
+ *   a new tempo map
+ */
+SMFTEMPO *smftempo_alloc(void);
+
+/*
+ * Free a tempo map.
+ * 
+ * If NULL is passed, the call is ignored.  If the map is attached to a
+ * parser, it must be detached first.
+ * 
+ * Parameters:
+ * 
+ *   pm - the tempo map to release, or NULL
+ */
+void smftempo_free(SMFTEMPO *pm);
+
+/*
+ * Remove all tempo changes from a tempo map and set its time system.
+ * 
+ * Without any tempo changes, the tempo is the MIDI default of 500000
+ * microseconds per beat (120 beats per minute).
+ * 
+ * Parameters:
+ * 
+ *   pm - the tempo map
+ * 
+ *   pts - the time system of the MIDI file
+ */
+void smftempo_clear(SMFTEMPO *pm, const SMF_TIMESYS *pts);
+
+/*
+ * Add a tempo change to a tempo map.
+ * 
+ * The tempo change takes effect at the given absolute tick offset and
+ * lasts until the next tempo change.  Changes may be added in any
+ * order, but adding them in increasing tick order is fastest.  If there
+ * already is a change at the same tick, it is replaced.
+ * 
+ * Tempo changes are ignored by SMPTE time systems, but they are still
+ * stored in the map.
+ * 
+ * Parameters:
+ * 
+ *   pm - the tempo map
+ * 
+ *   tick - the non-negative absolute tick offset
+ * 
+ *   beat_dur - the beat duration in microseconds, in the range of the
+ *   beat_dur field of SMF_ENTITY
+ */
+void smftempo_add(SMFTEMPO *pm, int64_t tick, int32_t beat_dur);
+
+/*
+ * Convert an absolute tick offset into microseconds.
+ * 
+ * The result is the time of the tick from the start of the track,
+ * rounded down to a whole microsecond.  It is computed exactly, without
+ * accumulating rounding errors across tempo changes.  With SMPTE
+ * timing, the tick rate is constant, and the frame rate value of 29
+ * means exactly 30000/1001 frames per second (see SMF_TIMESYS).
+ * 
+ * Lookups take logarithmic time in the number of tempo changes.  The
+ * map remembers the tempo change of the last lookup, so a series of
+ * lookups with increasing ticks takes constant time for each lookup.
+ * Because of this, the map may not be used for lookups from multiple
+ * threads at the same time.
+ * 
+ * The map must have a time system (see smftempo_alloc()).
+ * 
+ * Parameters:
+ * 
+ *   pm - the tempo map
+ * 
+ *   tick - the non-negative absolute tick offset
+ * 
+ * Return:
+ * 
+ *   the time in microseconds
+ */
+int64_t smftempo_micros(SMFTEMPO *pm, int64_t tick);
+
+/*
+ * Attach a tempo map to a parser object, so that the parser builds the
+ * map as it parses.
+ * 
+ * When the header is parsed, the map is cleared with the time system of
+ * the MIDI file.  After that, every Set Tempo meta-event in the first
+ * track is added to the map at its absolute tick offset.  For format 0
+ * files, the first track is the only track.  For format 1 files, the
+ * first track is the one that carries the tempo map of the whole file.
+ * For format 2 files, the map only applies to the first track.
+ * 
+ * This works with every way of reading from the parser, including
+ * smfparse_read_batch() and smfparse_read_track().  Visiting the first
+ * track again after smfparse_seek_track() adds the same tempo changes
+ * again, which leaves the map as it was.
+ * 
+ * The map is not owned by the parser.  Pass NULL to detach the current
+ * map, if any.
+ * 
+ * Parameters:
+ * 
+ *   ps - the parser object
+ * 
+ *   pm - the tempo map to attach, or NULL
+ */
+void smfparse_set_tempo(SMFPARSE *ps, SMFTEMPO *pm);
+
+/*
+ * Allocate a merger that reads the events of all tracks of a MIDI file
+ * interleaved in time order.
+ * 
+ * The input source must support rewinding.  It is indexed with a
+ * temporary parser object (see smfparse_index()), and then the merger
+ * keeps one parser object positioned within each track.  The merger
+ * does not take ownership of the source, which must remain open until
+ * the merger is released.  The source may not be used for anything
+ * else while the merger exists.
+ * 
+ * Memory-resident sources (smfsource_new_memory() and
+ * smfsource_new_mmap()) are the fastest, because each track is read
+ * directly from the memory window.  Other sources work too, but the
+ * source must be rewound and skipped forward whenever the merger
+ * switches from reading one track to reading another.
+ * 
+ * The memory used by the merger is proportional to the number of
+ * tracks, not the number of events.
+ * 
+ * pOpt is the parser options to use for all the parser objects, or
+ * NULL for the defaults.
+ * 
+ * If pHead is not NULL, the parsed header is copied into it.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the input source
+ * 
+ *   pOpt - the parser options, or NULL
+ * 
+ *   pHead - receives the parsed header, or NULL
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   a new merger, or NULL if indexing the source failed
+ */
+SMFMERGE *smfmerge_alloc(
+    SMFSOURCE         * pSrc,
+    const SMF_OPTIONS * pOpt,
+    SMF_HEADER        * pHead,
+    int               * pErr);
+
+/*
+ * Free a merger.
+ * 
+ * If NULL is passed, the call is ignored.  The input source of the
+ * merger is not closed.
+ * 
+ * Parameters:
+ * 
+ *   pm - the merger to release, or NULL
+ */
+void smfmerge_free(SMFMERGE *pm);
+
+/*
+ * Read the next event from all tracks of a MIDI file in time order.
+ * 
+ * This works like smfparse_read(), except that only the events within
+ * tracks are returned, including the SMF_TYPE_END_TRACK of each track.
+ * Events are returned in order of their absolute tick offset.  Events
+ * at the same tick offset are returned in order of track number, and
+ * the events of the same track are always returned in the order they
+ * appear in the track.  The delta field is the delta time from the
+ * previous event returned by the merger, not from the previous event in
+ * the same track.
+ * 
+ * After the End Of Track of the last track to end, SMF_TYPE_EOF is
+ * returned.  If any track has an error, the error is returned and the
+ * merger remains in that error state.
+ * 
+ * Pointers in the returned entity remain valid until the next call to
+ * this function or until the merger is released, whichever comes first.
+ * 
+ * Since each track of a format 2 file is an independent sequence,
+ * merging is only meaningful for format 0 and format 1 files.
+ * 
+ * Parameters:
+ * 
+ *   pm - the merger
+ * 
+ *   pEnt - the entity structure to fill
+ * 
+ *   pTrk - receives the zero-based track number of the event, or -1 if
+ *   an EOF or error is returned, or NULL
+ * 
+ *   pTick - receives the absolute tick offset of the event, or that of
+ *   the last event if an EOF or error is returned, or NULL
+ */
+void smfmerge_read(
+    SMFMERGE   * pm,
+    SMF_ENTITY * pEnt,
+    int32_t    * pTrk,
+    int64_t    * pTick);
+
+/*
+ * Allocate a note pairing engine.
+ * 
+ * The engine pairs the Note-On and Note-Off events of a MIDI file into
+ * note spans (see SMF_NOTE).  It keeps a fixed table of the sounding
+ * notes for every channel and key, so it does not allocate anything per
+ * note.
+ * 
+ * policy is one of the SMF_NOTES constants, which determines how
+ * overlapping notes on the same channel and key are handled.
+ * 
+ * Parameters:
+ * 
+ *   policy - the overlapping note policy
+ * 
+ * Return:
+ * 
+ *   a new note pairing engine
+ */
+SMFNOTES *smfnotes_alloc(int policy);
+
+/*
+ * Free a note pairing engine.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pn - the engine to release, or NULL
+ */
+void smfnotes_free(SMFNOTES *pn);
+
+/*
+ * Reset a note pairing engine to its initial state, so that it can be
+ * used for another MIDI file.
+ * 
+ * All sounding notes and all note spans that have not been retrieved
+ * yet are discarded.
+ * 
+ * Parameters:
+ * 
+ *   pn - the engine
+ */
+void smfnotes_reset(SMFNOTES *pn);
+
+/*
+ * Pass an entity to a note pairing engine.
+ * 
+ * The entities of a MIDI file must be passed in the order that
+ * smfparse_read() returns them, one whole track after another.  The
+ * engine keeps track of the tick offset within each track by adding up
+ * the delta times.  Note-On and Note-Off events start and end notes,
+ * and the end of each track ends all notes that are still sounding.
+ * Other entities only advance the time.  Error and EOF entities are
+ * ignored.
+ * 
+ * The note spans that are completed by the entity are queued, and they
+ * should be retrieved with smfnotes_get() before or after passing the
+ * next entity.
+ * 
+ * Parameters:
+ * 
+ *   pn - the engine
+ * 
+ *   pEnt - the entity
+ */
+void smfnotes_put(SMFNOTES *pn, const SMF_ENTITY *pEnt);
+
+/*
+ * Retrieve the next completed note span from a note pairing engine.
+ * 
+ * Note spans are returned in the order they end, which is not
+ * necessarily the order they start.  Notes that are ended by the end of
+ * a track are returned in order of channel and then key.
+ * 
+ * Parameters:
+ * 
+ *   pn - the engine
+ * 
+ *   pNote - receives the note span
+ * 
+ * Return:
+ * 
+ *   non-zero if a note span was retrieved, zero if none is queued
+ */
+int smfnotes_get(SMFNOTES *pn, SMF_NOTE *pNote);
+
+/*
+ * Read the next note span of a MIDI file.
+ * 
+ * This is a convenience wrapper that reads entities with
+ * smfparse_read() and passes them to the engine with smfnotes_put()
+ * until a note span can be retrieved with smfnotes_get().  The parser
+ * and source are used in the same way as with smfparse_read().
+ * 
+ * Parameters:
+ * 
+ *   pn - the engine
+ * 
+ *   ps - the parser object
+ * 
+ *   pSrc - the input source
+ * 
+ *   pNote - receives the note span
+ * 
+ * Return:
+ * 
+ *   one if a note span was retrieved, SMF_TYPE_EOF (zero) if the file
+ *   has ended, or a negative error code if parsing failed
+ */
+int smfnotes_read(
+    SMFNOTES  * pn,
+    SMFPARSE  * ps,
+    SMFSOURCE * pSrc,
+    SMF_NOTE  * pNote);
+
+/*
+ * Build the chase snapshots of a MIDI file.
+ * 
+ * The whole file is read once in time order with a merger (see
+ * smfmerge_alloc()), which only decodes the events that affect the
+ * chase state (see SMF_CHASE).  Those events are kept in a compact
+ * list of state changes, and a snapshot of the state is recorded at
+ * every multiple of interval ticks at which the state has changed since
+ * the previous snapshot.  Each snapshot takes a little over four
+ * kilobytes, so the interval should usually be a few beats or more.
+ * 
+ * smfchase_query() then finds the state at any tick by starting from
+ * the last snapshot at or before it and replaying the state changes of
+ * less than one interval.  The source is not needed after this function
+ * returns, and it is left in an undefined position.
+ * 
+ * The input source must support rewinding.  pOpt is the parser options
+ * to use, or NULL for the defaults.  interval must be in range one up
+ * to INT32_MAX, inclusive.
+ * 
+ * Since each track of a format 2 file is an independent sequence, the
+ * chase state is only meaningful for format 0 and format 1 files.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the input source
+ * 
+ *   pOpt - the parser options, or NULL
+ * 
+ *   interval - the snapshot interval in ticks
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
  * 
- * Fault handlers must never return to the caller.  Undefined behavior
- * occurs if they do.
+ * Return:
  * 
- * See the function pointer type documentation for further information.
+ *   a new chase object, or NULL if parsing the source failed
+ */
+SMFCHASE *smfchase_alloc(
+    SMFSOURCE         * pSrc,
+    const SMF_OPTIONS * pOpt,
+    int32_t             interval,
+    int               * pErr);
+
+/*
+ * Free a chase object.
+ * 
+ * If NULL is passed, the call is ignored.
  * 
  * Parameters:
  * 
- *   fFault - the fault handler to install, or NULL
+ *   pc - the chase object to release, or NULL
  */
-void smf_set_fault(smf_fp_fault fFault);
+void smfchase_free(SMFCHASE *pc);
 
 /*
- * Create a custom SMFSOURCE object.
- * 
- * For most common cases, you can use one of the pre-made input source
- * types, which use smfsource_new_ constructor functions.  If none of
- * the pre-made input sources will work for you, then you can use this
- * custom constructor to define your own input source.
+ * Get the chase state of a MIDI file at a tick offset.
  * 
- * pInstance can have any value, including NULL.  It will always be
- * passed through as-is when invoking the callback functions.  If this
- * points to a dynamically allocated memory block, it's a good idea to
- * define an fClose destructor that will release the memory block and
- * any resources owned by it.
+ * The state includes all the events at or before the given absolute
+ * tick offset (see SMF_CHASE).  Ticks beyond the end of the file give
+ * the state at the end of the file.
  * 
- * fRead is the only callback that is required to be defined with a
- * non-NULL value.  It allows bytes to be read from the input source in
- * sequential order.
+ * Lookups take logarithmic time in the number of snapshots plus linear
+ * time in the number of state changes within one snapshot interval.
+ * The chase object is not modified, so lookups may be made from
+ * multiple threads at the same time.
  * 
- * fRewind should only be defined for input sources that support
- * rewinding back to the beginning.  For input sources that do not
- * support this, pass NULL.
+ * Parameters:
  * 
- * fClose is a destructor routine that is invoked when the input source
- * is released.  You can pass NULL if you do not need a destructor
- * routine.
+ *   pc - the chase object
  * 
- * fSkip is a callback for skipping ahead by a given number of bytes.
- * It should only be defined for input sources that support random
- * access or fast skips.  For input sources that do not support this,
- * pass NULL.  If no skip callback is provided, skips will be simulated
- * by repeatedly invoking the fRead callback.
+ *   tick - the non-negative absolute tick offset
  * 
- * The returned object should eventually be freed with
- * smfsource_close().
+ *   pState - receives the chase state
+ */
+void smfchase_query(const SMFCHASE *pc, int64_t tick, SMF_CHASE *pState);
+
+/*
+ * Decode a whole MIDI file into a binary cache.
+ * 
+ * A cache holds everything that smfparse_read() would return for the
+ * file, already decoded and validated, so that smfcache_open() can
+ * later iterate over the same entities without parsing anything.  It
+ * is meant to be written to disk and then mapped back into memory.
+ * 
+ * The cache is a single block of bytes that starts with a header of
+ * sixteen 32-bit words, the first of which is the magic value "SMFC"
+ * as a big-endian integer and the second of which is
+ * SMF_CACHE_VERSION.  It is followed by the chunk index, the tempo map
+ * of the first track, the event columns (in the same form as
+ * SMF_TRACK), the payload table, and the payload arena, each aligned to
+ * eight bytes.  All values are stored in the byte order of the machine
+ * that built the cache, and caches from machines of the other byte
+ * order are rejected by smfcache_open().
+ * 
+ * pSrc is the rewindable input source of the MIDI file.  pOpt is the
+ * parser options to decode with, or NULL for the defaults.  The file is
+ * indexed with smfparse_index() and every track is decoded with
+ * smfparse_read_track(), so the same limits apply.  The total number of
+ * events and the total size of the payloads are also limited to
+ * INT32_MAX, beyond which SMF_ERR_HUGE_FILE is reported.
+ * 
+ * If successful, *ppBlob is set to the dynamically allocated cache,
+ * which should eventually be released with free(), and *pLen is set to
+ * its length in bytes.  On failure, both are set to NULL and zero.
  * 
- * The object starts out without any error state.
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
  * 
  * Parameters:
  * 
- *   pInstance - value passed through to all callbacks
+ *   pSrc - the rewindable input source
  * 
- *   fRead - the required read function callback
+ *   pOpt - the parser options, or NULL
  * 
- *   fRewind - the rewind function callback or NULL
+ *   ppBlob - receives the cache
  * 
- *   fClose - the close function callback or NULL
+ *   pLen - receives the length of the cache in bytes
  * 
- *   fSkip - the skip function callback or NULL
+ *   pErr - pointer to variable to receive an error number, or NULL
  * 
  * Return:
  * 
- *   the new input source object
+ *   non-zero if successful, zero if failure
  */
-SMFSOURCE *smfsource_custom(
-    void                * pInstance,
-    smfsource_fp_read     fRead,
-    smfsource_fp_rewind   fRewind,
-    smfsource_fp_close    fClose,
-    smfsource_fp_skip     fSkip);
+int smfcache_build(
+    SMFSOURCE          * pSrc,
+    const SMF_OPTIONS  * pOpt,
+    void              ** ppBlob,
+    int64_t            * pLen,
+    int                * pErr);
 
 /*
- * Construct an SMFSOURCE object around an open file handle.
- * 
- * pIn is the file handle, which should be open for reading.  You should
- * not use the file handle while an SMFSOURCE object is open around it.
- * 
- * is_owner is non-zero if the SMFSOURCE object should act like the
- * owner of the file handle.  Specifically, this means that the file
- * handle will be closed when the SMFSOURCE object is closed.  You
- * should NOT specify is_owner if you are wrapping stdin!
- * 
- * can_seek is non-zero if the given file handle supports random access.
- * If this is non-zero, then rewinding will be available.  You should
- * NOT specify can_seek if you are wrapping stdin!
+ * Open a binary cache that is in memory.
  * 
- * If can_seek is specified, then this function will determine the total
- * file length and then rewind the file.  This constructor can fail if
- * the file exceeds the 1 GiB limit (see below) or if rewinding fails.
+ * pData points to the len bytes of a cache built by smfcache_build().
+ * If pData is aligned to eight bytes, which it always is for a block
+ * from malloc() or a memory-mapped file, the cache is used in place, so
+ * the bytes must remain valid and unchanged until the cache object is
+ * closed.  Otherwise, a copy is made.
  * 
- * This input source implementation has a limit of at most 1 GiB for the
- * full file.  In the rare case that you need to read MIDI files that
- * are larger than that, you should define a custom input source type
- * that works with 64-bit file pointers.
+ * Opening only checks the header and the tables, which takes time in
+ * proportion to the number of chunks and payloads.  The events are
+ * checked as they are read.  A cache that is not valid causes
+ * SMF_ERR_CACHE, either here or when reading.
  * 
  * If pErr is specified, it will be cleared to zero at the start of the
  * function and then set to an error code that can be passed to
- * smf_errorString() if the constructor fails.
+ * smf_errorString() if the function fails.
  * 
  * Parameters:
  * 
- *   pIn - the file handle to wrap
- * 
- *   is_owner - non-zero if handle should be closed when source object
- *   is released
+ *   pData - the cache bytes
  * 
- *   can_seek - non-zero if handle supports random access
+ *   len - the number of cache bytes
  * 
  *   pErr - pointer to variable to receive an error number, or NULL
  * 
  * Return:
  * 
- *   the new input source object, or NULL if constructor failed
+ *   the new cache object, or NULL if the function failed
  */
-SMFSOURCE *smfsource_new_handle(
-    FILE * pIn,
-    int    is_owner,
-    int    can_seek,
-    int  * pErr);
+SMFCACHE *smfcache_open(const void *pData, int64_t len, int *pErr);
 
 /*
- * Construct an SMFSOURCE object by opening a file at a given path.
+ * Open a binary cache that is stored in a file.
  * 
- * This is a wrapper around smfsource_new_handle().  Files opened with
- * this wrapper will always specify both is_owner and can_seek.  This
- * means that rewinds are always supported when using this constructor.
+ * On POSIX platforms (see SMF_POSIX), the file is memory-mapped with
+ * smfsource_new_mmap(), so opening the cache costs little more than
+ * paging in the parts that are read.  Otherwise, the file is read into
+ * memory.  Apart from that, this is the same as smfcache_open().
  * 
  * If pErr is specified, it will be cleared to zero at the start of the
  * function and then set to an error code that can be passed to
- * smf_errorString() if the constructor fails.
+ * smf_errorString() if the function fails.
  * 
  * Parameters:
  * 
- *   pPath - the file path to open
+ *   pPath - the path of the cache file
  * 
  *   pErr - pointer to variable to receive an error number, or NULL
  * 
  * Return:
  * 
- *   the new input source object, or NULL if constructor failed
+ *   the new cache object, or NULL if the function failed
  */
-SMFSOURCE *smfsource_new_path(const char *pPath, int *pErr);
+SMFCACHE *smfcache_open_path(const char *pPath, int *pErr);
 
 /*
- * Release an SMFSOURCE object.
+ * Close a cache object.
  * 
- * If NULL is passed, this function will succeed without doing anything.
+ * If NULL is passed, the call is ignored.  Entities returned from the
+ * cache are no longer valid afterwards.
  * 
- * Otherwise, the close callback of the source object will be invoked if
- * defined, and then the source object will be released.
+ * Parameters:
  * 
- * This function always releases the source object.  The return value
- * merely indicates whether something went wrong during the close-down
- * process, which you may want to warn the user about.  The source
- * object will be released even if this function returns failure.
+ *   pc - the cache object to close, or NULL
+ */
+void smfcache_close(SMFCACHE *pc);
+
+/*
+ * Read the next entity from a cache object.
  * 
- * This function can be used on any source object regardless of its
- * state.
+ * This returns exactly the entities that smfparse_read() returns for
+ * the MIDI file the cache was built from, with the default event
+ * filter, ending with SMF_TYPE_EOF.  Pointers in the entity remain
+ * valid until the next read from the cache or until it is closed.
+ * 
+ * If the cache turns out not to be valid, SMF_ERR_CACHE is returned,
+ * and the cache object stays in that error state until it is rewound.
  * 
  * Parameters:
  * 
- *   pSrc - the source object to close, or NULL
+ *   pc - the cache object
  * 
- * Return:
+ *   pEnt - the entity structure to fill in
+ */
+void smfcache_read(SMFCACHE *pc, SMF_ENTITY *pEnt);
+
+/*
+ * Rewind a cache object to the start, so that the next read returns the
+ * SMF_TYPE_HEADER entity again.
  * 
- *   non-zero if regular close-down, zero if object is closed but
- *   something went awry during the close-down process
+ * Parameters:
+ * 
+ *   pc - the cache object
  */
-int smfsource_close(SMFSOURCE *pSrc);
+void smfcache_rewind(SMFCACHE *pc);
 
 /*
- * Check whether a given SMFSOURCE object is capable of rewinding back
- * to the beginning of input.
+ * Get the number of chunks in the chunk index of a cache object.
  * 
- * This function can be called on any SMFSOURCE object regardless of its
- * state.
+ * The chunk index is the one that smfparse_index() built from the MIDI
+ * file.
  * 
  * Parameters:
  * 
- *   pSrc - the source object to query
+ *   pc - the cache object
  * 
  * Return:
  * 
- *   non-zero if source can be rewound, zero if not
+ *   the number of chunks in the index
  */
-int smfsource_canRewind(SMFSOURCE *pSrc);
+int32_t smfcache_chunk_count(const SMFCACHE *pc);
 
 /*
- * Rewind a given SMFSOURCE object back to the beginning of input and
- * clear any error state or EOF state.
+ * Get a chunk from the chunk index of a cache object.
  * 
- * If called on an object that does not support rewinding, the function
- * fails but does not change the error state of the object.
+ * i must be in range zero up to one less than smfcache_chunk_count().
  * 
- * If called on an object that supports rewinding and is not in a
- * double-error state, this function will attempt a rewind.  If
- * successful, the error state is cleared in addition to rewinding back
- * to beginning of input.  If failure, the object is changed to
- * double-error state.
+ * Parameters:
  * 
- * If called on an object that is in double-error state, then this
- * function fails without making an actual attempt to rewind.
+ *   pc - the cache object
+ * 
+ *   i - the index of the chunk
+ * 
+ *   pChunk - receives the chunk information
+ */
+void smfcache_chunk(const SMFCACHE *pc, int32_t i, SMF_CHUNK *pChunk);
+
+/*
+ * Fill a tempo map with the tempo changes stored in a cache object.
+ * 
+ * The map is cleared with the time system of the MIDI file and then
+ * receives the Set Tempo events of the first track, just as attaching
+ * it with smfparse_set_tempo() and parsing the first track would.
  * 
  * Parameters:
  * 
- *   pSrc - the source object to rewind
+ *   pc - the cache object
+ * 
+ *   pm - the tempo map to fill
+ */
+void smfcache_tempo(const SMFCACHE *pc, SMFTEMPO *pm);
+
+/*
+ * Construct a writer that encodes a MIDI file into a growable buffer in
+ * memory.
+ * 
+ * The encoded bytes can be retrieved at any time with
+ * smfwrite_buffer().  The whole file must be less than 2 GiB, beyond
+ * which SMF_ERR_HUGE_FILE is reported.
  * 
  * Return:
  * 
- *   non-zero if successful, zero if rewind failed
+ *   the new writer
  */
-int smfsource_rewind(SMFSOURCE *pSrc);
+SMFWRITE *smfwrite_new_buffer(void);
 
 /*
- * Skip a source ahead by a given number of bytes.
+ * Construct a writer that encodes a MIDI file to an open file handle.
  * 
- * The skip distance must be greater than or equal to zero.  If zero is
- * passed, the function succeeds without doing anything, unless the
- * object is already in an error state, in which case the function still
- * fails.
+ * pOut is the file handle, which should be open for writing in binary
+ * mode.  You should not use the file handle while the writer is open
+ * around it.
  * 
- * This skip function can even be used with input sources that do not
- * define a skip callback.  In that case, the skip will be simulated
- * with repeated calls to the read callback.
+ * is_owner is non-zero if the handle should be closed when the writer
+ * is released with smfwrite_free().
  * 
- * If the skip would go beyond the end of the input, the skip is
- * shortened so that the next read will read EOF.  The function will
- * still succeed in this case.
+ * can_seek is non-zero if the handle supports random access.  The
+ * writer then writes the output in large blocks and seeks back to fill
+ * in the length of each track chunk once the track is complete.
+ * Otherwise, each track chunk is held in memory until it is complete,
+ * so each track must be less than 2 GiB.  You should NOT specify
+ * can_seek if you are wrapping stdout!
  * 
- * If called on an object in error state, this function fails without
- * actually attempting a skip.
+ * Parameters:
  * 
- * If a skip is attempted but fails, the object is switched into an
- * error state.
+ *   pOut - the file handle to wrap
+ * 
+ *   is_owner - non-zero if handle should be closed when the writer is
+ *   released
+ * 
+ *   can_seek - non-zero if handle supports random access
+ * 
+ * Return:
+ * 
+ *   the new writer
+ */
+SMFWRITE *smfwrite_new_handle(FILE *pOut, int is_owner, int can_seek);
+
+/*
+ * Construct a writer that creates a MIDI file at a given path.
+ * 
+ * The file is created or truncated, and then wrapped in the same way as
+ * smfwrite_new_handle() with is_owner and can_seek both set.
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the constructor fails.
  * 
  * Parameters:
  * 
- *   pSrc - the source object
+ *   pPath - the path to the file to create
  * 
- *   skip - the non-negative skip distance
+ *   pErr - pointer to variable to receive an error number, or NULL
  * 
  * Return:
  * 
- *   non-zero if successful, zero if skip failed
+ *   the new writer, or NULL if the file could not be created
  */
-int smfsource_skip(SMFSOURCE *pSrc, int32_t skip);
+SMFWRITE *smfwrite_new_path(const char *pPath, int *pErr);
 
 /*
- * Read the next byte from a given input source object.
+ * Free a writer.
  * 
- * The return value is either an unsigned byte value in range 0 to 255
- * (inclusive), or one of the special codes SMFSOURCE_EOF or
- * SMFSOURCE_IOERR, indicating End Of File or I/O error, respectively.
+ * If NULL is passed, the call is ignored.  If the writer owns its file
+ * handle, the handle is closed.  Output that has not been written out
+ * by smfwrite_finish() yet is discarded.
  * 
- * If called on an object that is in error state, this function fails
- * with an I/O error without actually attempting a read.
+ * Parameters:
  * 
- * If a read is attempted but fails, the object is changed into an error
- * state.
+ *   pw - the writer to release, or NULL
+ */
+void smfwrite_free(SMFWRITE *pw);
+
+/*
+ * Encode an entity with a writer.
+ * 
+ * Entities are passed in the same order and form as smfparse_read()
+ * returns them, so the entities of a parser can be passed straight
+ * through, filtered, or modified.  The writer must first be given an
+ * SMF_TYPE_HEADER entity, and then the tracks.  Each track starts with
+ * an SMF_TYPE_BEGIN_TRACK entity and ends with an SMF_TYPE_END_TRACK
+ * entity, with the events of the track in between.  Only the status
+ * field and the fields that smfparse_read() uses for the type of entity
+ * are read.  Passing entities in any other order is a fault.
+ * 
+ * The header chunk is written with the format and time system of the
+ * pHead field.  Its track count is filled in by smfwrite_finish() with
+ * the number of tracks that were actually written.  The track chunk
+ * lengths are also filled in as the tracks end, so nothing needs to be
+ * known in advance.
+ * 
+ * Events are written with the shortest variable-length quantities.
+ * MIDI messages use running status whenever they have the same status
+ * byte as the previous event in the track, which is never the case
+ * right after a System Exclusive or meta-event, matching the way the
+ * parser interprets running status.  The delta field must be in range
+ * zero up to SMF_MAX_VARINT, or SMF_ERR_TIME_RANGE is reported.
+ * 
+ * The values of events are checked against the same ranges that
+ * smfparse_read() accepts at the SMF_VALIDATE_STRICT level, and values
+ * out of range are reported with the same error codes that the parser
+ * would report.  A second track in a format 0 file is reported as
+ * SMF_ERR_MULTI_TRACK, and more than 65535 tracks as SMF_ERR_HEADER.
+ * 
+ * SMF_TYPE_CHUNK entities are ignored, because the parser does not
+ * return the contents of unrecognized chunks.  Use smfwrite_copy()
+ * to pass such chunks through.  SMF_TYPE_EOF entities are ignored as
+ * well, and smfwrite_finish() should be called instead.
+ * 
+ * Once the writer has failed, it stays in that error state, and every
+ * further call fails with the same error.
  * 
- * If the SMFSOURCE_EOF condition is returned, the object state switches
- * to EOF state, which causes subsequent reads to also return EOF
- * without actually attempting a read.  EOF state can be cleared with a
- * successful rewind.
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
  * 
  * Parameters:
  * 
- *   pSrc - the source object
+ *   pw - the writer
+ * 
+ *   pEnt - the entity to encode
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
  * 
  * Return:
  * 
- *   an unsigned byte value that was read from input, or SMFSOURCE_EOF
- *   if at end of file, or SMFSOURCE_IOERR if I/O error
+ *   non-zero if successful, zero if failure
  */
-int smfsource_read(SMFSOURCE *pSrc);
+int smfwrite_put(SMFWRITE *pw, const SMF_ENTITY *pEnt, int *pErr);
 
 /*
- * Allocate a new SMFPARSE object instance.
+ * Copy a whole chunk from an input source to a writer without decoding
+ * it.
+ * 
+ * pChunk describes the chunk, normally as returned by smfparse_chunk()
+ * from the index of the same source (see smfparse_index()).  The chunk
+ * header is written from pChunk, and then the chunk data is copied
+ * byte-for-byte from the input source in large blocks.  This is the
+ * fastest way to pass unchanged tracks through, and it is also the only
+ * way to pass unrecognized chunks through.
+ * 
+ * The copy must be made between chunks, after the header has been
+ * written.  A copied "MTrk" chunk counts as a track of the file.  The
+ * "MThd" chunk may not be copied, because the writer writes its own
+ * header chunk.
+ * 
+ * The input source must support rewinding.  It is rewound and skipped
+ * forward to the chunk data, and it is left in an undefined position
+ * afterwards, so a parser reading from the same source must be
+ * positioned again, for example with smfparse_seek_track().
  * 
- * The parser instance should eventually be released with
- * smfparse_free().
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.  SMF_ERR_EOF is reported if
+ * the source ends within the chunk.
+ * 
+ * Parameters:
+ * 
+ *   pw - the writer
+ * 
+ *   pSrc - the rewindable input source
+ * 
+ *   pChunk - the chunk to copy
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
  * 
  * Return:
  * 
- *   a new SMFPARSE object
+ *   non-zero if successful, zero if failure
  */
-SMFPARSE *smfparse_alloc(void);
+int smfwrite_copy(
+    SMFWRITE        * pw,
+    SMFSOURCE       * pSrc,
+    const SMF_CHUNK * pChunk,
+    int             * pErr);
 
 /*
- * Free an SMFPARSE instance.
+ * Finish the MIDI file of a writer.
  * 
- * If NULL is passed, the call is ignored.
+ * This must be called between chunks, after at least one track has been
+ * written, or SMF_ERR_NO_TRACKS is reported.  The track count of the
+ * header chunk is filled in, and everything is written out to the file
+ * handle, if any.  If the handle cannot seek and the header has already
+ * been written out with a different track count than the number of
+ * tracks written, SMF_ERR_HEADER is reported.
+ * 
+ * The writer may not be used for anything else afterwards, except for
+ * smfwrite_buffer() and smfwrite_free().
+ * 
+ * If pErr is specified, it will be cleared to zero at the start of the
+ * function and then set to an error code that can be passed to
+ * smf_errorString() if the function fails.
  * 
  * Parameters:
  * 
- *   ps - the SMFPARSE instance to release, or NULL
+ *   pw - the writer
+ * 
+ *   pErr - pointer to variable to receive an error number, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
  */
-void smfparse_free(SMFPARSE *ps);
+int smfwrite_finish(SMFWRITE *pw, int *pErr);
 
 /*
- * Read the next entity from a MIDI file.
- * 
- * ps is the parser object to use.  If the parser is in an error state,
- * subsequent calls to read will just return the same error without
- * reading any further.  If the parser had previously returned the
- * entity SMF_TYPE_EOF, all subsequent calls will also return the entity
- * SMF_TYPE_EOF without reading anything further.
- * 
- * pEnt is the entity structure to receive the results of the parse.
- * Look at the status field to determine what entity was read or whether
- * there was an error or End Of File.
+ * Get the encoded bytes of a writer that was constructed with
+ * smfwrite_new_buffer().
  * 
- * pSrc is the input source to read data from.  Bytes are read in
- * sequential order from this data source.
+ * The returned pointer is owned by the writer and remains valid until
+ * the next call to any other writer function.  It may be NULL if
+ * nothing has been written yet.  For writers around file handles, this
+ * returns the bytes that have not been written out to the handle yet.
  * 
  * Parameters:
  * 
- *   ps - the parser object
+ *   pw - the writer
  * 
- *   pEnt - the entity structure to fill with parsing results
+ *   pLen - receives the number of bytes
  * 
- *   pSrc - the input source to read from
+ * Return:
+ * 
+ *   the encoded bytes
  */
-void smfparse_read(SMFPARSE *ps, SMF_ENTITY *pEnt, SMFSOURCE *pSrc);
+const uint8_t *smfwrite_buffer(const SMFWRITE *pw, int64_t *pLen);
 
 /*
  * Convert an error code returned by this parsing library into an error